@@ -244,8 +244,8 @@ int recId; /* id of the record to delete */
 
 
 
-/* Inserts a value,recId pair into the tree */
-AM_InsertEntry(fileDesc,attrType,attrLength,value,recId)
+/* AM_InsertEntry(), without the timing */
+static int AMinsertEntry(fileDesc,attrType,attrLength,value,recId)
 int fileDesc; /* file Descriptor */
 char attrType; /* 'i' or 'c' or 'f' */
 int attrLength; /* 4 for 'i' or 'f', 1-255 for 'c' */
@@ -354,6 +354,25 @@ int recId; /* recId to be inserted */
 }
 
 
+/* Inserts a value,recId pair into the tree; timed while PF_SetLatency()
+is on */
+AM_InsertEntry(fileDesc,attrType,attrLength,value,recId)
+int fileDesc; /* file Descriptor */
+char attrType; /* 'i' or 'c' or 'f' */
+int attrLength; /* 4 for 'i' or 'f', 1-255 for 'c' */
+char *value; /* value to be inserted */ 
+int recId; /* recId to be inserted */
+
+{
+	long long start = PFlatStart();
+	int errVal;
+
+	errVal = AMinsertEntry(fileDesc,attrType,attrLength,value,recId);
+	PFlatEnd(PF_LAT_AMINSERT,start);
+	return(errVal);
+}
+
+
 /* error messages */
 static char *AMerrormsg[] = {
 "No error",
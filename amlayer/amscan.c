@@ -97,6 +97,9 @@ if (value == NULL)
 /* search for the pagenumber and index of value */
 status = AM_Search(fileDesc,attrType,attrLength,value,&pageNum,&pageBuf,&index);
 searchpageNum = pageNum;
+/* a scan does not split nodes: empty the stack AM_Search() filled, so
+that it is set for next amlayer call */
+AM_EmptyStack();
 /* check for errors */
 if (status < 0) 
   { AM_scanTable[scanDesc].status = FREE;
@@ -276,9 +279,8 @@ AM_Check;
 return(scanDesc);
 }
 
-/* returns the record id of the next record that satisfies the conditions
-specified for index scan associated with scanDesc */
-AM_FindNextEntry(scanDesc)
+/* AM_FindNextEntry(), without the timing */
+static int AMfindNextEntry(scanDesc)
 int scanDesc;/* index scan descriptor */
 
 {
@@ -470,6 +472,22 @@ return(recId);
 }
 
 
+/* returns the record id of the next record that satisfies the conditions
+specified for index scan associated with scanDesc; timed while
+PF_SetLatency() is on */
+AM_FindNextEntry(scanDesc)
+int scanDesc;/* index scan descriptor */
+
+{
+long long start = PFlatStart();
+int recId;
+
+recId = AMfindNextEntry(scanDesc);
+PFlatEnd(PF_LAT_AMFINDNEXT,start);
+return(recId);
+}
+
+
 /* terminates an index scan */
 AM_CloseIndexScan(scanDesc)
 int scanDesc;/* scan Descriptor*/
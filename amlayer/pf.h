@@ -34,7 +34,13 @@
 /* page size */
 #define PF_PAGE_SIZE	1020
 
+/* latency histograms (pflayer/lat.c), same numbers as pflayer/pf.h */
+#define PF_LAT_AMINSERT	4	/* AM_InsertEntry() */
+#define PF_LAT_AMFINDNEXT 5	/* AM_FindNextEntry() */
+
 /* externs from the PF layer */
-extern int PFerrno;		/* error number of last error */
+extern __thread int PFerrno;	/* error number of last error, per thread */
 extern void PF_Init();
 extern void PF_PrintError();
+extern long long PFlatStart();
+extern void PFlatEnd();
@@ -2,7 +2,7 @@
 echo "--- Cleaning old files ---"
 rm -f pflayer/*.o
 rm -f amlayer/*.o
-rm -f test_pf_stats test_hf test_am
+rm -f test_pf_stats test_hf test_am test_mmap
 
 echo "--- 1. Building PF/HF Layer (pflayer) ---"
 make -C pflayer
@@ -22,8 +22,9 @@ echo "--- 3. Linking AM Layer Object (amlayer.o) ---"
 ld -r -o ./amlayer/amlayer.o ./amlayer/am.o ./amlayer/amfns.o ./amlayer/amsearch.o ./amlayer/aminsert.o ./amlayer/amstack.o ./amlayer/amglobals.o ./amlayer/amscan.o ./amlayer/amprint.o
 
 echo "--- 4. Compiling Test Programs ---"
-cc -o test_pf_stats test_pf_stats.c -I./pflayer ./pflayer/pflayer.o
-cc -o test_hf test_hf.c -I./pflayer ./pflayer/pflayer.o
-cc -o test_am test_am.c -I./pflayer -I./amlayer ./pflayer/pflayer.o ./amlayer/amlayer.o
+cc -o test_pf_stats test_pf_stats.c -I./pflayer ./pflayer/pflayer.o -lpthread
+cc -o test_hf test_hf.c -I./pflayer ./pflayer/pflayer.o -lpthread
+cc -o test_am test_am.c -I./pflayer -I./amlayer ./pflayer/pflayer.o ./amlayer/amlayer.o -lpthread
+cc -o test_mmap test_mmap.c -I./pflayer -I./amlayer ./pflayer/pflayer.o ./amlayer/amlayer.o -lpthread
 
 echo "--- Build Complete ---"
\ No newline at end of file
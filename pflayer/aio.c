@@ -0,0 +1,418 @@
+/* aio.c: the asynchronous I/O engine. PFaioSubmit() takes a batch of
+PFaioreq's (see pftypes.h) and returns at once; each request's "done"
+function is called when it is over, from a thread of the engine.
+
+Requests on a Unix file go to an io_uring, set up the first time it is
+needed, with one io_uring_enter() per batch; a reaper thread waits for
+their completions. If the kernel has no io_uring, or PF_SetAioEngine()
+asks for PF_AIO_THREADS, and for devices that are not Unix files, a pool
+of PF_AIO_NTHREADS threads does the requests with ordinary blocking
+calls, as many at a time as there are threads. There is no liburing:
+the ring is set up with the system calls themselves. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_AIO_DEPTH	256	/* entries of the submission queue */
+#define PF_AIO_NTHREADS	16	/* threads of the pool */
+#define PF_AIO_POLLUS	1000	/* us between polls if the reaper cannot
+				wait for completions */
+
+/* the io_uring: its file descriptor and the rings mmap()'d from it */
+static int PFringfd = -1;	/* -1 until set up */
+static unsigned *PFsqhead, *PFsqtail, *PFsqmask, *PFsqarray;
+static unsigned *PFcqhead, *PFcqtail, *PFcqmask;
+static struct io_uring_sqe *PFsqes;
+static struct io_uring_cqe *PFcqes;
+static unsigned PFsqentries;	/* # of entries of the submission queue */
+static unsigned PFcqentries;	/* and of the completion queue */
+static int PFringtried = FALSE;	/* TRUE once setting it up was tried */
+static int PFringinflight = 0;	/* # of requests submitted, not reaped */
+static pthread_mutex_t PFringlock = PTHREAD_MUTEX_INITIALIZER; /* held
+				while requests are queued, and for the above */
+static pthread_cond_t PFringroom = PTHREAD_COND_INITIALIZER; /* a request
+				was reaped */
+
+/* the pool: requests wait in a FIFO queue */
+static PFaioreq *PFpoolfirst = NULL, *PFpoollast = NULL;
+static int PFpoolthreads = 0;	/* # of threads started */
+static pthread_mutex_t PFpoollock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PFpoolwork = PTHREAD_COND_INITIALIZER;
+
+static int PFaioengine = PF_AIO_URING;	/* asked for by PF_SetAioEngine() */
+
+/* requests of this thread held back by PFaioSubmit(...,TRUE) */
+static __thread PFaioreq *PFheldfirst = NULL, *PFheldlast = NULL;
+
+
+/****************************** io_uring ********************************/
+
+static void *PFringMap(size,offset)
+size_t size;
+off_t offset;	/* IORING_OFF_* */
+{
+void *p = mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,
+		PFringfd,offset);
+
+	return(p == MAP_FAILED ? NULL : p);
+}
+
+static void *PFringReaper();
+
+static void PFringSetup()
+/****************************************************************************
+SPECIFICATIONS:
+	Set up the io_uring and start its reaper, unless that was tried
+	before. Called with PFringlock held.
+
+RETURN VALUE: none. PFringfd stays -1 if it cannot be set up.
+*****************************************************************************/
+{
+struct io_uring_params p;
+char *sq, *cq;
+size_t sqlen, cqlen;
+pthread_t reaper;
+int fd;
+
+	if (PFringtried)
+		return;
+	PFringtried = TRUE;
+	memset((char *)&p,0,sizeof(p));
+	if ((fd = syscall(__NR_io_uring_setup,PF_AIO_DEPTH,&p)) < 0)
+		return;
+	PFringfd = fd;
+
+	sqlen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	cqlen = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP){
+		sq = cq = PFringMap(sqlen > cqlen ? sqlen : cqlen,
+			(off_t)IORING_OFF_SQ_RING);
+	}
+	else {
+		sq = PFringMap(sqlen,(off_t)IORING_OFF_SQ_RING);
+		cq = PFringMap(cqlen,(off_t)IORING_OFF_CQ_RING);
+	}
+	PFsqes = PFringMap(p.sq_entries * sizeof(struct io_uring_sqe),
+			(off_t)IORING_OFF_SQES);
+	if (sq == NULL || cq == NULL || PFsqes == NULL){
+		/* what was mapped stays, unused */
+		close(fd);
+		PFringfd = -1;
+		return;
+	}
+	PFsqhead = (unsigned *)(sq + p.sq_off.head);
+	PFsqtail = (unsigned *)(sq + p.sq_off.tail);
+	PFsqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	PFsqarray = (unsigned *)(sq + p.sq_off.array);
+	PFcqhead = (unsigned *)(cq + p.cq_off.head);
+	PFcqtail = (unsigned *)(cq + p.cq_off.tail);
+	PFcqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	PFcqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	PFsqentries = p.sq_entries;
+	PFcqentries = p.cq_entries;
+	if (pthread_create(&reaper,NULL,PFringReaper,NULL) != 0){
+		close(fd);
+		PFringfd = -1;
+		return;
+	}
+	pthread_detach(reaper);
+}
+
+static void PFringSubmit(reqs)
+PFaioreq *reqs;	/* list linked by "next", all on Unix files */
+/****************************************************************************
+SPECIFICATIONS:
+	Put the requests of "reqs" on the submission queue and submit
+	them, as few io_uring_enter() calls as the queue allows. No more
+	requests are in flight than the completion queue can hold; if
+	that many are, wait for the reaper. If io_uring_enter() fails,
+	the requests the kernel did not take are taken back from the
+	queue and failed, with those not queued yet.
+*****************************************************************************/
+{
+struct io_uring_sqe *sqe;
+unsigned tail, n;
+PFaioreq *req;
+PFaioreq *failed = NULL;	/* requests to fail, linked by "next" */
+int ret, err;
+
+	pthread_mutex_lock(&PFringlock);
+	while (reqs != NULL){
+		/* queue as many as there is room for */
+		tail = *PFsqtail;
+		for (n = 0; reqs != NULL && n < PFsqentries &&
+				PFringinflight < (int)PFcqentries; n++){
+			req = reqs;
+			reqs = req->next;
+			sqe = &PFsqes[tail & *PFsqmask];
+			memset((char *)sqe,0,sizeof(*sqe));
+			sqe->opcode = req->write ? IORING_OP_WRITEV : IORING_OP_READV;
+			sqe->fd = PFdevUnixFd(req->dev);
+			sqe->addr = (unsigned long)req->iov;
+			sqe->len = req->niov;
+			sqe->off = req->offset;
+			sqe->user_data = (unsigned long)req;
+			PFsqarray[tail & *PFsqmask] = tail & *PFsqmask;
+			tail++;
+			PFringinflight++;
+		}
+		__atomic_store_n(PFsqtail,tail,__ATOMIC_RELEASE);
+
+		while (n > 0){
+			ret = syscall(__NR_io_uring_enter,PFringfd,n,0,0,NULL,0);
+			if (ret > 0)
+				n -= ret;
+			else if (ret < 0 && errno != EINTR && errno != EAGAIN &&
+					errno != EBUSY){
+				/* the kernel has not seen the last n */
+				err = errno;
+				for (; n > 0; n--){
+					req = (PFaioreq *)(unsigned long)
+						PFsqes[--tail & *PFsqmask].user_data;
+					req->result = -1;
+					req->err = err;
+					req->next = failed;
+					failed = req;
+					PFringinflight--;
+				}
+				__atomic_store_n(PFsqtail,tail,__ATOMIC_RELEASE);
+				while ((req = reqs) != NULL){
+					reqs = req->next;
+					req->result = -1;
+					req->err = err;
+					req->next = failed;
+					failed = req;
+				}
+				pthread_cond_broadcast(&PFringroom);
+			}
+			else if (ret <= 0 && errno != EINTR){
+				/* out of kernel resources: let some finish */
+				if (PFringinflight > (int)n)
+					pthread_cond_wait(&PFringroom,&PFringlock);
+				else	sched_yield();
+			}
+		}
+		if (reqs != NULL && PFringinflight >= (int)PFcqentries)
+			pthread_cond_wait(&PFringroom,&PFringlock);
+	}
+	pthread_mutex_unlock(&PFringlock);
+
+	/* "done" may submit more */
+	while ((req = failed) != NULL){
+		failed = req->next;
+		(*req->done)(req);
+	}
+}
+
+static void *PFringReaper(arg)
+void *arg;	/* not used */
+/****************************************************************************
+SPECIFICATIONS:
+	Thread waiting for completions of the io_uring, and calling the
+	"done" function of each request. Runs until the process exits.
+	The requests are the kernel's until they complete, so if waiting
+	fails they cannot be failed: the queue is then polled.
+*****************************************************************************/
+{
+struct io_uring_cqe cqe;
+unsigned head;
+PFaioreq *req;
+
+	for (;;){
+		if (syscall(__NR_io_uring_enter,PFringfd,0,1,
+				IORING_ENTER_GETEVENTS,NULL,0) < 0 && errno != EINTR)
+			usleep(PF_AIO_POLLUS);
+		head = *PFcqhead;
+		while (head != __atomic_load_n(PFcqtail,__ATOMIC_ACQUIRE)){
+			cqe = PFcqes[head & *PFcqmask];
+			__atomic_store_n(PFcqhead,++head,__ATOMIC_RELEASE);
+
+			pthread_mutex_lock(&PFringlock);
+			PFringinflight--;
+			pthread_cond_broadcast(&PFringroom);
+			pthread_mutex_unlock(&PFringlock);
+
+			req = (PFaioreq *)(unsigned long)cqe.user_data;
+			req->result = cqe.res < 0 ? -1 : cqe.res;
+			req->err = cqe.res < 0 ? -cqe.res : 0;
+			(*req->done)(req);
+		}
+	}
+	return(NULL);
+}
+
+
+/******************************* pool ***********************************/
+
+static void *PFpoolWorker(arg)
+void *arg;	/* not used */
+/****************************************************************************
+SPECIFICATIONS:
+	Thread of the pool: do the queued requests one at a time.
+*****************************************************************************/
+{
+PFaioreq *req;
+
+	for (;;){
+		pthread_mutex_lock(&PFpoollock);
+		while (PFpoolfirst == NULL)
+			pthread_cond_wait(&PFpoolwork,&PFpoollock);
+		req = PFpoolfirst;
+		if ((PFpoolfirst = req->next) == NULL)
+			PFpoollast = NULL;
+		pthread_mutex_unlock(&PFpoollock);
+
+		errno = 0;
+		req->result = req->write ?
+			PFdevWritev(req->dev,req->iov,req->niov,req->offset) :
+			PFdevReadv(req->dev,req->iov,req->niov,req->offset);
+		req->err = req->result < 0 ? errno : 0;
+		(*req->done)(req);
+	}
+	return(NULL);
+}
+
+static void PFpoolSubmit(reqs,last)
+PFaioreq *reqs;	/* list linked by "next" */
+PFaioreq *last;	/* its last request */
+/****************************************************************************
+SPECIFICATIONS:
+	Queue the requests of "reqs" for the pool, starting its threads
+	the first time. If not even one thread can be started, the
+	requests are done right here.
+*****************************************************************************/
+{
+pthread_t worker;
+PFaioreq *req;
+
+	pthread_mutex_lock(&PFpoollock);
+	while (PFpoolthreads < PF_AIO_NTHREADS &&
+			pthread_create(&worker,NULL,PFpoolWorker,NULL) == 0){
+		pthread_detach(worker);
+		PFpoolthreads++;
+	}
+	if (PFpoolthreads == 0){
+		pthread_mutex_unlock(&PFpoollock);
+		while ((req = reqs) != NULL){
+			reqs = req->next;
+			req->result = req->write ?
+				PFdevWritev(req->dev,req->iov,req->niov,req->offset) :
+				PFdevReadv(req->dev,req->iov,req->niov,req->offset);
+			req->err = req->result < 0 ? errno : 0;
+			(*req->done)(req);
+		}
+		return;
+	}
+	if (PFpoollast != NULL)
+		PFpoollast->next = reqs;
+	else	PFpoolfirst = reqs;
+	PFpoollast = last;
+	pthread_cond_broadcast(&PFpoolwork);
+	pthread_mutex_unlock(&PFpoollock);
+}
+
+
+/************************** Interface Routines **************************/
+
+void PFaioSubmit(reqs,n,more)
+PFaioreq **reqs;	/* requests to start */
+int n;			/* # of them */
+int more;		/* TRUE if this thread submits more right away */
+/****************************************************************************
+SPECIFICATIONS:
+	Start the "n" requests of reqs[]. With "more" they are only held
+	back, and started with those of the next call without it, so
+	that a batch made of several calls is submitted together. A
+	request's "done" is called once it is over, possibly before this
+	returns; until then the request and its iovecs must stay.
+	"done" runs on a thread of the engine: it must not wait for other
+	requests.
+
+RETURN VALUE: none. Errors are reported in each request.
+*****************************************************************************/
+{
+PFaioreq *ring = NULL, *ringlast = NULL;	/* for the io_uring */
+PFaioreq *pool = NULL, *poollast = NULL;	/* for the pool */
+PFaioreq *req;
+int i;
+
+	for (i = 0; i < n; i++){
+		reqs[i]->next = NULL;
+		if (PFheldlast != NULL)
+			PFheldlast->next = reqs[i];
+		else	PFheldfirst = reqs[i];
+		PFheldlast = reqs[i];
+	}
+	if (more || PFheldfirst == NULL)
+		return;
+
+	if (PFaioengine == PF_AIO_URING && PFringfd < 0 && !PFringtried){
+		pthread_mutex_lock(&PFringlock);
+		PFringSetup();
+		pthread_mutex_unlock(&PFringlock);
+	}
+	while ((req = PFheldfirst) != NULL){
+		PFheldfirst = req->next;
+		req->next = NULL;
+		if (PFaioengine == PF_AIO_URING && PFringfd >= 0 &&
+				PFdevUnixFd(req->dev) >= 0){
+			if (ringlast != NULL)
+				ringlast->next = req;
+			else	ring = req;
+			ringlast = req;
+		}
+		else {
+			if (poollast != NULL)
+				poollast->next = req;
+			else	pool = req;
+			poollast = req;
+		}
+	}
+	PFheldlast = NULL;
+	if (ring != NULL)
+		PFringSubmit(ring);
+	if (pool != NULL)
+		PFpoolSubmit(pool,poollast);
+}
+
+
+int PF_SetAioEngine(engine)
+int engine;	/* PF_AIO_URING or PF_AIO_THREADS */
+/****************************************************************************
+SPECIFICATIONS:
+	Choose the engine asynchronous I/O (PF_GetPagesAsync(), and
+	writing a file back as it is closed) goes to: PF_AIO_URING, the
+	default, or PF_AIO_THREADS. Files not kept in a Unix file (see
+	PF_OPEN_MEMORY) always use the threads. Must not be called
+	while asynchronous I/O is going on.
+
+RETURN VALUE:
+	The engine used from now on: PF_AIO_THREADS if the kernel cannot
+	set up an io_uring.
+	PFE_INVALIDARG	if "engine" is neither.
+*****************************************************************************/
+{
+	if (engine != PF_AIO_URING && engine != PF_AIO_THREADS){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	PFaioengine = engine;
+	if (engine == PF_AIO_URING){
+		pthread_mutex_lock(&PFringlock);
+		PFringSetup();
+		pthread_mutex_unlock(&PFringlock);
+		if (PFringfd < 0)
+			return(PF_AIO_THREADS);
+	}
+	return(engine);
+}
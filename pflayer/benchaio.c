@@ -0,0 +1,246 @@
+/* benchaio.c: synchronous against asynchronous gets. Batches of BATCH
+pages of a file of NPAGES pages are got with PF_GetThisPage() one at a
+time, then with one PF_GetPagesAsync() per batch, then with one
+PF_GetPages(). A batch is what fetching the RecIds of an index range
+asks for: pages drawn at random from a window of WINDOW pages, in no
+order. The buffer is much smaller than the file, so most gets are
+misses; the I/O calls per batch are counted. Then all pages are
+dirtied and the file closed, which writes them back through the same
+engine. Each is timed on a Unix file with both engines, through the
+kernel's cache and with PF_OPEN_DIRECT, and on the file kept in memory
+as slow as the device given on the command line
+(PF_OPEN_MEMORY|PF_OPEN_THROTTLED):
+
+	benchaio [read_us write_us mbps]
+
+The default is 80 20 2000, as benchdev. The data of every page got is
+checked, and so are the writes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pf.h"
+#include "benchutil.h"
+
+#define FILE1		"benchaio.pf"
+#define NPAGES		8000		/* pages in the file */
+#define NBUFS		500		/* buffer pool size */
+#define BATCH		64		/* pages per batch */
+#define WINDOW		(2 * BATCH)	/* pages a batch is drawn from */
+#define NBATCHES	100		/* batches per run */
+
+#define SYNC		0		/* how getbatches() gets a batch */
+#define ASYNC		1
+#define GETPAGES	2
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t over = PTHREAD_COND_INITIALIZER;
+static int ndone;		/* pages of the batch passed to got() */
+static int nbad;		/* of those, wrong or failed */
+
+/* page "i" holds "i" in its first int, and "gen" in its second */
+static void makefile()
+{
+int fd, i, pagenum;
+char *buf;
+
+	PF_Init(NBUFS, PF_LRU);
+	unlink(FILE1);
+	check(PF_CreateFileEx(FILE1, PF_FORMAT_V2), "create");
+	if ((fd = PF_OpenFile(FILE1)) < 0)
+		check(fd, "open");
+	for (i = 0; i < NPAGES; i++){
+		check(PF_AllocPage(fd, &pagenum, &buf), "alloc");
+		((int *)buf)[0] = i;
+		((int *)buf)[1] = 0;
+		check(PF_UnfixPage(fd, pagenum, TRUE), "unfix");
+	}
+	check(PF_CloseFile(fd), "close");
+}
+
+/* callback of PF_GetPagesAsync() */
+static void got(fd, pagenum, pagebuf, error, arg)
+int fd;
+int pagenum;
+char *pagebuf;
+int error;
+void *arg;
+{
+int bad = error != PFE_OK || ((int *)pagebuf)[0] != pagenum;
+
+	if (error == PFE_OK && PF_UnfixPage(fd, pagenum, FALSE) != PFE_OK)
+		bad = TRUE;
+	pthread_mutex_lock(&lock);
+	nbad += bad;
+	if (++ndone == *(int *)arg)
+		pthread_cond_signal(&over);
+	pthread_mutex_unlock(&lock);
+}
+
+/* get the batches with "fd" the "how" way; return ms, and the # of I/O
+calls in *calls */
+static double getbatches(fd, how, calls)
+int fd;
+int how;
+double *calls;
+{
+struct PF_Stats stats;
+int pages[BATCH];
+char *bufs[BATCH];
+int i, k, start, n = BATCH;
+long long iocalls;
+char *buf;
+double t0;
+
+	check(PF_GetStats(&stats), "stats");
+	iocalls = stats.iocalls;
+	srand(1);
+	t0 = nsnow();
+	for (i = 0; i < NBATCHES; i++){
+		start = rand() % (NPAGES - WINDOW);
+		for (k = 0; k < BATCH; k++)
+			pages[k] = start + rand() % WINDOW;
+		if (how == GETPAGES){
+			check(PF_GetPages(fd, pages, BATCH, bufs), "get pages");
+			for (k = 0; k < BATCH; k++)
+				if (((int *)bufs[k])[0] != pages[k]){
+					printf("page %d holds %d\n", pages[k],
+						((int *)bufs[k])[0]);
+					exit(1);
+				}
+			check(PF_UnfixPages(fd, pages, BATCH, FALSE), "unfix pages");
+			continue;
+		}
+		if (how == SYNC){
+			for (k = 0; k < BATCH; k++){
+				check(PF_GetThisPage(fd, pages[k], &buf), "get");
+				if (((int *)buf)[0] != pages[k]){
+					printf("page %d holds %d\n", pages[k],
+						((int *)buf)[0]);
+					exit(1);
+				}
+				check(PF_UnfixPage(fd, pages[k], FALSE), "unfix");
+			}
+			continue;
+		}
+		ndone = 0;
+		check(PF_GetPagesAsync(fd, pages, BATCH, got, (void *)&n),
+			"get async");
+		pthread_mutex_lock(&lock);
+		while (ndone < BATCH)
+			pthread_cond_wait(&over, &lock);
+		pthread_mutex_unlock(&lock);
+		if (nbad > 0){
+			printf("%d pages got wrong\n", nbad);
+			exit(1);
+		}
+	}
+	t0 = (nsnow() - t0) / 1e6;
+	check(PF_GetStats(&stats), "stats");
+	*calls = (double)(stats.iocalls - iocalls) / NBATCHES;
+	return(t0);
+}
+
+/* set the second int of every page to "gen" and close; return ms */
+static double flush(fd, gen)
+int fd;
+int gen;
+{
+int i;
+char *buf;
+double t0;
+
+	for (i = 0; i < NPAGES; i++){
+		check(PF_GetThisPage(fd, i, &buf), "get");
+		((int *)buf)[1] = gen;
+		check(PF_UnfixPage(fd, i, TRUE), "unfix");
+	}
+	t0 = nsnow();
+	check(PF_CloseFile(fd), "close");
+	return((nsnow() - t0) / 1e6);
+}
+
+/* check that every page of the file, opened with "flags", holds "gen" */
+static void checkgen(flags, gen)
+int flags;
+int gen;
+{
+int fd, i;
+char *buf;
+
+	PF_Init(NBUFS, PF_LRU);
+	if ((fd = PF_OpenFileEx(FILE1, flags)) < 0)
+		check(fd, "open");
+	for (i = 0; i < NPAGES; i++){
+		check(PF_GetThisPage(fd, i, &buf), "get");
+		if (((int *)buf)[0] != i || ((int *)buf)[1] != gen){
+			printf("page %d holds %d %d, not %d %d\n", i,
+				((int *)buf)[0], ((int *)buf)[1], i, gen);
+			exit(1);
+		}
+		check(PF_UnfixPage(fd, i, FALSE), "unfix");
+	}
+	check(PF_CloseFile(fd), "close");
+}
+
+/* time the kinds of gets and the close, the file opened with "flags" */
+static void run(name, flags, gen)
+char *name;
+int flags;
+int gen;
+{
+double ms[GETPAGES+1], calls[GETPAGES+1], closems;
+int how, fd;
+
+	for (how = SYNC; how <= GETPAGES; how++){
+		PF_Init(NBUFS, PF_LRU);
+		if ((fd = PF_OpenFileEx(FILE1, flags)) < 0)
+			check(fd, "open");
+		ms[how] = getbatches(fd, how, &calls[how]);
+		if (how == GETPAGES)
+			closems = flush(fd, gen);
+		else	check(PF_CloseFile(fd), "close");
+	}
+	printf("  %-20s %8.1f %6.1f %8.1f %6.1f %8.1f %6.1f %8.1f\n", name,
+		ms[SYNC], calls[SYNC], ms[ASYNC], calls[ASYNC], ms[GETPAGES],
+		calls[GETPAGES], closems);
+	checkgen(flags, gen);
+}
+
+int main(argc, argv)
+int argc;
+char **argv;
+{
+int read_us, write_us, mbps;
+int uring;
+
+	benchdevice(argc, argv, &read_us, &write_us, &mbps);
+	makefile();
+
+	printf("%d batches of %d pages of a random window of %d, file of %d "
+		"pages, %d buffer pages:\n", NBATCHES, BATCH, WINDOW, NPAGES,
+		NBUFS);
+	printf("  %-20s %15s %15s %15s %8s\n", "", "GetThisPage",
+		"GetPagesAsync", "GetPages", "close");
+	printf("  %-20s %8s %6s %8s %6s %8s %6s %8s\n", "", "ms", "calls",
+		"ms", "calls", "ms", "calls", "ms");
+	/* O_DIRECT writes drop the file from the kernel's cache: last */
+	uring = PF_SetAioEngine(PF_AIO_URING) == PF_AIO_URING;
+	if (uring)
+		run("Unix file, io_uring", 0, 1);
+	(void)PF_SetAioEngine(PF_AIO_THREADS);
+	run("Unix file, threads", 0, 2);
+	if (uring){
+		(void)PF_SetAioEngine(PF_AIO_URING);
+		run("O_DIRECT, io_uring", PF_OPEN_DIRECT, 3);
+		(void)PF_SetAioEngine(PF_AIO_THREADS);
+	}
+	else	printf("  (no io_uring in this kernel)\n");
+	run("O_DIRECT, threads", PF_OPEN_DIRECT, 4);
+	printf("  device %d us read, %d us write, %d MB/s:\n", read_us,
+		write_us, mbps);
+	run("memory, threads", PF_OPEN_MEMORY|PF_OPEN_THROTTLED, 5);
+
+	check(PF_DestroyFile(FILE1), "destroy");
+	return(0);
+}
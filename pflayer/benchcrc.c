@@ -0,0 +1,255 @@
+/* benchcrc.c: cost of page checksums (PF_FORMAT_CHECKSUM). The CRC32C of
+a 4 KiB page is timed with each engine of PF_SetCrcEngine(), after
+checking that both give the known CRCs. Then random gets of a file of
+NPAGES pages, through a buffer much smaller than it so that almost all
+are misses, are timed on a V3 file without checksums and on one with
+them, with each engine: from the kernel's cache, and from the file kept
+in memory as slow as the device given on the command line
+(PF_OPEN_MEMORY|PF_OPEN_THROTTLED):
+
+	benchcrc [read_us write_us mbps]
+
+The default is 80 20 2000, as benchdev. Checksumming a page must cost
+less than MAXPCT percent of reading it from the device. Last, a byte of
+a page is changed behind the PF layer's back: getting that page must
+fail with PFE_CHECKSUM, and the others must not. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include "pf.h"
+#include "pftypes.h"
+#include "benchutil.h"
+
+#define FILE1		"benchcrc.pf"
+#define FILE2		"benchcrc2.pf"
+#define NPAGES		4000		/* pages in the file */
+#define NBUFS		64		/* buffer pool size */
+#define NGETS		4000		/* gets per run */
+#define NCRC		100000		/* pages checksummed per engine */
+#define NROUNDS		3		/* runs of each; the fastest counts */
+#define MAXPCT		3.0		/* most a checksum may add to a read */
+
+/* both engines must give the CRC32C of "123456789", and agree on odd
+lengths and alignments, also when a CRC is continued */
+static void checkcrcs()
+{
+static char buf[3 * PF_PAGE_SIZE];
+unsigned crc[2];
+int engine, i, off, len;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = rand();
+	for (engine = PF_CRC_SSE42; engine <= PF_CRC_SLICE8; engine++){
+		(void)PF_SetCrcEngine(engine);
+		if (PFcrc32c(0, "123456789", 9) != 0xE3069283){
+			printf("engine %d: CRC32C of \"123456789\" is %08x\n",
+				engine, PFcrc32c(0, "123456789", 9));
+			exit(1);
+		}
+	}
+	for (i = 0; i < 1000; i++){
+		off = rand() % 64;
+		len = rand() % (sizeof(buf) - 64);
+		for (engine = PF_CRC_SSE42; engine <= PF_CRC_SLICE8; engine++){
+			(void)PF_SetCrcEngine(engine);
+			crc[engine] = PFcrc32c(PFcrc32c(0, buf + off, len / 3),
+				buf + off + len / 3, len - len / 3);
+		}
+		if (crc[0] != crc[1] || crc[1] != PFcrc32c(0, buf + off, len)){
+			printf("engines disagree on %d bytes at %d\n", len, off);
+			exit(1);
+		}
+	}
+}
+
+/* ns to checksum a page with "engine" */
+static double crcns(engine)
+int engine;
+{
+static char pages[16][PF_PAGE_SIZE] __attribute__((aligned(PF_PAGE_SIZE)));
+unsigned sum = 0;
+double t0;
+int i;
+
+	(void)PF_SetCrcEngine(engine);
+	memset(pages, 'x', sizeof(pages));
+	t0 = nsnow();
+	for (i = 0; i < NCRC; i++)
+		sum += PFcrcPage(i, pages[i % 16]);
+	t0 = nsnow() - t0;
+	if (sum == 0)
+		printf("\n");	/* keep the loop */
+	return(t0 / NCRC);
+}
+
+/* page "i" of a new file "fname" in "format" holds "i" in its first int */
+static void makefile(fname, format)
+char *fname;
+int format;
+{
+int fd, i, pagenum;
+char *buf;
+
+	PF_Init(NBUFS, PF_LRU);
+	unlink(fname);
+	check(PF_CreateFileEx(fname, format), "create");
+	if ((fd = PF_OpenFile(fname)) < 0)
+		check(fd, "open");
+	for (i = 0; i < NPAGES; i++){
+		check(PF_AllocPage(fd, &pagenum, &buf), "alloc");
+		memset(buf, i, PF_PAGE_SIZE);
+		((int *)buf)[0] = i;
+		check(PF_UnfixPage(fd, pagenum, TRUE), "unfix");
+	}
+	check(PF_CloseFile(fd), "close");
+}
+
+/* ns per miss of random gets of "fname" opened with "flags", fastest of
+NROUNDS runs */
+static double getns(fname, flags)
+char *fname;
+int flags;
+{
+struct PF_Stats stats;
+double t, best = 0;
+int r, i, fd, page;
+char *buf;
+
+	for (r = 0; r < NROUNDS; r++){
+		PF_Init(NBUFS, PF_LRU);
+		if ((fd = PF_OpenFileEx(fname, flags)) < 0)
+			check(fd, "open");
+		srand(1);
+		t = nsnow();
+		for (i = 0; i < NGETS; i++){
+			page = rand() % NPAGES;
+			check(PF_GetThisPage(fd, page, &buf), "get");
+			if (((int *)buf)[0] != page){
+				printf("page %d holds %d\n", page, ((int *)buf)[0]);
+				exit(1);
+			}
+			check(PF_UnfixPage(fd, page, FALSE), "unfix");
+		}
+		t = nsnow() - t;
+		check(PF_GetStats(&stats), "stats");
+		t /= stats.file[fd].misses;
+		check(PF_CloseFile(fd), "close");
+		if (r == 0 || t < best)
+			best = t;
+	}
+	return(best);
+}
+
+/* time the gets of both files opened with "flags" */
+static void run(name, flags, hw)
+char *name;
+int flags;
+int hw;		/* TRUE if SSE4.2 can be used */
+{
+double plain, sse = 0, slice;
+
+	plain = getns(FILE1, flags);
+	if (hw){
+		(void)PF_SetCrcEngine(PF_CRC_SSE42);
+		sse = getns(FILE2, flags);
+	}
+	(void)PF_SetCrcEngine(PF_CRC_SLICE8);
+	slice = getns(FILE2, flags);
+	printf("  %-20s %10.0f %10.0f %+6.1f%% %10.0f %+6.1f%%\n", name, plain,
+		sse, hw ? 100 * (sse - plain) / plain : 0.0, slice,
+		100 * (slice - plain) / plain);
+}
+
+/* change a byte of the last page of FILE2 and put it back; only that
+page must fail */
+static void corrupt()
+{
+int fd, unixfd, error;
+off_t end;
+char *buf, c;
+
+	if ((unixfd = open(FILE2, O_RDWR)) < 0 ||
+			(end = lseek(unixfd, (off_t)0, SEEK_END)) <= 0 ||
+			pread(unixfd, &c, 1, end - 1) != 1){
+		perror(FILE2);
+		exit(1);
+	}
+	c ^= 1;
+	if (pwrite(unixfd, &c, 1, end - 1) != 1){
+		perror(FILE2);
+		exit(1);
+	}
+	PF_Init(NBUFS, PF_LRU);
+	if ((fd = PF_OpenFile(FILE2)) < 0)
+		check(fd, "open");
+	if ((error = PF_GetThisPage(fd, NPAGES - 1, &buf)) != PFE_CHECKSUM){
+		printf("a changed page was got with error %d\n", error);
+		exit(1);
+	}
+	check(PF_GetThisPage(fd, NPAGES - 2, &buf), "get");
+	check(PF_UnfixPage(fd, NPAGES - 2, FALSE), "unfix");
+	check(PF_CloseFile(fd), "close");
+
+	c ^= 1;
+	if (pwrite(unixfd, &c, 1, end - 1) != 1){
+		perror(FILE2);
+		exit(1);
+	}
+	close(unixfd);
+	PF_Init(NBUFS, PF_LRU);
+	if ((fd = PF_OpenFile(FILE2)) < 0)
+		check(fd, "open");
+	check(PF_GetThisPage(fd, NPAGES - 1, &buf), "get restored page");
+	check(PF_UnfixPage(fd, NPAGES - 1, FALSE), "unfix");
+	check(PF_CloseFile(fd), "close");
+	printf("a changed page fails with PFE_CHECKSUM, and only it\n");
+}
+
+int main(argc, argv)
+int argc;
+char **argv;
+{
+int read_us, write_us, mbps;
+double sse = 0, slice, pct;
+int hw;
+
+	benchdevice(argc, argv, &read_us, &write_us, &mbps);
+	checkcrcs();
+	hw = PF_SetCrcEngine(PF_CRC_SSE42) == PF_CRC_SSE42;
+	if (hw)
+		sse = crcns(PF_CRC_SSE42);
+	slice = crcns(PF_CRC_SLICE8);
+	printf("CRC32C of a %d byte page: ", PF_PAGE_SIZE);
+	if (hw)
+		printf("SSE4.2 %.0f ns (%.1f GB/s), ", sse, PF_PAGE_SIZE / sse);
+	else	printf("(no SSE4.2 on this processor) ");
+	printf("slicing-by-8 %.0f ns (%.1f GB/s)\n", slice, PF_PAGE_SIZE / slice);
+
+	makefile(FILE1, PF_FORMAT_V3);
+	makefile(FILE2, PF_FORMAT_V3|PF_FORMAT_CHECKSUM);
+	printf("%d random gets of %d pages, %d buffer pages, ns per miss:\n",
+		NGETS, NPAGES, NBUFS);
+	printf("  %-20s %10s %18s %18s\n", "", "no checksum", "SSE4.2",
+		"slicing-by-8");
+	run("kernel's cache", 0, hw);
+	run("device", PF_OPEN_MEMORY|PF_OPEN_THROTTLED, hw);
+	printf("  device %d us read, %d us write, %d MB/s\n", read_us,
+		write_us, mbps);
+
+	/* the default engine against a read from the device */
+	(void)PF_SetCrcEngine(PF_CRC_SSE42);
+	pct = 100 * (hw ? sse : slice) / (read_us * 1000.0 +
+		PF_PAGE_SIZE * 1000.0 / (mbps > 0 ? mbps : 1));
+	printf("checksum: %.2f%% of a page read from the device\n", pct);
+	if (read_us > 0 && pct > MAXPCT){
+		printf("checksums cost over %.0f%% of a read\n", MAXPCT);
+		exit(1);
+	}
+
+	corrupt();
+	check(PF_DestroyFile(FILE1), "destroy");
+	check(PF_DestroyFile(FILE2), "destroy");
+	return(0);
+}
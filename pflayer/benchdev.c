@@ -0,0 +1,133 @@
+/* benchdev.c: buffer strategies on a simulated device. A file of NPAGES
+pages is loaded into memory (PF_OPEN_MEMORY), then each strategy runs
+the same skewed workload, 10% of it writes, on the memory image made as
+slow as the device given on the command line (PF_OPEN_THROTTLED):
+
+	benchdev [read_us write_us mbps]
+
+The default, 80 20 2000, is an NVMe drive; 8000 8000 150 is a hard
+disk, and with 0 0 0 only the memory copies are timed. The Unix file is
+checked to be untouched by the writes, and the image to keep them until
+PF_DestroyFile(). */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pf.h"
+#include "benchutil.h"
+
+#define FILE1		"benchdev.pf"
+#define NPAGES		4000		/* pages in the file */
+#define NBUFS		400		/* buffer pool size */
+#define NGETS		20000		/* gets per strategy */
+
+/* page "i" holds "i" in its first int, and the # of writes after it */
+static void makefile()
+{
+int fd, i, pagenum;
+char *buf;
+
+	PF_Init(NBUFS, PF_LRU);
+	unlink(FILE1);
+	check(PF_CreateFile(FILE1), "create");
+	if ((fd = PF_OpenFile(FILE1)) < 0)
+		check(fd, "open");
+	for (i = 0; i < NPAGES; i++){
+		check(PF_AllocPage(fd, &pagenum, &buf), "alloc");
+		((int *)buf)[0] = i;
+		((int *)buf)[1] = 0;
+		check(PF_UnfixPage(fd, pagenum, TRUE), "unfix");
+	}
+	check(PF_CloseFile(fd), "close");
+}
+
+/* sum of the write counts of all pages, opened with "flags" */
+static long long nwrites(flags)
+int flags;
+{
+int fd, i;
+char *buf;
+long long sum = 0;
+
+	PF_Init(NBUFS, PF_LRU);
+	if ((fd = PF_OpenFileEx(FILE1, flags)) < 0)
+		check(fd, "open");
+	for (i = 0; i < NPAGES; i++){
+		check(PF_GetThisPage(fd, i, &buf), "get");
+		if (((int *)buf)[0] != i){
+			printf("page %d holds %d\n", i, ((int *)buf)[0]);
+			exit(1);
+		}
+		sum += ((int *)buf)[1];
+		check(PF_UnfixPage(fd, i, FALSE), "unfix");
+	}
+	check(PF_CloseFile(fd), "close");
+	return(sum);
+}
+
+static char *names[] = { "LRU", "MRU", "CLOCK", "2Q", "ARC" };
+
+/* run the workload with "strategy"; return the # of writes done */
+static int run(strategy)
+int strategy;
+{
+struct PF_Stats stats;
+int fd, i, page, dirty, writes = 0;
+double u, t0;
+char *buf;
+
+	PF_Init(NBUFS, strategy);
+	if ((fd = PF_OpenFileEx(FILE1, PF_OPEN_MEMORY|PF_OPEN_THROTTLED)) < 0)
+		check(fd, "open");
+	srand(1);
+	t0 = nsnow();
+	for (i = 0; i < NGETS; i++){
+		/* a quarter of the pages get most of the gets */
+		u = (double)rand() / RAND_MAX;
+		page = (int)(NPAGES * u * u);
+		page = page < NPAGES ? page : NPAGES - 1;
+		dirty = rand() % 10 == 0;
+		check(PF_GetThisPage(fd, page, &buf), "get");
+		if (dirty){
+			((int *)buf)[1]++;
+			writes++;
+		}
+		check(PF_UnfixPage(fd, page, dirty), "unfix");
+	}
+	check(PF_GetStats(&stats), "stats");
+	check(PF_CloseFile(fd), "close");
+	printf("  %-6s %9.2f%% %10lld %10.1f %10.2f\n", names[strategy],
+		100.0 * stats.total.hits / NGETS, stats.total.pages_written,
+		(nsnow() - t0) / 1e6, (nsnow() - t0) / 1e3 / NGETS);
+	return(writes);
+}
+
+int main(argc, argv)
+int argc;
+char **argv;
+{
+int read_us, write_us, mbps;
+long long writes = 0;
+int s;
+
+	benchdevice(argc, argv, &read_us, &write_us, &mbps);
+	makefile();
+
+	printf("%d gets of %d pages, %d buffer pages, device %d us read, "
+		"%d us write, %d MB/s:\n", NGETS, NPAGES, NBUFS, read_us,
+		write_us, mbps);
+	printf("  %-6s %10s %10s %10s %10s\n", "", "hit rate", "writes",
+		"ms", "us/get");
+	for (s = PF_LRU; s <= PF_ARC; s++)
+		writes += run(s);
+
+	if (nwrites(PF_OPEN_MEMORY) != writes || nwrites(0) != 0){
+		printf("writes went to the wrong place\n");
+		exit(1);
+	}
+	check(PF_DestroyFile(FILE1), "destroy");
+	if (PF_OpenFileEx(FILE1, PF_OPEN_MEMORY) >= 0 || PFerrno != PFE_UNIX){
+		printf("memory image outlived PF_DestroyFile()\n");
+		exit(1);
+	}
+	return(0);
+}
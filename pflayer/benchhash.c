@@ -0,0 +1,66 @@
+/* benchhash.c: microbenchmark of the PF hash table. For buffer pools
+from 20 to 1M pages it fills the table with one entry per buffer page,
+the way a full pool does, and times PFhashFind() hits and misses. */
+#include <stdio.h>
+#include <stdlib.h>
+#include "pf.h"
+#include "pftypes.h"
+#include "benchutil.h"
+
+#define NFILES		4		/* pages are spread over this many fds */
+#define NLOOKUPS	2000000		/* lookups timed per pool size */
+
+int main()
+{
+static PFhashtab tab;
+static int sizes[] = { 20, 100, 1000, 10000, 100000, 1000000 };
+int s, n, i, k;
+int *keys;
+double t0, hit_ns, miss_ns;
+long found;
+
+	printf("%10s %12s %12s\n", "pool", "ns/hit", "ns/miss");
+	for (s = 0; s < sizeof(sizes)/sizeof(sizes[0]); s++){
+		n = sizes[s];
+		PFhashInit(&tab, n);
+
+		/* page i of the pool is page i/NFILES of fd i%NFILES */
+		for (i = 0; i < n; i++)
+			if (PFhashInsert(&tab, i % NFILES, i / NFILES,
+					(PFbpage *)(long)(i + 1)) != PFE_OK){
+				PF_PrintError("PFhashInsert");
+				exit(1);
+			}
+
+		/* random order, so large tables do not hit the cache
+		just because the keys are consecutive */
+		keys = (int *)malloc(NLOOKUPS * sizeof(int));
+		srand(1);
+		for (i = 0; i < NLOOKUPS; i++)
+			keys[i] = (int)(((long)rand() * RAND_MAX + rand()) % n);
+
+		found = 0;
+		t0 = nsnow();
+		for (i = 0; i < NLOOKUPS; i++){
+			k = keys[i];
+			found += PFhashFind(&tab, k % NFILES, k / NFILES) != NULL;
+		}
+		hit_ns = (nsnow() - t0) / NLOOKUPS;
+		if (found != NLOOKUPS){
+			printf("lost entries at pool size %d\n", n);
+			exit(1);
+		}
+
+		/* same pages of a file that is not in the pool */
+		t0 = nsnow();
+		for (i = 0; i < NLOOKUPS; i++){
+			k = keys[i];
+			found += PFhashFind(&tab, NFILES, k / NFILES) != NULL;
+		}
+		miss_ns = (nsnow() - t0) / NLOOKUPS;
+
+		printf("%10d %12.1f %12.1f\n", n, hit_ns, miss_ns);
+		free((char *)keys);
+	}
+	return(0);
+}
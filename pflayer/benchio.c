@@ -0,0 +1,233 @@
+/* benchio.c: system calls and time taken to read 10k pages of a file,
+the way pages were read before (lseek + read per page), through
+PF_GetThisPage() (one pread per page), and with PFbufPrefetch() moving
+runs of adjacent pages with one preadv each. Then, for each file format,
+the system calls it takes to dispose half of the pages and allocate them
+again: a V3 file does it in its bitmap, without reading the pages.
+Last, two V2 files are loaded at once, a page of each in turn, with
+files growing page by page and by extents (PF_SetExtentPages()); the
+number of extents the file system gave the first one, and the time a
+scan of it with O_DIRECT takes, show how fragmented it is. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/fs.h>
+#include <linux/fiemap.h>
+#include "pf.h"
+#include "pftypes.h"
+#include "benchutil.h"
+
+#define FILE1		"benchio.pf"
+#define FILE2		"benchio2.pf"
+#define NPAGES		10000		/* pages in the file, all read */
+#define NBUFS		128		/* buffer pool size */
+
+static void makefile(format)
+int format;
+{
+int fd, i, pagenum;
+char *buf;
+
+	unlink(FILE1);
+	check(PF_CreateFileEx(FILE1, format), "create");
+	if ((fd = PF_OpenFile(FILE1)) < 0)
+		check(fd, "open");
+	for (i = 0; i < NPAGES; i++){
+		check(PF_AllocPage(fd, &pagenum, &buf), "alloc");
+		*(int *)buf = i;
+		check(PF_UnfixPage(fd, pagenum, TRUE), "unfix");
+	}
+	check(PF_CloseFile(fd), "close");
+}
+
+/* the old way: seek to each page, then read it */
+static void seekread(format)
+int format;
+{
+static char buf[PF_FPAGE_SIZE];
+int ufd, i, calls = 0;
+size_t size = format == PF_FORMAT_V1 ? PF_FPAGE_SIZE : PF_PAGE_SIZE;
+off_t offset;
+double t0;
+
+	if ((ufd = open(FILE1, O_RDONLY)) < 0){
+		perror(FILE1);
+		exit(1);
+	}
+	t0 = nsnow();
+	for (i = 0; i < NPAGES; i++){
+		offset = format == PF_FORMAT_V2 ? PFv2PageOffset(i) :
+			format == PF_FORMAT_V3 ? PFv3PageOffset(i) :
+			(off_t)i * PF_FPAGE_SIZE + PF_HDR_SIZE;
+		calls++;
+		if (lseek(ufd, offset, SEEK_SET) == -1){
+			perror("lseek");
+			exit(1);
+		}
+		calls++;
+		if (read(ufd, buf, size) != size){
+			perror("read");
+			exit(1);
+		}
+	}
+	printf("  %-14s %10d %10.1f\n", "lseek+read", calls,
+		(nsnow() - t0) / 1e6);
+	close(ufd);
+}
+
+/* through the PF layer, prefetching "run" pages at a time (0: none) */
+static void pfread(run)
+int run;
+{
+int fd, i, calls;
+char *buf;
+char name[32];
+double t0;
+
+	PF_Init(NBUFS, PF_LRU);
+	if ((fd = PF_OpenFile(FILE1)) < 0)
+		check(fd, "open");
+	calls = PFiocalls;
+	t0 = nsnow();
+	for (i = 0; i < NPAGES; i++){
+		if (run > 0 && i % run == 0)
+			check(PFbufPrefetch(fd, i, i + run <= NPAGES ? run :
+				NPAGES - i, PFreadvfcn, PFwritefcn), "prefetch");
+		check(PF_GetThisPage(fd, i, &buf), "get");
+		if (*(int *)buf != i){
+			printf("page %d holds %d\n", i, *(int *)buf);
+			exit(1);
+		}
+		check(PF_UnfixPage(fd, i, FALSE), "unfix");
+	}
+	if (run > 0)
+		sprintf(name, "preadv x%d", run);
+	else	sprintf(name, "pread");
+	printf("  %-14s %10d %10.1f\n", name, (int)(PFiocalls - calls),
+		(nsnow() - t0) / 1e6);
+	check(PF_CloseFile(fd), "close");
+}
+
+/* dispose every other page, then allocate as many pages */
+static void churn(format)
+int format;
+{
+int fd, i, pagenum, calls;
+char *buf;
+double t0;
+
+	PF_Init(NBUFS, PF_LRU);
+	if ((fd = PF_OpenFile(FILE1)) < 0)
+		check(fd, "open");
+	calls = PFiocalls;
+	t0 = nsnow();
+	for (i = 0; i < NPAGES; i += 2)
+		check(PF_DisposePage(fd, i), "dispose");
+	for (i = 0; i < NPAGES; i += 2){
+		check(PF_AllocPage(fd, &pagenum, &buf), "alloc");
+		check(PF_UnfixPage(fd, pagenum, TRUE), "unfix");
+	}
+	check(PF_CloseFile(fd), "close");
+	printf("  %-14s %10d %10.1f\n", "dispose+alloc", (int)(PFiocalls - calls),
+		(nsnow() - t0) / 1e6);
+}
+
+/* # of extents of file "fname", -1 if the file system does not say */
+static int nextents(fname)
+char *fname;
+{
+struct fiemap fm;
+int ufd, n;
+
+	if ((ufd = open(fname, O_RDONLY)) < 0){
+		perror(fname);
+		exit(1);
+	}
+	fsync(ufd);
+	memset((char *)&fm, 0, sizeof(fm));
+	fm.fm_length = FIEMAP_MAX_OFFSET;
+	fm.fm_flags = FIEMAP_FLAG_SYNC;
+	n = ioctl(ufd, FS_IOC_FIEMAP, &fm) == 0 ? (int)fm.fm_mapped_extents : -1;
+	close(ufd);
+	return(n);
+}
+
+/* load FILE1 and FILE2 at once, growing by "extent" pages */
+static void grow(extent)
+int extent;
+{
+int fd1, fd2, i, pagenum;
+char *buf;
+char name[32];
+double t0, load;
+
+	check(PF_SetExtentPages(extent), "extent");
+	PF_Init(NBUFS, PF_LRU);
+	unlink(FILE1);
+	unlink(FILE2);
+	check(PF_CreateFileEx(FILE1, PF_FORMAT_V2), "create");
+	check(PF_CreateFileEx(FILE2, PF_FORMAT_V2), "create");
+	if ((fd1 = PF_OpenFile(FILE1)) < 0 || (fd2 = PF_OpenFile(FILE2)) < 0)
+		check(PFerrno, "open");
+	t0 = nsnow();
+	for (i = 0; i < NPAGES; i++){
+		check(PF_AllocPage(fd1, &pagenum, &buf), "alloc");
+		check(PF_UnfixPage(fd1, pagenum, TRUE), "unfix");
+		check(PF_AllocPage(fd2, &pagenum, &buf), "alloc");
+		check(PF_UnfixPage(fd2, pagenum, TRUE), "unfix");
+	}
+	check(PF_CloseFile(fd1), "close");
+	check(PF_CloseFile(fd2), "close");
+	load = (nsnow() - t0) / 1e6;
+
+	PF_Init(NBUFS, PF_LRU);
+	if ((fd1 = PF_OpenFileEx(FILE1, PF_OPEN_DIRECT)) < 0)
+		check(fd1, "open");
+	t0 = nsnow();
+	for (i = 0; i < NPAGES; i++){
+		if (i % PF_IO_MAXPAGES == 0)
+			check(PFbufPrefetch(fd1, i, i + PF_IO_MAXPAGES <= NPAGES ?
+				PF_IO_MAXPAGES : NPAGES - i, PFreadvfcn,
+				PFwritefcn), "prefetch");
+		check(PF_GetThisPage(fd1, i, &buf), "get");
+		check(PF_UnfixPage(fd1, i, FALSE), "unfix");
+	}
+	check(PF_CloseFile(fd1), "close");
+	if (extent > 0)
+		sprintf(name, "extent %d", extent);
+	else	sprintf(name, "page by page");
+	printf("  %-14s %10.1f %10d %10.1f\n", name, load, nextents(FILE1),
+		(nsnow() - t0) / 1e6);
+	unlink(FILE2);
+}
+
+int main()
+{
+static int formats[] = { PF_FORMAT_V1, PF_FORMAT_V2, PF_FORMAT_V3 };
+static int runs[] = { 0, 8, 32, PF_IO_MAXPAGES };
+static int extents[] = { 0, PF_EXTENT_MIN, PF_EXTENT_MAX };
+int f, r;
+
+	for (f = 0; f < sizeof(formats)/sizeof(formats[0]); f++){
+		PF_Init(NBUFS, PF_LRU);
+		makefile(formats[f]);
+		printf("V%d file, %d page reads:\n", formats[f], NPAGES);
+		printf("  %-14s %10s %10s\n", "", "syscalls", "ms");
+		seekread(formats[f]);
+		for (r = 0; r < sizeof(runs)/sizeof(runs[0]); r++)
+			pfread(runs[r]);
+		churn(formats[f]);
+	}
+
+	printf("two V2 files of %d pages loaded at once:\n", NPAGES);
+	printf("  %-14s %10s %10s %10s\n", "growth", "load ms", "extents",
+		"scan ms");
+	for (r = 0; r < sizeof(extents)/sizeof(extents[0]); r++)
+		grow(extents[r]);
+	unlink(FILE1);
+	return(0);
+}
@@ -0,0 +1,138 @@
+/* benchmt.c: multi-threaded read throughput of the buffer manager. 1 to
+32 threads fix random pages of one file with PF_GetThisPage(), take a
+shared latch, check the page, and unfix it. First with the whole file
+resident (every get is a hit), then with a pool holding a quarter of the
+file, so that most gets miss and are read from the kernel page cache.
+Each is measured with the partitions locked on every call, and with the
+lock-free hit path (PFbufSetOptimistic()); rates per core divide by the
+number of threads or of CPUs, whichever is smaller. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "pf.h"
+#include "pftypes.h"
+#include "benchutil.h"
+
+#define FILE1		"benchmt.pf"
+#define NPAGES		16384		/* pages in the file */
+#define RUNTIME		0.5		/* seconds per measurement */
+#define MAXTHREADS	32
+
+static int fd;
+static int ncpus;
+static volatile int stop;
+static long counts[MAXTHREADS];
+
+static void makefile()
+{
+int i, pagenum;
+char *buf;
+
+	unlink(FILE1);
+	check(PF_CreateFile(FILE1), "create");
+	if ((fd = PF_OpenFile(FILE1)) < 0)
+		check(fd, "open");
+	for (i = 0; i < NPAGES; i++){
+		check(PF_AllocPage(fd, &pagenum, &buf), "alloc");
+		*(int *)buf = i;
+		check(PF_UnfixPage(fd, pagenum, TRUE), "unfix");
+	}
+	check(PF_CloseFile(fd), "close");
+}
+
+static void *reader(arg)
+void *arg;
+{
+long id = (long)arg;
+unsigned seed = id + 1;
+long n = 0;
+int page;
+char *buf;
+
+	while (!stop){
+		page = rand_r(&seed) % NPAGES;
+		check(PF_GetThisPage(fd, page, &buf), "get");
+		check(PF_LatchPage(fd, page, PF_LATCH_SHARED), "latch");
+		if (*(int *)buf != page){
+			printf("page %d holds %d\n", page, *(int *)buf);
+			exit(1);
+		}
+		check(PF_UnlatchPage(fd, page), "unlatch");
+		check(PF_UnfixPage(fd, page, FALSE), "unfix");
+		n++;
+	}
+	counts[id] = n;
+	return(NULL);
+}
+
+/* millions of gets per second by "nthreads" threads */
+static double measure(nthreads)
+int nthreads;
+{
+pthread_t threads[MAXTHREADS];
+int i;
+long total;
+double t0;
+
+	stop = FALSE;
+	t0 = nsnow();
+	for (i = 0; i < nthreads; i++)
+		if (pthread_create(&threads[i], NULL, reader,
+				(void *)(long)i) != 0){
+			perror("pthread_create");
+			exit(1);
+		}
+	usleep((useconds_t)(RUNTIME * 1e6));
+	stop = TRUE;
+	total = 0;
+	for (i = 0; i < nthreads; i++){
+		pthread_join(threads[i], NULL);
+		total += counts[i];
+	}
+	return(total / ((nsnow() - t0) / 1e9) / 1e6);
+}
+
+static void run(nbufs, title)
+int nbufs;
+char *title;
+{
+int nthreads, page, cores;
+double locked, lockfree;
+char *buf;
+
+	PF_Init(nbufs, PF_CLOCK);
+	if ((fd = PF_OpenFile(FILE1)) < 0)
+		check(fd, "open");
+	for (page = 0; page < NPAGES && page < nbufs; page++){
+		check(PF_GetThisPage(fd, page, &buf), "get");
+		check(PF_UnfixPage(fd, page, FALSE), "unfix");
+	}
+
+	printf("%s, %d buffer pages (Mgets/s):\n", title, nbufs);
+	printf("  %8s %12s %12s %12s %12s\n", "threads", "locked",
+		"per core", "lock-free", "per core");
+	for (nthreads = 1; nthreads <= MAXTHREADS; nthreads *= 2){
+		PFbufSetOptimistic(FALSE);
+		locked = measure(nthreads);
+		PFbufSetOptimistic(TRUE);
+		lockfree = measure(nthreads);
+		cores = nthreads < ncpus ? nthreads : ncpus;
+		printf("  %8d %12.2f %12.2f %12.2f %12.2f\n", nthreads,
+			locked, locked / cores, lockfree, lockfree / cores);
+	}
+	PF_PrintStats();
+	check(PF_CloseFile(fd), "close");
+}
+
+int main()
+{
+	PF_Init(1024, PF_LRU);
+	makefile();
+	ncpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	printf("%d CPUs online\n", ncpus);
+	run(NPAGES + NPAGES / 8, "all pages resident");
+	run(NPAGES / 4, "a quarter of the pages resident");
+	unlink(FILE1);
+	return(0);
+}
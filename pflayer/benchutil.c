@@ -0,0 +1,63 @@
+/* benchutil.c: helpers of the bench*.c programs: a clock, a check of PF
+calls, and the device model the ones timing a device take on their
+command line. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "pf.h"
+#include "benchutil.h"
+
+double nsnow()
+/****************************************************************************
+SPECIFICATIONS:
+	Return the time in ns, from a clock that only moves forward.
+*****************************************************************************/
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return(ts.tv_sec * 1e9 + ts.tv_nsec);
+}
+
+void check(error, s)
+int error;	/* what a PF call returned */
+char *s;	/* what it did, for the message */
+/****************************************************************************
+SPECIFICATIONS:
+	Print the PF error and exit, unless "error" is PFE_OK.
+*****************************************************************************/
+{
+	if (error != PFE_OK){
+		PF_PrintError(s);
+		exit(1);
+	}
+}
+
+void benchdevice(argc, argv, read_us, write_us, mbps)
+int argc;
+char **argv;	/* the program's: [read_us write_us mbps] */
+int *read_us;	/* set to the device's latency of a read, */
+int *write_us;	/* of a write, */
+int *mbps;	/* and its bandwidth */
+/****************************************************************************
+SPECIFICATIONS:
+	Set the device PF_OPEN_THROTTLED files are as slow as from the
+	command line, 80 20 2000 (an NVMe drive) without arguments, and
+	tell what it is. Exit with a usage message if the arguments are
+	wrong.
+*****************************************************************************/
+{
+	*read_us = 80;
+	*write_us = 20;
+	*mbps = 2000;
+	if (argc == 4){
+		*read_us = atoi(argv[1]);
+		*write_us = atoi(argv[2]);
+		*mbps = atoi(argv[3]);
+	}
+	else if (argc != 1){
+		fprintf(stderr, "usage: %s [read_us write_us mbps]\n", argv[0]);
+		exit(1);
+	}
+	check(PF_SetDeviceModel(*read_us, *write_us, *mbps), "device model");
+}
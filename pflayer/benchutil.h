@@ -0,0 +1,5 @@
+/* benchutil.h: helpers of the bench*.c programs, see benchutil.c */
+extern double nsnow();
+extern void check(int error, char *s);
+extern void benchdevice(int argc, char **argv, int *read_us, int *write_us,
+	int *mbps);
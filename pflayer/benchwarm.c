@@ -0,0 +1,147 @@
+/* benchwarm.c: cold against warm restart. A file of NPAGES pages is
+kept in memory as slow as the device given on the command line
+(PF_OPEN_MEMORY|PF_OPEN_THROTTLED). A skewed workload runs long enough
+for the buffer to settle, then the PF layer is shut down and started
+again, as a restarting service would be, and the first NFIRST gets of
+the same workload are timed: once cold, and once with warm restart on
+(PF_SetWarmRestart()), after waiting for the warm-up that
+PF_GetStats() reports:
+
+	benchwarm [read_us write_us mbps]
+
+The default, 80 20 2000, is an NVMe drive, as benchdev. The warm
+restart must have a better hit rate than the cold one, and
+PF_DestroyFile() must remove the warm list. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "pf.h"
+#include "benchutil.h"
+
+#define FILE1		"benchwarm.pf"
+#define WARM1		"benchwarm.pf.warm"
+#define NPAGES		4000		/* pages in the file */
+#define NBUFS		1000		/* buffer pool size */
+#define NGETS		40000		/* gets before the restart */
+#define NFIRST		2000		/* gets timed after it */
+#define FLAGS		(PF_OPEN_MEMORY|PF_OPEN_THROTTLED)
+
+/* page "i" holds "i" in its first int */
+static void makefile()
+{
+int fd, i, pagenum;
+char *buf;
+
+	PF_Init(NBUFS, PF_LRU);
+	unlink(FILE1);
+	check(PF_CreateFile(FILE1), "create");
+	if ((fd = PF_OpenFile(FILE1)) < 0)
+		check(fd, "open");
+	for (i = 0; i < NPAGES; i++){
+		check(PF_AllocPage(fd, &pagenum, &buf), "alloc");
+		((int *)buf)[0] = i;
+		check(PF_UnfixPage(fd, pagenum, TRUE), "unfix");
+	}
+	check(PF_CloseFile(fd), "close");
+}
+
+/* do "n" gets of the workload on "fd"; return the hit rate */
+static double gets(fd, n)
+int fd;
+int n;
+{
+struct PF_Stats stats;
+long long hits;
+int i, page;
+double u;
+char *buf;
+
+	check(PF_GetStats(&stats), "stats");
+	hits = stats.total.hits;
+	for (i = 0; i < n; i++){
+		/* a quarter of the pages get 70% of the gets */
+		u = (double)rand() / RAND_MAX;
+		page = (int)(NPAGES * u * u * u * u);
+		page = page < NPAGES ? page : NPAGES - 1;
+		check(PF_GetThisPage(fd, page, &buf), "get");
+		if (((int *)buf)[0] != page){
+			printf("page %d holds %d\n", page, ((int *)buf)[0]);
+			exit(1);
+		}
+		check(PF_UnfixPage(fd, page, FALSE), "unfix");
+	}
+	check(PF_GetStats(&stats), "stats");
+	return((double)(stats.total.hits - hits) / n);
+}
+
+/* restart, warm or not, and time the first gets; return the hit rate */
+static double restart(warm)
+int warm;
+{
+struct PF_Stats stats;
+double t0, waitms = 0, rate;
+int fd;
+
+	check(PF_SetWarmRestart(warm), "warm restart");
+	PF_Init(NBUFS, PF_LRU);
+	t0 = nsnow();
+	if ((fd = PF_OpenFileEx(FILE1, FLAGS)) < 0)
+		check(fd, "open");
+	do
+		check(PF_GetStats(&stats), "stats");
+	while (stats.warm_done < stats.warm_pages);
+	waitms = (nsnow() - t0) / 1e6;
+
+	srand(2);
+	t0 = nsnow();
+	rate = gets(fd, NFIRST);
+	printf("  %-14s %9lld %10.1f %9.2f%% %10.1f\n", warm ? "warm" : "cold",
+		stats.warm_pages, waitms, 100 * rate, (nsnow() - t0) / 1e6);
+	check(PF_Shutdown(), "shutdown");
+	return(rate);
+}
+
+int main(argc, argv)
+int argc;
+char **argv;
+{
+int read_us, write_us, mbps;
+double cold, warm;
+int fd;
+
+	benchdevice(argc, argv, &read_us, &write_us, &mbps);
+	makefile();
+
+	/* the service's first life, leaving a warm list */
+	check(PF_SetWarmRestart(TRUE), "warm restart");
+	PF_Init(NBUFS, PF_LRU);
+	if ((fd = PF_OpenFileEx(FILE1, FLAGS)) < 0)
+		check(fd, "open");
+	srand(1);
+	(void)gets(fd, NGETS - NFIRST);
+	printf("%d pages, %d buffer pages, device %d us read, %d us write, "
+		"%d MB/s;\nfirst %d gets after a restart:\n", NPAGES, NBUFS,
+		read_us, write_us, mbps, NFIRST);
+	printf("  %-14s %9s %10s %10s %10s\n", "", "warm-up", "wait ms",
+		"hit rate", "ms");
+	printf("  %-14s %9s %10s %9.2f%%\n", "steady state", "", "",
+		100 * gets(fd, NFIRST));
+	check(PF_Shutdown(), "shutdown");
+	if (access(WARM1, F_OK) != 0){
+		printf("no warm list was saved\n");
+		exit(1);
+	}
+
+	cold = restart(FALSE);
+	warm = restart(TRUE);
+	if (warm <= cold){
+		printf("warm restart did not help\n");
+		exit(1);
+	}
+	check(PF_DestroyFile(FILE1), "destroy");
+	if (access(WARM1, F_OK) == 0){
+		printf("warm list outlived PF_DestroyFile()\n");
+		exit(1);
+	}
+	return(0);
+}
@@ -1,30 +1,241 @@
 /* buf.c: buffer management routines. The interface routines are:
-PFbufGet(), PFbufUnfix(), PFbufAlloc(), PFbufReleaseFile(), PFbufUsed() and
-PFbufPrint() */
+int PFbufGet(), PFbufUnfix(), PFbufAlloc(), PFbufReleaseFile(), PFbufUsed(),
+int PFbufPrefetch(), PFbufGetAsync(), PFbufLatch(), PFbufUnlatch() and PFbufPrint() */
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#include <sched.h>
 #include "pf.h"
 #include "pftypes.h"
 
-/* --- MODIFIED: Old PFnumbpage is fine, but we add new globals --- */
-static int PFnumbpage = 0;   /* # of buffer pages in memory */
-static PFbpage *PFfirstbpage= NULL; /* ptr to first buffer page, or NULL */
-static PFbpage *PFlastbpage = NULL; /* ptr to last buffer page, or NULL */
-static PFbpage *PFfreebpage= NULL;  /* list of free buffer pages */
-
 /* --- NEW: Globals for configurable size, strategy, and stats --- */
 static int PF_MAX_BUFS = 0; /* Configurable buffer size, set by PFbufInit */
-#define LRU 0
-#define MRU 1
+#define LRU PF_LRU
+#define MRU PF_MRU
+#define CLOCK PF_CLOCK
+#define TWOQ PF_2Q
+#define ARC PF_ARC
 static int PF_REPLACEMENT_STRATEGY = LRU; /* Default to LRU */
 
-/* Statistics Counters */
-static int g_logical_reads = 0;
-static int g_physical_reads = 0;
-static int g_logical_writes = 0;
-static int g_physical_writes = 0;
+/* The buffer pool is allocated once, by PFbufInit(). PFbufframes[] is a
+dense array with the bookkeeping of all PF_MAX_BUFS buffer pages, and
+PFbufdata is one page aligned region holding their data, page i at
+PFbufdata + i*PF_PAGE_SIZE. Keeping the two apart lets victim searches
+walk small, contiguous headers without touching page data. CLOCK sweeps
+its hand over PFbufframes[] instead of relinking the used list on a hit. */
+static PFbpage *PFbufframes = NULL;
+static char *PFbufdata = NULL;
+static size_t PFbufdatasize = 0;	/* bytes mapped at PFbufdata */
+
+/* The pool can be resized (PFbufResize()) up to the PFbufcap frames
+allocated by PFbufInit(): the budget set by PFbufSetBudget(), or the
+initial size if larger. Each partition owns a fixed range of frames and
+uses the first "nbufs" of them; the others are claimed, so nothing pins
+them, and their data is given back to the system. */
+static int PFbufcap = 0;	/* # of frames at PFbufframes */
+static int PFbufbudget = 0;	/* most pages for the next PFbufInit(),
+				0 to keep the size fixed */
+
+/* Auto-sizing: while a budget is set, every PF_AUTOSIZE_GETS sampled
+gets (see mrc.c) the pool is resized to the smallest point of the
+estimated curve whose hit rate is within PF_AUTOSIZE_SLACK of the best
+the budget allows. Only the gets since the last resize count (mrc.c
+keeps them in "win"), so that it follows the workload. The resize is
+done by the thread whose get was counted last, after it unlocked its
+partition. */
+#define PF_AUTOSIZE_GETS	4096
+#define PF_AUTOSIZE_SLACK	0.01
+#define PF_BUF_MINPART		4	/* fewest frames a partition uses */
+static int PFbufsampled = 0;	/* sampled gets since the last resize */
+static int PFbufautodue = FALSE;	/* TRUE if a resize is due */
+
+/* data regions at least this large ask for transparent huge pages */
+#define PF_HUGEPAGE_SIZE	(2*1024*1024)
+
+/* 2Q: pages enter PF_QNEW (A1in, FIFO) on their first reference and are
+only promoted to PF_QMAIN (Am, LRU) when they are referenced again after
+having been evicted, which the ghost list PF_GHOST_A1OUT remembers, or
+when they were referenced again while on A1in, after another page was.
+Re-references with no other page's in between are correlated and
+ignored, so a scan touching each page once cannot push out Am; but with
+a small pool the leaf an index insert keeps going back to is not
+evicted from A1in by the pages of a scan running alongside. */
+#define PF_GHOST_A1OUT	0
+
+/* ARC (Megiddo & Modha): PF_QNEW is T1 (pages seen once recently) and
+PF_QMAIN is T2 (pages seen at least twice), both LRU. B1 and B2 remember
+pages evicted from T1 and T2. A miss that hits B1 means T1 was too
+small and grows the target arcp; a hit in B2 shrinks it. The victim
+comes from T1 while T1 is above target, otherwise from T2. */
+#define PF_GHOST_B1	0
+#define PF_GHOST_B2	1
+
+/* Statistics counters (PF_Counters, see pf.h) are kept per partition
+and per file descriptor, under the partition lock. When a file is
+closed its counters are added to the partition's "closed" ones, so the
+totals keep them and the next file given that descriptor starts at 0.
+The bytes fields are counted by pf.c. */
 /* --- END NEW --- */
 
-
+/* Partitions. The pool is split into PFbufnparts partitions, and page
+(fd,page) only ever lives in a frame of partition PFbufPart(fd,page).
+Each partition has its own lock, hash table, used lists, free list,
+ghost directory and counters, and replaces pages among its own frames,
+so threads using pages of different partitions do not contend. A pool
+is only split when each partition gets at least PF_BUF_PARTPAGES
+frames; a small pool is one partition and replaces pages exactly as a
+single pool would.
+
+The partition lock is not held during page I/O: a page being read or
+written is iobusy (and claimed, see PFbufClaim()), and a thread that wants it waits on
+the partition's iodone condition. */
+#define PF_BUF_MAXPARTS		16	/* most partitions */
+#define PF_BUF_PARTPAGES	128	/* fewest frames in a partition */
+#define PF_CACHELINE		64
+
+typedef struct PFbufpart {
+	pthread_mutex_t mutex;		/* protects all of this, and the
+					frames of the partition */
+	pthread_cond_t iodone;		/* a page stopped being iobusy */
+	/* used lists, indexed by PFbpage.queue */
+	PFbpage *firstbpage[PF_NQUEUES]; /* ptr to first buffer page, or NULL */
+	PFbpage *lastbpage[PF_NQUEUES];  /* ptr to last buffer page, or NULL */
+	int qlen[PF_NQUEUES];            /* # of pages on each list */
+	PFbpage *freebpage;		/* list of free buffer pages */
+	PFbpage *filepages[PF_FTAB_SIZE]; /* resident pages of each file */
+	PFhashtab hash;			/* (fd,page) -> resident page */
+	PFghostdir ghost;		/* for 2Q and ARC */
+	int first;			/* its frames are PFbufframes[first] */
+	int nbufs;			/* to PFbufframes[first+nbufs-1] */
+	int cap;			/* it owns PFbufframes[first+cap-1] */
+	int clockhand;			/* next frame for CLOCK to inspect */
+	int kin;			/* 2Q: target size of A1in */
+	int kout;			/* 2Q: max size of A1out */
+	PFbpage *lastref;		/* 2Q: page referenced last */
+	int arcp;			/* ARC: target size of T1 */
+	int nbusy;			/* # of iobusy pages */
+	volatile int flushwant;		/* TRUE if the flusher waits for
+					the lock */
+	PF_Counters st[PF_FTAB_SIZE];	/* counters of each open file */
+	PF_Counters closed;		/* of files closed since */
+	PFmrc mrc;			/* reuse distances of its gets */
+	long long wingets;		/* its gets at the last auto-sizing */
+	/* hits of PFbufFixFast(), counted without the lock, on cache
+	lines of their own so that lock holders do not share them */
+	long long fasthits[PF_FTAB_SIZE] __attribute__((aligned(PF_CACHELINE)));
+} __attribute__((aligned(PF_CACHELINE))) PFbufpart;
+
+static PFbufpart *PFbufparts = NULL;
+static int PFbufnparts = 0;
+
+/* partition of page "page" of file "fd": the high bits of the hash,
+as the hash tables inside a partition use the low ones */
+#define PFbufPart(fd,page) (&PFbufparts[(unsigned)(((unsigned long long) \
+		PFhash(fd,page) * (unsigned)PFbufnparts) >> 32)])
+
+static int PFbufndirty = 0;	/* # of dirty pages in the buffer */
+
+/* Background flusher (see PFbufSetFlusher()). It visits the partitions
+in turn, picks a dirty page near the victim end of the used lists, and
+writes it with the partition unlocked. A page being written is claimed,
+so it is neither chosen as a victim nor fixed without the lock, and iobusy, so PFbufGet() waits for the
+write to finish before handing it out. */
+static int PFflusheron = FALSE;
+static pthread_t PFflusherthread;
+static pthread_mutex_t PFflushmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t PFflushwake = PTHREAD_COND_INITIALIZER; /* to flusher */
+static volatile int PFflushkick = FALSE;	/* TRUE if the flusher should
+					make a pass */
+static volatile int PFflushstop = FALSE;	/* TRUE if the flusher should
+					exit */
+static int PFflushlow = 0;	/* flush down to this many dirty pages */
+static int PFflushhigh = 0;	/* wake the flusher above this many */
+static int PFflushlowpct = 0;	/* the same, in % of the pool, for when */
+static int PFflushhighpct = 0;	/* it is resized */
+static int (*PFflushwritefcn)();	/* function to write a page */
+
+#define PFbufLock(part) \
+	pthread_mutex_lock(&(part)->mutex)
+#define PFbufUnlock(part) { \
+		pthread_mutex_unlock(&(part)->mutex); \
+		if ((part)->flushwant) /* else we would just take it again */ \
+			sched_yield(); \
+	}
+
+/* a page is about to become dirty: count it, and wake the flusher if
+there are too many */
+#define PFbufSetDirty(bpage) \
+	if (!(bpage)->dirty) { \
+		(bpage)->dirty = TRUE; \
+		if (__sync_add_and_fetch(&PFbufndirty,1) > PFflushhigh && \
+				PFflusheron && !PFflushkick) \
+			PFbufKickFlusher(); \
+	}
+
+/* The hit path. PFbufGet() first tries to fix a resident page without
+locking its partition (PFbufFixFast()): it looks the page up with
+PFhashPeek() and pins the frame by raising its pin count with a
+compare-and-swap, as long as the count is not negative. A thread holding
+the partition lock claims an unfixed frame before giving it to another
+page, reading or writing it, or freeing it: PFbufClaim() moves the pin
+count from 0 to -1 and makes the version odd. PFbufRelease() makes the
+version even again when it is done. A reader that pinned a frame checks
+that the version is still the even one it saw before looking at the
+frame; if not, it drops its pin and takes the locked path. So do hits
+that need list work under the lock (prefetched pages, ARC's T1).
+Bit fields of a frame are only written with the partition locked. */
+static int PFbufoptimistic = TRUE;	/* FALSE: always lock (for tests) */
+
+#define PFbufClaim(bpage) \
+	(__sync_bool_compare_and_swap(&(bpage)->pincount,0,-1) ? \
+		(__sync_fetch_and_add(&(bpage)->version,1), TRUE) : FALSE)
+#define PFbufRelease(bpage,pins) { \
+		(bpage)->pincount = (pins); \
+		__sync_fetch_and_add(&(bpage)->version,1); \
+	}
+
+
+
+
+static void PFbufInsertFree();
+static void PFbufKickFlusher();
+static void PFbufSizeQueues();
+static void PFbufGetCurve();
+static void PFbufAutoSize();
+
+
+static void PFbufFree()
+/****************************************************************************
+SPECIFICATIONS:
+    Give back the pool and the partitions of a previous PFbufInit().
+*****************************************************************************/
+{
+int i;
+
+    for (i = 0; i < PFbufnparts; i++) {
+        free((char *)PFbufparts[i].hash.tbl);
+        PFghostInit(&PFbufparts[i].ghost, 0);
+        PFmrcInit(&PFbufparts[i].mrc, 0);
+        pthread_mutex_destroy(&PFbufparts[i].mutex);
+        pthread_cond_destroy(&PFbufparts[i].iodone);
+    }
+    free((char *)PFbufparts);
+    PFbufparts = NULL;
+    PFbufnparts = 0;
+
+    if (PFbufframes != NULL)
+        for (i = 0; i < PFbufcap; i++)
+            pthread_rwlock_destroy(&PFbufframes[i].latch);
+    free((char *)PFbufframes);
+    PFbufframes = NULL;
+    if (PFbufdata != NULL)
+        munmap(PFbufdata, PFbufdatasize);
+    PFbufdata = NULL;
+    PF_MAX_BUFS = 0;
+    PFbufcap = 0;
+}
 
 
 /* --- NEW: PFbufInit function --- */
@@ -34,23 +245,111 @@ void PFbufInit(int buf_size, int strategy)
 SPECIFICATIONS:
     Initialize the buffer manager with a specific size and strategy.
     This function should be called by PF_Init() BEFORE any other
-    buffer manager functions are called.
+    buffer manager functions are called, and not while another thread
+    uses the buffer.
 *****************************************************************************/
 {
-    PF_MAX_BUFS = buf_size;
+int i, j;
+int nparts, cap;
+PFbufpart *part;
+
+    /* the flusher works on the old pool */
+    (void)PFbufSetFlusher(0, 0, NULL);
+
+    PFbufFree();
+    if (PFtraceon)
+        /* every page is let go of */
+        PFtrace(-1,-1,PF_TRACE_CLOSE);
     PF_REPLACEMENT_STRATEGY = strategy;
+    PFbufndirty = 0;
+
+    /* as many partitions as the pool is large enough for */
+    for (nparts = 1; 2 * nparts <= PF_BUF_MAXPARTS &&
+            2 * nparts * PF_BUF_PARTPAGES <= buf_size; nparts *= 2)
+        ;
+
+    /* Allocate the pool: headers, then data, for as many frames as
+    the budget. mmap() returns memory aligned to the system page size,
+    as O_DIRECT wants it; frames never used cost no memory. */
+    cap = PFbufbudget > buf_size ? PFbufbudget : buf_size;
+    PFbufdatasize = (size_t)cap * PF_PAGE_SIZE;
+    if (buf_size <= 0 ||
+        (PFbufframes = (PFbpage *)calloc(cap, sizeof(PFbpage))) == NULL ||
+        (PFbufdata = mmap(NULL, PFbufdatasize, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0)) == MAP_FAILED) {
+        /* no pool means no buffer pages */
+        free((char *)PFbufframes);
+        PFbufframes = NULL;
+        PFbufdata = NULL;
+        buf_size = cap = 0;
+        nparts = 1;
+    }
+#ifdef MADV_HUGEPAGE
+    /* fewer TLB misses when sweeping a large pool; only a hint */
+    else if (PFbufdatasize >= PF_HUGEPAGE_SIZE)
+        (void)madvise(PFbufdata, PFbufdatasize, MADV_HUGEPAGE);
+#endif
+
+    /* there is always a partition, so every page has somewhere to miss */
+    if (posix_memalign((void **)&PFbufparts, PF_CACHELINE,
+                nparts * sizeof(PFbufpart)) != 0) {
+        printf("Internal error:PFbufInit()\n");
+        exit(1);
+    }
+    PFbufcap = cap;
+    PFbufnparts = nparts;
+    PFbufsampled = 0;
+    PFbufautodue = FALSE;
+    memset((char *)PFbufparts, 0, nparts * sizeof(PFbufpart));
+
+    for (i = 0; i < PFbufcap; i++) {
+        PFbufframes[i].fpage.pagebuf = PFbufdata + (size_t)i * PF_PAGE_SIZE;
+        pthread_rwlock_init(&PFbufframes[i].latch, NULL);
+    }
+
+    PF_MAX_BUFS = 0;
+    for (i = 0; i < nparts; i++) {
+        part = &PFbufparts[i];
+        pthread_mutex_init(&part->mutex, NULL);
+        pthread_cond_init(&part->iodone, NULL);
+        part->first = i == 0 ? 0 : part[-1].first + part[-1].cap;
+        part->cap = cap / nparts + (i < cap % nparts);
+        part->nbufs = buf_size / nparts + (i < buf_size % nparts);
+        if (part->nbufs > part->cap)
+            part->nbufs = part->cap;
+        PF_MAX_BUFS += part->nbufs;
+
+        /* the hash table and ghost directory must hold the largest
+        the partition can grow to */
+        PFhashInit(&part->hash, part->cap);
+        PFbufSizeQueues(part);
+        PFghostInit(&part->ghost, strategy == TWOQ ? part->cap / 2 + 1 :
+                    strategy == ARC ? part->cap : 0);
+        PFmrcInit(&part->mrc, nparts);
+
+        /* every buffer page starts out on the free list, in order;
+        frames beyond the size are claimed */
+        for (j = part->cap - 1; j >= part->nbufs; j--)
+            PFbufClaim(&PFbufframes[part->first + j]);
+        for (j = part->nbufs - 1; j >= 0; j--)
+            PFbufInsertFree(part, &PFbufframes[part->first + j]);
+    }
+}
 
-    /* Reset all globals to a clean state */
-    PFnumbpage = 0;
-    PFfirstbpage = NULL;
-    PFlastbpage = NULL;
-    PFfreebpage = NULL;
 
-    /* Reset statistics */
-    g_logical_reads = 0;
-    g_physical_reads = 0;
-    g_logical_writes = 0;
-    g_physical_writes = 0;
+static void PFbufSizeQueues(part)
+PFbufpart *part;
+/****************************************************************************
+SPECIFICATIONS:
+    Set the list sizes 2Q and ARC aim for from the # of frames the
+    partition uses.
+*****************************************************************************/
+{
+    /* 2Q sizes from Johnson & Shasha: Kin = 25%, Kout = 50% */
+    part->kin = part->nbufs / 4 > 0 ? part->nbufs / 4 : 1;
+    part->kout = part->nbufs / 2 > 0 ? part->nbufs / 2 : 1;
+    if (part->arcp > part->nbufs)
+        part->arcp = part->nbufs;
 }
 /* --- END NEW --- */
 
@@ -61,45 +360,261 @@ void PFbufPrintStats()
 /****************************************************************************
 SPECIFICATIONS:
     Prints the collected buffer manager statistics to stdout.
+    The counters of all partitions are added up.
 *****************************************************************************/
 {
+static struct PF_Stats stats;	/* too large for a thread's stack */
+PF_Counters *st = &stats.total;
+long long logical_reads, physical_reads;
+PFbufpart *part;
+int arcp = 0, t1 = 0, t2 = 0, b1 = 0, b2 = 0;
+int i;
+
+    PFbufGetStats(&stats);
+    for (i = 0; i < PFbufnparts; i++) {
+        part = &PFbufparts[i];
+        PFbufLock(part);
+        arcp += part->arcp;
+        t1 += part->qlen[PF_QNEW];
+        t2 += part->qlen[PF_QMAIN];
+        b1 += PFghostLen(&part->ghost, PF_GHOST_B1);
+        b2 += PFghostLen(&part->ghost, PF_GHOST_B2);
+        PFbufUnlock(part);
+    }
+
+    /* read-ahead is only counted as read once it is used */
+    logical_reads = st->hits + st->misses;
+    physical_reads = st->misses + st->ra_hits;
+
     printf("Buffer Manager Statistics:\n");
-    printf("  Logical Reads:    %d\n", g_logical_reads);
-    printf("  Physical Reads:   %d\n", g_physical_reads);
-    printf("  Logical Writes:   %d\n", g_logical_writes);
-    printf("  Physical Writes:  %d\n", g_physical_writes);
-    
-    if (g_logical_reads > 0) {
-        printf("  Read Hit Rate:    %.2f%%\n", 
-            100.0 * (g_logical_reads - g_physical_reads) / g_logical_reads);
+    printf("  Strategy:         %s\n",
+        PF_REPLACEMENT_STRATEGY == LRU ? "LRU" :
+        PF_REPLACEMENT_STRATEGY == MRU ? "MRU" :
+        PF_REPLACEMENT_STRATEGY == CLOCK ? "CLOCK" :
+        PF_REPLACEMENT_STRATEGY == TWOQ ? "2Q" : "ARC");
+    if (PF_REPLACEMENT_STRATEGY == ARC)
+        printf("  ARC Target T1:    %d of %d (T1 %d, T2 %d, B1 %d, B2 %d)\n",
+            arcp, PF_MAX_BUFS, t1, t2, b1, b2);
+    printf("  Logical Reads:    %lld\n", logical_reads);
+    printf("  Physical Reads:   %lld\n", physical_reads);
+    printf("  Logical Writes:   %lld\n", st->writes);
+    printf("  Physical Writes:  %lld\n", st->pages_written);
+
+    if (logical_reads > 0) {
+        printf("  Read Hit Rate:    %.2f%%\n",
+            100.0 * (logical_reads - physical_reads) / logical_reads);
     } else {
         printf("  Read Hit Rate:    N/A\n");
     }
+    printf("  Victim Writes:    %lld by caller, %lld by flusher\n",
+        st->dirty_evictions, st->flusher_writes);
+    if (st->ra_pages > 0)
+        printf("  Read-ahead:       %lld pages, %lld used (%.2f%%)\n",
+            st->ra_pages, st->ra_hits, 100.0 * st->ra_hits / st->ra_pages);
+    else
+        printf("  Read-ahead:       none\n");
+    printf("  Partitions:       %d\n", PFbufnparts);
 }
 /* --- END NEW --- */
 
 
-static void PFbufInsertFree(bpage)
+static void PFbufAddCounters(to,from)
+PF_Counters *to;    /* counters to add to */
+PF_Counters *from;  /* counters to add */
+{
+    to->hits += from->hits;
+    to->misses += from->misses;
+    to->evictions += from->evictions;
+    to->dirty_evictions += from->dirty_evictions;
+    to->pin_waits += from->pin_waits;
+    to->ra_pages += from->ra_pages;
+    to->ra_hits += from->ra_hits;
+    to->writes += from->writes;
+    to->pages_written += from->pages_written;
+    to->flusher_writes += from->flusher_writes;
+    to->bytes_read += from->bytes_read;
+    to->bytes_written += from->bytes_written;
+}
+
+
+void PFbufGetStats(stats)
+struct PF_Stats *stats; /* filled with the buffer counters */
+/****************************************************************************
+SPECIFICATIONS:
+    Set the counters of every file descriptor, and the totals, to
+    those of the buffer manager, added up over the partitions, and
+    the pool size and miss ratio curve. Other fields of "stats" are
+    left alone. Each partition is locked in
+    turn, so the counters of different partitions may be a few
+    operations apart.
+*****************************************************************************/
+{
+PFbufpart *part;
+int i, fd;
+
+    memset((char *)&stats->total, 0, sizeof(stats->total));
+    memset((char *)stats->file, 0, sizeof(stats->file));
+    for (i = 0; i < PFbufnparts; i++) {
+        part = &PFbufparts[i];
+        PFbufLock(part);
+        for (fd = 0; fd < PF_FTAB_SIZE; fd++) {
+            PFbufAddCounters(&stats->file[fd], &part->st[fd]);
+            stats->file[fd].hits += part->fasthits[fd];
+        }
+        PFbufAddCounters(&stats->total, &part->closed);
+        PFbufUnlock(part);
+    }
+    for (fd = 0; fd < PF_FTAB_SIZE; fd++)
+        PFbufAddCounters(&stats->total, &stats->file[fd]);
+    PFbufGetCurve(stats);
+}
+
+
+static long long PFbufPartGets(part)
+PFbufpart *part;    /* locked */
+/****************************************************************************
+SPECIFICATIONS:
+    Return the # of gets of partition "part" since the counters were
+    reset, also of files closed since.
+*****************************************************************************/
+{
+long long gets = part->closed.hits + part->closed.misses;
+int fd;
+
+    for (fd = 0; fd < PF_FTAB_SIZE; fd++)
+        gets += part->st[fd].hits + part->st[fd].misses + part->fasthits[fd];
+    return(gets);
+}
+
+
+static void PFbufHitRates(hist,gets,rate)
+long long *hist;    /* PF_MRC_NPOINTS + 1 scaled counts, see PFmrc */
+long long gets;     /* # of gets they sample */
+double *rate;       /* set to the hit rate of each point */
+/****************************************************************************
+SPECIFICATIONS:
+    Turn the distances of a sample of "gets" gets into the hit rates
+    of the points of the curve. The sample seldom stands for exactly
+    "gets" gets: a hot page in or out of it makes a big difference.
+    As in SHARDS-adj, the difference is made up at the first point,
+    which is where most gets of hot pages fall.
+*****************************************************************************/
+{
+long long sampled = 0, hits;
+int b;
+
+    for (b = 0; b <= PF_MRC_NPOINTS; b++)
+        sampled += hist[b];
+    hits = gets - sampled;
+    for (b = 0; b < PF_MRC_NPOINTS; b++) {
+        hits += hist[b];
+        rate[b] = gets <= 0 || hits <= 0 ? 0.0 :
+            hits >= gets ? 1.0 : (double)hits / gets;
+    }
+}
+
+
+static void PFbufGetCurve(stats)
+struct PF_Stats *stats; /* its nbufs and mrc_ fields are set */
+/****************************************************************************
+SPECIFICATIONS:
+    Add up the miss ratio curves estimated by the partitions (see
+    mrc.c). Each partition's distances are already scaled to the
+    whole pool.
+*****************************************************************************/
+{
+long long hist[PF_MRC_NPOINTS + 1];
+long long gets = 0;
+int i, b;
+
+    memset((char *)hist, 0, sizeof(hist));
+    stats->mrc_sampled = 0;
+    for (i = 0; i < PFbufnparts; i++) {
+        PFbufLock(&PFbufparts[i]);
+        for (b = 0; b <= PF_MRC_NPOINTS; b++)
+            hist[b] += PFbufparts[i].mrc.hist[b];
+        stats->mrc_sampled += PFbufparts[i].mrc.nsampled;
+        gets += PFbufPartGets(&PFbufparts[i]);
+        PFbufUnlock(&PFbufparts[i]);
+    }
+    stats->nbufs = PF_MAX_BUFS;
+    PFbufHitRates(hist, gets, stats->mrc_hitrate);
+    for (b = 0; b < PF_MRC_NPOINTS; b++)
+        stats->mrc_nbufs[b] = PFmrcSize(b);
+}
+
+
+void PFbufResetStats()
+/****************************************************************************
+SPECIFICATIONS:
+    Set all the counters of the buffer manager, and the estimated
+    miss ratio curve, to 0. The buffer, and the pages in it, are left
+    alone.
+*****************************************************************************/
+{
+PFbufpart *part;
+int i;
+
+    for (i = 0; i < PFbufnparts; i++) {
+        part = &PFbufparts[i];
+        PFbufLock(part);
+        memset((char *)part->st, 0, sizeof(part->st));
+        memset((char *)&part->closed, 0, sizeof(part->closed));
+        memset((char *)part->fasthits, 0, sizeof(part->fasthits));
+        memset((char *)part->mrc.hist, 0, sizeof(part->mrc.hist));
+        memset((char *)part->mrc.win, 0, sizeof(part->mrc.win));
+        part->mrc.nsampled = 0;
+        part->wingets = 0;
+        PFbufUnlock(part);
+    }
+}
+
+
+int PFbufARCTarget()
+/****************************************************************************
+SPECIFICATIONS:
+    Return ARC's current target size for T1, in pages, added up over
+    the partitions. It is 0 for the other strategies.
+*****************************************************************************/
+{
+int arcp = 0;
+int i;
+
+    if (PF_REPLACEMENT_STRATEGY != ARC)
+        return(0);
+    for (i = 0; i < PFbufnparts; i++)
+        arcp += PFbufparts[i].arcp;
+    return(arcp);
+}
+
+
+static void PFbufInsertFree(part,bpage)
+PFbufpart *part;
 PFbpage *bpage;
 /****************************************************************************
 SPECIFICATIONS:
-     Insert the buffer page pointed by "bpage" into the free list.
+     Insert the buffer page pointed by "bpage" into the free list
+     of its partition "part".
 
 AUTHOR: clc
 *****************************************************************************/
 {
-    bpage->nextpage = PFfreebpage;
-    PFfreebpage = bpage;
+    bpage->pincount = 0;
+    bpage->iobusy = FALSE;
+    bpage->nextpage = part->freebpage;
+    part->freebpage = bpage;
 }
 
 
-static void PFbufLinkHead(bpage)
+static void PFbufLinkHead(part,bpage)
+PFbufpart *part;     /* partition of bpage */
 PFbpage *bpage;      /* pointer to buffer page to be linked */
 /****************************************************************************
 SPECIFICATIONS:
 
      Link the buffer page pointed by "bpage" as the head
-     of the used buffer list. No other field of bpage is modified.
+     of the used buffer list "bpage->queue". No other field of
+     bpage is modified.
 
 AUTHOR: clc
 
@@ -107,26 +622,62 @@ RETURN VALUE:
      none.
 
 GLOBAL VARIABLES MODIFIED:
-     PFfirstbpage, PFlastbpage.
+     part->firstbpage, part->lastbpage, part->qlen.
 
 *****************************************************************************/
 {
+int q = bpage->queue;
 
-    bpage->nextpage = PFfirstbpage;
+    bpage->nextpage = part->firstbpage[q];
     bpage->prevpage = NULL;
-    if (PFfirstbpage != NULL)
-        PFfirstbpage->prevpage = bpage;
-    PFfirstbpage = bpage;
-    if (PFlastbpage == NULL)
-        PFlastbpage = bpage;
-}
-    
-void PFbufUnlink(bpage)
+    if (part->firstbpage[q] != NULL)
+        part->firstbpage[q]->prevpage = bpage;
+    part->firstbpage[q] = bpage;
+    if (part->lastbpage[q] == NULL)
+        part->lastbpage[q] = bpage;
+    part->qlen[q]++;
+}
+
+static void PFbufFileLink(part,bpage)
+PFbufpart *part;    /* partition of bpage */
+PFbpage *bpage;     /* buffer page, its fd set */
+/****************************************************************************
+SPECIFICATIONS:
+     Add "bpage" to the list of resident pages of its file.
+*****************************************************************************/
+{
+    bpage->prevfile = NULL;
+    bpage->nextfile = part->filepages[bpage->fd];
+    if (bpage->nextfile != NULL)
+        bpage->nextfile->prevfile = bpage;
+    part->filepages[bpage->fd] = bpage;
+}
+
+
+static void PFbufFileUnlink(part,bpage)
+PFbufpart *part;    /* partition of bpage */
+PFbpage *bpage;     /* buffer page on its file's list */
+/****************************************************************************
+SPECIFICATIONS:
+     Take "bpage" off the list of resident pages of its file.
+*****************************************************************************/
+{
+    if (bpage->prevfile != NULL)
+        bpage->prevfile->nextfile = bpage->nextfile;
+    else
+        part->filepages[bpage->fd] = bpage->nextfile;
+    if (bpage->nextfile != NULL)
+        bpage->nextfile->prevfile = bpage->prevfile;
+}
+
+
+void PFbufUnlink(part,bpage)
+PFbufpart *part;     /* partition of bpage */
 PFbpage *bpage;      /* buffer page to be unlinked from the used list */
 /****************************************************************************
 SPECIFICATIONS:
-     Unlink the page pointed by bpage from the buffer list. Assume
-     that bpage is a valid pointer.  Set the "prevpage" and "nextpage"
+     Unlink the page pointed by bpage from its used buffer list
+     "bpage->queue". Assume that bpage is a valid pointer.  Set the "prevpage" and "nextpage"
      fields to NULL. The caller is responsible to either place
      the unlinked page into the free list, or insert it back
      into the used list.
@@ -137,82 +688,292 @@ RETURN VALUE:
      none
 
 GLOBAL VARIABLES MODIFIED:
-     PFfirstbpage,PFlastbpage.
+     part->firstbpage, part->lastbpage, part->qlen.
 *****************************************************************************/
 {
+int q = bpage->queue;
+
+    if (part->firstbpage[q] == bpage)
+        part->firstbpage[q] = bpage->nextpage;
+
+    if (part->lastbpage[q] == bpage)
+        part->lastbpage[q] = bpage->prevpage;
 
-    if (PFfirstbpage == bpage)
-        PFfirstbpage = bpage->nextpage;
-    
-    if (PFlastbpage == bpage)
-        PFlastbpage = bpage->prevpage;
-    
     if (bpage->nextpage != NULL)
         bpage->nextpage->prevpage = bpage->prevpage;
-    
+
     if (bpage->prevpage != NULL)
         bpage->prevpage->nextpage = bpage->nextpage;
 
     bpage->prevpage = bpage->nextpage = NULL;
+    part->qlen[q]--;
+
+}
+
+
+static void PFbufDrop(part,bpage)
+PFbufpart *part;     /* partition of bpage */
+PFbpage *bpage;      /* resident page */
+/****************************************************************************
+SPECIFICATIONS:
+     Take a resident page out of the hash table and the lists, and
+     put its frame on the free list. The page must be unfixed, or
+     claimed by the caller.
+*****************************************************************************/
+{
+    if (bpage->pincount == 0)
+        /* only a reader that is about to let go can hold it now */
+        while (!PFbufClaim(bpage))
+            sched_yield();
+    if (PFhashDelete(&part->hash,bpage->fd,bpage->page)!= PFE_OK){
+        /* internal error */
+        printf("Internal error:PFbufDrop()\n");
+        exit(1);
+    }
+    PFbufFileUnlink(part,bpage);
+    PFbufUnlink(part,bpage);
+    PFbufInsertFree(part,bpage);
+    PFbufRelease(bpage,0);
+}
+
+
+static PFbpage *PFbufClockVictim(part)
+PFbufpart *part;     /* partition to choose from */
+/****************************************************************************
+SPECIFICATIONS:
+     Choose a victim for the CLOCK strategy. The hand sweeps over
+     the frames of the partition; a page whose reference bit is set
+     gets a second chance (the bit is cleared and the hand moves on).
+     Fixed pages are skipped.
+
+RETURN VALUE:
+     The victim, claimed, or NULL if all pages are fixed.
+
+GLOBAL VARIABLES MODIFIED:
+     part->clockhand
+*****************************************************************************/
+{
+PFbpage *tbpage;
+int n;
+
+    /* two full turns: the first may only clear reference bits */
+    for (n = 0; n < 2 * part->nbufs; n++) {
+        tbpage = &PFbufframes[part->first + part->clockhand];
+        if (++part->clockhand == part->nbufs)
+            part->clockhand = 0;
+
+        if (tbpage->pincount != 0)
+            continue;
+        if (tbpage->refbit) {
+            tbpage->refbit = FALSE;
+            continue;
+        }
+        if (PFbufClaim(tbpage))
+            return(tbpage);
+    }
+    return(NULL);
+}
+
+
+static PFbpage *PFbufLRUVictim(part,q)
+PFbufpart *part;     /* partition to choose from */
+int q;      /* used list to search */
+/****************************************************************************
+SPECIFICATIONS:
+     Return the unfixed page closest to the tail of used list "q",
+     claimed, or NULL if every page on it is fixed.
+*****************************************************************************/
+{
+PFbpage *tbpage;
+
+    for (tbpage=part->lastbpage[q]; tbpage!=NULL; tbpage=tbpage->prevpage){
+        if (tbpage->pincount == 0 && PFbufClaim(tbpage))
+            break;
+    }
+    return(tbpage);
+}
+
+
+static PFbpage *PFbuf2QVictim(part)
+PFbufpart *part;     /* partition to choose from */
+/****************************************************************************
+SPECIFICATIONS:
+     Choose a victim for the 2Q strategy: the oldest page of A1in while
+     A1in is above its target size, otherwise the LRU page of Am. If
+     the preferred list has only fixed pages, the other one is tried.
+     The oldest pages of A1in that were referenced again while on it
+     are first promoted to Am. A victim taken from A1in is remembered
+     in A1out.
+
+RETURN VALUE:
+     The victim, claimed, or NULL if all pages are fixed.
+*****************************************************************************/
+{
+PFbpage *tbpage;
+
+    while (part->qlen[PF_QNEW] > part->kin &&
+            (tbpage = part->lastbpage[PF_QNEW])->reref &&
+            tbpage->pincount == 0) {
+        PFbufUnlink(part,tbpage);
+        tbpage->queue = PF_QMAIN;
+        tbpage->reref = FALSE;
+        PFbufLinkHead(part,tbpage);
+    }
+
+    if (part->qlen[PF_QNEW] > part->kin || part->qlen[PF_QMAIN] == 0) {
+        if ((tbpage = PFbufLRUVictim(part,PF_QNEW)) == NULL)
+            tbpage = PFbufLRUVictim(part,PF_QMAIN);
+    }
+    else if ((tbpage = PFbufLRUVictim(part,PF_QMAIN)) == NULL)
+        tbpage = PFbufLRUVictim(part,PF_QNEW);
+
+    if (tbpage != NULL && tbpage->queue == PF_QNEW) {
+        PFghostInsert(&part->ghost, PF_GHOST_A1OUT, tbpage->fd, tbpage->page);
+        if (PFghostLen(&part->ghost, PF_GHOST_A1OUT) > part->kout)
+            PFghostDeleteLRU(&part->ghost, PF_GHOST_A1OUT);
+    }
+    return(tbpage);
+}
+
+
+static void PFbufARCAdapt(part,ghost)
+PFbufpart *part;     /* partition of the page that missed */
+int ghost;  /* ghost list holding the page that missed, or -1 */
+/****************************************************************************
+SPECIFICATIONS:
+     ARC bookkeeping for a miss, done before a victim is chosen.
+     A hit in B1 or B2 moves the target arcp towards the list that
+     would have kept the page. A page never seen before may make room
+     in the directory, so that |T1|+|B1| <= c and the whole directory
+     stays within 2c, c being the # of frames of the partition.
+
+GLOBAL VARIABLES MODIFIED:
+     part->arcp
+*****************************************************************************/
+{
+int b1 = PFghostLen(&part->ghost, PF_GHOST_B1);
+int b2 = PFghostLen(&part->ghost, PF_GHOST_B2);
+
+    if (ghost == PF_GHOST_B1) {
+        part->arcp += (b1 >= b2) ? 1 : b2 / b1;
+        if (part->arcp > part->nbufs)
+            part->arcp = part->nbufs;
+    }
+    else if (ghost == PF_GHOST_B2) {
+        part->arcp -= (b2 >= b1) ? 1 : b1 / b2;
+        if (part->arcp < 0)
+            part->arcp = 0;
+    }
+    else if (part->qlen[PF_QNEW] + b1 >= part->nbufs) {
+        if (b1 > 0)
+            PFghostDeleteLRU(&part->ghost, PF_GHOST_B1);
+    }
+    else if (part->qlen[PF_QNEW] + part->qlen[PF_QMAIN] + b1 + b2
+                                            >= 2 * part->nbufs)
+        PFghostDeleteLRU(&part->ghost, PF_GHOST_B2);
+}
+
+
+static PFbpage *PFbufARCVictim(part,ghost)
+PFbufpart *part;     /* partition to choose from */
+int ghost;  /* ghost list holding the page that missed, or -1 */
+/****************************************************************************
+SPECIFICATIONS:
+     Choose a victim for ARC: the LRU page of T1 if T1 is above its
+     target (or at the target and the missing page is in B2), else the
+     LRU page of T2. If that list has only fixed pages the other one is
+     tried. The victim is remembered in B1 or B2.
+
+RETURN VALUE:
+     The victim, claimed, or NULL if all pages are fixed.
+*****************************************************************************/
+{
+PFbpage *tbpage;
+int t1 = part->qlen[PF_QNEW];
 
+    if (t1 > 0 && (t1 > part->arcp ||
+            (ghost == PF_GHOST_B2 && t1 == part->arcp))) {
+        if ((tbpage = PFbufLRUVictim(part,PF_QNEW)) == NULL)
+            tbpage = PFbufLRUVictim(part,PF_QMAIN);
+    }
+    else if ((tbpage = PFbufLRUVictim(part,PF_QMAIN)) == NULL)
+        tbpage = PFbufLRUVictim(part,PF_QNEW);
+
+    if (tbpage != NULL)
+        PFghostInsert(&part->ghost,
+                    tbpage->queue == PF_QNEW ? PF_GHOST_B1 : PF_GHOST_B2,
+                    tbpage->fd, tbpage->page);
+    return(tbpage);
 }
 
 
-static PFbufInternalAlloc(bpage,writefcn)
+static PFbufInternalAlloc(part,bpage,fd,pagenum,writefcn,wait)
+PFbufpart *part;     /* partition of (fd,pagenum), locked */
 PFbpage **bpage;     /* pointer to pointer to buffer bpage to be allocated*/
+int fd;              /* file descriptor of the page to be put in it */
+int pagenum;         /* page number of the page to be put in it */
 int (*writefcn)();
+int wait;            /* TRUE to wait for pages being read or written */
 /****************************************************************************
 SPECIFICATIONS:
-     Allocate a buffer page and set *bpage to point to it. *bpage
-     is set to NULL if one can not be allocated.
+     Allocate a buffer page of partition "part" and set *bpage to point
+     to it. *bpage is set to NULL if one can not be allocated.
      The "nextpage" and "prevpage" fields of *bpage are linked as
-     the head of the list of used buffers.All the other fields are undefined.
+     the head of the list of used buffers, and "queue" tells which list
+     that is (for 2Q and ARC it depends on whether page "pagenum" of
+     "fd" is in the ghost directory).All the other fields are undefined.
+     The frame is claimed (see PFbufClaim()): the caller sets it up and
+     then releases it.
      writefcn() is used to write pages. (See PFbufGet()).
 
 ALGORITHM:
-     If there is something on the free list, then use it.
-     If free list is empty, and there are less than PF_MAX_BUFS (NOW A VARIABLE) 
-     number of pages allocated, then malloc() one.
+     If there is something on the free list, then use it. All
+     frames are put there by PFbufInit(), so nothing is
+     malloc()'ed here.
      Otherwise, choose a victim (BASED ON STRATEGY) to write out, and then use that
-     page as the page to be used.
+     page as the page to be used. LRU and MRU walk the used list,
+     CLOCK sweeps the partition's frames (see PFbufClockVictim()), 2Q
+     picks between A1in and Am (see PFbuf2QVictim()) and ARC between T1
+     and T2 (see PFbufARCVictim()).
      If a victim cannot be chosen (because all the pages are fixed),
-     then return error.
+     then return error. If "wait" is TRUE, pages fixed only while some
+     I/O finishes are waited for first; a caller that has pages of its
+     own iobusy must not wait.
+     A dirty victim is written with the partition unlocked, claimed and
+     iobusy, as the flusher does. Another thread may meanwhile have
+     brought page "pagenum" in: then the victim is evicted all the
+     same, but goes to the free list.
 
 AUTHOR: clc
 
 RETURN VALUE:
 
      PFE_OK  if no error.
-     PF_NOMEM    if no memory.
      PF_NOBUF    if no buffer space left because all pages are fixed.
+     PFE_PAGEINBUF  if page "pagenum" of "fd" was brought in while the
+             partition was unlocked; *bpage is not set.
 
 GLOBAL VARIABLES MODIFIED:
-     PFnumbpage, PFfirstbpage, PFlastbpage, PFfreebpage
+     part->firstbpage, part->lastbpage, part->freebpage
 *****************************************************************************/
 {
 PFbpage *tbpage;   /* temporary pointer to buffer page */
 int error;         /* error value returned*/
+int ghost = -1;    /* ghost list remembering (fd,pagenum), or -1 */
+
+    if (PF_REPLACEMENT_STRATEGY == TWOQ || PF_REPLACEMENT_STRATEGY == ARC)
+        ghost = PFghostFind(&part->ghost,fd,pagenum);
+    if (PF_REPLACEMENT_STRATEGY == ARC)
+        PFbufARCAdapt(part,ghost);
 
     /* Set *bpage to the buffer page to be returned */
-    if (PFfreebpage != NULL){
+    if (part->freebpage != NULL){
         /* Free list not empty, use the one from the free list. */
-        *bpage = PFfreebpage;
-        PFfreebpage = (*bpage)->nextpage;
-    }
-    /* --- MODIFIED: Use new global variable PF_MAX_BUFS --- */
-    else if (PFnumbpage < PF_MAX_BUFS){
-    /* --- END MODIFIED --- */
-
-        /* We have not reached max buffer limit, so
-         malloc() a new one */
-        if ((*bpage=(PFbpage *)malloc(sizeof(PFbpage)))==NULL){
-            /* no mem */
-            *bpage = NULL;
-            PFerrno = PFE_NOMEM;
-            return(PFerrno);
-        }
-        /* increment # of pages allocated */
-        PFnumbpage++;
+        *bpage = part->freebpage;
+        part->freebpage = (*bpage)->nextpage;
+        while (!PFbufClaim(*bpage))
+            /* a reader that found it through a stale hash entry */
+            sched_yield();
     }
     else {
         /* we have reached max buffer limit */
@@ -223,21 +984,34 @@ int error;         /* error value returned*/
         /* --- MODIFIED: Victim selection logic based on strategy --- */
         if (PF_REPLACEMENT_STRATEGY == LRU) {
             /* LRU: Scan from the back (Least Recently Used) */
-            for (tbpage=PFlastbpage; tbpage!=NULL; tbpage=tbpage->prevpage){
-                if (!tbpage->fixed)
-                    /* found a page that can be swapped out */
-                    break;
-            }
+            tbpage = PFbufLRUVictim(part,PF_QMAIN);
+        } else if (PF_REPLACEMENT_STRATEGY == CLOCK) {
+            tbpage = PFbufClockVictim(part);
+        } else if (PF_REPLACEMENT_STRATEGY == TWOQ) {
+            tbpage = PFbuf2QVictim(part);
+        } else if (PF_REPLACEMENT_STRATEGY == ARC) {
+            tbpage = PFbufARCVictim(part,ghost);
         } else {
             /* MRU: Scan from the front (Most Recently Used) */
-            for (tbpage=PFfirstbpage; tbpage!=NULL; tbpage=tbpage->nextpage){
-                 if (!tbpage->fixed)
+            for (tbpage=part->firstbpage[PF_QMAIN]; tbpage!=NULL;
+                                        tbpage=tbpage->nextpage){
+                 if (tbpage->pincount == 0 && PFbufClaim(tbpage))
                     /* found a page that can be swapped out */
                     break;
             }
         }
         /* --- END MODIFIED --- */
 
+        if (tbpage == NULL && part->nbusy > 0 && wait){
+            /* the only unfixed pages are being read or written */
+            part->st[fd].pin_waits++;
+            pthread_cond_wait(&part->iodone, &part->mutex);
+            if (PFhashFind(&part->hash,fd,pagenum) != NULL){
+                PFerrno = PFE_PAGEINBUF;
+                return(PFerrno);
+            }
+            return(PFbufInternalAlloc(part,bpage,fd,pagenum,writefcn,wait));
+        }
         if (tbpage == NULL){
             /* couldn't find a free page */
             PFerrno = PFE_NOBUF;
@@ -247,36 +1021,209 @@ int error;         /* error value returned*/
         /* write out the dirty page */
         /* --- MODIFIED: Check dirty flag and add stats counter --- */
         if (tbpage->dirty) {
-             if (((error=(*writefcn)(tbpage->fd,
-                 tbpage->page,&tbpage->fpage))!= PFE_OK))
+             tbpage->iobusy = TRUE;
+             part->nbusy++;
+             PFbufUnlock(part);
+             error = (*writefcn)(tbpage->fd,tbpage->page,&tbpage->fpage);
+             PFbufLock(part);
+             tbpage->iobusy = FALSE;
+             part->nbusy--;
+             pthread_cond_broadcast(&part->iodone);
+             if (error != PFE_OK) {
+                 PFbufRelease(tbpage,0);
                  return(error);
-             
+             }
+
              /* --- NEW: Increment physical write counter --- */
-             g_physical_writes++;
+             part->st[tbpage->fd].pages_written++;
+             __sync_fetch_and_sub(&PFbufndirty,1);
+
+             /* the caller waited for a write: the flusher is behind */
+             part->st[tbpage->fd].dirty_evictions++;
+             if (PFflusheron)
+                 PFbufKickFlusher();
         }
         /* --- END MODIFIED --- */
         tbpage->dirty = FALSE;
+        part->st[tbpage->fd].evictions++;
 
         /* unlink from hash table */
-        if ((error=PFhashDelete(tbpage->fd,tbpage->page))!= PFE_OK)
+        if ((error=PFhashDelete(&part->hash,tbpage->fd,tbpage->page))!= PFE_OK) {
+            PFbufRelease(tbpage,0);
             return(error);
-        
+        }
+        PFbufFileUnlink(part,tbpage);
+
         /* unlink from buffer list */
-        PFbufUnlink(tbpage);
+        PFbufUnlink(part,tbpage);
 
+        if (PFhashFind(&part->hash,fd,pagenum) != NULL){
+            /* brought in while the victim was written */
+            PFbufInsertFree(part,tbpage);
+            PFbufRelease(tbpage,0);
+            PFerrno = PFE_PAGEINBUF;
+            return(PFerrno);
+        }
         *bpage = tbpage;
 
     }
 
-    /* Link the page as the head of the used list */
-    PFbufLinkHead(*bpage);
+    /* Link the page as the head of the used list. 2Q and ARC admit a
+    page straight into Am/T2 only if it was seen recently enough to be
+    in the ghost directory. */
+    (*bpage)->prefetched = FALSE;
+    (*bpage)->queue = PF_QMAIN;
+    if (PF_REPLACEMENT_STRATEGY == TWOQ || PF_REPLACEMENT_STRATEGY == ARC) {
+        if (ghost >= 0)
+            PFghostDelete(&part->ghost,fd,pagenum);
+        else
+            (*bpage)->queue = PF_QNEW;
+    }
+    PFbufLinkHead(part,*bpage);
+    return(PFE_OK);
+}
+
+
+static void PFbufLockAll()
+/****************************************************************************
+SPECIFICATIONS:
+     Lock every partition, at a time when none of them has a page
+     being read or written. Partitions are always locked in index
+     order, so two threads doing this cannot deadlock.
+*****************************************************************************/
+{
+int i, k;
+
+    for (;;) {
+        for (i = 0; i < PFbufnparts; i++) {
+            PFbufLock(&PFbufparts[i]);
+            if (PFbufparts[i].nbusy > 0)
+                break;
+        }
+        if (i == PFbufnparts)
+            return;
+
+        /* whoever finishes the I/O may need the partitions we hold */
+        for (k = 0; k < i; k++)
+            pthread_mutex_unlock(&PFbufparts[k].mutex);
+        while (PFbufparts[i].nbusy > 0)
+            pthread_cond_wait(&PFbufparts[i].iodone, &PFbufparts[i].mutex);
+        pthread_mutex_unlock(&PFbufparts[i].mutex);
+    }
+}
+
+
+static void PFbufUnlockAll()
+/****************************************************************************
+SPECIFICATIONS:
+     Unlock the partitions locked by PFbufLockAll().
+*****************************************************************************/
+{
+int i;
+
+    for (i = 0; i < PFbufnparts; i++)
+        pthread_mutex_unlock(&PFbufparts[i].mutex);
+}
+
+
+static int PFbufNewFrame(part,fd,pagenum,writefcn,wait,bpage)
+PFbufpart *part; /* partition of (fd,pagenum), locked */
+int fd;          /* file descriptor */
+int pagenum;     /* page number, not in the buffer */
+int (*writefcn)();  /* function to write a page */
+int wait;        /* see PFbufInternalAlloc() */
+PFbpage **bpage; /* set to the frame */
+/****************************************************************************
+SPECIFICATIONS:
+     Give page "pagenum" of file "fd" a frame of partition "part", to
+     be read into with the partition unlocked. The page is entered in
+     the hash table and the file's list, claimed and iobusy, so that a
+     thread asking for it waits for the read instead of doing its own,
+     and PFbufFixFast() leaves it alone. Its reference bits are clear,
+     and it is the page the partition saw referenced last.
+     Once read, the caller clears iobusy, and releases the frame or
+     drops it (PFbufDrop()) if the read failed.
+
+RETURN VALUE:
+     PFE_OK  if no error.
+     PF error code if error.
+*****************************************************************************/
+{
+int error;
+
+    if ((error=PFbufInternalAlloc(part,bpage,fd,pagenum,writefcn,wait))!= PFE_OK)
+        return(error);
+
+    if ((error=PFhashInsert(&part->hash,fd,pagenum,*bpage))!=PFE_OK){
+        /* failed to insert into hash table */
+        /* put page into free list */
+        PFbufUnlink(part,*bpage);
+        PFbufInsertFree(part,*bpage);
+        PFbufRelease(*bpage,0);
+        return(error);
+    }
+
+    /* set the fields for this page*/
+    (*bpage)->fd = fd;
+    (*bpage)->page = pagenum;
+    (*bpage)->dirty = FALSE;
+    (*bpage)->refbit = FALSE;
+    (*bpage)->reref = FALSE;
+    (*bpage)->iobusy = TRUE;
+    part->lastref = *bpage;
+    part->nbusy++;
+    PFbufFileLink(part,*bpage);
     return(PFE_OK);
 }
 
 
+static void PFbufHit(part,bpage,fd)
+PFbufpart *part; /* partition of the page, locked */
+PFbpage *bpage;  /* the page, resident and not iobusy */
+int fd;          /* its file descriptor */
+/****************************************************************************
+SPECIFICATIONS:
+     Fix a page found in the buffer, telling the replacement strategy
+     it was referenced, and count the hit.
+*****************************************************************************/
+{
+    part->st[fd].hits++;
+    if (bpage->pincount > 0){
+        /* page already fixed: share it. This is not a new reference
+        as far as the replacement strategy is concerned. */
+        __sync_fetch_and_add(&bpage->pincount,1);
+        return;
+    }
+    else if (bpage->prefetched){
+        /* read ahead, and now asked for: a first reference. Its read
+        is only counted now, so unused read-ahead does not show up as
+        physical reads. */
+        part->st[fd].ra_hits++;
+        bpage->prefetched = FALSE;
+    }
+    else if (PF_REPLACEMENT_STRATEGY == TWOQ && bpage->queue == PF_QNEW &&
+            bpage != part->lastref)
+        /* 2Q: not correlated, see PFbuf2QVictim() */
+        bpage->reref = TRUE;
+    else if (PF_REPLACEMENT_STRATEGY == ARC && bpage->queue == PF_QNEW){
+        /* ARC: second reference, the page moves from T1 to T2 */
+        PFbufUnlink(part,bpage);
+        bpage->queue = PF_QMAIN;
+        PFbufLinkHead(part,bpage);
+    }
+
+    /* Fix the page in the buffer. PFbufFixFast() may have fixed it
+    meanwhile. */
+    __sync_fetch_and_add(&bpage->pincount,1);
+    bpage->refbit = TRUE;
+    part->lastref = bpage;
+}
+
+
 /************************* Interface to the Outside World ****************/
 
-PFbufGet(fd,pagenum,fpage,readfcn,writefcn)
+static int PFbufDoGet(part,fd,pagenum,fpage,readfcn,writefcn)
+PFbufpart *part; /* partition of (fd,pagenum), locked */
 int fd; /* file descriptor */
 int pagenum;     /* page number */
 PFfpage **fpage;     /* pointer to pointer to file page */
@@ -287,7 +1234,7 @@ SPECIFICATIONS:
      Get a page whose number is "pagenum" from the file pointed
      by "fd". Set *fpage to point to the data for that page.
      This function requires two functions:
-         readfcn(fd,pagenum,fpage) 
+         readfcn(fd,pagenum,fpage)
          int fd;
          int pagenum;
          PFfpage *fpage;
@@ -298,77 +1245,86 @@ SPECIFICATIONS:
          in pagenum;
          PFpage *fpage;
      which will write one page into the file.
-     It is an error to read a page already fixed in the buffer.
+     A page already fixed in the buffer can be fixed again (for
+     instance by a second scan); it stays fixed until each PFbufGet()
+     has been matched by a PFbufUnfix().
 
 RETURN VALUE:
      PFE_OK  if no error.
      PF error code if error.
-     If error code is PFE_PAGEFIXED, *fpage is still set to point to the buffer
-     page of the page in memory.
 
-GLOBAL VARIABLES MODIFIED:
+IMPLEMENTATION NOTES:
+     A missing page gets its frame from PFbufNewFrame() before the
+     partition is unlocked for the read.
 *****************************************************************************/
 {
 PFbpage *bpage; /* pointer to buffer */
 int error;
+int waited = FALSE;
+
+    if (PFmrcSampled(&part->mrc,fd,pagenum) &&
+            PFmrcRef(&part->mrc,fd,pagenum,TRUE) && PFbufbudget > 0 &&
+            __sync_add_and_fetch(&PFbufsampled,1) >= PF_AUTOSIZE_GETS)
+        PFbufautodue = TRUE;
+
+    for (;;) {
+        while ((bpage=PFhashFind(&part->hash,fd,pagenum)) != NULL &&
+                bpage->iobusy){
+            /* being read or written by another thread */
+            if (!waited)
+                part->st[fd].pin_waits++;
+            waited = TRUE;
+            pthread_cond_wait(&part->iodone, &part->mutex);
+        }
+        if (bpage != NULL)
+            break;
 
-    /* --- NEW: Increment logical read counter --- */
-    g_logical_reads++;
-    /* --- END NEW --- */
-
-    if ((bpage=PFhashFind(fd,pagenum)) == NULL){
         /* page not in buffer. */
-        
+
         /* --- NEW: Increment physical read counter --- */
-        g_physical_reads++;
+        part->st[fd].misses++;
         /* --- END NEW --- */
-        
+
         /* allocate an empty page */
-        if ((error=PFbufInternalAlloc(&bpage,writefcn))!= PFE_OK){
+        if ((error=PFbufNewFrame(part,fd,pagenum,writefcn,TRUE,&bpage))
+                == PFE_PAGEINBUF){
+            /* brought in by another thread while a victim was written */
+            part->st[fd].misses--;
+            continue;
+        }
+        if (error != PFE_OK){
             /* error */
             *fpage = NULL;
             return(error);
         }
-        
+        bpage->refbit = TRUE;
+
         /* read the page */
-        if ((error=(*readfcn)(fd,pagenum,&bpage->fpage))!= PFE_OK){
-            /* error reading the page. put buffer back into 
+        PFbufUnlock(part);
+        error = (*readfcn)(fd,pagenum,&bpage->fpage);
+        PFbufLock(part);
+        bpage->iobusy = FALSE;
+        part->nbusy--;
+        pthread_cond_broadcast(&part->iodone);
+        if (error != PFE_OK){
+            /* error reading the page. put buffer back into
             the free list, and return gracefully */
-            PFbufUnlink(bpage);
-            PFbufInsertFree(bpage);
+            PFbufDrop(part,bpage);
             *fpage = NULL;
             return(error);
         }
-
-        /* insert new page into hash table */
-        if ((error=PFhashInsert(fd,pagenum,bpage))!=PFE_OK){
-            /* failed to insert into hash table */
-            /* put page into free list */
-            PFbufUnlink(bpage);
-            PFbufInsertFree(bpage);
-            return(error);
-        }
-
-        /* set the fields for this page*/
-        bpage->fd = fd;
-        bpage->page = pagenum;
-        bpage->dirty = FALSE;
-    }
-    else if (bpage->fixed){
-        /* page already in memory, and is fixed, so we can't
-         get it again. */
+        PFbufRelease(bpage,1);
         *fpage = &bpage->fpage;
-        PFerrno = PFE_PAGEFIXED;
-        return(PFerrno);
+        return(PFE_OK);
     }
 
-    /* Fix the page in the buffer then return*/
-    bpage->fixed = TRUE;
+    PFbufHit(part,bpage,fd);
     *fpage = &bpage->fpage;
     return(PFE_OK);
 }
 
-PFbufUnfix(fd,pagenum,dirty)
+static int PFbufDoUnfix(part,fd,pagenum,dirty)
+PFbufpart *part; /* partition of (fd,pagenum), locked */
 int fd;      /* file descriptor */
 int pagenum;     /* page number */
 int dirty;   /* TRUE if page is dirty */
@@ -376,7 +1332,9 @@ int dirty;   /* TRUE if page is dirty */
 SPECIFICATIONS:
      Unfix the file page whose number is "pagenum" from the buffer.
      If dirty is TRUE, then mark the buffer as having been modified.
-     Otherwise, the dirty flag is left unchanged.
+     Otherwise, the dirty flag is left unchanged. A page fixed more
+     than once stays fixed until the last unfix, which is also when it
+     becomes most recently used.
 
 AUTHOR: clc
 
@@ -388,13 +1346,13 @@ RETURN VALUE:
 {
 PFbpage *bpage;
 
-    if ((bpage= PFhashFind(fd,pagenum))==NULL){
+    if ((bpage= PFhashFind(&part->hash,fd,pagenum))==NULL){
         /* page not in buffer */
         PFerrno = PFE_PAGENOTINBUF;
         return(PFerrno);
     }
 
-    if (!bpage->fixed){
+    if (bpage->pincount <= 0){
         /* page already unfixed */
         PFerrno = PFE_PAGEUNFIXED;
         return(PFerrno);
@@ -402,26 +1360,39 @@ PFbpage *bpage;
 
     if (dirty) {
         /* mark this page dirty */
-        bpage->dirty = TRUE;
-        
+        PFbufSetDirty(bpage);
+
         /* --- NEW: Increment logical write counter --- */
-        g_logical_writes++;
+        part->st[fd].writes++;
         /* --- END NEW --- */
     }
-    
+
     /* unfix the page */
-    bpage->fixed = FALSE;
-    
+    if (__sync_sub_and_fetch(&bpage->pincount,1) > 0)
+        /* still fixed by someone else */
+        return(PFE_OK);
+
+    if (PF_REPLACEMENT_STRATEGY == CLOCK) {
+        /* no relinking, the reference bit is all CLOCK needs */
+        bpage->refbit = TRUE;
+        return(PFE_OK);
+    }
+
+    if (PF_REPLACEMENT_STRATEGY == TWOQ && bpage->queue == PF_QNEW)
+        /* 2Q: correlated reference, A1in stays in FIFO order */
+        return(PFE_OK);
+
     /* unlink this page */
-    PFbufUnlink(bpage);
+    PFbufUnlink(part,bpage);
 
     /* insert it as head of linked list to make it most recently used*/
-    PFbufLinkHead(bpage);
+    PFbufLinkHead(part,bpage);
 
     return(PFE_OK);
 }
 
-PFbufAlloc(fd,pagenum,fpage,writefcn)
+static int PFbufDoAlloc(part,fd,pagenum,fpage,writefcn)
+PFbufpart *part; /* partition of (fd,pagenum), locked */
 int fd;      /* file descriptor */
 int pagenum;     /* page number */
 PFfpage **fpage;     /* pointer to file page */
@@ -444,104 +1415,573 @@ int error;
 
     *fpage = NULL;  /* initial value of fpage */
 
-    if ((bpage=PFhashFind(fd,pagenum))!= NULL){
+    if ((bpage=PFhashFind(&part->hash,fd,pagenum))!= NULL){
         /* page already in buffer*/
         PFerrno = PFE_PAGEINBUF;
         return(PFerrno);
     }
 
-    if ((error=PFbufInternalAlloc(&bpage,writefcn))!= PFE_OK)
+    if ((error=PFbufInternalAlloc(part,&bpage,fd,pagenum,writefcn,TRUE))!= PFE_OK)
         /* can't get any buffer */
         return(error);
-    
+
     /* put ourselves into the hash table */
-    if ((error=PFhashInsert(fd,pagenum,bpage))!= PFE_OK){
+    if ((error=PFhashInsert(&part->hash,fd,pagenum,bpage))!= PFE_OK){
         /* can't insert into the hash table */
         /* unlink bpage, and put it into the free list */
-        PFbufUnlink(bpage);
-        PFbufInsertFree(bpage);
+        PFbufUnlink(part,bpage);
+        PFbufInsertFree(part,bpage);
+        PFbufRelease(bpage,0);
         return(error);
     }
 
     /* init the fields of bpage and return */
     bpage->fd = fd;
     bpage->page = pagenum;
-    bpage->fixed = TRUE;
     bpage->dirty = FALSE;
+    bpage->refbit = TRUE;
+    PFbufFileLink(part,bpage);
+    PFbufRelease(bpage,1);
+    if (PFmrcSampled(&part->mrc,fd,pagenum))
+        (void)PFmrcRef(&part->mrc,fd,pagenum,FALSE);
 
     *fpage = &bpage->fpage;
     return(PFE_OK);
 }
 
 
-PFbufReleaseFile(fd,writefcn)
-int fd;      /* file descriptor */
-int (*writefcn)();  /* function to write a page of file */
+static int PFbufPageCmp(a,b)
+const void *a;
+const void *b;
 /****************************************************************************
 SPECIFICATIONS:
-     Release all pages of file "fd" from the buffer and
-     put them into the free list 
+     qsort() comparison of two (PFbpage *)s by page number.
+*****************************************************************************/
+{
+    return((*(PFbpage **)a)->page - (*(PFbpage **)b)->page);
+}
 
-AUTHOR: clc
 
-RETURN VALUE:
-     PFE_OK if no error.
+#define PF_BUF_WRITEDEPTH	32	/* most runs PFbufDoReleaseFile() has
+					being written at once */
+
+/* the writes PFbufDoReleaseFile() has handed to "startfcn" */
+typedef struct PFbufflush {
+    pthread_mutex_t lock;
+    pthread_cond_t over;    /* signalled when "pending" drops to 0 */
+    int pending;            /* # of runs not written yet */
+    int error;              /* first error, PFE_OK if none */
+} PFbufflush;
+
+static void PFbufFlushDone(flush,error)
+PFbufflush *flush;
+int error;
+/****************************************************************************
+SPECIFICATIONS:
+     Called by the engine when a run of PFbufDoReleaseFile() is
+     written. It must not lock a partition: they are all held.
+*****************************************************************************/
+{
+    pthread_mutex_lock(&flush->lock);
+    if (error != PFE_OK && flush->error == PFE_OK)
+        flush->error = error;
+    if (--flush->pending == 0)
+        pthread_cond_signal(&flush->over);
+    pthread_mutex_unlock(&flush->lock);
+}
+
+
+static int PFbufDoReleaseFile(fd,startfcn)
+int fd;      /* file descriptor */
+int (*startfcn)();  /* function to start reading or writing adjacent pages */
+/****************************************************************************
+SPECIFICATIONS:
+     Release all pages of file "fd" from the buffer and
+     put them into the free list. The dirty pages are written in
+     page number order, each run of adjacent pages started with one
+     call of
+         startfcn(fd,pagenum,fpages,n,write,done,arg,more)
+         int fd;
+         int pagenum;
+         PFfpage **fpages;
+         int n;
+         int write;
+         void (*done)(void *arg, int error);
+         void *arg;
+         int more;
+     which starts writing (reading if !write) the "n" (at most
+     PF_IO_MAXPAGES) pages starting at "pagenum" from fpages[0..n-1],
+     and calls done(arg,error) from another thread once it is over.
+     With "more", the caller starts more runs right away, and the
+     engine may hold this one back until then. If it returns an
+     error "done" is not called. fpages[] must stay until "done".
+     Called with all partitions locked.
+
+AUTHOR: clc
+
+RETURN VALUE:
+     PFE_OK if no error.
      PF error code if error.
 
 IMPLEMENTATION NOTES:
-     A linear search of the buffer is performed.
-     A better method is not needed because # of buffers are small.
+     Only the file's own lists of resident pages are walked, so the cost
+     does not depend on the size of the buffer.
+     Up to PF_BUF_WRITEDEPTH runs are in flight at once, so a device
+     that can do several writes at a time gets them.
 *****************************************************************************/
 {
-PFbpage *bpage; /* ptr to buffer pages to search */
-PFbpage *temppage;
+PFbpage *bpage;
+PFbpage **dirty;     /* dirty pages of the file */
+PFfpage **fpages;    /* their buffers */
+PFbufflush flush;
+int ndirty = 0;
 int error;       /* error code */
+int i, n, k, end;
 
-    /* Do linear scan of the buffer to find pages belonging to the file */
-    bpage = PFfirstbpage;
-    while (bpage != NULL){
-        if (bpage->fd == fd){
-            /* The file descriptor matches*/
-            if (bpage->fixed){
+    for (i = 0; i < PFbufnparts; i++)
+        for (bpage = PFbufparts[i].filepages[fd]; bpage != NULL;
+                bpage = bpage->nextfile){
+            if (bpage->pincount != 0){
                 PFerrno = PFE_PAGEFIXED;
                 return(PFerrno);
             }
+            if (bpage->dirty)
+                ndirty++;
+        }
 
-            /* write out dirty page */
-            /* --- MODIFIED: Add stats counter on dirty write --- */
-            if (bpage->dirty) {
-                if (((error=(*writefcn)(fd,bpage->page,
-                        &bpage->fpage))!= PFE_OK))
-                    /* error writing file */
-                    return(error);
-                
+    if (ndirty > 0){
+        dirty = (PFbpage **)malloc(ndirty * sizeof(PFbpage *));
+        fpages = (PFfpage **)malloc(ndirty * sizeof(PFfpage *));
+        if (dirty == NULL || fpages == NULL){
+            free((char *)dirty);
+            free((char *)fpages);
+            PFerrno = PFE_NOMEM;
+            return(PFerrno);
+        }
+        ndirty = 0;
+        for (i = 0; i < PFbufnparts; i++)
+            for (bpage = PFbufparts[i].filepages[fd]; bpage != NULL;
+                    bpage = bpage->nextfile)
+                if (bpage->dirty)
+                    dirty[ndirty++] = bpage;
+        qsort((char *)dirty, ndirty, sizeof(PFbpage *), PFbufPageCmp);
+        for (i = 0; i < ndirty; i++)
+            fpages[i] = &dirty[i]->fpage;
+
+        /* write out runs of adjacent dirty pages, PF_BUF_WRITEDEPTH
+        runs at a time */
+        pthread_mutex_init(&flush.lock,NULL);
+        pthread_cond_init(&flush.over,NULL);
+        flush.error = PFE_OK;
+        for (i = 0; i < ndirty; i = end){
+            flush.pending = 1;  /* until all are started */
+            for (end = i, k = 0; end < ndirty && k < PF_BUF_WRITEDEPTH;
+                    end += n, k++){
+                for (n = 1; end + n < ndirty && n < PF_IO_MAXPAGES &&
+                        dirty[end+n]->page == dirty[end]->page + n; n++);
+                pthread_mutex_lock(&flush.lock);
+                flush.pending++;
+                pthread_mutex_unlock(&flush.lock);
+                if ((error=(*startfcn)(fd,dirty[end]->page,fpages+end,n,
+                        TRUE,PFbufFlushDone,&flush,
+                        end + n < ndirty && k + 1 < PF_BUF_WRITEDEPTH))
+                        != PFE_OK)
+                    PFbufFlushDone(&flush,error);
+            }
+            PFbufFlushDone(&flush,PFE_OK);
+            pthread_mutex_lock(&flush.lock);
+            while (flush.pending > 0)
+                pthread_cond_wait(&flush.over,&flush.lock);
+            pthread_mutex_unlock(&flush.lock);
+            if (flush.error != PFE_OK)
+                /* error writing file: which runs made it is not
+                known, so they all stay dirty */
+                break;
+
+            for (k = i; k < end; k++){
+                dirty[k]->dirty = FALSE;
                 /* --- NEW: Increment physical write counter --- */
-                g_physical_writes++;
+                PFbufPart(fd,dirty[k]->page)->st[fd].pages_written++;
             }
-            /* --- END MODIFIED --- */
-            bpage->dirty = FALSE;
+            __sync_fetch_and_sub(&PFbufndirty,end - i);
+        }
+        pthread_mutex_destroy(&flush.lock);
+        pthread_cond_destroy(&flush.over);
+        free((char *)dirty);
+        free((char *)fpages);
+        if (flush.error != PFE_OK){
+            PFerrno = flush.error;
+            return(PFerrno);
+        }
+    }
 
-            /* get rid of it from the hash table */
-            if ((error=PFhashDelete(fd,bpage->page))!= PFE_OK){
-                /* internal error */
-                printf("Internal error:PFbufReleaseFile()\n");
-                exit(1);
-            }
+    /* put all its pages into the free list, and keep its counters
+    only in the totals */
+    for (i = 0; i < PFbufnparts; i++){
+        while ((bpage = PFbufparts[i].filepages[fd]) != NULL)
+            PFbufDrop(&PFbufparts[i],bpage);
+        PFbufparts[i].st[fd].hits += PFbufparts[i].fasthits[fd];
+        PFbufAddCounters(&PFbufparts[i].closed,&PFbufparts[i].st[fd]);
+        memset((char *)&PFbufparts[i].st[fd], 0, sizeof(PF_Counters));
+        PFbufparts[i].fasthits[fd] = 0;
+        PFmrcForget(&PFbufparts[i].mrc,fd);
+        PFghostForget(&PFbufparts[i].ghost,fd);
+    }
+    return(PFE_OK);
+}
+
+
+static int PFbufLoadRun(fd,pagenum,run,n,readvfcn)
+int fd;             /* file descriptor */
+int pagenum;        /* page of run[0] */
+PFbpage **run;      /* claimed, iobusy pages pagenum..pagenum+n-1 */
+int n;              /* # of pages in run[] */
+int (*readvfcn)();  /* function to read adjacent pages */
+/****************************************************************************
+SPECIFICATIONS:
+     Read the pages of run[] with one call of "readvfcn", then release
+     them and let the threads waiting for them go on. If the read
+     fails, the pages go back to the free list. No partition is locked
+     by the caller.
+
+RETURN VALUE:
+     PFE_OK if no error.
+     PF error code if error.
+*****************************************************************************/
+{
+PFfpage *fpages[PF_IO_MAXPAGES];
+PFbufpart *part;
+int error;
+int i;
+
+    if (n == 0)
+        return(PFE_OK);
+
+    for (i = 0; i < n; i++)
+        fpages[i] = &run[i]->fpage;
+    error = (*readvfcn)(fd,pagenum,fpages,n);
+
+    for (i = 0; i < n; i++){
+        part = PFbufPart(fd,pagenum+i);
+        PFbufLock(part);
+        run[i]->iobusy = FALSE;
+        part->nbusy--;
+        pthread_cond_broadcast(&part->iodone);
+        if (error != PFE_OK)
+            PFbufDrop(part,run[i]);
+        else {
+            run[i]->prefetched = TRUE;
+            PFbufRelease(run[i],0);
+            part->st[fd].ra_pages++;
+        }
+        PFbufUnlock(part);
+    }
+    return(error);
+}
+
+
+static int PFbufDoPrefetch(fd,pagenum,npages,readvfcn,writefcn)
+int fd;             /* file descriptor */
+int pagenum;        /* first page */
+int npages;         /* # of pages */
+int (*readvfcn)();  /* function to read adjacent pages */
+int (*writefcn)();  /* function to write a page */
+/****************************************************************************
+SPECIFICATIONS:
+     Bring pages "pagenum" to "pagenum"+npages-1 of file "fd" into the
+     buffer without fixing them. Pages already in the buffer are left
+     alone; each run of missing pages is read with one call of
+         readvfcn(fd,pagenum,fpages,n)
+         int fd;
+         int pagenum;
+         PFfpage **fpages;
+         int n;
+     which reads the "n" (at most PF_IO_MAXPAGES) pages starting at
+     "pagenum" into fpages[0..n-1]. Prefetching stops early, without
+     error, when no more buffer pages can be had.
+     The pages must exist in the file.
+
+RETURN VALUE:
+     PFE_OK if no error.
+     PF error code if error.
+
+IMPLEMENTATION NOTES:
+     The pages of a run are spread over the partitions; each is locked
+     just long enough to claim a frame. A run's pages stay claimed until
+     it is read, so that allocating the next page of the run cannot
+     choose one of them as victim, and iobusy, so that other threads
+     wait for the read instead of reading them too.
+     Prefetched pages do not have the reference bit set, and are not
+     counted as logical reads until they are asked for.
+*****************************************************************************/
+{
+PFbpage *run[PF_IO_MAXPAGES];
+PFbpage *bpage;
+PFbufpart *part;
+int n = 0;      /* # of pages in run[] */
+int error;
+int p;
+
+    for (p = pagenum; p < pagenum + npages; p++){
+        if (n == PF_IO_MAXPAGES){
+            if ((error=PFbufLoadRun(fd,p-n,run,n,readvfcn))!= PFE_OK)
+                return(error);
+            n = 0;
+        }
+
+        part = PFbufPart(fd,p);
+        PFbufLock(part);
+        if (PFhashFind(&part->hash,fd,p) != NULL){
+            /* the run ends here */
+            PFbufUnlock(part);
+            if ((error=PFbufLoadRun(fd,p-n,run,n,readvfcn))!= PFE_OK)
+                return(error);
+            n = 0;
+            continue;
+        }
+
+        if ((error=PFbufNewFrame(part,fd,p,writefcn,FALSE,&bpage))
+                == PFE_PAGEINBUF){
+            /* brought in meanwhile: the run ends here */
+            PFbufUnlock(part);
+            if ((error=PFbufLoadRun(fd,p-n,run,n,readvfcn))!= PFE_OK)
+                return(error);
+            n = 0;
+            continue;
+        }
+        if (error != PFE_OK){
+            PFbufUnlock(part);
+            if (error == PFE_NOBUF)
+                /* buffer full of fixed pages: read what we have */
+                break;
+            (void)PFbufLoadRun(fd,p-n,run,n,readvfcn);
+            return(error);
+        }
+        PFbufUnlock(part);
+        run[n++] = bpage;
+    }
+    return(PFbufLoadRun(fd,p-n,run,n,readvfcn));
+}
+
+
+/* a run of pages of PFbufDoGetAsync(), read with one call of startfcn() */
+typedef struct PFbufrun {
+    int fd;             /* file descriptor */
+    int pagenum;        /* page of bpage[0] */
+    int n;              /* # of pages */
+    PFbpage *bpage[PF_IO_MAXPAGES];  /* claimed, iobusy pages */
+    PFfpage *fpage[PF_IO_MAXPAGES];  /* their buffers, for startfcn() */
+    int prefetch;       /* TRUE to leave the pages unfixed */
+    void (*done)();     /* the caller's, see PFbufDoGetAsync() */
+    void *arg;
+} PFbufrun;
+
+static void PFbufRunDone(run,error)
+PFbufrun *run;  /* run read, freed */
+int error;      /* PFE_OK, or the error reading it */
+/****************************************************************************
+SPECIFICATIONS:
+     Called by the engine when a run of PFbufDoGetAsync() is read:
+     release its pages, fixed unless prefetched, let the threads
+     waiting for them go on, and pass each to the caller's "done". If
+     the read failed the pages go back to the free list.
+*****************************************************************************/
+{
+PFbufpart *part;
+int i, p;
+
+    for (i = 0; i < run->n; i++){
+        part = PFbufPart(run->fd,run->pagenum+i);
+        PFbufLock(part);
+        run->bpage[i]->iobusy = FALSE;
+        part->nbusy--;
+        pthread_cond_broadcast(&part->iodone);
+        if (error != PFE_OK)
+            PFbufDrop(part,run->bpage[i]);
+        else if (run->prefetch){
+            run->bpage[i]->prefetched = TRUE;
+            PFbufRelease(run->bpage[i],0);
+            part->st[run->fd].ra_pages++;
+        }
+        else    PFbufRelease(run->bpage[i],1);
+        PFbufUnlock(part);
+    }
+    for (i = 0; i < run->n; i++){
+        p = run->pagenum + i;
+        if (PFtraceon && error == PFE_OK && !run->prefetch)
+            PFtrace(run->fd,p,PF_TRACE_PIN);
+        (*run->done)(run->arg,run->fd,p,
+            error == PFE_OK && !run->prefetch ? run->fpage[i] :
+            (PFfpage *)NULL,error);
+    }
+    free((char *)run);
+}
+
+
+static int PFbufDoGetAsync(fd,pages,n,prefetch,readfcn,writefcn,startfcn,done,arg)
+int fd;             /* file descriptor */
+int *pages;         /* pages to get */
+int n;              /* # of them */
+int prefetch;       /* TRUE to prefetch them instead */
+int (*readfcn)();   /* function to read a page */
+int (*writefcn)();  /* function to write a page */
+int (*startfcn)();  /* function to start reading adjacent pages */
+void (*done)();     /* called for each page, see below */
+void *arg;          /* passed to "done" */
+/****************************************************************************
+SPECIFICATIONS:
+     Get pages[0..n-1] of file "fd", as PFbufGet() does, without
+     waiting for their reads. Once page "pagenum" is fixed in the
+     buffer, or cannot be,
+         done(arg,fd,pagenum,fpage,error)
+         void *arg;
+         int fd;
+         int pagenum;
+         PFfpage *fpage;
+         int error;
+     is called with its buffer, or with a NULL "fpage" and the error.
+     Pages in the buffer get it before this returns. Missing ones are
+     sorted, whatever their order in pages[], and grouped in runs of
+     adjacent pages, each read with one call of "startfcn" (see
+     PFbufDoReleaseFile()), all started before the first is waited
+     for; they get it from the engine's thread.
+     Pages being read by another thread, listed twice, or for which
+     no frame is free without waiting, are then got one at a time with
+     PFbufGet().
+     With "prefetch", the pages are brought into the buffer as
+     PFbufPrefetch() does, without fixing them or counting them as
+     gets; "done" gets a NULL "fpage". Pages in the buffer or being
+     read are left alone, and those with no free frame are left out
+     (error PFE_NOBUF).
+
+RETURN VALUE:
+     PFE_OK if "done" will be called for every page.
+     PFE_NOMEM if not, and it was called for none.
+*****************************************************************************/
+{
+PFbpage **miss;     /* claimed, iobusy pages to read */
+PFbufrun **runs;    /* runs to start */
+PFbufrun *run = NULL;
+int *later;         /* pages to get with PFbufGet() */
+int nmiss = 0, nruns = 0, nlater = 0;
+PFbpage *bpage;
+PFbufpart *part;
+PFfpage *fpage;
+int error;
+int i, p;
+
+    miss = (PFbpage **)malloc(n * sizeof(PFbpage *));
+    runs = (PFbufrun **)malloc(n * sizeof(PFbufrun *));
+    later = (int *)malloc(n * sizeof(int));
+    if (miss == NULL || runs == NULL || later == NULL){
+        free((char *)miss);
+        free((char *)runs);
+        free((char *)later);
+        PFerrno = PFE_NOMEM;
+        return(PFerrno);
+    }
+
+    for (i = 0; i < n; i++){
+        p = pages[i];
+        part = PFbufPart(fd,p);
+        PFbufLock(part);
+        bpage = PFhashFind(&part->hash,fd,p);
+        if (bpage != NULL && prefetch){
+            PFbufUnlock(part);
+            (*done)(arg,fd,p,(PFfpage *)NULL,PFE_OK);
+            continue;
+        }
+        if (bpage != NULL && bpage->iobusy){
+            PFbufUnlock(part);
+            later[nlater++] = p;
+            continue;
+        }
+        if (bpage == NULL &&
+                (error=PFbufNewFrame(part,fd,p,writefcn,FALSE,&bpage))!= PFE_OK){
+            PFbufUnlock(part);
+            if (error == PFE_PAGEINBUF && prefetch)
+                /* brought in meanwhile */
+                (*done)(arg,fd,p,(PFfpage *)NULL,PFE_OK);
+            else if ((error == PFE_NOBUF || error == PFE_PAGEINBUF) &&
+                    !prefetch)
+                later[nlater++] = p;
+            else    (*done)(arg,fd,p,(PFfpage *)NULL,error);
+            continue;
+        }
+        if (prefetch){
+            PFbufUnlock(part);
+            miss[nmiss++] = bpage;
+            continue;
+        }
 
-            /* put the page into free list */
-            temppage = bpage;
-            bpage = bpage->nextpage;
-            PFbufUnlink(temppage);
-            PFbufInsertFree(temppage);
+        if (PFmrcSampled(&part->mrc,fd,p) &&
+                PFmrcRef(&part->mrc,fd,p,TRUE) && PFbufbudget > 0 &&
+                __sync_add_and_fetch(&PFbufsampled,1) >= PF_AUTOSIZE_GETS)
+            PFbufautodue = TRUE;
+        if (!bpage->iobusy){
+            /* a hit */
+            PFbufHit(part,bpage,fd);
+            PFbufUnlock(part);
+            if (PFtraceon)
+                PFtrace(fd,p,PF_TRACE_PIN);
+            (*done)(arg,fd,p,&bpage->fpage,PFE_OK);
+            continue;
+        }
+        part->st[fd].misses++;
+        bpage->refbit = TRUE;
+        PFbufUnlock(part);
+        miss[nmiss++] = bpage;
+    }
 
+    /* one sorted batch of runs */
+    qsort((char *)miss, nmiss, sizeof(PFbpage *), PFbufPageCmp);
+    for (i = 0; i < nmiss; i++){
+        bpage = miss[i];
+        p = bpage->page;
+        if (run == NULL || run->n == PF_IO_MAXPAGES ||
+                run->pagenum + run->n != p){
+            if ((run = (PFbufrun *)malloc(sizeof(PFbufrun))) == NULL){
+                part = PFbufPart(fd,p);
+                PFbufLock(part);
+                bpage->iobusy = FALSE;
+                part->nbusy--;
+                pthread_cond_broadcast(&part->iodone);
+                PFbufDrop(part,bpage);
+                PFbufUnlock(part);
+                (*done)(arg,fd,p,(PFfpage *)NULL,PFE_NOMEM);
+                continue;
+            }
+            run->fd = fd;
+            run->pagenum = p;
+            run->n = 0;
+            run->prefetch = prefetch;
+            run->done = done;
+            run->arg = arg;
+            runs[nruns++] = run;
         }
-        else    bpage = bpage->nextpage;
+        run->bpage[run->n] = bpage;
+        run->fpage[run->n++] = &bpage->fpage;
+    }
+
+    for (i = 0; i < nruns; i++)
+        if ((error=(*startfcn)(fd,runs[i]->pagenum,runs[i]->fpage,
+                runs[i]->n,FALSE,PFbufRunDone,runs[i],i + 1 < nruns))!= PFE_OK)
+            PFbufRunDone(runs[i],error);
+
+    for (i = 0; i < nlater; i++){
+        error = PFbufGet(fd,later[i],&fpage,readfcn,writefcn);
+        (*done)(arg,fd,later[i],error == PFE_OK ? fpage : (PFfpage *)NULL,
+            error);
     }
+    free((char *)miss);
+    free((char *)runs);
+    free((char *)later);
     return(PFE_OK);
 }
 
 
-PFbufUsed(fd,pagenum)
+static int PFbufDoUsed(part,fd,pagenum)
+PFbufpart *part; /* partition of (fd,pagenum), locked */
 int fd;      /* file descriptor */
 int pagenum;     /* page number */
 /****************************************************************************
@@ -559,13 +1999,13 @@ RETURN VALUE: PF error codes.
 PFbpage *bpage; /* pointer to the bpage we are looking for */
 
     /* Find page in the buffer */
-    if ((bpage=PFhashFind(fd,pagenum))==NULL){
+    if ((bpage=PFhashFind(&part->hash,fd,pagenum))==NULL){
         /* page not in the buffer */
         PFerrno = PFE_PAGENOTINBUF;
         return(PFerrno);
     }
 
-    if (!(bpage->fixed)){
+    if (bpage->pincount <= 0){
         /* page not fixed */
         PFerrno = PFE_PAGEUNFIXED;
         return(PFerrno);
@@ -573,20 +2013,806 @@ PFbpage *bpage; /* pointer to the bpage we are looking for */
 
     /* mark this page dirty */
     /* * NOTE: This function is badly named. "Used" implies a read.
-     * The original code sets dirty = TRUE. 
+     * The original code sets dirty = TRUE.
      * We will *not* add g_logical_writes++ here, because PFbufUnfix
      * is the correct place to do it (when the user *tells* us it's dirty).
      * This function is just for re-linking the page as MRU.
      */
-    bpage->dirty = TRUE;
+    PFbufSetDirty(bpage);
+    bpage->refbit = TRUE;
+
+    if (PF_REPLACEMENT_STRATEGY == CLOCK ||
+            (PF_REPLACEMENT_STRATEGY == TWOQ && bpage->queue == PF_QNEW))
+        return(PFE_OK);
 
     /* make this page head of the list of buffers*/
-    PFbufUnlink(bpage);
-    PFbufLinkHead(bpage);
+    PFbufUnlink(part,bpage);
+    PFbufLinkHead(part,bpage);
+
+    return(PFE_OK);
+}
+
+static PFbpage *PFbufFixFast(part,fd,pagenum)
+PFbufpart *part; /* partition of (fd,pagenum), not locked */
+int fd;      /* file descriptor */
+int pagenum;     /* page number */
+/****************************************************************************
+SPECIFICATIONS:
+     Fix page "pagenum" of file "fd" if it is resident and its hit
+     needs nothing but a higher pin count, without locking the
+     partition (see PFbufClaim()).
+
+RETURN VALUE:
+     The page, fixed, or NULL if the caller must take the locked path.
+*****************************************************************************/
+{
+PFbpage *bpage;
+unsigned version;
+short n;
+
+    if ((bpage=PFhashPeek(&part->hash,fd,pagenum)) == NULL)
+        return(NULL);
+    version = __atomic_load_n(&bpage->version, __ATOMIC_ACQUIRE);
+    if ((version & 1) || bpage->fd != fd || bpage->page != pagenum ||
+            bpage->prefetched ||
+            ((PF_REPLACEMENT_STRATEGY == ARC ||
+            PF_REPLACEMENT_STRATEGY == TWOQ) && bpage->queue == PF_QNEW))
+        return(NULL);
+
+    do {
+        if ((n = *(volatile short *)&bpage->pincount) < 0)
+            return(NULL);
+    } while (!__sync_bool_compare_and_swap(&bpage->pincount,n,n+1));
+
+    if (*(volatile unsigned *)&bpage->version != version){
+        /* the frame changed hands before we fixed it */
+        __sync_fetch_and_sub(&bpage->pincount,1);
+        return(NULL);
+    }
+    __sync_fetch_and_add(&part->fasthits[fd],1);
+    return(bpage);
+}
+
+
+static int PFbufUnfixFast(part,fd,pagenum)
+PFbufpart *part; /* partition of (fd,pagenum), not locked */
+int fd;      /* file descriptor */
+int pagenum;     /* page number, fixed by the caller, not dirty */
+/****************************************************************************
+SPECIFICATIONS:
+     Unfix page "pagenum" of file "fd" without locking the partition,
+     if that needs nothing but a lower pin count: the page stays fixed
+     by someone else, or CLOCK only wants its reference bit set. The
+     caller's pin keeps the page in its frame.
+
+RETURN VALUE:
+     TRUE if done, FALSE if the caller must take the locked path.
+*****************************************************************************/
+{
+PFbpage *bpage;
+short n;
+
+    if ((bpage=PFhashPeek(&part->hash,fd,pagenum)) == NULL ||
+            bpage->fd != fd || bpage->page != pagenum)
+        return(FALSE);
+    do {
+        n = *(volatile short *)&bpage->pincount;
+        if (n == 1 && PF_REPLACEMENT_STRATEGY == CLOCK)
+            /* before the page can be chosen as victim */
+            bpage->refbit = TRUE;
+        else if (n <= 1)
+            return(FALSE);
+    } while (!__sync_bool_compare_and_swap(&bpage->pincount,n,n-1));
+    return(TRUE);
+}
+
+
+void PFbufSetOptimistic(on)
+int on;     /* FALSE to always lock the partition */
+/****************************************************************************
+SPECIFICATIONS:
+     Turn the lock-free hit path of PFbufGet(), PFbufUnfix() and the
+     latches on or off. It is on by default; turning it off is meant
+     for measuring it. Not to be called while other threads use the
+     buffer.
+*****************************************************************************/
+{
+    PFbufoptimistic = on;
+}
+
+
+/* The entry points: each locks the partition of the page around the
+function doing the work, unless the page is a hit that can be fixed or
+unfixed without. Any number of threads may call them at once. Closing a
+file must wait until no other thread uses it. Each fix, unfix and
+release that succeeds is recorded in the page access trace, if it is
+on (see trace.c). */
+
+int PFbufGet(fd,pagenum,fpage,readfcn,writefcn)
+int fd;
+int pagenum;
+PFfpage **fpage;
+int (*readfcn)();
+int (*writefcn)();
+{
+PFbufpart *part = PFbufPart(fd,pagenum);
+PFbpage *bpage;
+int error;
+
+    /* sampled pages take the lock, to be tracked */
+    if (PFbufoptimistic && !PFmrcSampled(&part->mrc,fd,pagenum) &&
+            (bpage=PFbufFixFast(part,fd,pagenum)) != NULL){
+        *fpage = &bpage->fpage;
+        error = PFE_OK;
+    }
+    else {
+        PFbufLock(part);
+        error = PFbufDoGet(part,fd,pagenum,fpage,readfcn,writefcn);
+        PFbufUnlock(part);
+        if (PFbufautodue && __sync_bool_compare_and_swap(&PFbufautodue,TRUE,FALSE))
+            PFbufAutoSize(writefcn);
+    }
+    if (PFtraceon && error == PFE_OK)
+        PFtrace(fd,pagenum,PF_TRACE_PIN);
+    return(error);
+}
+
+int PFbufUnfix(fd,pagenum,dirty)
+int fd;
+int pagenum;
+int dirty;
+{
+PFbufpart *part = PFbufPart(fd,pagenum);
+int error;
+
+    if (PFbufoptimistic && !dirty && PFbufUnfixFast(part,fd,pagenum))
+        error = PFE_OK;
+    else {
+        PFbufLock(part);
+        error = PFbufDoUnfix(part,fd,pagenum,dirty);
+        PFbufUnlock(part);
+    }
+    if (PFtraceon && error == PFE_OK)
+        PFtrace(fd,pagenum,dirty ? PF_TRACE_WRITE : 0);
+    return(error);
+}
+
+int PFbufAlloc(fd,pagenum,fpage,writefcn)
+int fd;
+int pagenum;
+PFfpage **fpage;
+int (*writefcn)();
+{
+PFbufpart *part = PFbufPart(fd,pagenum);
+int error;
+
+    PFbufLock(part);
+    error = PFbufDoAlloc(part,fd,pagenum,fpage,writefcn);
+    PFbufUnlock(part);
+    if (PFtraceon && error == PFE_OK)
+        PFtrace(fd,pagenum,PF_TRACE_PIN|PF_TRACE_WRITE);
+    return(error);
+}
+
+int PFbufReleaseFile(fd,startfcn)
+int fd;
+int (*startfcn)();
+{
+int error;
+
+    PFbufLockAll();
+    error = PFbufDoReleaseFile(fd,startfcn);
+    PFbufUnlockAll();
+    if (PFtraceon)
+        PFtrace(fd,-1,PF_TRACE_CLOSE);
+    return(error);
+}
+
+int PFbufPrefetch(fd,pagenum,npages,readvfcn,writefcn)
+int fd;
+int pagenum;
+int npages;
+int (*readvfcn)();
+int (*writefcn)();
+{
+    /* locks the partitions itself */
+    return(PFbufDoPrefetch(fd,pagenum,npages,readvfcn,writefcn));
+}
+
+int PFbufGetAsync(fd,pages,n,prefetch,readfcn,writefcn,startfcn,done,arg)
+int fd;
+int *pages;
+int n;
+int prefetch;
+int (*readfcn)();
+int (*writefcn)();
+int (*startfcn)();
+void (*done)();
+void *arg;
+{
+    /* locks the partitions itself, and traces each page as it is got */
+    return(PFbufDoGetAsync(fd,pages,n,prefetch,readfcn,writefcn,startfcn,
+        done,arg));
+}
+
+int PFbufUsed(fd,pagenum)
+int fd;
+int pagenum;
+{
+PFbufpart *part = PFbufPart(fd,pagenum);
+int error;
 
+    PFbufLock(part);
+    error = PFbufDoUsed(part,fd,pagenum);
+    PFbufUnlock(part);
+    return(error);
+}
+
+
+int PFbufPinCount(fd,pagenum)
+int fd;      /* file descriptor */
+int pagenum;     /* page number */
+/****************************************************************************
+SPECIFICATIONS:
+     Return the # of times page "pagenum" of file "fd" is fixed, 0 if
+     it is not in the buffer.
+*****************************************************************************/
+{
+PFbufpart *part = PFbufPart(fd,pagenum);
+PFbpage *bpage;
+int n;
+
+    PFbufLock(part);
+    n = (bpage=PFhashFind(&part->hash,fd,pagenum)) == NULL ||
+            bpage->pincount < 0 ? 0 : bpage->pincount;
+    PFbufUnlock(part);
+    return(n);
+}
+
+
+/* a page of PFbufResident(), and how hot it is */
+typedef struct PFbufranked {
+    double rank;     /* its place in its partition: 0 coldest, 1 hottest */
+    int page;
+} PFbufranked;
+
+static int PFbufRankCmp(a,b)
+const void *a;
+const void *b;
+/****************************************************************************
+SPECIFICATIONS:
+     qsort() comparison of two PFbufranked's, coldest first.
+*****************************************************************************/
+{
+    if (((PFbufranked *)a)->rank != ((PFbufranked *)b)->rank)
+        return(((PFbufranked *)a)->rank < ((PFbufranked *)b)->rank ? -1 : 1);
+    return(((PFbufranked *)a)->page - ((PFbufranked *)b)->page);
+}
+
+int PFbufResident(fd,pages)
+int fd;      /* file descriptor */
+int **pages; /* set to a malloc()'ed array of page numbers */
+/****************************************************************************
+SPECIFICATIONS:
+     List the pages of file "fd" in the buffer, coldest first, leaving
+     out those read ahead and not asked for since. *pages is NULL if
+     there are none; else the caller frees it.
+
+RETURN VALUE:
+     The # of pages listed, or
+     PFE_NOMEM if no memory.
+
+IMPLEMENTATION NOTES:
+     A partition's pages are ranked by their place on its used lists,
+     from the victim end: PF_QNEW before PF_QMAIN, whose pages have
+     been referenced more. Partitions are merged by rank, as each
+     holds a random share of the pages.
+*****************************************************************************/
+{
+static int order[PF_NQUEUES] = { PF_QNEW, PF_QMAIN };
+PFbufranked *ranked;
+PFbpage *bpage;
+int n = 0, m, j;
+int i, q;
+
+    PFbufLockAll();
+    for (i = 0; i < PFbufnparts; i++)
+        for (bpage = PFbufparts[i].filepages[fd]; bpage != NULL;
+                bpage = bpage->nextfile)
+            n += !bpage->prefetched;
+    *pages = NULL;
+    if (n == 0){
+        PFbufUnlockAll();
+        return(0);
+    }
+    ranked = (PFbufranked *)malloc(n * sizeof(PFbufranked));
+    *pages = (int *)malloc(n * sizeof(int));
+    if (ranked == NULL || *pages == NULL){
+        PFbufUnlockAll();
+        free((char *)ranked);
+        free((char *)*pages);
+        *pages = NULL;
+        PFerrno = PFE_NOMEM;
+        return(PFerrno);
+    }
+    n = 0;
+    for (i = 0; i < PFbufnparts; i++){
+        for (m = 0, bpage = PFbufparts[i].filepages[fd]; bpage != NULL;
+                bpage = bpage->nextfile)
+            m += !bpage->prefetched;
+        for (j = q = 0; q < PF_NQUEUES; q++)
+            for (bpage = PFbufparts[i].lastbpage[order[q]]; bpage != NULL;
+                    bpage = bpage->prevpage)
+                if (bpage->fd == fd && !bpage->prefetched && j < m){
+                    ranked[n].rank = (j++ + 0.5) / m;
+                    ranked[n++].page = bpage->page;
+                }
+    }
+    PFbufUnlockAll();
+    qsort((char *)ranked, n, sizeof(PFbufranked), PFbufRankCmp);
+    for (i = 0; i < n; i++)
+        (*pages)[i] = ranked[i].page;
+    free((char *)ranked);
+    return(n);
+}
+
+
+static PFbpage *PFbufFixed(fd,pagenum)
+int fd;      /* file descriptor */
+int pagenum;     /* page number */
+/****************************************************************************
+SPECIFICATIONS:
+     Find page "pagenum" of file "fd", which should be fixed.
+
+RETURN VALUE:
+     The page, or NULL (with PFerrno set) if it is not in the buffer
+     or not fixed. A fixed page stays in its frame until it is unfixed,
+     so the frame can be used without the partition lock, and can
+     mostly be found without it too.
+*****************************************************************************/
+{
+PFbufpart *part = PFbufPart(fd,pagenum);
+PFbpage *bpage;
+
+    if (PFbufoptimistic && (bpage=PFhashPeek(&part->hash,fd,pagenum)) != NULL
+            && bpage->fd == fd && bpage->page == pagenum
+            && *(volatile short *)&bpage->pincount > 0)
+        return(bpage);
+
+    PFbufLock(part);
+    if ((bpage=PFhashFind(&part->hash,fd,pagenum)) == NULL)
+        PFerrno = PFE_PAGENOTINBUF;
+    else if (bpage->pincount <= 0){
+        PFerrno = PFE_PAGEUNFIXED;
+        bpage = NULL;
+    }
+    PFbufUnlock(part);
+    return(bpage);
+}
+
+
+int PFbufLatch(fd,pagenum,exclusive)
+int fd;      /* file descriptor */
+int pagenum;     /* page number, fixed by the caller */
+int exclusive;   /* TRUE for an exclusive latch, FALSE for a shared one */
+/****************************************************************************
+SPECIFICATIONS:
+     Latch the data of page "pagenum" of file "fd", waiting for
+     conflicting latches to be released. Any number of threads can hold
+     a shared latch on a page at the same time, but only one an
+     exclusive latch, and then no other thread a shared one.
+     Latches are for the callers' use: the buffer manager itself only
+     relies on the pin count.
+
+RETURN VALUE:
+     PFE_OK if no error.
+     PFE_PAGENOTINBUF, PFE_PAGEUNFIXED if the page is not fixed.
+*****************************************************************************/
+{
+PFbpage *bpage;
+
+    if ((bpage=PFbufFixed(fd,pagenum)) == NULL)
+        return(PFerrno);
+    if (exclusive)
+        pthread_rwlock_wrlock(&bpage->latch);
+    else
+        pthread_rwlock_rdlock(&bpage->latch);
+    return(PFE_OK);
+}
+
+
+int PFbufUnlatch(fd,pagenum)
+int fd;      /* file descriptor */
+int pagenum;     /* page number */
+/****************************************************************************
+SPECIFICATIONS:
+     Release the latch the calling thread holds on page "pagenum" of
+     file "fd".
+
+RETURN VALUE:
+     PFE_OK if no error.
+     PFE_PAGENOTINBUF, PFE_PAGEUNFIXED if the page is not fixed.
+*****************************************************************************/
+{
+PFbpage *bpage;
+
+    if ((bpage=PFbufFixed(fd,pagenum)) == NULL)
+        return(PFerrno);
+    pthread_rwlock_unlock(&bpage->latch);
+    return(PFE_OK);
+}
+
+
+/****************************** Flusher ************************************/
+
+static void PFbufKickFlusher()
+/****************************************************************************
+SPECIFICATIONS:
+     Ask the flusher for a pass over the victim end of the used lists.
+     Threads unlocking a partition give it the CPU until it has been
+     there.
+*****************************************************************************/
+{
+int i;
+
+    for (i = 0; i < PFbufnparts; i++)
+        PFbufparts[i].flushwant = TRUE;
+    pthread_mutex_lock(&PFflushmutex);
+    PFflushkick = TRUE;
+    pthread_cond_signal(&PFflushwake);
+    pthread_mutex_unlock(&PFflushmutex);
+}
+
+
+static PFbpage *PFbufFlushVictim(part,n)
+PFbufpart *part;    /* partition to look at */
+int n;      /* # of pages to look at */
+/****************************************************************************
+SPECIFICATIONS:
+     Find a dirty, unfixed page among the "n" pages the strategy will
+     choose victims from soonest: the pages from the CLOCK hand on,
+     from the head of the list for MRU, from the tails of the lists
+     otherwise.
+
+RETURN VALUE:
+     The page, claimed, or NULL if there is none.
+*****************************************************************************/
+{
+PFbpage *bpage;
+int i;
+int q;
+
+    if (PF_REPLACEMENT_STRATEGY == CLOCK) {
+        for (i = 0; i < n; i++) {
+            bpage = &PFbufframes[part->first +
+                        (part->clockhand + i) % part->nbufs];
+            if (bpage->dirty && bpage->pincount == 0 && PFbufClaim(bpage))
+                return(bpage);
+        }
+        return(NULL);
+    }
+
+    /* 2Q and ARC mostly evict from PF_QNEW */
+    for (q = PF_NQUEUES - 1; q >= 0; q--)
+        for (bpage = PF_REPLACEMENT_STRATEGY == MRU ? part->firstbpage[q] :
+                    part->lastbpage[q];
+                bpage != NULL && n > 0;
+                bpage = PF_REPLACEMENT_STRATEGY == MRU ? bpage->nextpage :
+                    bpage->prevpage, n--)
+            if (bpage->dirty && bpage->pincount == 0 && PFbufClaim(bpage))
+                return(bpage);
+    return(NULL);
+}
+
+
+static void PFbufFlushPart(part)
+PFbufpart *part;    /* partition to clean */
+/****************************************************************************
+SPECIFICATIONS:
+     One pass of the flusher over partition "part" (see PFbufFlusher()).
+*****************************************************************************/
+{
+PFbpage *bpage;
+int error;
+int window = part->nbufs / 4 > 0 ? part->nbufs / 4 : 1;
+
+    part->flushwant = TRUE;
+    PFbufLock(part);
+    part->flushwant = FALSE;
+    while (!PFflushstop && (bpage = PFbufFlushVictim(part,
+            PFbufndirty > PFflushlow ? part->nbufs : window)) != NULL) {
+        bpage->iobusy = TRUE;
+        part->nbusy++;
+        pthread_mutex_unlock(&part->mutex);
+
+        error = (*PFflushwritefcn)(bpage->fd,bpage->page,&bpage->fpage);
+
+        part->flushwant = TRUE;
+        PFbufLock(part);
+        part->flushwant = FALSE;
+        bpage->iobusy = FALSE;
+        PFbufRelease(bpage,0);
+        part->nbusy--;
+        if (error == PFE_OK) {
+            bpage->dirty = FALSE;
+            __sync_fetch_and_sub(&PFbufndirty,1);
+            part->st[bpage->fd].pages_written++;
+            part->st[bpage->fd].flusher_writes++;
+        }
+        pthread_cond_broadcast(&part->iodone);
+        if (error != PFE_OK)
+            /* leave the page to the caller that evicts it */
+            break;
+    }
+    pthread_mutex_unlock(&part->mutex);
+}
+
+
+static void *PFbufFlusher(arg)
+void *arg;
+/****************************************************************************
+SPECIFICATIONS:
+     The flusher thread. Each time it is kicked, it writes the dirty
+     pages among the quarter of each partition that will be evicted
+     next. While more than PFflushlow pages are dirty it looks further,
+     up to the whole partition. Hot pages at the other end are otherwise
+     left alone, as they would only be dirtied again.
+*****************************************************************************/
+{
+int i;
+
+    pthread_mutex_lock(&PFflushmutex);
+    while (!PFflushstop) {
+        if (!PFflushkick) {
+            pthread_cond_wait(&PFflushwake, &PFflushmutex);
+            continue;
+        }
+        PFflushkick = FALSE;
+        pthread_mutex_unlock(&PFflushmutex);
+
+        for (i = 0; i < PFbufnparts && !PFflushstop; i++)
+            PFbufFlushPart(&PFbufparts[i]);
+
+        pthread_mutex_lock(&PFflushmutex);
+    }
+    pthread_mutex_unlock(&PFflushmutex);
+    return(NULL);
+}
+
+
+int PFbufSetFlusher(lowpct,highpct,writefcn)
+int lowpct;         /* low watermark, % of the pool */
+int highpct;        /* high watermark, % of the pool; 0 stops the flusher */
+int (*writefcn)();  /* function to write a page */
+/****************************************************************************
+SPECIFICATIONS:
+     Start, reconfigure or stop the background flusher. Once more than
+     "highpct" percent of the buffer pages are dirty, or a dirty victim
+     had to be written by the caller, the flusher writes the dirty
+     pages near the victim end of the used lists, and more of them
+     until at most "lowpct" percent are dirty (see PFbufFlusher()).
+     Must not be called while another thread uses the buffer.
+
+RETURN VALUE:
+     PFE_OK if no error.
+     PFE_UNIX if the thread cannot be started.
+*****************************************************************************/
+{
+    if (PFflusheron) {
+        /* stop it, it is restarted below with the new settings */
+        pthread_mutex_lock(&PFflushmutex);
+        PFflushstop = TRUE;
+        pthread_cond_signal(&PFflushwake);
+        pthread_mutex_unlock(&PFflushmutex);
+        pthread_join(PFflusherthread, NULL);
+        PFflusheron = FALSE;
+    }
+    PFflushhigh = PFflushlow = 0;
+
+    if (highpct <= 0 || PF_MAX_BUFS == 0)
+        return(PFE_OK);
+
+    PFflushlowpct = lowpct;
+    PFflushhighpct = highpct;
+    PFflushlow = PF_MAX_BUFS * lowpct / 100;
+    PFflushhigh = PF_MAX_BUFS * highpct / 100;
+    PFflushwritefcn = writefcn;
+    PFflushkick = PFbufndirty > PFflushhigh;
+    PFflushstop = FALSE;
+    if (pthread_create(&PFflusherthread, NULL, PFbufFlusher, NULL) != 0) {
+        PFerrno = PFE_UNIX;
+        return(PFerrno);
+    }
+    PFflusheron = TRUE;
     return(PFE_OK);
 }
 
+
+int PFbufResize(nbufs,writefcn)
+int nbufs;          /* # of buffer pages wanted */
+int (*writefcn)();  /* function to write a page */
+/****************************************************************************
+SPECIFICATIONS:
+     Make the pool use "nbufs" of the frames allocated by PFbufInit(),
+     spread over the partitions as PFbufInit() does. A partition that
+     grows puts frames on its free list. One that shrinks gives up its
+     last frames, from the end: their pages are replaced, the dirty
+     ones written first with writefcn(), and their data is given back
+     to the system. It stops at a frame whose page is fixed, so the
+     pool may stay larger than asked for. All partitions are locked
+     meanwhile.
+
+RETURN VALUE:
+     The # of buffer pages the pool uses now, or
+     PFE_INVALIDARG if "nbufs" is more than PFbufInit() allocated, or
+         fewer than PF_BUF_MINPART per partition.
+     PF error code if a page cannot be written; the pool is then left
+         partly resized.
+*****************************************************************************/
+{
+PFbufpart *part;
+PFbpage *bpage, **pp;
+int i, j, want, oldn;
+int error = PFE_OK;
+
+    if (nbufs > PFbufcap || nbufs < PFbufnparts * PF_BUF_MINPART) {
+        PFerrno = PFE_INVALIDARG;
+        return(PFerrno);
+    }
+
+    PFbufLockAll();
+    for (i = 0; i < PFbufnparts && error == PFE_OK; i++) {
+        part = &PFbufparts[i];
+        want = nbufs / PFbufnparts + (i < nbufs % PFbufnparts);
+        if (want > part->cap)
+            want = part->cap;
+        oldn = part->nbufs;
+
+        /* grow */
+        for (j = oldn; j < want; j++) {
+            bpage = &PFbufframes[part->first + j];
+            PFbufRelease(bpage,0);
+            PFbufInsertFree(part,bpage);
+        }
+        if (want >= oldn) {
+            part->nbufs = want;
+            PFbufSizeQueues(part);
+            continue;
+        }
+
+        /* shrink: claim the frames given up, emptying them */
+        for (j = oldn - 1; j >= want; j--) {
+            bpage = &PFbufframes[part->first + j];
+            if (PFhashFind(&part->hash,bpage->fd,bpage->page) != bpage) {
+                /* free */
+                while (!PFbufClaim(bpage))
+                    /* a reader that found it through a stale hash entry */
+                    sched_yield();
+                continue;
+            }
+            if (!PFbufClaim(bpage))
+                /* fixed */
+                break;
+            if (bpage->dirty) {
+                if ((error=(*writefcn)(bpage->fd,bpage->page,
+                        &bpage->fpage)) != PFE_OK) {
+                    PFbufRelease(bpage,0);
+                    break;
+                }
+                part->st[bpage->fd].pages_written++;
+                __sync_fetch_and_sub(&PFbufndirty,1);
+                bpage->dirty = FALSE;
+            }
+            part->st[bpage->fd].evictions++;
+            (void)PFhashDelete(&part->hash,bpage->fd,bpage->page);
+            PFbufFileUnlink(part,bpage);
+            PFbufUnlink(part,bpage);
+        }
+        part->nbufs = j + 1;
+        PFbufSizeQueues(part);
+        if (part->clockhand >= part->nbufs)
+            part->clockhand = 0;
+
+        /* drop the frames given up from the free list */
+        for (pp = &part->freebpage; *pp != NULL; )
+            if (*pp - &PFbufframes[part->first] >= part->nbufs)
+                *pp = (*pp)->nextpage;
+            else
+                pp = &(*pp)->nextpage;
+        (void)madvise(PFbufdata + (size_t)(part->first + part->nbufs) * PF_PAGE_SIZE,
+                (size_t)(oldn - part->nbufs) * PF_PAGE_SIZE, MADV_DONTNEED);
+    }
+
+    PF_MAX_BUFS = 0;
+    for (i = 0; i < PFbufnparts; i++)
+        PF_MAX_BUFS += PFbufparts[i].nbufs;
+    if (PFflusheron) {
+        PFflushlow = PF_MAX_BUFS * PFflushlowpct / 100;
+        PFflushhigh = PF_MAX_BUFS * PFflushhighpct / 100;
+    }
+    PFbufUnlockAll();
+    return(error != PFE_OK ? error : PF_MAX_BUFS);
+}
+
+
+static void PFbufAutoSize(writefcn)
+int (*writefcn)();  /* function to write a page */
+/****************************************************************************
+SPECIFICATIONS:
+     Resize the pool to the smallest point of the miss ratio curve of
+     the gets since the last call whose hit rate is within
+     PF_AUTOSIZE_SLACK of the best within the budget, or to the whole
+     budget if the curve still rises past the last point below it.
+     Called without locks.
+*****************************************************************************/
+{
+long long hist[PF_MRC_NPOINTS + 1];
+double rate[PF_MRC_NPOINTS];
+long long gets = 0, now;
+PFbufpart *part;
+int i, b, bmax, size;
+
+    PFbufsampled = 0;
+    memset((char *)hist, 0, sizeof(hist));
+    for (i = 0; i < PFbufnparts; i++) {
+        part = &PFbufparts[i];
+        PFbufLock(part);
+        for (b = 0; b <= PF_MRC_NPOINTS; b++)
+            hist[b] += part->mrc.win[b];
+        memset((char *)part->mrc.win, 0, sizeof(part->mrc.win));
+        now = PFbufPartGets(part);
+        gets += now - part->wingets;
+        part->wingets = now;
+        PFbufUnlock(part);
+    }
+    PFbufHitRates(hist, gets, rate);
+
+    /* the last point the budget allows */
+    for (bmax = -1; bmax + 1 < PF_MRC_NPOINTS &&
+            PFmrcSize(bmax + 1) <= PFbufcap; bmax++)
+        ;
+    if (gets <= 0 || bmax < 0)
+        return;
+
+    for (b = 0; b < bmax; b++)
+        if (PFmrcSize(b) >= PFbufnparts * PF_BUF_MINPART &&
+                rate[b] >= rate[bmax] - PF_AUTOSIZE_SLACK)
+            break;
+    if (b == bmax && bmax + 1 < PF_MRC_NPOINTS &&
+            rate[bmax + 1] > rate[bmax] + PF_AUTOSIZE_SLACK)
+        size = PFbufcap;
+    else
+        size = PFmrcSize(b);
+    if (size < PFbufnparts * PF_BUF_MINPART)
+        size = PFbufnparts * PF_BUF_MINPART;
+    if (size != PF_MAX_BUFS)
+        (void)PFbufResize(size,writefcn);
+}
+
+
+void PFbufSetBudget(maxbufs)
+int maxbufs;    /* most buffer pages, 0 for a fixed size */
+/****************************************************************************
+SPECIFICATIONS:
+     From the next PFbufInit() on, allocate frames for up to "maxbufs"
+     pages, and resize the pool within them as the estimated miss
+     ratio curve suggests (see PFbufAutoSize()).
+*****************************************************************************/
+{
+    PFbufbudget = maxbufs;
+}
+
+
+int PFbufSize()
+/****************************************************************************
+SPECIFICATIONS:
+     Return the # of buffer pages the pool uses now.
+*****************************************************************************/
+{
+    return(PF_MAX_BUFS);
+}
+
+
 void PFbufPrint()
 /****************************************************************************
 SPECIFICATIONS:
@@ -597,15 +2823,26 @@ AUTHOR: clc
 *****************************************************************************/
 {
 PFbpage *bpage;
+int i, q;
+int empty = TRUE;
 
+    PFbufLockAll();
     printf("buffer content:\n");
-    if (PFfirstbpage == NULL)
+    for (i = 0; i < PFbufnparts; i++)
+        for (q = 0; q < PF_NQUEUES; q++)
+            if (PFbufparts[i].firstbpage[q] != NULL)
+                empty = FALSE;
+    if (empty)
         printf("empty\n");
     else {
-        printf("fd\tpage\tfixed\tdirty\tfpage\n");
-        for(bpage = PFfirstbpage; bpage != NULL; bpage= bpage->nextpage)
-            printf("%d\t%d\t%d\t%d\t%d\n",
-                bpage->fd,bpage->page,(int)bpage->fixed,
-                (int)bpage->dirty,(int)&bpage->fpage);
+        printf("fd\tpage\tpins\tdirty\tqueue\tpagebuf\n");
+        for (i = 0; i < PFbufnparts; i++)
+        for (q = 0; q < PF_NQUEUES; q++)
+        for(bpage = PFbufparts[i].firstbpage[q]; bpage != NULL;
+                bpage= bpage->nextpage)
+            printf("%d\t%d\t%d\t%d\t%d\t%p\n",
+                bpage->fd,bpage->page,(int)bpage->pincount,
+                (int)bpage->dirty,q,(void *)bpage->fpage.pagebuf);
     }
-}
\ No newline at end of file
+    PFbufUnlockAll();
+}
@@ -0,0 +1,236 @@
+/* crc.c: CRC32C (Castagnoli) checksums of pages, kept by files created
+with PF_FORMAT_CHECKSUM. On an x86-64 processor with SSE4.2 the crc32
+instruction takes 8 bytes at a time; it takes three cycles, but a new
+one can start every cycle, so a page is cut in three stripes whose CRCs
+are computed side by side, then combined with tables that append the
+stripe's worth of zeros to a CRC. Elsewhere, or after PF_SetCrcEngine(),
+a table driven "slicing-by-8" takes 8 bytes at a time too. The engine is
+chosen at run time, on the first checksum; both give the same CRCs. */
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_CRC_POLY	0x82F63B78	/* CRC32C, bits reversed */
+#define PF_CRC_STRIPE	1360	/* bytes of each of the three stripes:
+				a multiple of 8, three of them just under
+				a page */
+
+static unsigned PFcrctab[8][256];	/* slicing-by-8: PFcrctab[k][b] is
+				the CRC of byte b followed by k zeros */
+static unsigned PFcrcshift[4][256];	/* PFcrcshift[k][b]: CRC register
+				b << 8*k, after PF_CRC_STRIPE zeros */
+static pthread_once_t PFcrconce = PTHREAD_ONCE_INIT;
+static int PFcrchw = FALSE;	/* TRUE if the processor has SSE4.2 */
+static unsigned (*PFcrcfcn)();	/* the engine in use */
+
+
+static unsigned PFcrcSlice8(crc,buf,len)
+unsigned crc;	/* CRC register so far */
+unsigned char *buf;	/* bytes to add */
+int len;	/* # of bytes */
+/****************************************************************************
+SPECIFICATIONS:
+	Add "len" bytes to the CRC register "crc", 8 at a time with the
+	tables. The words are read little-endian.
+
+RETURN VALUE:
+	The new register.
+*****************************************************************************/
+{
+unsigned lo, hi;
+
+	for (; len > 0 && ((unsigned long)buf & 7) != 0; len--)
+		crc = PFcrctab[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+	for (; len >= 8; len -= 8, buf += 8){
+		memcpy((char *)&lo,(char *)buf,4);
+		memcpy((char *)&hi,(char *)buf+4,4);
+		lo ^= crc;
+		crc = PFcrctab[7][lo & 0xff] ^ PFcrctab[6][(lo >> 8) & 0xff] ^
+			PFcrctab[5][(lo >> 16) & 0xff] ^ PFcrctab[4][lo >> 24] ^
+			PFcrctab[3][hi & 0xff] ^ PFcrctab[2][(hi >> 8) & 0xff] ^
+			PFcrctab[1][(hi >> 16) & 0xff] ^ PFcrctab[0][hi >> 24];
+	}
+	for (; len > 0; len--)
+		crc = PFcrctab[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+	return(crc);
+}
+
+#if defined(__x86_64__)
+#define PFcrcShift(crc) (PFcrcshift[0][(crc) & 0xff] ^ \
+	PFcrcshift[1][((crc) >> 8) & 0xff] ^ \
+	PFcrcshift[2][((crc) >> 16) & 0xff] ^ PFcrcshift[3][(crc) >> 24])
+
+__attribute__((target("sse4.2")))
+static unsigned PFcrcSse42(crc,buf,len)
+unsigned crc;	/* CRC register so far */
+unsigned char *buf;	/* bytes to add */
+int len;	/* # of bytes */
+/****************************************************************************
+SPECIFICATIONS:
+	Add "len" bytes to the CRC register "crc" with the crc32
+	instruction, three stripes at a time while there are enough.
+
+RETURN VALUE:
+	The new register.
+*****************************************************************************/
+{
+unsigned long long c0 = crc, c1, c2, w0, w1, w2;
+int i;
+
+	for (; len > 0 && ((unsigned long)buf & 7) != 0; len--)
+		c0 = _mm_crc32_u8((unsigned)c0,*buf++);
+	for (; len >= 3*PF_CRC_STRIPE; len -= 3*PF_CRC_STRIPE,
+			buf += 3*PF_CRC_STRIPE){
+		c1 = c2 = 0;
+		for (i = 0; i < PF_CRC_STRIPE; i += 8){
+			memcpy((char *)&w0,(char *)buf+i,8);
+			memcpy((char *)&w1,(char *)buf+PF_CRC_STRIPE+i,8);
+			memcpy((char *)&w2,(char *)buf+2*PF_CRC_STRIPE+i,8);
+			c0 = _mm_crc32_u64(c0,w0);
+			c1 = _mm_crc32_u64(c1,w1);
+			c2 = _mm_crc32_u64(c2,w2);
+		}
+		/* CRC(a b) is CRC(a followed by zeros) ^ CRC(b) */
+		c0 = PFcrcShift((unsigned)c0) ^ c1;
+		c0 = PFcrcShift((unsigned)c0) ^ c2;
+	}
+	for (; len >= 8; len -= 8, buf += 8){
+		memcpy((char *)&w0,(char *)buf,8);
+		c0 = _mm_crc32_u64(c0,w0);
+	}
+	for (; len > 0; len--)
+		c0 = _mm_crc32_u8((unsigned)c0,*buf++);
+	return((unsigned)c0);
+}
+#endif
+
+static unsigned PFcrcZeros(crc,n)
+unsigned crc;	/* CRC register */
+int n;		/* # of zero bytes */
+/****************************************************************************
+SPECIFICATIONS:
+	Add "n" zero bytes to the register "crc", a byte at a time.
+
+RETURN VALUE:
+	The new register.
+*****************************************************************************/
+{
+	while (n-- > 0)
+		crc = PFcrctab[0][crc & 0xff] ^ (crc >> 8);
+	return(crc);
+}
+
+static void PFcrcInit()
+/****************************************************************************
+SPECIFICATIONS:
+	Fill the tables and choose the engine; called once.
+
+IMPLEMENTATION NOTES:
+	Adding zeros is linear in the register, so PFcrcshift[] is made
+	from the 32 registers of one bit.
+*****************************************************************************/
+{
+unsigned bit[32];
+unsigned c;
+int b, i, k;
+
+	for (b = 0; b < 256; b++){
+		for (c = b, i = 0; i < 8; i++)
+			c = c & 1 ? (c >> 1) ^ PF_CRC_POLY : c >> 1;
+		PFcrctab[0][b] = c;
+	}
+	for (b = 0; b < 256; b++)
+		for (c = PFcrctab[0][b], k = 1; k < 8; k++)
+			PFcrctab[k][b] = c = PFcrctab[0][c & 0xff] ^ (c >> 8);
+
+	for (i = 0; i < 32; i++)
+		bit[i] = PFcrcZeros(1U << i,PF_CRC_STRIPE);
+	for (k = 0; k < 4; k++)
+		for (b = 0; b < 256; b++){
+			for (c = 0, i = 0; i < 8; i++)
+				if (b & (1 << i))
+					c ^= bit[8*k + i];
+			PFcrcshift[k][b] = c;
+		}
+
+	PFcrcfcn = PFcrcSlice8;
+#if defined(__x86_64__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse4.2")){
+		PFcrchw = TRUE;
+		PFcrcfcn = PFcrcSse42;
+	}
+#endif
+}
+
+unsigned PFcrc32c(crc,buf,len)
+unsigned crc;	/* CRC32C of the bytes before "buf", 0 if none */
+char *buf;	/* bytes to add */
+int len;	/* # of bytes */
+/****************************************************************************
+SPECIFICATIONS:
+	Compute the CRC32C of the bytes before and those at "buf", with
+	the engine in use.
+
+RETURN VALUE:
+	The CRC32C.
+*****************************************************************************/
+{
+	pthread_once(&PFcrconce,PFcrcInit);
+	return(~(*PFcrcfcn)(~crc,(unsigned char *)buf,len));
+}
+
+unsigned PFcrcPage(pagenum,pagebuf)
+int pagenum;	/* page number */
+char *pagebuf;	/* its PF_PAGE_SIZE bytes */
+/****************************************************************************
+SPECIFICATIONS:
+	Compute the checksum of page "pagenum" holding "pagebuf": the
+	CRC32C of the page, started from the page number, so that a page
+	written at the wrong place does not match either.
+
+RETURN VALUE:
+	The checksum, never 0: a CRC of 0 is made 1.
+*****************************************************************************/
+{
+unsigned crc = PFcrc32c((unsigned)pagenum,pagebuf,PF_PAGE_SIZE);
+
+	return(crc != 0 ? crc : 1);
+}
+
+
+/************************** Interface Routines **************************/
+
+int PF_SetCrcEngine(engine)
+int engine;	/* PF_CRC_SSE42 or PF_CRC_SLICE8 */
+/****************************************************************************
+SPECIFICATIONS:
+	Choose how the checksums of PF_FORMAT_CHECKSUM files are
+	computed: PF_CRC_SSE42, the default, or PF_CRC_SLICE8. Both give
+	the same checksums, so it can be called at any time.
+
+RETURN VALUE:
+	The engine used from now on: PF_CRC_SLICE8 if the processor has
+	no SSE4.2.
+	PFE_INVALIDARG	if "engine" is neither.
+*****************************************************************************/
+{
+	if (engine != PF_CRC_SSE42 && engine != PF_CRC_SLICE8){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	pthread_once(&PFcrconce,PFcrcInit);
+#if defined(__x86_64__)
+	if (engine == PF_CRC_SSE42 && PFcrchw){
+		PFcrcfcn = PFcrcSse42;
+		return(PF_CRC_SSE42);
+	}
+#endif
+	PFcrcfcn = PFcrcSlice8;
+	return(PF_CRC_SLICE8);
+}
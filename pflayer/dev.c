@@ -0,0 +1,648 @@
+/* dev.c: storage devices. The bytes of an open paged file are kept by a
+device, chosen by the flags given to PF_OpenFileEx():
+	posix		the Unix file, read and written with pread()/pwrite()
+			and their vectored forms; the default.
+	memory		(PF_OPEN_MEMORY) an image of the file in memory,
+			loaded from the Unix file the first time it is
+			opened this way. It stays, with the changes made to
+			it, until PF_DestroyFile(); the Unix file is never
+			written.
+	throttled	(PF_OPEN_THROTTLED) either of the above, with every
+			read and write delayed as a device with the latency
+			and bandwidth set by PF_SetDeviceModel() would.
+pf.c only reaches a file through the PFdevops of its device, see
+pftypes.h. */
+#define _GNU_SOURCE	/* for O_DIRECT */
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sched.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_MEM_MINCAP	(64*1024)	/* least bytes of a memory image */
+#define PF_SLOW_SLACKNS	60000	/* a sleep may take this much longer */
+
+/* a Unix file */
+typedef struct PFposixdev {
+	PFdev dev;
+	int unixfd;	/* unix file descriptor */
+} PFposixdev;
+
+/* the memory image of a file. Reads, and writes inside the image, are
+done under a read lock, so they run at the same time; the buffer
+manager does not move the same page twice at once. Writes that make the
+image longer take the write lock, as "data" may move. */
+typedef struct PFmemfile {
+	char *fname;		/* name of the Unix file it was loaded from */
+	char *data;		/* the bytes of the file */
+	off_t size;		/* # of bytes of the file */
+	off_t cap;		/* # of bytes at "data"; past "size" all 0 */
+	pthread_rwlock_t lock;
+	struct PFmemfile *next;	/* next image in PFmemfiles */
+} PFmemfile;
+
+typedef struct PFmemdev {
+	PFdev dev;
+	PFmemfile *file;
+} PFmemdev;
+
+/* A device wrapped by PF_OPEN_THROTTLED. A call takes the latency, plus
+the time its bytes take at the bandwidth. Transfers are done one after
+the other, calls from different threads queue for the bandwidth, but
+their latencies overlap, as on a device with many requests in flight. */
+typedef struct PFslowdev {
+	PFdev dev;
+	PFdev *under;		/* the device doing the I/O */
+	long long readns;	/* latency of a read, ns */
+	long long writens;	/* latency of a write, ns */
+	double nsperbyte;	/* transfer time, 0 for no bandwidth limit */
+	long long busy;		/* time the last transfer queued ends */
+	pthread_mutex_t lock;	/* held while "busy" changes */
+} PFslowdev;
+
+static PFmemfile *PFmemfiles = NULL;	/* memory images, all files */
+static pthread_mutex_t PFmemlock = PTHREAD_MUTEX_INITIALIZER; /* held
+				while PFmemfiles changes */
+
+/* device model of the files opened with PF_OPEN_THROTTLED next */
+static int PFslowread = 0;	/* latency of a read, us */
+static int PFslowwrite = 0;	/* latency of a write, us */
+static int PFslowmbps = 0;	/* MB/s, 0 for no limit */
+
+/* # of bytes described by "iov" */
+static ssize_t PFiovLen(iov,niov)
+struct iovec *iov;
+int niov;
+{
+ssize_t len = 0;
+int i;
+
+	for (i = 0; i < niov; i++)
+		len += iov[i].iov_len;
+	return(len);
+}
+
+static long long PFdevNow()
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+
+/******************************* posix **********************************/
+
+static ssize_t PFposixReadv(PFdev *dev, struct iovec *iov, int niov, off_t offset)
+{
+int unixfd = ((PFposixdev *)dev)->unixfd;
+
+	return(niov == 1 ? pread(unixfd,iov[0].iov_base,iov[0].iov_len,offset) :
+		preadv(unixfd,iov,niov,offset));
+}
+
+static ssize_t PFposixWritev(PFdev *dev, struct iovec *iov, int niov, off_t offset)
+{
+int unixfd = ((PFposixdev *)dev)->unixfd;
+
+	return(niov == 1 ? pwrite(unixfd,iov[0].iov_base,iov[0].iov_len,offset) :
+		pwritev(unixfd,iov,niov,offset));
+}
+
+static off_t PFposixSize(PFdev *dev)
+{
+struct stat st;
+
+	if (fstat(((PFposixdev *)dev)->unixfd,&st) == -1)
+		return(-1);
+	return(st.st_size);
+}
+
+static int PFposixTruncate(PFdev *dev, off_t len)
+{
+	return(ftruncate(((PFposixdev *)dev)->unixfd,len));
+}
+
+static int PFposixAllocate(PFdev *dev, off_t offset, off_t len)
+{
+	return(fallocate(((PFposixdev *)dev)->unixfd,0,offset,len));
+}
+
+static int PFposixDirect(PFdev *dev, int on)
+{
+	return(fcntl(((PFposixdev *)dev)->unixfd,F_SETFL,on ? O_DIRECT : 0));
+}
+
+static int PFposixClose(PFdev *dev)
+{
+int error = close(((PFposixdev *)dev)->unixfd);
+
+	free((char *)dev);
+	return(error);
+}
+
+static PFdevops PFposixops = {
+	PFposixReadv, PFposixWritev, PFposixSize, PFposixTruncate,
+	PFposixAllocate, PFposixDirect, PFposixClose
+};
+
+static PFdev *PFposixOpen(fname,rdonly)
+char *fname;	/* name of the Unix file */
+int rdonly;	/* TRUE to open it read-only */
+{
+PFposixdev *p;
+
+	if ((p = (PFposixdev *)malloc(sizeof(PFposixdev))) == NULL){
+		PFerrno = PFE_NOMEM;
+		return(NULL);
+	}
+	if ((p->unixfd = open(fname,rdonly ? O_RDONLY : O_RDWR)) < 0){
+		free((char *)p);
+		PFerrno = PFE_UNIX;
+		return(NULL);
+	}
+	p->dev.ops = &PFposixops;
+	return(&p->dev);
+}
+
+
+/******************************* memory *********************************/
+
+static int PFmemGrow(m,len)
+PFmemfile *m;	/* write locked */
+off_t len;	/* # of bytes the image must have room for */
+/****************************************************************************
+SPECIFICATIONS:
+	Make room for "len" bytes at m->data, doubling it as needed. The
+	new bytes are 0.
+
+RETURN VALUE:
+	0 if ok, -1 with errno set if no memory.
+*****************************************************************************/
+{
+off_t cap;
+char *data;
+
+	if (len <= m->cap)
+		return(0);
+	for (cap = m->cap > 0 ? 2 * m->cap : PF_MEM_MINCAP; cap < len; cap *= 2)
+		;
+	if ((data = realloc(m->data,(size_t)cap)) == NULL){
+		errno = ENOMEM;
+		return(-1);
+	}
+	memset(data + m->cap,0,(size_t)(cap - m->cap));
+	m->data = data;
+	m->cap = cap;
+	return(0);
+}
+
+static ssize_t PFmemReadv(PFdev *dev, struct iovec *iov, int niov, off_t offset)
+{
+PFmemfile *m = ((PFmemdev *)dev)->file;
+ssize_t count = 0;
+size_t n;
+int i;
+
+	pthread_rwlock_rdlock(&m->lock);
+	for (i = 0; i < niov && offset < m->size; i++){
+		n = m->size - offset < iov[i].iov_len ?
+			(size_t)(m->size - offset) : iov[i].iov_len;
+		memcpy(iov[i].iov_base,m->data + offset,n);
+		offset += n;
+		count += n;
+	}
+	pthread_rwlock_unlock(&m->lock);
+	return(count);
+}
+
+static ssize_t PFmemWritev(PFdev *dev, struct iovec *iov, int niov, off_t offset)
+{
+PFmemfile *m = ((PFmemdev *)dev)->file;
+off_t end = offset + PFiovLen(iov,niov);
+int i;
+
+	pthread_rwlock_rdlock(&m->lock);
+	if (end > m->size){
+		/* longer: "data" may move */
+		pthread_rwlock_unlock(&m->lock);
+		pthread_rwlock_wrlock(&m->lock);
+		if (PFmemGrow(m,end) == -1){
+			pthread_rwlock_unlock(&m->lock);
+			return(-1);
+		}
+		if (end > m->size)
+			m->size = end;
+	}
+	for (i = 0; i < niov; i++){
+		memcpy(m->data + offset,iov[i].iov_base,iov[i].iov_len);
+		offset += iov[i].iov_len;
+	}
+	pthread_rwlock_unlock(&m->lock);
+	return(PFiovLen(iov,niov));
+}
+
+static off_t PFmemSize(PFdev *dev)
+{
+PFmemfile *m = ((PFmemdev *)dev)->file;
+off_t size;
+
+	pthread_rwlock_rdlock(&m->lock);
+	size = m->size;
+	pthread_rwlock_unlock(&m->lock);
+	return(size);
+}
+
+static int PFmemTruncate(PFdev *dev, off_t len)
+{
+PFmemfile *m = ((PFmemdev *)dev)->file;
+int error = 0;
+
+	pthread_rwlock_wrlock(&m->lock);
+	if (len < m->size)
+		/* bytes past the end are 0 */
+		memset(m->data + len,0,(size_t)(m->size - len));
+	else	error = PFmemGrow(m,len);
+	if (error == 0)
+		m->size = len;
+	pthread_rwlock_unlock(&m->lock);
+	return(error);
+}
+
+static int PFmemAllocate(PFdev *dev, off_t offset, off_t len)
+{
+PFmemfile *m = ((PFmemdev *)dev)->file;
+int error = 0;
+
+	pthread_rwlock_wrlock(&m->lock);
+	if (offset + len > m->size && (error = PFmemGrow(m,offset + len)) == 0)
+		m->size = offset + len;
+	pthread_rwlock_unlock(&m->lock);
+	return(error);
+}
+
+static int PFmemDirect(PFdev *dev, int on)
+{
+	/* there is no page cache to bypass */
+	errno = EINVAL;
+	return(-1);
+}
+
+static int PFmemClose(PFdev *dev)
+{
+	/* the image stays, see PFdevForget() */
+	free((char *)dev);
+	return(0);
+}
+
+static PFdevops PFmemops = {
+	PFmemReadv, PFmemWritev, PFmemSize, PFmemTruncate,
+	PFmemAllocate, PFmemDirect, PFmemClose
+};
+
+static PFmemfile *PFmemLoad(fname)
+char *fname;	/* name of the Unix file */
+/****************************************************************************
+SPECIFICATIONS:
+	Make a memory image of Unix file "fname". Called with PFmemlock
+	held.
+
+RETURN VALUE:
+	The image, or NULL with PFerrno set.
+*****************************************************************************/
+{
+PFmemfile *m;
+PFdev *disk;
+struct iovec iov;
+ssize_t count;
+off_t size;
+
+	if ((disk = PFposixOpen(fname,TRUE)) == NULL)
+		return(NULL);
+	if ((m = (PFmemfile *)calloc(1,sizeof(PFmemfile))) == NULL ||
+			(m->fname = malloc(strlen(fname) + 1)) == NULL){
+		PFerrno = PFE_NOMEM;
+		goto fail;
+	}
+	strcpy(m->fname,fname);
+	if ((size = PFposixSize(disk)) == -1){
+		PFerrno = PFE_UNIX;
+		goto fail;
+	}
+	if (PFmemGrow(m,size) == -1){
+		PFerrno = PFE_NOMEM;
+		goto fail;
+	}
+	for (m->size = 0; m->size < size; m->size += count){
+		iov.iov_base = m->data + m->size;
+		iov.iov_len = (size_t)(size - m->size);
+		if ((count = PFposixReadv(disk,&iov,1,m->size)) <= 0){
+			PFerrno = count < 0 ? PFE_UNIX : PFE_INCOMPLETEREAD;
+			goto fail;
+		}
+	}
+	(void)PFposixClose(disk);
+	pthread_rwlock_init(&m->lock,NULL);
+	return(m);
+
+fail:
+	(void)PFposixClose(disk);
+	if (m != NULL){
+		free(m->fname);
+		free(m->data);
+		free((char *)m);
+	}
+	return(NULL);
+}
+
+static PFdev *PFmemOpen(fname)
+char *fname;	/* name of the Unix file */
+{
+PFmemdev *p;
+PFmemfile *m;
+
+	if ((p = (PFmemdev *)malloc(sizeof(PFmemdev))) == NULL){
+		PFerrno = PFE_NOMEM;
+		return(NULL);
+	}
+	pthread_mutex_lock(&PFmemlock);
+	for (m = PFmemfiles; m != NULL && strcmp(m->fname,fname) != 0; m = m->next)
+		;
+	if (m == NULL && (m = PFmemLoad(fname)) != NULL){
+		m->next = PFmemfiles;
+		PFmemfiles = m;
+	}
+	pthread_mutex_unlock(&PFmemlock);
+	if (m == NULL){
+		free((char *)p);
+		return(NULL);
+	}
+	p->dev.ops = &PFmemops;
+	p->file = m;
+	return(&p->dev);
+}
+
+
+/****************************** throttled *******************************/
+
+static long long PFslowStart(s,len,latency)
+PFslowdev *s;
+ssize_t len;		/* # of bytes to move */
+long long latency;	/* ns */
+/****************************************************************************
+SPECIFICATIONS:
+	Queue a transfer of "len" bytes.
+
+RETURN VALUE:
+	The time the call must end at.
+*****************************************************************************/
+{
+long long now = PFdevNow();
+long long end;
+
+	pthread_mutex_lock(&s->lock);
+	end = (s->busy > now ? s->busy : now) + (long long)(len * s->nsperbyte);
+	s->busy = end;
+	pthread_mutex_unlock(&s->lock);
+	return(end + latency);
+}
+
+static void PFslowWait(end)
+long long end;	/* returned by PFslowStart() */
+/****************************************************************************
+SPECIFICATIONS:
+	Wait until time "end". A sleep can end PF_SLOW_SLACKNS late, so
+	the last of the wait is spent yielding the CPU instead.
+*****************************************************************************/
+{
+struct timespec ts;
+long long wake = end - PF_SLOW_SLACKNS;
+
+	if (wake > PFdevNow()){
+		ts.tv_sec = wake / 1000000000LL;
+		ts.tv_nsec = wake % 1000000000LL;
+		while (clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&ts,NULL) == EINTR)
+			;
+	}
+	while (PFdevNow() < end)
+		sched_yield();
+}
+
+static ssize_t PFslowReadv(PFdev *dev, struct iovec *iov, int niov, off_t offset)
+{
+PFslowdev *s = (PFslowdev *)dev;
+long long end = PFslowStart(s,PFiovLen(iov,niov),s->readns);
+ssize_t count = PFdevReadv(s->under,iov,niov,offset);
+
+	PFslowWait(end);
+	return(count);
+}
+
+static ssize_t PFslowWritev(PFdev *dev, struct iovec *iov, int niov, off_t offset)
+{
+PFslowdev *s = (PFslowdev *)dev;
+long long end = PFslowStart(s,PFiovLen(iov,niov),s->writens);
+ssize_t count = PFdevWritev(s->under,iov,niov,offset);
+
+	PFslowWait(end);
+	return(count);
+}
+
+/* the others cost no time */
+static off_t PFslowSize(PFdev *dev)
+{
+	return(PFdevSize(((PFslowdev *)dev)->under));
+}
+
+static int PFslowTruncate(PFdev *dev, off_t len)
+{
+	return(PFdevTruncate(((PFslowdev *)dev)->under,len));
+}
+
+static int PFslowAllocate(PFdev *dev, off_t offset, off_t len)
+{
+	return(PFdevAllocate(((PFslowdev *)dev)->under,offset,len));
+}
+
+static int PFslowDirect(PFdev *dev, int on)
+{
+	return(PFdevDirect(((PFslowdev *)dev)->under,on));
+}
+
+static int PFslowClose(PFdev *dev)
+{
+PFslowdev *s = (PFslowdev *)dev;
+int error = PFdevClose(s->under);
+
+	pthread_mutex_destroy(&s->lock);
+	free((char *)s);
+	return(error);
+}
+
+static PFdevops PFslowops = {
+	PFslowReadv, PFslowWritev, PFslowSize, PFslowTruncate,
+	PFslowAllocate, PFslowDirect, PFslowClose
+};
+
+
+/************************** Interface Routines **************************/
+
+int PFdevOpen(fname,flags,devp)
+char *fname;	/* name of the Unix file */
+int flags;	/* PF_OPEN_* flags */
+PFdev **devp;	/* set to the device */
+/****************************************************************************
+SPECIFICATIONS:
+	Open the device "flags" ask for on file "fname". A PF_OPEN_MAPPED
+	file is opened read-only.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PFE_INVALIDARG	if PF_OPEN_MEMORY or PF_OPEN_THROTTLED is given
+			with PF_OPEN_DIRECT or PF_OPEN_MAPPED.
+	PF error code if the file cannot be opened or loaded.
+*****************************************************************************/
+{
+PFdev *dev;
+PFslowdev *s;
+
+	if ((flags & (PF_OPEN_MEMORY|PF_OPEN_THROTTLED)) &&
+			(flags & (PF_OPEN_DIRECT|PF_OPEN_MAPPED))){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	if ((dev = (flags & PF_OPEN_MEMORY) ? PFmemOpen(fname) :
+			PFposixOpen(fname,(flags & PF_OPEN_MAPPED) != 0)) == NULL)
+		return(PFerrno);
+
+	if (flags & PF_OPEN_THROTTLED){
+		if ((s = (PFslowdev *)malloc(sizeof(PFslowdev))) == NULL){
+			(void)PFdevClose(dev);
+			PFerrno = PFE_NOMEM;
+			return(PFerrno);
+		}
+		s->dev.ops = &PFslowops;
+		s->under = dev;
+		s->readns = PFslowread * 1000LL;
+		s->writens = PFslowwrite * 1000LL;
+		s->nsperbyte = PFslowmbps > 0 ? 1e3 / PFslowmbps : 0.0;
+		s->busy = 0;
+		pthread_mutex_init(&s->lock,NULL);
+		dev = &s->dev;
+	}
+	*devp = dev;
+	return(PFE_OK);
+}
+
+
+int PFdevUnixFd(dev)
+PFdev *dev;
+/****************************************************************************
+SPECIFICATIONS:
+	Return the Unix file descriptor of posix device "dev", or -1 if
+	it is another kind of device.
+*****************************************************************************/
+{
+	return(dev->ops == &PFposixops ? ((PFposixdev *)dev)->unixfd : -1);
+}
+
+
+ssize_t PFdevPread(dev,buf,len,offset)
+PFdev *dev;
+char *buf;
+size_t len;
+off_t offset;
+/****************************************************************************
+SPECIFICATIONS:
+	pread() from device "dev".
+*****************************************************************************/
+{
+struct iovec iov;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	return(PFdevReadv(dev,&iov,1,offset));
+}
+
+
+ssize_t PFdevPwrite(dev,buf,len,offset)
+PFdev *dev;
+char *buf;
+size_t len;
+off_t offset;
+/****************************************************************************
+SPECIFICATIONS:
+	pwrite() to device "dev".
+*****************************************************************************/
+{
+struct iovec iov;
+
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	return(PFdevWritev(dev,&iov,1,offset));
+}
+
+
+int PFdevForget(fname)
+char *fname;	/* name of a file, not open */
+/****************************************************************************
+SPECIFICATIONS:
+	Free the memory image of file "fname", if it has one.
+
+RETURN VALUE:
+	TRUE if it had one, else FALSE.
+*****************************************************************************/
+{
+PFmemfile **mp, *m;
+
+	pthread_mutex_lock(&PFmemlock);
+	for (mp = &PFmemfiles; (m = *mp) != NULL && strcmp(m->fname,fname) != 0;
+			mp = &m->next)
+		;
+	if (m != NULL)
+		*mp = m->next;
+	pthread_mutex_unlock(&PFmemlock);
+	if (m == NULL)
+		return(FALSE);
+	pthread_rwlock_destroy(&m->lock);
+	free(m->fname);
+	free(m->data);
+	free((char *)m);
+	return(TRUE);
+}
+
+
+int PF_SetDeviceModel(read_us,write_us,mbps)
+int read_us;	/* latency of a read, in microseconds */
+int write_us;	/* latency of a write, in microseconds */
+int mbps;	/* bandwidth in MB/s (10^6 bytes), 0 for no limit */
+/****************************************************************************
+SPECIFICATIONS:
+	Set the device the files opened with PF_OPEN_THROTTLED from now
+	on behave as. Each page read or write, or run of adjacent pages
+	moved by one vectored call, takes the latency plus its bytes at
+	"mbps". Files already open keep the model they were opened with.
+	E.g. (8000,8000,150) is close to a hard disk, (80,20,2000) to an
+	NVMe drive.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PFE_INVALIDARG	if an argument is negative.
+*****************************************************************************/
+{
+	if (read_us < 0 || write_us < 0 || mbps < 0){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	PFslowread = read_us;
+	PFslowwrite = write_us;
+	PFslowmbps = mbps;
+	return(PFE_OK);
+}
@@ -0,0 +1,250 @@
+/* ghost.c: ghost directory. Remembers the (fd,page) identity of pages
+that were recently evicted from the buffer, without their data, so that
+a replacement policy can tell a re-reference from a first touch.
+Entries are kept in up to PF_GHOST_NLISTS lists, each ordered from most
+recently inserted (head) to least recently inserted (tail). */
+#include <stdlib.h>
+#include <stdio.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_GHOST_NIL	-1	/* end of an index-linked chain */
+
+/* one remembered page */
+typedef struct PFghost_entry {
+	int fd;		/* file descriptor */
+	int page;	/* page number */
+	int list;	/* list holding this entry, or PF_GHOST_NIL if free */
+	int next;	/* next entry towards the tail of the list */
+	int prev;	/* previous entry towards the head of the list */
+	int hnext;	/* next entry in the same hash bucket */
+} PFghost_entry;
+
+/* A directory is a PFghostdir (see pftypes.h); there is one per buffer
+partition, and the caller does the locking. */
+
+/* bucket of (fd,page) in directory "g" */
+#define PFghostHash(g,fd,page) (PFhash(fd,page) & (g)->mask)
+
+
+void PFghostInit(PFghostdir *g, int nentries)
+/****************************************************************************
+SPECIFICATIONS:
+	Make room for "nentries" ghost entries in "g", all of them free,
+	and empty all lists. The entries of a previous PFghostInit() of "g"
+	are released; "g" must be zeroed before its first one.
+
+RETURN VALUE: none. If memory runs out the directory stays empty and
+	every PFghostInsert() is ignored.
+
+*****************************************************************************/
+{
+int i;
+int nbuckets;
+
+	free((char *)g->tbl);
+	free((char *)g->bucket);
+	g->tbl = NULL;
+	g->bucket = NULL;
+	g->cap = 0;
+	g->free = PF_GHOST_NIL;
+	for (i = 0; i < PF_GHOST_NLISTS; i++){
+		g->head[i] = g->tail[i] = PF_GHOST_NIL;
+		g->len[i] = 0;
+	}
+
+	if (nentries <= 0)
+		return;
+
+	/* power of 2 buckets, about 2 per entry */
+	for (nbuckets = 1; nbuckets < 2 * nentries; nbuckets <<= 1)
+		;
+	g->tbl = (PFghost_entry *)malloc(nentries * sizeof(PFghost_entry));
+	g->bucket = (int *)malloc(nbuckets * sizeof(int));
+	if (g->tbl == NULL || g->bucket == NULL){
+		free((char *)g->tbl);
+		free((char *)g->bucket);
+		g->tbl = NULL;
+		g->bucket = NULL;
+		return;
+	}
+
+	g->cap = nentries;
+	g->mask = nbuckets - 1;
+	for (i = 0; i < nbuckets; i++)
+		g->bucket[i] = PF_GHOST_NIL;
+	for (i = 0; i < nentries; i++){
+		g->tbl[i].list = PF_GHOST_NIL;
+		g->tbl[i].next = i + 1 < nentries ? i + 1 : PF_GHOST_NIL;
+	}
+	g->free = 0;
+}
+
+
+static int PFghostLookup(PFghostdir *g, int fd, int page)
+/****************************************************************************
+SPECIFICATIONS:
+	Return the index of the entry for (fd,page), or PF_GHOST_NIL.
+*****************************************************************************/
+{
+int i;
+
+	if (g->cap == 0)
+		return(PF_GHOST_NIL);
+	for (i = g->bucket[PFghostHash(g,fd,page)]; i != PF_GHOST_NIL;
+					i = g->tbl[i].hnext)
+		if (g->tbl[i].fd == fd && g->tbl[i].page == page)
+			return(i);
+	return(PF_GHOST_NIL);
+}
+
+
+static void PFghostRemove(PFghostdir *g, int i)
+/****************************************************************************
+SPECIFICATIONS:
+	Unlink entry "i" from its list and its hash bucket, and put it
+	back into the free pool.
+*****************************************************************************/
+{
+PFghost_entry *e = &g->tbl[i];
+int *link;
+
+	/* list */
+	if (e->prev != PF_GHOST_NIL)
+		g->tbl[e->prev].next = e->next;
+	else	g->head[e->list] = e->next;
+	if (e->next != PF_GHOST_NIL)
+		g->tbl[e->next].prev = e->prev;
+	else	g->tail[e->list] = e->prev;
+	g->len[e->list]--;
+
+	/* hash bucket */
+	for (link = &g->bucket[PFghostHash(g,e->fd,e->page)];
+			*link != i; link = &g->tbl[*link].hnext)
+		;
+	*link = e->hnext;
+
+	e->list = PF_GHOST_NIL;
+	e->next = g->free;
+	g->free = i;
+}
+
+
+int PFghostFind(PFghostdir *g, int fd, int page)
+/****************************************************************************
+SPECIFICATIONS:
+	Find out whether (fd,page) is remembered.
+
+RETURN VALUE:
+	The list holding it, or -1 if it is not in the directory.
+*****************************************************************************/
+{
+int i;
+
+	if ((i = PFghostLookup(g,fd,page)) == PF_GHOST_NIL)
+		return(-1);
+	return(g->tbl[i].list);
+}
+
+
+void PFghostInsert(PFghostdir *g, int list, int fd, int page)
+/****************************************************************************
+SPECIFICATIONS:
+	Remember (fd,page) as the most recent entry of "list". If it is
+	already remembered it is moved there. When the pool is full the
+	least recent entry of "list" is forgotten to make room (or of the
+	longest list, if "list" is empty).
+*****************************************************************************/
+{
+int i;
+int victim;
+PFghost_entry *e;
+
+	if (g->cap == 0)
+		return;
+
+	if ((i = PFghostLookup(g,fd,page)) != PF_GHOST_NIL)
+		PFghostRemove(g,i);
+
+	if (g->free == PF_GHOST_NIL){
+		/* full: forget something */
+		victim = list;
+		if (g->len[victim] == 0)
+			for (i = 0; i < PF_GHOST_NLISTS; i++)
+				if (g->len[i] > g->len[victim])
+					victim = i;
+		PFghostRemove(g,g->tail[victim]);
+	}
+
+	i = g->free;
+	e = &g->tbl[i];
+	g->free = e->next;
+
+	e->fd = fd;
+	e->page = page;
+	e->list = list;
+	e->prev = PF_GHOST_NIL;
+	e->next = g->head[list];
+	if (g->head[list] != PF_GHOST_NIL)
+		g->tbl[g->head[list]].prev = i;
+	g->head[list] = i;
+	if (g->tail[list] == PF_GHOST_NIL)
+		g->tail[list] = i;
+	g->len[list]++;
+
+	e->hnext = g->bucket[PFghostHash(g,fd,page)];
+	g->bucket[PFghostHash(g,fd,page)] = i;
+}
+
+
+void PFghostDelete(PFghostdir *g, int fd, int page)
+/****************************************************************************
+SPECIFICATIONS:
+	Forget (fd,page), if it is remembered.
+*****************************************************************************/
+{
+int i;
+
+	if ((i = PFghostLookup(g,fd,page)) != PF_GHOST_NIL)
+		PFghostRemove(g,i);
+}
+
+
+void PFghostForget(PFghostdir *g, int fd)
+/****************************************************************************
+SPECIFICATIONS:
+	Forget the pages of file "fd", which is being closed: if another
+	file gets the same descriptor, its pages are new ones.
+*****************************************************************************/
+{
+int list;
+int i, next;
+
+	for (list = 0; list < PF_GHOST_NLISTS; list++)
+		for (i = g->head[list]; i != PF_GHOST_NIL; i = next){
+			next = g->tbl[i].next;
+			if (g->tbl[i].fd == fd)
+				PFghostRemove(g,i);
+		}
+}
+
+
+void PFghostDeleteLRU(PFghostdir *g, int list)
+/****************************************************************************
+SPECIFICATIONS:
+	Forget the least recent entry of "list", if there is one.
+*****************************************************************************/
+{
+	if (g->tail[list] != PF_GHOST_NIL)
+		PFghostRemove(g,g->tail[list]);
+}
+
+
+int PFghostLen(PFghostdir *g, int list)
+/****************************************************************************
+SPECIFICATIONS:
+	Return the # of entries in "list".
+*****************************************************************************/
+{
+	return(g->len[list]);
+}
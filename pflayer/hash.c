@@ -5,33 +5,133 @@ a file descriptor and a page number */
 #include "pf.h"
 #include "pftypes.h"
 
-/* hash table */
-static PFhash_entry *PFhashtbl[PF_HASH_TBL_SIZE];
+/* hash table: open addressing with linear probing. A slot is empty
+when its "bpage" is NULL. The table is kept at most half full, so
+probe sequences stay short; it is sized from the buffer pool by
+PFhashInit() and only grows (doubles) if more entries than that are
+inserted. Nothing is malloc'ed per entry. There can be several tables
+(one per buffer partition); each function works on the one it is given,
+and the caller does the locking. */
 
 
 
-void PFhashInit()
+static int PFhashAlloc(tab,nslots)
+PFhashtab *tab;		/* hash table */
+unsigned nslots;	/* # of slots, a power of 2 */
+/****************************************************************************
+SPECIFICATIONS:
+	Replace the slots of "tab" by "nslots" empty ones.
+	The old slots are not freed.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_NOMEM	if no mem. The old table is left in place.
+
+*****************************************************************************/
+{
+PFhash_entry *tbl;
+unsigned i;
+
+	if ((tbl=(PFhash_entry *)malloc(nslots*sizeof(PFhash_entry)))==NULL){
+		PFerrno = PFE_NOMEM;
+		return(PFerrno);
+	}
+	for (i=0; i < nslots; i++)
+		tbl[i].bpage = NULL;
+
+	tab->tbl = tbl;
+	tab->mask = nslots - 1;
+	tab->count = 0;
+	return(PFE_OK);
+}
+
+
+static unsigned PFhashSlot(tab,fd,page)
+PFhashtab *tab;	/* hash table */
+int fd;		/* file descriptor */
+int page;	/* page number */
+/****************************************************************************
+SPECIFICATIONS:
+	Return the slot holding (fd,page), or else the empty slot that
+	ends its probe sequence.
+*****************************************************************************/
+{
+unsigned slot;
+
+	for (slot = PFhash(fd,page) & tab->mask;
+			tab->tbl[slot].bpage != NULL;
+			slot = (slot + 1) & tab->mask)
+		if (tab->tbl[slot].fd == fd && tab->tbl[slot].page == page)
+			break;
+	return(slot);
+}
+
+
+void PFhashInit(tab,nentries)
+PFhashtab *tab;	/* hash table, or garbage if never initialized */
+int nentries;	/* # of entries expected, normally the buffer pool size */
 /****************************************************************************
 SPECIFICATIONS:
 	Init the hash table entries. Must be called before any of the other
-	hash functions are used.
+	hash functions are used on "tab". The table gets room for "nentries"
+	entries at a load factor of at most 1/2. The slots of a previous
+	PFhashInit() of "tab" are freed; "tab" must be zeroed before its
+	first one.
 
 AUTHOR: clc
 
-RETURN VALUE: none
+RETURN VALUE: none. If memory runs out the table is left empty, and
+	the first PFhashInsert() tries again.
 
-GLOBAL VARIABLES MODIFIED:
-	PFhashtbl
 *****************************************************************************/
 {
-int i;
+unsigned nslots;
+
+	free((char *)tab->tbl);
+	tab->tbl = NULL;
+	tab->mask = 0;
+	tab->count = 0;
+
+	for (nslots = PF_HASH_MIN_SLOTS; nslots < 2 * (unsigned)nentries;
+				nslots <<= 1)
+		;
+	(void)PFhashAlloc(tab,nslots);
+}
+
 
-	for (i=0; i < PF_HASH_TBL_SIZE; i++)
-		PFhashtbl[i] = NULL;
+static int PFhashGrow(tab)
+PFhashtab *tab;	/* hash table */
+/****************************************************************************
+SPECIFICATIONS:
+	Double the size of the hash table (or create it, if the last
+	PFhashInit() ran out of memory) and rehash all entries.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_NOMEM	if no mem. The old table is left in place.
+*****************************************************************************/
+{
+PFhash_entry *old = tab->tbl;
+unsigned oldslots = tab->tbl == NULL ? 0 : tab->mask + 1;
+unsigned i;
+int error;
+
+	if ((error=PFhashAlloc(tab,oldslots == 0 ? PF_HASH_MIN_SLOTS :
+				2*oldslots)) != PFE_OK)
+		return(error);
+
+	for (i=0; i < oldslots; i++)
+		if (old[i].bpage != NULL){
+			tab->tbl[PFhashSlot(tab,old[i].fd,old[i].page)] = old[i];
+			tab->count++;
+		}
+	free((char *)old);
+	return(PFE_OK);
 }
 
 
-PFbpage *PFhashFind(fd,page)
+PFbpage *PFhashFind(tab,fd,page)
+PFhashtab *tab;	/* hash table */
 int fd;		/* file descriptor */
 int page;	/* page number */
 /****************************************************************************
@@ -47,33 +147,60 @@ RETURN VALUE:
 
 *****************************************************************************/
 {
-int bucket;	/* bucket to look for the page*/
-PFhash_entry *entry; /* ptr to entries to search */
+	if (tab->tbl == NULL)
+		return(NULL);
 
+	/* an empty slot has bpage NULL, which is the "not found" answer */
+	return(tab->tbl[PFhashSlot(tab,fd,page)].bpage);
+}
 
-	/* See which bucket it is in */
-	bucket = PFhash(fd,page);
+PFbpage *PFhashPeek(tab,fd,page)
+PFhashtab *tab;	/* hash table */
+int fd;		/* file descriptor */
+int page;	/* page number */
+/****************************************************************************
+SPECIFICATIONS:
+	PFhashFind() for callers that do not hold the lock of the table,
+	while other threads may be inserting and deleting. The answer is
+	only a hint: an entry being moved by PFhashDelete() can be missed,
+	and the buffer page returned may already hold another page, so
+	the caller must check it. The table must never have grown (its
+	slots must not have been freed), which holds as long as it never
+	had more entries than PFhashInit() was told.
 
-	/* go through the linked list of this bucket */
-	for (entry=PFhashtbl[bucket]; entry != NULL; 
-				entry = entry->nextentry){
-		if (entry->fd == fd && entry->page == page )
-			/* found it */
-			return(entry->bpage);
+RETURN VALUE:
+	NULL	if not found.
+	Buffer address, if found.
+*****************************************************************************/
+{
+volatile PFhash_entry *tbl = tab->tbl;
+unsigned slot;
+unsigned n;
+PFbpage *bpage;
+
+	if (tbl == NULL)
+		return(NULL);
+
+	/* give up after a lap, in case entries keep moving under us */
+	for (slot = PFhash(fd,page) & tab->mask, n = 0; n <= tab->mask;
+			slot = (slot + 1) & tab->mask, n++){
+		if ((bpage = tbl[slot].bpage) == NULL)
+			return(NULL);
+		if (tbl[slot].fd == fd && tbl[slot].page == page)
+			return(bpage);
 	}
-
-	/* not found */
 	return(NULL);
 }
 
-PFhashInsert(fd,page,bpage)
+int PFhashInsert(tab,fd,page,bpage)
+PFhashtab *tab;	/* hash table */
 int fd;		/* file descriptor */
 int page;	/* page number */
 PFbpage *bpage;	/* buffer address for this page */
 /*****************************************************************************
 SPECIFICATIONS:
 	Insert the file descriptor "fd", page number "page", and the
-	buffer address "bpage" into the hash table. 
+	buffer address "bpage" into the hash table.
 
 AUTHOR: clc
 
@@ -81,45 +208,34 @@ RETURN VALUE:
 	PFE_OK	if OK
 	PFE_NOMEM	if nomem
 	PFE_HASHPAGEEXIST if the page already exists.
-	
-GLOBAL VARIABLES MODIFIED:
-	PFhashtbl
+
 *****************************************************************************/
 {
-int bucket;	/* bucket to insert the page */
-PFhash_entry *entry; /* pointer to new entry */
+unsigned slot;	/* slot to insert the page */
+int error;
 
+	/* keep the load factor at or below 1/2 */
+	if (tab->tbl == NULL || 2 * (unsigned)(tab->count + 1) > tab->mask + 1)
+		if ((error=PFhashGrow(tab))!= PFE_OK)
+			return(error);
 
-	if (PFhashFind(fd,page) != NULL){
+	slot = PFhashSlot(tab,fd,page);
+	if (tab->tbl[slot].bpage != NULL){
 		/* page already inserted */
 		PFerrno = PFE_HASHPAGEEXIST;
 		return(PFerrno);
 	}
 
-	/* find the bucket for this page */
-	bucket = PFhash(fd,page);
-	
-	/* allocate mem for new entry */
-	if ((entry=(PFhash_entry *)malloc(sizeof(PFhash_entry)))== NULL){
-		/* no mem */
-		PFerrno = PFE_NOMEM;
-		return(PFerrno);
-	}
-
-	/* Insert entry as head of list for this bucket */
-	entry->fd = fd;
-	entry->page = page;
-	entry->bpage = bpage;
-	entry->nextentry = PFhashtbl[bucket];
-	entry->preventry = NULL;
-	if (PFhashtbl[bucket] != NULL)
-		PFhashtbl[bucket]->preventry = entry;
-	PFhashtbl[bucket] = entry;
+	tab->tbl[slot].fd = fd;
+	tab->tbl[slot].page = page;
+	tab->tbl[slot].bpage = bpage;
+	tab->count++;
 
 	return(PFE_OK);
 }
 
-PFhashDelete(fd,page)
+int PFhashDelete(tab,fd,page)
+PFhashtab *tab;	/* hash table */
 int fd;		/* file descriptor */
 int page;	/* page number */
 /****************************************************************************
@@ -133,41 +249,40 @@ RETURN VALUE:
 	PFE_OK	if OK
 	PFE_HASHNOTFOUND if can't find the entry
 
-GLOBAL VARIABLES MODIFIED:
-	PFhashtbl
+IMPLEMENTATION NOTES:
+	Deletion shifts later members of the probe sequence back into the
+	hole, so no tombstones are needed and lookups never slow down.
 *****************************************************************************/
 {
-int bucket;	/* bucket for this page */
-PFhash_entry *entry;	/* entry to look for */
-
-	/* find the bucket */
-	bucket = PFhash(fd,page);
-
-	/* See if the entry is in this bucket */
-	for (entry=PFhashtbl[bucket]; entry != NULL; entry = entry->nextentry)
-		if (entry->fd == fd && entry->page == page)
-			break;
+unsigned hole;	/* slot being emptied */
+unsigned slot;	/* slot after the hole being examined */
+unsigned home;	/* slot where the entry in "slot" hashes to */
 
-	if (entry == NULL){
+	if (tab->tbl == NULL || tab->tbl[hole=PFhashSlot(tab,fd,page)].bpage == NULL){
 		/* not found */
 		PFerrno = PFE_HASHNOTFOUND;
 		return(PFerrno);
 	}
 
-	/* get rid of this entry */
-	if (entry == PFhashtbl[bucket])
-		PFhashtbl[bucket] = entry->nextentry;
-	if (entry->preventry != NULL)
-		entry->preventry->nextentry = entry->nextentry;
-	if (entry->nextentry != NULL)
-		entry->nextentry->preventry = entry->preventry;
-	free((char *)entry);
+	for (slot = (hole + 1) & tab->mask; tab->tbl[slot].bpage != NULL;
+				slot = (slot + 1) & tab->mask){
+		home = PFhash(tab->tbl[slot].fd,tab->tbl[slot].page) & tab->mask;
+		/* the entry can fill the hole unless its home lies
+		cyclically in (hole,slot] */
+		if (((slot - home) & tab->mask) >= ((slot - hole) & tab->mask)){
+			tab->tbl[hole] = tab->tbl[slot];
+			hole = slot;
+		}
+	}
+	tab->tbl[hole].bpage = NULL;
+	tab->count--;
 
 	return(PFE_OK);
 }
 
 
-PFhashPrint()
+void PFhashPrint(tab)
+PFhashtab *tab;	/* hash table */
 /****************************************************************************
 SPECIFICATIONS:
 	Print the hash table entries.
@@ -177,18 +292,15 @@ AUTHOR: clc
 RETURN VALUE: None
 *****************************************************************************/
 {
-int i;
-PFhash_entry *entry;
-
-	for (i=0; i < PF_HASH_TBL_SIZE; i++){
-		printf("bucket %d\n",i);
-		if (PFhashtbl[i] == NULL)
-			printf("\tempty\n");
-		else{
-			for (entry = PFhashtbl[i]; entry != NULL;
-					entry = entry->nextentry)
-				printf("\tfd: %d, page: %d %d\n",
-					entry->fd, entry->page,entry->bpage);
-		}
+unsigned i;
+
+	if (tab->tbl == NULL || tab->count == 0){
+		printf("\tempty\n");
+		return;
 	}
+	for (i=0; i <= tab->mask; i++)
+		if (tab->tbl[i].bpage != NULL)
+			printf("slot %u\tfd: %d, page: %d %p\n",
+				i, tab->tbl[i].fd, tab->tbl[i].page,
+				(void *)tab->tbl[i].bpage);
 }
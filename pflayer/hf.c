@@ -78,7 +78,8 @@ void HF_InitPage(char *pageBuffer) {
 
 /* --- Core HF Functions --- */
 
-int HF_InsertRec(int fileDesc, char *record, int length, RecId *recId) {
+// HF_InsertRec(), without the timing
+static int HFinsertRec(int fileDesc, char *record, int length, RecId *recId) {
     int pageNum = -1;
     char *pageBuffer;
     HF_PageHeader *header;
@@ -95,9 +96,7 @@ int HF_InsertRec(int fileDesc, char *record, int length, RecId *recId) {
                         (sizeof(HF_PageHeader) + (header->numSlots * sizeof(HF_Slot)));
         
         if (freeSpace >= neededSpace) {
-            // Found a page! Unfix it (clean) and break the loop.
-            // We'll re-Get it as fixed later.
-            PF_UnfixPage(fileDesc, pageNum, FALSE);
+            // Found a page! Keep it fixed and break the loop.
             break; 
         }
 
@@ -118,14 +117,9 @@ int HF_InsertRec(int fileDesc, char *record, int length, RecId *recId) {
     } else if (pfErr != PFE_OK) {
         return HFE_PF; // Some other PF error
     
-    } else {
-        // We found a page (pageNum) in the loop.
-        // We must Get it again to fix it in the buffer.
-        if ((pfErr = PF_GetThisPage(fileDesc, pageNum, &pageBuffer)) != PFE_OK) {
-            return HFE_PF;
-        }
-        header = (HF_PageHeader *)pageBuffer;
     }
+    // else: we found a page (pageNum) in the loop, still fixed, and
+    // header already points into it.
 
     // 3. Insert the record into the page (pageBuffer)
     
@@ -156,6 +150,15 @@ int HF_InsertRec(int fileDesc, char *record, int length, RecId *recId) {
     return HFE_OK;
 }
 
+// Timed while PF_SetLatency() is on
+int HF_InsertRec(int fileDesc, char *record, int length, RecId *recId) {
+    long long start = PFlatStart();
+    int error = HFinsertRec(fileDesc, record, length, recId);
+
+    PFlatEnd(PF_LAT_HFINSERT, start);
+    return error;
+}
+
 
 int HF_DeleteRec(int fileDesc, RecId recId) {
     char *pageBuffer;
@@ -219,7 +222,8 @@ int HF_OpenScan(int fileDesc) {
 }
 
 
-int HF_FindNextRec(int scanDesc, char *record, RecId *recId) {
+// HF_FindNextRec(), without the timing
+static int HFfindNextRec(int scanDesc, char *record, RecId *recId) {
     // 1. Check for valid scan descriptor
     if (scanDesc < 0 || scanDesc >= HF_MAX_SCANS || 
         HF_ScanTable[scanDesc].status != SC_OPEN) {
@@ -291,6 +295,16 @@ int HF_FindNextRec(int scanDesc, char *record, RecId *recId) {
 }
 
 
+// Timed while PF_SetLatency() is on
+int HF_FindNextRec(int scanDesc, char *record, RecId *recId) {
+    long long start = PFlatStart();
+    int error = HFfindNextRec(scanDesc, record, recId);
+
+    PFlatEnd(PF_LAT_HFFINDNEXT, start);
+    return error;
+}
+
+
 int HF_CloseScan(int scanDesc) {
     // 1. Check for valid scan descriptor
     if (scanDesc < 0 || scanDesc >= HF_MAX_SCANS || 
@@ -0,0 +1,219 @@
+/* lat.c: latency histograms of the public PF, HF and AM calls. Each
+call to time brackets its work with PFlatStart() and PFlatEnd(); while
+histograms are off (the default) that costs a test of PFlaton. While on,
+the elapsed CLOCK_MONOTONIC time is added to the histogram of the
+operation. A histogram has 8 buckets per power of two of nanoseconds,
+so a percentile read from it is within 12.5% of the true value. */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "pf.h"
+
+#define PF_LAT_SUB	8	/* buckets per power of two */
+#define PF_LAT_SUBBITS	3	/* log2(PF_LAT_SUB) */
+#define PF_LAT_NBUCKETS	((64 - PF_LAT_SUBBITS + 1) * PF_LAT_SUB)
+
+/* histogram of one operation. Buckets are added to atomically, by
+any thread; a dump taken meanwhile may miss the calls in flight. */
+typedef struct PFlathist {
+	long long bucket[PF_LAT_NBUCKETS];	/* # of calls per bucket */
+	long long sum;		/* ns taken by them */
+	long long max;		/* ns taken by the slowest */
+} PFlathist;
+
+int PFlaton = FALSE;	/* TRUE while calls are timed */
+static PFlathist PFlathists[PF_LAT_NOPS];
+
+static char *PFlatnames[PF_LAT_NOPS] = {
+	"PF_GetThisPage",
+	"PF_AllocPage",
+	"HF_InsertRec",
+	"HF_FindNextRec",
+	"AM_InsertEntry",
+	"AM_FindNextEntry"
+};
+
+/* bucket of a call that took "ns" nanoseconds: values below PF_LAT_SUB
+have one each, then each power of two is split in PF_LAT_SUB */
+static int PFlatBucket(ns)
+unsigned long long ns;
+{
+int e;
+
+	if (ns < PF_LAT_SUB)
+		return((int)ns);
+	e = 63 - __builtin_clzll(ns);	/* ns >= 2^e */
+	return((e - PF_LAT_SUBBITS + 1) * PF_LAT_SUB +
+		(int)((ns >> (e - PF_LAT_SUBBITS)) & (PF_LAT_SUB - 1)));
+}
+
+/* largest number of ns counted in bucket "b" */
+static long long PFlatBucketMax(b)
+int b;
+{
+int e;
+
+	if (b < PF_LAT_SUB)
+		return((long long)b);
+	e = b / PF_LAT_SUB + PF_LAT_SUBBITS - 1;
+	return((long long)((((unsigned long long)(PF_LAT_SUB + b % PF_LAT_SUB) + 1)
+		<< (e - PF_LAT_SUBBITS)) - 1));
+}
+
+/* # of calls counted in histogram "h" */
+static long long PFlatCount(h)
+PFlathist *h;
+{
+long long count = 0;
+int b;
+
+	for (b = 0; b < PF_LAT_NBUCKETS; b++)
+		count += h->bucket[b];
+	return(count);
+}
+
+static long long PFlatNow()
+{
+struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+
+
+long long PFlatStart()
+/****************************************************************************
+SPECIFICATIONS:
+	Start timing a call.
+
+RETURN VALUE:
+	The time to pass to PFlatEnd(), or 0 if histograms are off.
+*****************************************************************************/
+{
+	return(PFlaton ? PFlatNow() : 0);
+}
+
+
+void PFlatEnd(op,start)
+int op;		/* PF_LAT_* operation */
+long long start;	/* returned by PFlatStart() */
+/****************************************************************************
+SPECIFICATIONS:
+	Add the time since "start" to the histogram of "op". Nothing is
+	done if "start" is 0, so turning histograms on or off while a
+	call is timed is harmless.
+
+RETURN VALUE: none
+*****************************************************************************/
+{
+PFlathist *h = &PFlathists[op];
+long long ns, max;
+
+	if (start == 0)
+		return;
+	ns = PFlatNow() - start;
+	__sync_fetch_and_add(&h->bucket[PFlatBucket((unsigned long long)ns)], 1);
+	__sync_fetch_and_add(&h->sum, ns);
+	while (ns > (max = *(volatile long long *)&h->max) &&
+			!__sync_bool_compare_and_swap(&h->max, max, ns))
+		;
+}
+
+
+void PF_SetLatency(on)
+int on;		/* TRUE to time calls, FALSE to stop */
+/****************************************************************************
+SPECIFICATIONS:
+	Start or stop timing the calls of PF_GetThisPage(), PF_AllocPage(),
+	HF_InsertRec(), HF_FindNextRec(), AM_InsertEntry() and
+	AM_FindNextEntry(). Their histograms are kept until
+	PF_ResetLatency(); PF_Init() leaves them alone too.
+
+RETURN VALUE: none
+*****************************************************************************/
+{
+	PFlaton = on;
+}
+
+
+void PF_ResetLatency()
+/****************************************************************************
+SPECIFICATIONS:
+	Empty all latency histograms. Calls being timed by other threads
+	meanwhile may or may not be kept.
+
+RETURN VALUE: none
+*****************************************************************************/
+{
+	memset((char *)PFlathists, 0, sizeof(PFlathists));
+}
+
+
+long long PF_GetLatency(op,pct)
+int op;		/* PF_LAT_* operation */
+double pct;	/* percentile, 0 to 100, e.g. 99.9 */
+/****************************************************************************
+SPECIFICATIONS:
+	Find the "pct" percentile of the times taken by the calls of "op":
+	at least pct percent of them took no longer.
+
+RETURN VALUE:
+	The percentile in ns, the upper end of the histogram bucket it
+	falls in (but no more than the slowest call), 0 if no call of
+	"op" was timed, or PFE_INVALIDARG if "op" or "pct" is out of range.
+*****************************************************************************/
+{
+PFlathist *h;
+long long want, seen, count, max, ns;
+int b;
+
+	if (op < 0 || op >= PF_LAT_NOPS || pct < 0 || pct > 100){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	h = &PFlathists[op];
+	count = PFlatCount(h);
+	max = h->max;
+	if (count == 0)
+		return(0);
+
+	/* the rank of the percentile, rounded up, at least 1 */
+	want = (long long)(pct / 100 * count);
+	if (want < pct / 100 * count || want == 0)
+		want++;
+	seen = 0;
+	for (b = 0; b < PF_LAT_NBUCKETS - 1; b++)
+		if ((seen += h->bucket[b]) >= want)
+			break;
+	ns = PFlatBucketMax(b);
+	return(ns < max ? ns : max);
+}
+
+
+void PF_PrintLatency()
+/****************************************************************************
+SPECIFICATIONS:
+	Print the # of calls, mean, p50, p90, p99, p99.9 and maximum time
+	of every operation timed since PF_ResetLatency(), in microseconds.
+
+RETURN VALUE: none
+*****************************************************************************/
+{
+PFlathist *h;
+long long count;
+int op;
+
+	printf("Latency (us):\n");
+	printf("  %-18s %10s %9s %9s %9s %9s %9s %9s\n", "call", "calls",
+		"mean", "p50", "p90", "p99", "p99.9", "max");
+	for (op = 0; op < PF_LAT_NOPS; op++){
+		h = &PFlathists[op];
+		if ((count = PFlatCount(h)) == 0)
+			continue;
+		printf("  %-18s %10lld %9.2f %9.2f %9.2f %9.2f %9.2f %9.2f\n",
+			PFlatnames[op], count, h->sum / 1e3 / count,
+			PF_GetLatency(op,50.0) / 1e3, PF_GetLatency(op,90.0) / 1e3,
+			PF_GetLatency(op,99.0) / 1e3, PF_GetLatency(op,99.9) / 1e3,
+			h->max / 1e3);
+	}
+}
@@ -0,0 +1,260 @@
+/* mrc.c: reuse distance tracker, estimating the miss ratio curve of the
+buffer: the hit rate an LRU pool of each size would have had. The reuse
+distance of a get is the # of distinct pages got since the previous get
+of the same page; it hits in an LRU pool of more pages than that.
+
+Distances are only measured for a sample of the pages (SHARDS, Waldspurger
+et al.): those whose PFmrcHash() has its low "shift" bits 0. Among them
+the distance is 1/2^shift of the real one, so it is scaled up by 2^shift,
+and each sampled get stands for 2^shift gets. A partition only sees
+1/scale of the pages, so its distances are scaled up by "scale" too.
+When more than PF_MRC_MAXPAGES pages are sampled the rate is halved and
+the pages no longer sampled are forgotten, so a tracker never grows
+past that. */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_MRC_NTIMES	(4*PF_MRC_MAXPAGES)	/* times before renumbering */
+
+/* one sampled page */
+typedef struct PFmrc_entry {
+	int fd;		/* file descriptor, -1 if the slot is empty */
+	int page;	/* page number */
+	int time;	/* time of its last get */
+} PFmrc_entry;
+
+/* A tracker is a PFmrc (see pftypes.h); there is one per buffer
+partition, and the caller does the locking. */
+
+static int PFmrcsizes[PF_MRC_NPOINTS];	/* pool sizes of the curve */
+
+/* slot of (fd,page) in the table of "m" */
+#define PFmrcSlot(m,fd,page) (PFhash(fd,page) & (m)->mask)
+
+
+int PFmrcSize(point)
+int point;	/* 0 to PF_MRC_NPOINTS-1 */
+/****************************************************************************
+SPECIFICATIONS:
+	Return the pool size of curve point "point": 8 pages for point
+	0, then 4 points for each doubling.
+*****************************************************************************/
+{
+int i;
+
+	if (PFmrcsizes[0] == 0)
+		for (i = 0; i < PF_MRC_NPOINTS; i++)
+			/* 8 * 2^(i/4), rounded */
+			PFmrcsizes[i] = (int)((8 << i / 4) *
+				(i % 4 == 0 ? 1.0 : i % 4 == 1 ? 1.189207 :
+				i % 4 == 2 ? 1.414214 : 1.681793) + 0.5);
+	return(PFmrcsizes[point]);
+}
+
+
+/* add "n" at time "t" of the Fenwick tree of "m" */
+static void PFmrcTreeAdd(m,t,n)
+PFmrc *m;
+int t, n;
+{
+	for (t++; t <= PF_MRC_NTIMES; t += t & -t)
+		m->tree[t] += n;
+}
+
+/* # of pages kept whose last get was at time "t" or before */
+static int PFmrcTreeSum(m,t)
+PFmrc *m;
+int t;
+{
+int n = 0;
+
+	for (t++; t > 0; t -= t & -t)
+		n += m->tree[t];
+	return(n);
+}
+
+
+static int PFmrcTimeCmp(a,b)
+PFmrc_entry **a, **b;
+{
+	return((*a)->time - (*b)->time);
+}
+
+static void PFmrcRebuild(m,fd)
+PFmrc *m;
+int fd;		/* forget pages of this file, -1 for none */
+/****************************************************************************
+SPECIFICATIONS:
+	Drop the pages of "fd" and the pages no longer sampled from "m",
+	and renumber the times of the others from 0, keeping their order.
+*****************************************************************************/
+{
+PFmrc_entry *old, **live, *e;
+int i, n, slot;
+
+	/* keep the live entries, oldest get first */
+	old = m->tbl;
+	if ((m->tbl = (PFmrc_entry *)malloc((m->mask + 1) * sizeof(PFmrc_entry))) == NULL ||
+			(live = (PFmrc_entry **)malloc((m->count + 1) * sizeof(PFmrc_entry *))) == NULL){
+		/* stop tracking */
+		free((char *)m->tbl);
+		m->tbl = old;
+		PFmrcInit(m, 0);
+		return;
+	}
+	for (i = 0, n = 0; i <= m->mask; i++)
+		if (old[i].fd >= 0 && old[i].fd != fd &&
+				PFmrcSampled(m,old[i].fd,old[i].page))
+			live[n++] = &old[i];
+	qsort((char *)live, n, sizeof(PFmrc_entry *), PFmrcTimeCmp);
+
+	for (i = 0; i <= m->mask; i++)
+		m->tbl[i].fd = -1;
+	memset((char *)m->tree, 0, (PF_MRC_NTIMES + 1) * sizeof(int));
+	for (i = 0; i < n; i++){
+		for (slot = PFmrcSlot(m,live[i]->fd,live[i]->page);
+				m->tbl[slot].fd >= 0; slot = (slot + 1) & m->mask)
+			;
+		e = &m->tbl[slot];
+		*e = *live[i];
+		e->time = i;
+		PFmrcTreeAdd(m, i, 1);
+	}
+	m->count = n;
+	m->clock = n;
+	free((char *)live);
+	free((char *)old);
+}
+
+
+void PFmrcInit(PFmrc *m, int scale)
+/****************************************************************************
+SPECIFICATIONS:
+	Start tracking in "m", for a partition that sees 1/"scale" of the
+	pages, with an empty curve. The memory of a previous PFmrcInit()
+	of "m" is released; "m" must be zeroed before its first one. A
+	"scale" of 0 turns tracking off.
+
+RETURN VALUE: none. If memory runs out "m" does not track anything.
+*****************************************************************************/
+{
+int i;
+
+	free((char *)m->tbl);
+	free((char *)m->tree);
+	memset((char *)m, 0, sizeof(PFmrc));
+	m->shift = PF_MRC_SHIFT0;
+	if (scale <= 0)
+		return;
+
+	/* power of 2 slots, at least 2 per page */
+	for (m->mask = 1; m->mask < 2 * PF_MRC_MAXPAGES; m->mask <<= 1)
+		;
+	m->tbl = (PFmrc_entry *)malloc(m->mask * sizeof(PFmrc_entry));
+	m->tree = (int *)calloc(PF_MRC_NTIMES + 1, sizeof(int));
+	if (m->tbl == NULL || m->tree == NULL){
+		PFmrcInit(m, 0);
+		return;
+	}
+	for (i = 0; i < m->mask; i++)
+		m->tbl[i].fd = -1;
+	m->mask--;
+	m->scale = scale;
+}
+
+
+int PFmrcRef(PFmrc *m, int fd, int page, int counted)
+/****************************************************************************
+SPECIFICATIONS:
+	Page "page" of file "fd" was got. If it is sampled, measure its
+	reuse distance, and if "counted" is TRUE add the get to the
+	curve. A new page being allocated is not counted: it is not read,
+	but it is now the most recently used.
+
+RETURN VALUE:
+	TRUE if the page is sampled, else FALSE.
+*****************************************************************************/
+{
+PFmrc_entry *e;
+long long dist;		/* scaled reuse distance, -1 if none */
+int slot, b;
+
+	if (m->tbl == NULL || !PFmrcSampled(m,fd,page))
+		return(FALSE);
+	if (m->clock == PF_MRC_NTIMES){
+		/* out of times: renumber */
+		PFmrcRebuild(m, -1);
+		if (m->tbl == NULL)
+			return(FALSE);
+	}
+
+	for (slot = PFmrcSlot(m,fd,page); m->tbl[slot].fd >= 0;
+			slot = (slot + 1) & m->mask)
+		if (m->tbl[slot].fd == fd && m->tbl[slot].page == page)
+			break;
+	e = &m->tbl[slot];
+	if (e->fd >= 0){
+		/* pages got since: those got last after this one */
+		dist = (long long)(m->count - PFmrcTreeSum(m, e->time)) *
+			m->scale << m->shift;
+		PFmrcTreeAdd(m, e->time, -1);
+	}
+	else {
+		dist = -1;
+		if (m->count == PF_MRC_MAXPAGES){
+			/* sample half as many pages, until some go */
+			while (m->tbl != NULL && m->count == PF_MRC_MAXPAGES){
+				m->shift++;
+				PFmrcRebuild(m, -1);
+			}
+			if (m->tbl == NULL || !PFmrcSampled(m,fd,page))
+				return(FALSE);
+			for (slot = PFmrcSlot(m,fd,page); m->tbl[slot].fd >= 0;
+					slot = (slot + 1) & m->mask)
+				;
+			e = &m->tbl[slot];
+		}
+		e->fd = fd;
+		e->page = page;
+		m->count++;
+	}
+
+	if (counted){
+		/* the first point with more pages than the distance */
+		for (b = 0; dist >= 0 && b < PF_MRC_NPOINTS &&
+				dist >= PFmrcSize(b); b++)
+			;
+		b = dist < 0 ? PF_MRC_NPOINTS : b;
+		m->hist[b] += 1LL << m->shift;
+		m->win[b] += 1LL << m->shift;
+		m->nsampled++;
+	}
+
+	e->time = m->clock++;
+	PFmrcTreeAdd(m, e->time, 1);
+	return(TRUE);
+}
+
+
+void PFmrcForget(PFmrc *m, int fd)
+/****************************************************************************
+SPECIFICATIONS:
+	Forget the pages of file "fd", which is being closed: if another
+	file gets the same descriptor, its pages are new ones.
+
+RETURN VALUE: none
+*****************************************************************************/
+{
+int i;
+
+	if (m->tbl == NULL)
+		return;
+	for (i = 0; i <= m->mask; i++)
+		if (m->tbl[i].fd == fd)
+			break;
+	if (i <= m->mask)
+		PFmrcRebuild(m, fd);
+}
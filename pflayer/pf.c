@@ -1,22 +1,31 @@
 /* pf.c: Paged File Interface Routines+ support routines */
+#define _GNU_SOURCE	/* for O_DIRECT */
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <errno.h>
 #include <sys/file.h>
 #include "pf.h"
 #include "pftypes.h"
 
-/* To keep system V and PC users happy */
-#ifndef L_SET
-#define L_SET 0
-#endif
-
-int PFerrno = PFE_OK;	/* last error message */
+__thread int PFerrno = PFE_OK;	/* last error message, of each thread */
+long long PFiocalls = 0;	/* # of page read/write system calls */
+static long long PFclosedread = 0;	/* page bytes read from, and */
+static long long PFclosedwritten = 0;	/* written to, files since closed */
+static int PFextentpages = 0;	/* pages reserved at a time when a file
+				grows, 0 to let it grow page by page */
+static int PFreadaheadon = TRUE;	/* FALSE if scans do not read ahead */
 
 static PFftab_ele PFftab[PF_FTAB_SIZE]; /* table of opened files */
+static pthread_mutex_t PFftabmutex = PTHREAD_MUTEX_INITIALIZER; /* held
+				while files are opened or closed */
 
 /* true if file descriptor fd is invaild */
 #define PFinvalidFd(fd) ((fd) < 0 || (fd) >= PF_FTAB_SIZE \
@@ -27,11 +36,49 @@ sense that it's <0 or >= # of pages in the file */
 #define PFinvalidPagenum(fd,pagenum) ((pagenum)<0 || (pagenum) >= \
 				PFftab[fd].hdr.numpages)
 
+/* # of data pages per map page of file "fd", which is V2 or V3 */
+#define PFmapEntries(fd) (PFftab[fd].format == PF_FORMAT_V3 ? \
+		PF_BITMAP_ENTRIES : PF_MAP_ENTRIES)
+
+/* # of map and checksum pages per map group of file "fd" */
+#define PFmetaPages(fd) (1 + PFftab[fd].crcpages)
+
+/* file offset of page "pagenum" of file "fd", and # of bytes it takes */
+#define PFpageOffset(fd,pagenum) (PFftab[fd].format != PF_FORMAT_V1 ? \
+		PFgroupPageOffset(pagenum,PFmapEntries(fd),PFmetaPages(fd)) : \
+		(off_t)(pagenum)*PF_FPAGE_SIZE + PF_HDR_SIZE)
+#define PFpageSize(fd) (PFftab[fd].format != PF_FORMAT_V1 ? \
+		PF_PAGE_SIZE : PF_FPAGE_SIZE)
+
+/* V3: bit of page "pagenum" in bitmap "map" */
+#define PFbitByte(map,pagenum) (((unsigned char *)(map))[(pagenum)>>3])
+#define PFbitMask(pagenum) (1 << ((pagenum)&7))
+#define PFbitTest(map,pagenum) (PFbitByte(map,pagenum) & PFbitMask(pagenum))
+
+/* TRUE if the map of file "fd" says page "pagenum" is free, so it need
+not be read to find out; always FALSE for a V1 file. The map may be
+replaced meanwhile, see PFmapGrow(). */
+#define PFmapSaysFree(fd,pagenum) (PFftab[fd].format == PF_FORMAT_V2 ? \
+		(*(int * volatile *)&PFftab[fd].pagemap)[pagenum] != PF_PAGE_USED : \
+		PFftab[fd].format == PF_FORMAT_V3 && \
+		!PFbitTest(*(int * volatile *)&PFftab[fd].pagemap,pagenum))
+
+/* TRUE if page "pagenum" of file "fd", fixed at "fpage", is used. The
+buffer copy of a V3 page's "nextfree" is not kept up to date, as
+disposing the page does not fix it; the bitmap is. */
+#define PFpageUsed(fd,pagenum,fpage) (PFftab[fd].format == PF_FORMAT_V3 ? \
+		PFbitTest(*(int * volatile *)&PFftab[fd].pagemap,pagenum) != 0 : \
+		(fpage)->nextfree == PF_PAGE_USED)
+
+/* TRUE if file "fd" was opened with PF_OPEN_MAPPED */
+#define PFmapped(fd) (PFftab[fd].flags & PF_OPEN_MAPPED)
+
 
 
 /* --- NEW: Prototypes for buffer manager functions in buf.c --- */
 extern void PFbufInit(int buf_size, int strategy);
 extern void PFbufPrintStats();
+extern int PFbufARCTarget();
 /* --- END NEW --- */
 
 
@@ -76,459 +123,2289 @@ int i;
 	return(-1);
 }
 
-static PFftabFindFree()
+static int PFsetiov(fd,iov,buf)
+int fd;			/* file descriptor */
+struct iovec iov[2];	/* set to describe the page */
+PFfpage *buf;		/* page in memory */
 /****************************************************************************
 SPECIFICATIONS:
-	Find a free entry in the open file table "PFtab", and return its
-	index.
-
-AUTHOR: clc
+	Describe page "buf" as it is laid out in file "fd": for a V1 file
+	its "nextfree" followed by its data, for a V2 or V3 file just the
+	data ("nextfree" lives in the map pages).
 
 RETURN VALUE:
-	If >=0, the index of the free entry.
-	Otherwise, none can be found.
-
+	The # of entries of iov[] used.
 *****************************************************************************/
 {
-int i;
+int n = 0;
 
-	for (i=0; i < PF_FTAB_SIZE; i++)
-		if (PFftab[i].fname == NULL)
-			return(i);
-	return(-1);
+	if (PFftab[fd].format == PF_FORMAT_V1){
+		iov[n].iov_base = (char *)&buf->nextfree;
+		iov[n++].iov_len = sizeof(buf->nextfree);
+	}
+	iov[n].iov_base = buf->pagebuf;
+	iov[n++].iov_len = PF_PAGE_SIZE;
+	return(n);
 }
 
-PFreadfcn(fd,pagenum,buf)
-int fd;	/* file descriptor */
-int pagenum; /* page number */
-PFfpage *buf;
+static int PFmapGrow(fd,numpages)
+int fd;		/* file descriptor of a V2 or V3 file */
+int numpages;	/* # of pages the map must describe */
 /****************************************************************************
 SPECIFICATIONS:
-	Read the paged numbered "pagenum" from the file indexed by "fd"
-	into the page buffer "buf".
-
-AUTHOR: clc
+	Make sure PFftab[fd].pagemap[] has room for "numpages" pages,
+	and PFftab[fd].crcs[] too if the file has checksums. New map and
+	checksum pages are marked changed, so they get written on close.
 
 RETURN VALUE:
 	PFE_OK	if ok
-	PF error code if not OK.
+	PFE_NOMEM	if no memory.
+
+IMPLEMENTATION NOTES:
+	Other threads read the map without a lock, so it is not realloc()'ed:
+	a larger copy replaces it, and the old one is kept until close.
+	Doubling the size each time keeps the old ones smaller than the
+	current map put together.
 *****************************************************************************/
 {
-int error;
+PFftab_ele *f = &PFftab[fd];
+int ngroups = (numpages + PFmapEntries(fd) - 1) / PFmapEntries(fd);
+int cap;
+int *map;
+char *dirty;
+PFcrcgroup **crcs = NULL;
+int i;
 
-	/* seek to the appropriate place */
-	if ((error=lseek(PFftab[fd].unixfd,pagenum*sizeof(PFfpage)+PF_HDR_SIZE,
-				L_SET)) == -1){
-		PFerrno = PFE_UNIX;
-		return(PFerrno);
-	}
+	if (ngroups <= f->mapgroups)
+		return(PFE_OK);
 
-	/* read the data */
-	if((error=read(PFftab[fd].unixfd,(char *)buf,sizeof(PFfpage)))
-			!=sizeof(PFfpage)){
-		if (error <0)
-			PFerrno = PFE_UNIX;
-		else	PFerrno = PFE_INCOMPLETEREAD;
-		return(PFerrno);
+	if (ngroups > f->mapcap){
+		for (cap = f->mapcap > 0 ? 2*f->mapcap : 1; cap < ngroups; cap *= 2)
+			;
+		if (f->nmapold == PF_MAP_NOLD ||
+				(map=malloc(cap*PF_PAGE_SIZE))== NULL){
+			PFerrno = PFE_NOMEM;
+			return(PFerrno);
+		}
+		if (f->crcpages > 0 && (crcs=(PFcrcgroup **)malloc(cap*
+				sizeof(PFcrcgroup *)))== NULL){
+			free((char *)map);
+			PFerrno = PFE_NOMEM;
+			return(PFerrno);
+		}
+		if ((dirty=realloc(f->mapdirty,cap))== NULL){
+			free((char *)map);
+			free((char *)crcs);
+			PFerrno = PFE_NOMEM;
+			return(PFerrno);
+		}
+		f->mapdirty = dirty;
+		if (f->pagemap != NULL){
+			memcpy((char *)map,(char *)f->pagemap,
+				f->mapgroups*PF_PAGE_SIZE);
+			if (crcs != NULL)
+				memcpy((char *)crcs,(char *)f->crcs,
+					f->mapgroups*sizeof(PFcrcgroup *));
+			f->crcold[f->nmapold] = f->crcs;
+			f->mapold[f->nmapold++] = f->pagemap;
+		}
+		/* the copy must be complete before anyone can see it */
+		__sync_synchronize();
+		f->pagemap = map;
+		f->crcs = crcs;
+		f->mapcap = cap;
 	}
 
+	/* new pages have no checksum yet */
+	for (i = f->mapgroups; i < ngroups && f->crcpages > 0; i++)
+		if ((f->crcs[i] = (PFcrcgroup *)calloc(1,offsetof(PFcrcgroup,crc)
+				+ PFmapEntries(fd)*sizeof(unsigned))) == NULL){
+			while (--i >= f->mapgroups)
+				free((char *)f->crcs[i]);
+			PFerrno = PFE_NOMEM;
+			return(PFerrno);
+		}
+		else	f->crcs[i]->dirty = TRUE;
+
+	/* new pages are free */
+	map = f->pagemap;
+	if (f->format == PF_FORMAT_V3)
+		memset((char *)map + f->mapgroups*PF_PAGE_SIZE,0,
+			(ngroups - f->mapgroups)*PF_PAGE_SIZE);
+	else for (i = f->mapgroups * PF_MAP_ENTRIES; i < ngroups * PF_MAP_ENTRIES; i++)
+		map[i] = PF_PAGE_LIST_END;
+	for (i = f->mapgroups; i < ngroups; i++)
+		f->mapdirty[i] = TRUE;
+	f->mapgroups = ngroups;
 	return(PFE_OK);
 }
 
-PFwritefcn(fd,pagenum,buf)
-int fd;		/* file descriptor */
-int pagenum;	/* page to read */
-PFfpage *buf;	/* buffer where to read the page */
+static int PFmapRead(fd)
+int fd;		/* file descriptor of a V2 or V3 file, header already read */
 /****************************************************************************
 SPECIFICATIONS:
-	Write the page numbered "pagenum" from the buffer indexed
-	by "buf" into the file indexed by "fd".
-
-AUTHOR: clc
+	Read all map pages of file "fd" into PFftab[fd].pagemap[], and
+	its checksum pages, if it has some, into PFftab[fd].crcs[].
 
 RETURN VALUE:
-	PFE_OK	if ok.
-	PF errod code if not OK.
-
+	PFE_OK	if ok
+	PF error code if not OK.
 *****************************************************************************/
 {
+PFftab_ele *f = &PFftab[fd];
+int crcsize = f->crcpages * PF_PAGE_SIZE;
+off_t offset;
 int error;
+int g;
 
-	/* seek to the right place */
-	if ((error=lseek(PFftab[fd].unixfd,pagenum*sizeof(PFfpage)+PF_HDR_SIZE,
-				L_SET)) == -1){
-		PFerrno = PFE_UNIX;
-		return(PFerrno);
-	}
+	if ((error=PFmapGrow(fd,f->hdr.numpages))!= PFE_OK)
+		return(error);
 
-	/* write out the page */
-	if((error=write(PFftab[fd].unixfd,(char *)buf,sizeof(PFfpage)))
-			!=sizeof(PFfpage)){
-		if (error <0)
-			PFerrno = PFE_UNIX;
-		else	PFerrno = PFE_INCOMPLETEWRITE;
-		return(PFerrno);
+	for (g = 0; g < f->mapgroups; g++){
+		offset = PFgroupMapOffset(g,PFmapEntries(fd),PFmetaPages(fd));
+		if ((error=PFdevPread(f->dev,(char *)(f->pagemap + g*PF_MAP_ENTRIES),
+				PF_PAGE_SIZE,offset))!= PF_PAGE_SIZE ||
+				(crcsize > 0 && (error=PFdevPread(f->dev,
+				(char *)f->crcs[g]->crc,crcsize,offset+PF_PAGE_SIZE))
+				!= crcsize)){
+			if (error < 0)
+				PFerrno = PFE_UNIX;
+			else	PFerrno = PFE_HDRREAD;
+			return(PFerrno);
+		}
+		f->mapdirty[g] = FALSE;
+		if (crcsize > 0)
+			f->crcs[g]->dirty = FALSE;
 	}
-
 	return(PFE_OK);
-
 }
 
-
-/************************* Interface Routines ****************************/
-
-/* --- MODIFIED: Changed signature and added PFbufInit call --- */
-void PF_Init(int buf_size, int strategy)
+static int PFmapWrite(fd)
+int fd;		/* file descriptor of a V2 or V3 file */
 /****************************************************************************
 SPECIFICATIONS:
-    Initialize the PF interface. Must be the first function called
-    in order to use the PF ADT.
-
-AUTHOR: clc
+	Write the changed map pages of file "fd" back to the file, and
+	its changed checksum pages.
 
-RETURN VALUE: none
+RETURN VALUE:
+	PFE_OK	if ok
+	PF error code if not OK.
+*****************************************************************************/
+{
+PFftab_ele *f = &PFftab[fd];
+int crcsize = f->crcpages * PF_PAGE_SIZE;
+off_t offset;
+int error;
+int g;
+
+	for (g = 0; g < f->mapgroups; g++){
+		offset = PFgroupMapOffset(g,PFmapEntries(fd),PFmetaPages(fd));
+		if ((f->mapdirty[g] && (error=PFdevPwrite(f->dev,
+				(char *)(f->pagemap + g*PF_MAP_ENTRIES),
+				PF_PAGE_SIZE,offset))!= PF_PAGE_SIZE) ||
+				(crcsize > 0 && f->crcs[g]->dirty &&
+				(error=PFdevPwrite(f->dev,(char *)f->crcs[g]->crc,
+				crcsize,offset+PF_PAGE_SIZE))!= crcsize)){
+			if (error < 0)
+				PFerrno = PFE_UNIX;
+			else	PFerrno = PFE_HDRWRITE;
+			return(PFerrno);
+		}
+		f->mapdirty[g] = FALSE;
+		if (crcsize > 0)
+			f->crcs[g]->dirty = FALSE;
+	}
+	return(PFE_OK);
+}
 
-GLOBAL VARIABLES MODIFIED:
-    PFftab
+static void PFmapFree(fd)
+int fd;		/* file descriptor */
+/****************************************************************************
+SPECIFICATIONS:
+	Free the in-memory map of file "fd", if it has one, and its
+	checksums.
 *****************************************************************************/
 {
-int i;
-    
-    /* --- NEW --- */
-    /* init the buffer manager with specified size and strategy */
-    PFbufInit(buf_size, strategy);
-    /* --- END NEW --- */
+int g;
+
+	for (g = 0; PFftab[fd].crcs != NULL && g < PFftab[fd].mapgroups; g++)
+		free((char *)PFftab[fd].crcs[g]);
+	free((char *)PFftab[fd].crcs);
+	free((char *)PFftab[fd].pagemap);
+	free(PFftab[fd].mapdirty);
+	while (PFftab[fd].nmapold > 0){
+		free((char *)PFftab[fd].mapold[--PFftab[fd].nmapold]);
+		free((char *)PFftab[fd].crcold[PFftab[fd].nmapold]);
+	}
+	PFftab[fd].pagemap = NULL;
+	PFftab[fd].crcs = NULL;
+	PFftab[fd].mapdirty = NULL;
+	PFftab[fd].mapgroups = 0;
+	PFftab[fd].mapcap = 0;
+}
 
-    /* init the hash table */
-    PFhashInit();
+static void PFcrcDrop(fd)
+int fd;		/* file descriptor of a file with checksums */
+/****************************************************************************
+SPECIFICATIONS:
+	Forget the checksums of file "fd", which was not closed: pages
+	written since it was opened may not match them. The pages get new
+	ones as they are written again.
+*****************************************************************************/
+{
+int g;
 
-    /* init the file table to be not used*/
-    for (i=0; i < PF_FTAB_SIZE; i++){
-        PFftab[i].fname = NULL;
-    }
+	for (g = 0; g < PFftab[fd].mapgroups; g++){
+		memset((char *)PFftab[fd].crcs[g]->crc,0,
+			PFftab[fd].crcpages * PF_PAGE_SIZE);
+		PFftab[fd].crcs[g]->dirty = TRUE;
+	}
 }
-/* --- END MODIFIED --- */
 
-PF_CreateFile(fname)
-char *fname;	/* name of file to create */
+static int PFcrcInUse(fd,inuse)
+int fd;		/* file descriptor of a file with checksums */
+int inuse;	/* new value of the header's "inuse" */
 /****************************************************************************
 SPECIFICATIONS:
-	Create a paged file called "fname". The file should not have
-	already existed before.
-
-AUTHOR: clc
+	Write "inuse" to the header of file "fd".
 
 RETURN VALUE:
-	PFE_OK	if OK
-	PF error code if error.
+	PFE_OK	if ok
+	PF error code if not OK.
 *****************************************************************************/
 {
-int fd;	/* unix file descripotr */
-PFhdr_str hdr;	/* file header */
 int error;
 
-	/* create file for exclusive use */
-	if ((fd=open(fname,O_CREAT|O_EXCL|O_WRONLY,0664))<0){
-		/* unix error on open */
-		PFerrno = PFE_UNIX;
-		return(PFE_UNIX);
-	}
-
-	/* write out the file header */
-	hdr.firstfree = PF_PAGE_LIST_END;	/* no free pag yet */
-	hdr.numpages = 0;
-	if ((error=write(fd,(char *)&hdr,sizeof(hdr))) != sizeof(hdr)){
-		/* error while writing. Abort everything. */
+	if ((error=PFdevPwrite(PFftab[fd].dev,(char *)&inuse,sizeof(inuse),
+			(off_t)offsetof(PFhdr2_str,inuse)))!= sizeof(inuse)){
 		if (error < 0)
 			PFerrno = PFE_UNIX;
-		else PFerrno = PFE_HDRWRITE;
-		close(fd);
-		unlink(fname);
-		return(PFerrno);
-	}
-
-	if ((error=close(fd)) == -1){
-		PFerrno = PFE_UNIX;
+		else	PFerrno = PFE_HDRWRITE;
 		return(PFerrno);
 	}
-
 	return(PFE_OK);
 }
 
-
-PF_DestroyFile(fname)
-char *fname;		/* file name to destroy */
+static void PFsetnextfree(fd,pagenum,fpage,nextfree)
+int fd;		/* file descriptor */
+int pagenum;	/* page number */
+PFfpage *fpage;	/* the page, fixed in the buffer */
+int nextfree;	/* new value of its "nextfree" */
 /****************************************************************************
 SPECIFICATIONS:
-	Destroy the paged file whose name is "fname". The file should
-	exist, and should not be already open.
+	Set the "nextfree" of page "pagenum" of file "fd". For a V2 file
+	the map is updated too, for a V3 file the page's bit; the map has
+	room for the page. "fpage" may be NULL for a V3 file.
+*****************************************************************************/
+{
+	if (fpage != NULL)
+		fpage->nextfree = nextfree;
+	if (PFftab[fd].format == PF_FORMAT_V2)
+		PFftab[fd].pagemap[pagenum] = nextfree;
+	else if (PFftab[fd].format == PF_FORMAT_V3){
+		if (nextfree == PF_PAGE_USED)
+			PFbitByte(PFftab[fd].pagemap,pagenum) |= PFbitMask(pagenum);
+		else	PFbitByte(PFftab[fd].pagemap,pagenum) &= ~PFbitMask(pagenum);
+	}
+	else	return;
+	PFftab[fd].mapdirty[pagenum / PFmapEntries(fd)] = TRUE;
+}
 
-AUTHOR:
-	clc
+static int PFbitmapFind(fd,npages)
+int fd;		/* file descriptor of a V3 file */
+int npages;	/* # of adjacent free pages wanted */
+/****************************************************************************
+SPECIFICATIONS:
+	Find "npages" adjacent free pages of file "fd", at the lowest page
+	number at or above the "firstfree" hint. Pages past the end of the
+	file count as free, so there always is such a run.
 
 RETURN VALUE:
-	PFE_OK 	if success
-	PF error codes if error
+	The first page of the run.
+
+IMPLEMENTATION NOTES:
+	Runs of 64 used pages are skipped a word at a time; the map is
+	allocated in whole pages, so the words are aligned.
 *****************************************************************************/
 {
-int error;
-
-	if (PFtabFindFname(fname)!= -1){
-		/* file is open */
-		PFerrno = PFE_FILEOPEN;
-		return(PFerrno);
-	}
-
-	if ((error =unlink(fname))!= 0){
-		/* unix error */
-		PFerrno = PFE_UNIX;
-		return(PFerrno);
+PFftab_ele *f = &PFftab[fd];
+unsigned long long *words = (unsigned long long *)f->pagemap;
+int start = f->hdr.firstfree;	/* first page of the run so far */
+int p;
+
+	for (p = start; p < f->hdr.numpages && p - start < npages; p++){
+		if ((p & 63) == 0 && p + 64 <= f->hdr.numpages &&
+				words[p >> 6] == ~0ULL){
+			p += 63;
+			start = p + 1;
+		}
+		else if (PFbitTest(f->pagemap,p))
+			start = p + 1;
 	}
-
-	/* success */
-	return(PFE_OK);
+	return(start);
 }
 
-
-PF_OpenFile(fname)
-char *fname;		/* name of the file to open */
+static int PFfileGrow(fd,npages,fill)
+int fd;		/* file descriptor */
+int npages;	/* # of pages the file is about to have */
+int fill;	/* TRUE if the new pages must be readable right away */
 /****************************************************************************
 SPECIFICATIONS:
-	Open the paged file whose name is fname.  It is possible to open
-	a file more than once. Warning: Openinging a file more than once for 
-	write operations is not prevented. The possible consequence is
-	the corruption of the file structure, which will crash
-	the Paged File functions. On the other hand, opening a file
-	more than once for reading is OK.
-
-AUTHOR: clc
+	Called with the lock of file "fd" held, before the file's
+	high-water mark (hdr.numpages) goes up to "npages". If extents
+	are on (see PF_SetExtentPages()) and the space of the file ends
+	before page "npages"-1 does, the next PFextentpages pages are
+	reserved with one fallocate(), which also makes the file that
+	long; the pages are then written into space allocated in one
+	piece. If "fill", the file is made long enough for the pages to be
+	read, even with extents off.
 
 RETURN VALUE:
-	The file descriptor, which is >= 0, if no error.
-	PF error codes otherwise.
+	PFE_OK	if ok
+	PFE_UNIX	if the file cannot be made longer.
 
 IMPLEMENTATION NOTES:
-	A file opened more than once will have different file descriptors
-	returned. Separate buffers are used.
+	On a file system without fallocate() the file grows page by page,
+	as pages are written.
 *****************************************************************************/
 {
-int count;	/* # of bytes in read */
-int fd; /* file descriptor */
+PFftab_ele *f = &PFftab[fd];
+off_t size;
+off_t end = PFpageOffset(fd,npages-1) + PFpageSize(fd);
+off_t want;
 
-	/* find a free entry in the file table */
-	if ((fd=PFftabFindFree())< 0){
-		/* file table full */
-		PFerrno = PFE_FTABFULL;
-		return(PFerrno);
-	}
+	if (end <= f->allocend)
+		return(PFE_OK);
 
-	/* open the file */
-	if ((PFftab[fd].unixfd = open(fname,O_RDWR))< 0){
-		/* can't open the file */
-		PFerrno = PFE_UNIX;
-		return(PFerrno);
+	if (PFextentpages > 0 && !f->nofalloc){
+		want = PFpageOffset(fd,npages-1+PFextentpages) + PFpageSize(fd);
+		if (PFdevAllocate(f->dev,f->allocend,want - f->allocend) == 0){
+			f->allocend = want;
+			return(PFE_OK);
+		}
+		if (errno != EOPNOTSUPP && errno != ENOSYS){
+			PFerrno = PFE_UNIX;
+			return(PFerrno);
+		}
+		f->nofalloc = TRUE;
 	}
 
-	/* Read the file header */
-	if ((count=read(PFftab[fd].unixfd,(char *)&PFftab[fd].hdr,PF_HDR_SIZE))
-				!= PF_HDR_SIZE){
-		if (count < 0)
-			/* unix error */
+	/* Pages written since open may have made the file longer than
+	allocend: it must not be truncated. */
+	if (fill){
+		if ((size = PFdevSize(f->dev)) == -1 ||
+				(size < end && PFdevTruncate(f->dev,end) == -1)){
 			PFerrno = PFE_UNIX;
-		else	/* not enough bytes in file */
-			PFerrno = PFE_HDRREAD;
-		close(PFftab[fd].unixfd);
-		return(PFerrno);
+			return(PFerrno);
+		}
+		f->allocend = size < end ? end : size;
 	}
-	/* set file header to be not changed */
-	PFftab[fd].hdrchanged = FALSE;
+	return(PFE_OK);
+}
 
-	/* save the file name */
-	if ((PFftab[fd].fname = savestr(fname)) == NULL){
-		/* no memory */
-		close(PFftab[fd].unixfd);
-		PFerrno = PFE_NOMEM;
-		return(PFerrno);
-	}
+static int PFopenElsewhere(fname,fd)
+char *fname;	/* file name */
+int fd;		/* file descriptor of "fname", not to count */
+/****************************************************************************
+SPECIFICATIONS:
+	Tell whether file "fname" is open, not PF_OPEN_MAPPED, under
+	another file descriptor than "fd". Called with PFftabmutex held.
 
-	return(fd);
+RETURN VALUE:
+	TRUE or FALSE.
+*****************************************************************************/
+{
+int i;
+
+	for (i=0; i < PF_FTAB_SIZE; i++)
+		if (i != fd && PFftab[i].fname != NULL && !PFmapped(i) &&
+				strcmp(PFftab[i].fname,fname) == 0)
+			return(TRUE);
+	return(FALSE);
 }
 
-PF_CloseFile(fd)
-int fd;		/* file descriptor to close */
+static PFftabFindFree()
 /****************************************************************************
 SPECIFICATIONS:
-	Close the file indexed by file descriptor fd. The file should have
-	been opened with PFopen(). It is an error to close a file
-	with pages still fixed in the buffer.
+	Find a free entry in the open file table "PFtab", and return its
+	index.
 
 AUTHOR: clc
 
 RETURN VALUE:
-	PFE_OK	if OK
-	PF error code if error.
+	If >=0, the index of the free entry.
+	Otherwise, none can be found.
 
 *****************************************************************************/
 {
-int error;
+int i;
 
-	if (PFinvalidFd(fd)){
-		/* invalid file descriptor */
-		PFerrno = PFE_FD;
-		return(PFerrno);
-	}
+	for (i=0; i < PF_FTAB_SIZE; i++)
+		if (PFftab[i].fname == NULL)
+			return(i);
+	return(-1);
+}
+
+static int PFpagegroup(fd,pagenum,bufs,n,iov,niov,offset)
+int fd;		/* file descriptor */
+int pagenum;	/* first page */
+PFfpage **bufs;	/* bufs[i] is the buffer of page pagenum+i */
+int n;		/* # of pages, at least 1 */
+struct iovec *iov;	/* set to describe the pages */
+int *niov;	/* set to the # of entries of iov[] used */
+off_t *offset;	/* set to where they are in the file */
+/****************************************************************************
+SPECIFICATIONS:
+	Describe the first of the pages "pagenum" to "pagenum"+n-1 of
+	file "fd" that are adjacent on file, and can be moved with one
+	positional call: all of them for a V1 file, those up to the end
+	of the map group of "pagenum" for a V2 or V3 file.
+
+RETURN VALUE:
+	The # of pages described.
+*****************************************************************************/
+{
+int i = 0;
+
+	*offset = PFpageOffset(fd,pagenum);
+	*niov = 0;
+	do
+		*niov += PFsetiov(fd,iov+*niov,bufs[i]);
+	while (++i < n && (PFftab[fd].format == PF_FORMAT_V1 ||
+				(pagenum+i) % PFmapEntries(fd) != 0));
+	return(i);
+}
+
+static int PFpagemoved(fd,write,len,count)
+int fd;		/* file descriptor */
+int write;	/* TRUE if pages were written, FALSE if read */
+ssize_t len;	/* # of bytes to move */
+ssize_t count;	/* # of bytes moved, -1 if error */
+/****************************************************************************
+SPECIFICATIONS:
+	Account for one positional call moving pages described by
+	PFpagegroup().
+
+RETURN VALUE:
+	PFE_OK	if all "len" bytes were moved
+	PF error code if not OK.
+
+GLOBAL VARIABLES MODIFIED:
+	PFftab[fd].bytesread or byteswritten
+*****************************************************************************/
+{
+	if (count > 0)
+		__sync_fetch_and_add(write ? &PFftab[fd].byteswritten :
+			&PFftab[fd].bytesread,(long long)count);
+	if (count == len)
+		return(PFE_OK);
+	if (count < 0)
+		return(PFE_UNIX);
+	return(write ? PFE_INCOMPLETEWRITE : PFE_INCOMPLETEREAD);
+}
+
+static void PFpageread(fd,pagenum,bufs,n)
+int fd;		/* file descriptor */
+int pagenum;	/* first page */
+PFfpage **bufs;	/* bufs[i] is the buffer of page pagenum+i */
+int n;		/* # of pages */
+/****************************************************************************
+SPECIFICATIONS:
+	Set "nextfree" of pages just read: for a V2 or V3 file it is in
+	the map, see PFsetnextfree(). The map may be replaced meanwhile,
+	see PFmapGrow(). A V3 page only needs to know whether it is used.
+*****************************************************************************/
+{
+int *map;
+int i;
+
+	if (PFftab[fd].format == PF_FORMAT_V2){
+		map = *(int * volatile *)&PFftab[fd].pagemap;
+		for (i = 0; i < n; i++)
+			bufs[i]->nextfree = map[pagenum+i];
+	}
+	else if (PFftab[fd].format == PF_FORMAT_V3){
+		map = *(int * volatile *)&PFftab[fd].pagemap;
+		for (i = 0; i < n; i++)
+			bufs[i]->nextfree = PFbitTest(map,pagenum+i) ?
+				PF_PAGE_USED : PF_PAGE_LIST_END;
+	}
+}
+
+static void PFcrcSet(fd,pagenum,bufs,n)
+int fd;		/* file descriptor */
+int pagenum;	/* first page */
+PFfpage **bufs;	/* bufs[i] is the buffer of page pagenum+i */
+int n;		/* # of pages */
+/****************************************************************************
+SPECIFICATIONS:
+	Set the checksums of pages about to be written, if file "fd" has
+	checksums. No two threads write the same page at once, and the
+	checksums of a group do not move, see PFmapGrow().
+*****************************************************************************/
+{
+PFcrcgroup *g;
+int i;
+
+	if (PFftab[fd].crcpages == 0)
+		return;
+	for (i = 0; i < n; i++){
+		g = (*(PFcrcgroup ** volatile *)&PFftab[fd].crcs)
+			[(pagenum+i) / PFmapEntries(fd)];
+		g->crc[(pagenum+i) % PFmapEntries(fd)] =
+			PFcrcPage(pagenum+i,bufs[i]->pagebuf);
+		g->dirty = TRUE;
+	}
+}
+
+static int PFcrcCheck(fd,pagenum,bufs,n)
+int fd;		/* file descriptor */
+int pagenum;	/* first page */
+PFfpage **bufs;	/* bufs[i] is the buffer of page pagenum+i */
+int n;		/* # of pages */
+/****************************************************************************
+SPECIFICATIONS:
+	Check the pages just read against their checksums, if file "fd"
+	has checksums. Pages never written have none.
+
+RETURN VALUE:
+	PFE_OK	if they all match
+	PFE_CHECKSUM	if one does not.
+*****************************************************************************/
+{
+unsigned crc;
+int i;
+
+	if (PFftab[fd].crcpages == 0)
+		return(PFE_OK);
+	for (i = 0; i < n; i++){
+		crc = (*(PFcrcgroup ** volatile *)&PFftab[fd].crcs)
+			[(pagenum+i) / PFmapEntries(fd)]->
+			crc[(pagenum+i) % PFmapEntries(fd)];
+		if (crc != 0 && crc != PFcrcPage(pagenum+i,bufs[i]->pagebuf))
+			return(PFE_CHECKSUM);
+	}
+	return(PFE_OK);
+}
+
+static int PFpageio(fd,pagenum,bufs,n,write)
+int fd;		/* file descriptor */
+int pagenum;	/* first page */
+PFfpage **bufs;	/* bufs[i] is the buffer of page pagenum+i */
+int n;		/* # of pages, at most PF_IO_MAXPAGES */
+int write;	/* TRUE to write the pages, FALSE to read them */
+/****************************************************************************
+SPECIFICATIONS:
+	Read or write the pages numbered "pagenum" to "pagenum"+n-1 of
+	file "fd". Pages that are adjacent on file are moved with one
+	positional call of its device: one in all for a V1 file, one per
+	map group crossed for a V2 or V3 file. The checksums of a file
+	that has them are set before writing and checked after reading.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PFE_CHECKSUM	if a page read does not match its checksum
+	PF error code if not OK.
+
+GLOBAL VARIABLES MODIFIED:
+	PFiocalls, PFftab[fd].bytesread or byteswritten
+*****************************************************************************/
+{
+struct iovec iov[2*PF_IO_MAXPAGES];
+int niov;	/* # of entries of iov[] in use */
+int i, k;
+off_t offset;
+ssize_t count;	/* # of bytes moved */
+
+	if (write)
+		PFcrcSet(fd,pagenum,bufs,n);
+	for (i = 0; i < n; i += k){
+		k = PFpagegroup(fd,pagenum+i,bufs+i,n-i,iov,&niov,&offset);
+
+		/* the flusher thread does I/O too */
+		__sync_fetch_and_add(&PFiocalls,1);
+		if (write)
+			count = PFdevWritev(PFftab[fd].dev,iov,niov,offset);
+		else	count = PFdevReadv(PFftab[fd].dev,iov,niov,offset);
+		if ((PFerrno=PFpagemoved(fd,write,
+				(ssize_t)k * PFpageSize(fd),count))!= PFE_OK)
+			return(PFerrno);
+	}
+	if (!write){
+		if ((PFerrno=PFcrcCheck(fd,pagenum,bufs,n))!= PFE_OK)
+			return(PFerrno);
+		PFpageread(fd,pagenum,bufs,n);
+	}
+	return(PFE_OK);
+}
+
+
+/* a run of pages being moved by the engine of aio.c, see PFstartfcn() */
+typedef struct PFaiorun {
+	int fd;
+	int pagenum;		/* first page */
+	PFfpage **bufs;		/* the caller's, kept until "done" */
+	int n;			/* # of pages */
+	int write;		/* TRUE to write them, FALSE to read */
+	int pending;		/* # of req[] not over */
+	int error;		/* first error of req[], PFE_OK if none */
+	void (*done)();		/* the caller's */
+	void *arg;		/* for "done" */
+	int nreq;		/* # of req[] used */
+	PFaioreq req[2];	/* one per map group: a map describes more
+				than PF_IO_MAXPAGES pages, so a run
+				crosses at most one boundary */
+	ssize_t len[2];		/* # of bytes req[i] must move */
+	struct iovec iov[2*PF_IO_MAXPAGES];
+} PFaiorun;
+
+static void PFaiodone(req)
+PFaioreq *req;	/* request of a PFaiorun, over */
+/****************************************************************************
+SPECIFICATIONS:
+	Called by the engine as a request of PFstartfcn() is over. The
+	last one of a run tells the caller, and frees the run.
+*****************************************************************************/
+{
+PFaiorun *run = (PFaiorun *)req->arg;
+int error;
+
+	error = PFpagemoved(run->fd,run->write,run->len[req - run->req],
+			req->result);
+	if (error != PFE_OK)
+		(void)__sync_bool_compare_and_swap(&run->error,PFE_OK,error);
+	if (__sync_sub_and_fetch(&run->pending,1) > 0)
+		return;
+	if (!run->write && run->error == PFE_OK &&
+			(run->error=PFcrcCheck(run->fd,run->pagenum,run->bufs,
+			run->n))== PFE_OK)
+		PFpageread(run->fd,run->pagenum,run->bufs,run->n);
+	(*run->done)(run->arg,run->error);
+	free((char *)run);
+}
+
+int PFstartfcn(fd,pagenum,bufs,n,write,done,arg,more)
+int fd;		/* file descriptor */
+int pagenum;	/* first page */
+PFfpage **bufs;	/* bufs[i] is the buffer of page pagenum+i */
+int n;		/* # of pages, at most PF_IO_MAXPAGES */
+int write;	/* TRUE to write the pages, FALSE to read them */
+void (*done)();	/* called as done(arg,error) once they are moved */
+void *arg;	/* for "done" */
+int more;	/* TRUE if more runs are started right away */
+/****************************************************************************
+SPECIFICATIONS:
+	Start reading or writing the "n" adjacent pages starting at
+	"pagenum" of file "fd", with the engine of aio.c: as few requests
+	as the file layout allows, submitted with those of the following
+	calls if "more" is set. "done" is called from the engine's thread,
+	with PFE_CHECKSUM if a page read does not match its checksum.
+	bufs[] must stay until then.
+
+RETURN VALUE:
+	PFE_OK	if started; "done" will tell how it went.
+	PFE_NOMEM	if not started; "done" is not called.
+
+GLOBAL VARIABLES MODIFIED:
+	PFiocalls
+*****************************************************************************/
+{
+PFaiorun *run;
+PFaioreq *reqs[2];
+int niov = 0;
+int i, k;
+
+	if ((run = (PFaiorun *)malloc(sizeof(PFaiorun))) == NULL){
+		if (!more)
+			/* start what earlier calls held back */
+			PFaioSubmit(reqs,0,FALSE);
+		PFerrno = PFE_NOMEM;
+		return(PFerrno);
+	}
+	run->fd = fd;
+	run->pagenum = pagenum;
+	run->bufs = bufs;
+	run->n = n;
+	run->write = write;
+	run->error = PFE_OK;
+	run->done = done;
+	run->arg = arg;
+	run->nreq = 0;
+	if (write)
+		PFcrcSet(fd,pagenum,bufs,n);
+	for (i = 0; i < n; i += k){
+		reqs[run->nreq] = &run->req[run->nreq];
+		reqs[run->nreq]->iov = run->iov + niov;
+		k = PFpagegroup(fd,pagenum+i,bufs+i,n-i,reqs[run->nreq]->iov,
+			&reqs[run->nreq]->niov,&reqs[run->nreq]->offset);
+		niov += reqs[run->nreq]->niov;
+		reqs[run->nreq]->dev = PFftab[fd].dev;
+		reqs[run->nreq]->write = write;
+		reqs[run->nreq]->done = PFaiodone;
+		reqs[run->nreq]->arg = (void *)run;
+		run->len[run->nreq++] = (ssize_t)k * PFpageSize(fd);
+	}
+	run->pending = run->nreq;
+	__sync_fetch_and_add(&PFiocalls,run->nreq);
+	PFaioSubmit(reqs,run->nreq,more);
+	return(PFE_OK);
+}
+
+int PFreadfcn(fd,pagenum,buf)
+int fd;	/* file descriptor */
+int pagenum; /* page number */
+PFfpage *buf;
+/****************************************************************************
+SPECIFICATIONS:
+	Read the paged numbered "pagenum" from the file indexed by "fd"
+	into the page buffer "buf".
+
+AUTHOR: clc
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PF error code if not OK.
+*****************************************************************************/
+{
+	return(PFpageio(fd,pagenum,&buf,1,FALSE));
+}
+
+int PFwritefcn(fd,pagenum,buf)
+int fd;		/* file descriptor */
+int pagenum;	/* page to read */
+PFfpage *buf;	/* buffer where to read the page */
+/****************************************************************************
+SPECIFICATIONS:
+	Write the page numbered "pagenum" from the buffer indexed
+	by "buf" into the file indexed by "fd".
+
+AUTHOR: clc
+
+RETURN VALUE:
+	PFE_OK	if ok.
+	PF errod code if not OK.
+
+*****************************************************************************/
+{
+	return(PFpageio(fd,pagenum,&buf,1,TRUE));
+}
+
+int PFreadvfcn(fd,pagenum,bufs,n)
+int fd;		/* file descriptor */
+int pagenum;	/* first page to read */
+PFfpage **bufs;	/* bufs[i] receives page pagenum+i */
+int n;		/* # of pages, at most PF_IO_MAXPAGES */
+/****************************************************************************
+SPECIFICATIONS:
+	Read the "n" adjacent pages starting at "pagenum" from file "fd",
+	with as few system calls as the file layout allows.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PF error code if not OK.
+*****************************************************************************/
+{
+	return(PFpageio(fd,pagenum,bufs,n,FALSE));
+}
+
+int PFwritevfcn(fd,pagenum,bufs,n)
+int fd;		/* file descriptor */
+int pagenum;	/* first page to write */
+PFfpage **bufs;	/* bufs[i] holds page pagenum+i */
+int n;		/* # of pages, at most PF_IO_MAXPAGES */
+/****************************************************************************
+SPECIFICATIONS:
+	Write the "n" adjacent pages starting at "pagenum" to file "fd",
+	with as few system calls as the file layout allows.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PF error code if not OK.
+*****************************************************************************/
+{
+	return(PFpageio(fd,pagenum,bufs,n,TRUE));
+}
+
+
+/************************* Interface Routines ****************************/
+
+/* --- MODIFIED: Changed signature and added PFbufInit call --- */
+void PF_Init(int buf_size, int strategy)
+/****************************************************************************
+SPECIFICATIONS:
+    Initialize the PF interface. Must be the first function called
+    in order to use the PF ADT.
+    After it, any number of threads can get, latch and unfix pages, of
+    the same file or of different ones, and allocate and dispose pages.
+    PF_Init() and PF_SetFlusher() must be called while no other thread
+    uses the PF layer, and a file must not be in use by another thread
+    while it is being closed.
+
+AUTHOR: clc
+
+RETURN VALUE: none
+
+GLOBAL VARIABLES MODIFIED:
+    PFftab
+*****************************************************************************/
+{
+int i;
+    
+    /* --- NEW --- */
+    /* init the buffer manager with specified size and strategy */
+    PFbufInit(buf_size, strategy);
+    /* --- END NEW --- */
+
+    PFiocalls = 0;
+    PFclosedread = 0;
+    PFclosedwritten = 0;
+    PFwarmpages = 0;
+    PFwarmdone = 0;
+
+    /* init the file table to be not used*/
+    for (i=0; i < PF_FTAB_SIZE; i++){
+        PFftab[i].fname = NULL;
+    }
+}
+/* --- END MODIFIED --- */
+
+PF_CreateFile(fname)
+char *fname;	/* name of file to create */
+/****************************************************************************
+SPECIFICATIONS:
+	Create a paged file called "fname". The file should not have
+	already existed before. The file is created in PF_FORMAT_V1;
+	see PF_CreateFileEx() for the others.
+
+AUTHOR: clc
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PF error code if error.
+*****************************************************************************/
+{
+	return(PF_CreateFileEx(fname,PF_FORMAT_V1));
+}
+
+
+int PF_CreateFileEx(fname,format)
+char *fname;	/* name of file to create */
+int format;	/* PF_FORMAT_V1, PF_FORMAT_V2 or PF_FORMAT_V3; V2 or V3
+		may be or'ed with PF_FORMAT_CHECKSUM */
+/****************************************************************************
+SPECIFICATIONS:
+	Create a paged file called "fname" in the given format. The file
+	should not have already existed before. Only a PF_FORMAT_V2 or V3
+	file can later be opened with PF_OPEN_DIRECT. A V3 file keeps a
+	bitmap of its free pages: allocating and disposing pages does not
+	read or write them, and PF_AllocExtent() can be used.
+	With PF_FORMAT_CHECKSUM the file keeps a CRC32C of every page,
+	set as the page is written and checked as it is read back, but
+	not by PF_OPEN_MAPPED, which does not read pages itself. A page
+	that does not match fails to be got with PFE_CHECKSUM. The
+	checksums are written back on close, like the map: those of a
+	file that was not closed (the program died) are dropped when it
+	is next opened, and pages get new ones as they are written.
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PFE_FORMAT	if "format" is unknown
+	PF error code if error.
+*****************************************************************************/
+{
+int fd;	/* unix file descripotr */
+union {
+	PFhdr2_str hdr2;
+	char page[PF_PAGE_SIZE];
+} hdrpage;	/* V2 or V3 header page */
+char *hdrbuf;	/* header to write */
+int hdrsize;	/* and its size */
+int checksums = (format & PF_FORMAT_CHECKSUM) != 0;
+int error;
+
+	format &= ~PF_FORMAT_CHECKSUM;
+	switch(format){
+	case PF_FORMAT_V1:
+		if (checksums){
+			PFerrno = PFE_FORMAT;
+			return(PFerrno);
+		}
+		hdrbuf = (char *)&hdrpage.hdr2.hdr;
+		hdrsize = PF_HDR_SIZE;
+		break;
+	case PF_FORMAT_V2:
+	case PF_FORMAT_V3:
+		memset(hdrpage.page,0,PF_PAGE_SIZE);
+		hdrpage.hdr2.magic = PF_MAGIC;
+		hdrpage.hdr2.version = format;
+		hdrpage.hdr2.checksums = checksums;
+		hdrbuf = hdrpage.page;
+		hdrsize = PF_PAGE_SIZE;
+		break;
+	default:
+		PFerrno = PFE_FORMAT;
+		return(PFerrno);
+	}
+
+	/* create file for exclusive use */
+	if ((fd=open(fname,O_CREAT|O_EXCL|O_WRONLY,0664))<0){
+		/* unix error on open */
+		PFerrno = PFE_UNIX;
+		return(PFE_UNIX);
+	}
+
+	/* write out the file header */
+	/* no free pag yet; for V3 the search for one starts at page 0 */
+	hdrpage.hdr2.hdr.firstfree = format == PF_FORMAT_V3 ? 0 :
+						PF_PAGE_LIST_END;
+	hdrpage.hdr2.hdr.numpages = 0;
+	if ((error=write(fd,hdrbuf,hdrsize)) != hdrsize){
+		/* error while writing. Abort everything. */
+		if (error < 0)
+			PFerrno = PFE_UNIX;
+		else PFerrno = PFE_HDRWRITE;
+		close(fd);
+		unlink(fname);
+		return(PFerrno);
+	}
+
+	if ((error=close(fd)) == -1){
+		PFerrno = PFE_UNIX;
+		return(PFerrno);
+	}
+
+	return(PFE_OK);
+}
+
+
+PF_DestroyFile(fname)
+char *fname;		/* file name to destroy */
+/****************************************************************************
+SPECIFICATIONS:
+	Destroy the paged file whose name is "fname". The file should
+	exist, and should not be already open. Its memory image, if it
+	was opened with PF_OPEN_MEMORY, goes too, and so does its warm
+	list (see PF_SetWarmRestart()).
+
+AUTHOR:
+	clc
+
+RETURN VALUE:
+	PFE_OK 	if success
+	PF error codes if error
+*****************************************************************************/
+{
+int error;
+int inmem;	/* TRUE if the file had a memory image */
+
+	pthread_mutex_lock(&PFftabmutex);
+	if (PFtabFindFname(fname)!= -1){
+		/* file is open */
+		pthread_mutex_unlock(&PFftabmutex);
+		PFerrno = PFE_FILEOPEN;
+		return(PFerrno);
+	}
+
+	inmem = PFdevForget(fname);
+	PFwarmForget(fname);
+	error = unlink(fname);
+	pthread_mutex_unlock(&PFftabmutex);
+	if (error != 0 && !inmem){
+		/* unix error */
+		PFerrno = PFE_UNIX;
+		return(PFerrno);
+	}
+
+	/* success */
+	return(PFE_OK);
+}
+
+
+static void PFwarmKeep(fd)
+int fd;		/* file descriptor, not PF_OPEN_MAPPED */
+/****************************************************************************
+SPECIFICATIONS:
+	Save the pages of file "fd" in the buffer to its warm list.
+*****************************************************************************/
+{
+int *pages;
+int n;
+
+	if ((n = PFbufResident(fd,&pages)) < 0)
+		/* a warm list is only advice */
+		return;
+	PFwarmSave(PFftab[fd].fname,pages,n);
+	free((char *)pages);
+}
+
+static void PFwarmStart(fd)
+int fd;		/* file descriptor, just opened, not PF_OPEN_MAPPED */
+/****************************************************************************
+SPECIFICATIONS:
+	Start prefetching the pages of the warm list of file "fd" that it
+	still has, at most as many as the pool holds: the hottest.
+
+GLOBAL VARIABLES MODIFIED:
+	PFwarmpages, and PFwarmdone as the pages are prefetched
+*****************************************************************************/
+{
+int *pages;
+int n, k = 0;
+int i, first;
+
+	if ((n = PFwarmLoad(PFftab[fd].fname,&pages)) == 0)
+		return;
+	for (i = 0; i < n; i++)
+		if (!PFinvalidPagenum(fd,pages[i]) && !PFmapSaysFree(fd,pages[i]))
+			pages[k++] = pages[i];
+	/* the list is coldest first */
+	first = k > PFbufSize() ? k - PFbufSize() : 0;
+	k -= first;
+	__sync_fetch_and_add(&PFwarmpages,(long long)k);
+	if (k > 0 && PFbufGetAsync(fd,pages+first,k,TRUE,PFreadfcn,PFwritefcn,
+			PFstartfcn,PFwarmed,(void *)NULL) != PFE_OK)
+		/* no memory: nothing will be prefetched */
+		__sync_fetch_and_add(&PFwarmdone,(long long)k);
+	free((char *)pages);
+}
+
+PF_OpenFile(fname)
+char *fname;		/* name of the file to open */
+/****************************************************************************
+SPECIFICATIONS:
+	Same as PF_OpenFileEx(fname,0).
+*****************************************************************************/
+{
+	return(PF_OpenFileEx(fname,0));
+}
+
+
+static int PFftabOpen(fname,flags)
+char *fname;		/* name of the file to open */
+int flags;		/* PF_OPEN_* flags */
+/****************************************************************************
+SPECIFICATIONS:
+	PF_OpenFileEx(), called with PFftabmutex held.
+*****************************************************************************/
+{
+int count;	/* # of bytes in read */
+int fd; /* file descriptor */
+PFhdr2_str hdr2;	/* start of the file: a V2/V3 header, or a V1 header
+			followed by page data */
+off_t size;	/* # of bytes of the file */
+int error;
+
+	if ((flags & PF_OPEN_DIRECT) && (flags & PF_OPEN_MAPPED)){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+
+	/* find a free entry in the file table */
+	if ((fd=PFftabFindFree())< 0){
+		/* file table full */
+		PFerrno = PFE_FTABFULL;
+		return(PFerrno);
+	}
+
+	/* open the file on its device */
+	if ((error=PFdevOpen(fname,flags,&PFftab[fd].dev))!= PFE_OK)
+		return(error);
+
+	/* Read the file header, and find out the format */
+	PFftab[fd].pagemap = NULL;
+	PFftab[fd].mapdirty = NULL;
+	PFftab[fd].mapgroups = 0;
+	PFftab[fd].mapcap = 0;
+	PFftab[fd].nmapold = 0;
+	PFftab[fd].crcpages = 0;
+	PFftab[fd].crcs = NULL;
+	PFftab[fd].flags = flags;
+	PFftab[fd].nofalloc = FALSE;
+	PFftab[fd].ralast = -1;
+	PFftab[fd].raend = 0;
+	PFftab[fd].rawin = 0;
+	PFftab[fd].mapaddr = NULL;
+	PFftab[fd].maplen = 0;
+	PFftab[fd].advice = MADV_NORMAL;
+	PFftab[fd].streak = 0;
+	PFftab[fd].bytesread = 0;
+	PFftab[fd].byteswritten = 0;
+	if ((count=PFdevPread(PFftab[fd].dev,(char *)&hdr2,sizeof(hdr2),(off_t)0))
+				< (int)PF_HDR_SIZE){
+		if (count < 0)
+			/* unix error */
+			PFerrno = PFE_UNIX;
+		else	/* not enough bytes in file */
+			PFerrno = PFE_HDRREAD;
+		(void)PFdevClose(PFftab[fd].dev);
+		return(PFerrno);
+	}
+	if (count == sizeof(hdr2) && hdr2.magic == PF_MAGIC){
+		if (hdr2.version != PF_FORMAT_V2 && hdr2.version != PF_FORMAT_V3){
+			PFerrno = PFE_FORMAT;
+			(void)PFdevClose(PFftab[fd].dev);
+			return(PFerrno);
+		}
+		PFftab[fd].format = hdr2.version;
+		PFftab[fd].hdr = hdr2.hdr;
+		if (hdr2.checksums)
+			PFftab[fd].crcpages = PFmapEntries(fd) / PF_CRC_ENTRIES;
+		if ((error=PFmapRead(fd))!= PFE_OK){
+			PFmapFree(fd);
+			(void)PFdevClose(PFftab[fd].dev);
+			return(error);
+		}
+		/* "inuse" is left set while the file may be written; found
+		set when nobody has it open, the file was not closed */
+		if (PFftab[fd].crcpages > 0 && !(flags & PF_OPEN_MAPPED) &&
+				!PFopenElsewhere(fname,fd)){
+			if (hdr2.inuse)
+				PFcrcDrop(fd);
+			else if ((error=PFcrcInUse(fd,TRUE))!= PFE_OK){
+				PFmapFree(fd);
+				(void)PFdevClose(PFftab[fd].dev);
+				return(error);
+			}
+		}
+	}
+	else {
+		/* V1: the header is the first int pair */
+		PFftab[fd].format = PF_FORMAT_V1;
+		PFftab[fd].hdr = *(PFhdr_str *)&hdr2;
+	}
+	if ((size = PFdevSize(PFftab[fd].dev)) == -1){
+		PFerrno = PFE_UNIX;
+		PFmapFree(fd);
+		(void)PFdevClose(PFftab[fd].dev);
+		return(PFerrno);
+	}
+	PFftab[fd].allocend = size;
+	/* set file header to be not changed */
+	PFftab[fd].hdrchanged = FALSE;
+
+	if (flags & PF_OPEN_DIRECT){
+		if (PFftab[fd].format == PF_FORMAT_V1)
+			PFerrno = PFE_NODIRECT;
+		else if (PFdevDirect(PFftab[fd].dev,TRUE) == -1)
+			PFerrno = PFE_UNIX;
+		else	PFerrno = PFE_OK;
+		if (PFerrno != PFE_OK){
+			PFmapFree(fd);
+			(void)PFdevClose(PFftab[fd].dev);
+			return(PFerrno);
+		}
+	}
+
+	if (flags & PF_OPEN_MAPPED){
+		/* every page must be in the mapping */
+		if (PFftab[fd].hdr.numpages > 0 &&
+				PFpageOffset(fd,PFftab[fd].hdr.numpages - 1) +
+				PFpageSize(fd) > size)
+			PFerrno = PFE_INCOMPLETEREAD;
+		else if ((PFftab[fd].mapaddr = mmap(NULL,(size_t)size,
+				PROT_READ,MAP_SHARED,PFdevUnixFd(PFftab[fd].dev),(off_t)0))
+				== MAP_FAILED)
+			PFerrno = PFE_UNIX;
+		else	PFerrno = PFE_OK;
+		if (PFerrno != PFE_OK){
+			PFmapFree(fd);
+			(void)PFdevClose(PFftab[fd].dev);
+			return(PFerrno);
+		}
+		PFftab[fd].maplen = size;
+	}
+
+	/* save the file name */
+	if ((PFftab[fd].fname = savestr(fname)) == NULL){
+		/* no memory */
+		if (PFftab[fd].mapaddr != NULL)
+			munmap(PFftab[fd].mapaddr,PFftab[fd].maplen);
+		PFmapFree(fd);
+		(void)PFdevClose(PFftab[fd].dev);
+		PFerrno = PFE_NOMEM;
+		return(PFerrno);
+	}
+	pthread_mutex_init(&PFftab[fd].lock,NULL);
+
+	return(fd);
+}
+
+
+int PF_OpenFileEx(fname,flags)
+char *fname;		/* name of the file to open */
+int flags;		/* PF_OPEN_* flags */
+/****************************************************************************
+SPECIFICATIONS:
+	Open the paged file whose name is fname.  It is possible to open
+	a file more than once. Warning: Openinging a file more than once for 
+	write operations is not prevented. The possible consequence is
+	the corruption of the file structure, which will crash
+	the Paged File functions. On the other hand, opening a file
+	more than once for reading is OK.
+
+AUTHOR: clc
+
+RETURN VALUE:
+	The file descriptor, which is >= 0, if no error.
+	PF error codes otherwise.
+
+	Both file formats are accepted. With PF_OPEN_DIRECT, pages are
+	read and written with O_DIRECT, bypassing the kernel page cache;
+	this needs a PF_FORMAT_V2 or V3 file. PF_OPEN_MAPPED is
+	PF_OpenFileMapped(); it cannot be combined with PF_OPEN_DIRECT.
+	With PF_OPEN_MEMORY the file is kept in memory (see dev.c), and
+	with PF_OPEN_THROTTLED its reads and writes take as long as
+	PF_SetDeviceModel() says; neither can be combined with
+	PF_OPEN_DIRECT or PF_OPEN_MAPPED.
+
+IMPLEMENTATION NOTES:
+	A file opened more than once will have different file descriptors
+	returned. Separate buffers are used.
+	O_DIRECT is only turned on once the header and map pages are in
+	memory, and turned off again by PF_CloseFile() before they are
+	written back, since they are not read into aligned buffers.
+	With warm restart on, the pages of the file's warm list start
+	being prefetched before this returns; see PF_SetWarmRestart().
+*****************************************************************************/
+{
+int fd;
+
+	pthread_mutex_lock(&PFftabmutex);
+	fd = PFftabOpen(fname,flags);
+	pthread_mutex_unlock(&PFftabmutex);
+	if (fd >= 0 && PFwarmon && !PFmapped(fd))
+		PFwarmStart(fd);
+	return(fd);
+}
+
+int PF_OpenFileMapped(fname)
+char *fname;		/* name of the file to open */
+/****************************************************************************
+SPECIFICATIONS:
+	Open the paged file "fname" read-only, and mmap() all of it.
+	Same as PF_OpenFileEx(fname,PF_OPEN_MAPPED).
+	PF_GetFirstPage(), PF_GetNextPage() and PF_GetThisPage() then
+	return pointers into the mapping: pages are neither copied nor
+	kept in the buffer, and never evicted. PF_UnfixPage(), which must
+	be passed dirty == FALSE, and the latch functions do nothing.
+	The kernel is advised to read ahead while the pages are read in
+	order, and not to while they are not.
+	The pages must not be changed through the returned pointers,
+	nor the file by anyone else while it is open this way.
+
+RETURN VALUE:
+	The file descriptor, which is >= 0, if no error.
+	PFE_INCOMPLETEREAD	if the file is shorter than its pages.
+	PF error codes otherwise. Functions that would change the file
+	return PFE_READONLY.
+*****************************************************************************/
+{
+	return(PF_OpenFileEx(fname,PF_OPEN_MAPPED));
+}
+
+PF_CloseFile(fd)
+int fd;		/* file descriptor to close */
+/****************************************************************************
+SPECIFICATIONS:
+	Close the file indexed by file descriptor fd. The file should have
+	been opened with PFopen(). It is an error to close a file
+	with pages still fixed in the buffer. With warm restart on, the
+	pages it has in the buffer are saved to its warm list first.
+
+AUTHOR: clc
+
+RETURN VALUE:
+	PFE_OK	if OK
+	PF error code if error.
+
+*****************************************************************************/
+{
+int error;
+
+	if (PFinvalidFd(fd)){
+		/* invalid file descriptor */
+		PFerrno = PFE_FD;
+		return(PFerrno);
+	}
 	
 
-	/* Flush all buffers for this file */
-	if ( (error=PFbufReleaseFile(fd,PFwritefcn)) != PFE_OK)
+	if (PFmapped(fd)){
+		/* nothing of it is in the buffer, nor was changed */
+		if (munmap(PFftab[fd].mapaddr,PFftab[fd].maplen) == -1){
+			PFerrno = PFE_UNIX;
+			return(PFerrno);
+		}
+		PFftab[fd].mapaddr = NULL;
+	}
+	/* Flush all buffers for this file */
+	else {
+		if (PFwarmon)
+			PFwarmKeep(fd);
+		if ( (error=PFbufReleaseFile(fd,PFstartfcn)) != PFE_OK)
+			return(error);
+	}
+
+	/* header and map pages are not in aligned buffers */
+	if ((PFftab[fd].flags & PF_OPEN_DIRECT) &&
+			PFdevDirect(PFftab[fd].dev,FALSE) == -1){
+		PFerrno = PFE_UNIX;
+		return(PFerrno);
+	}
+
+	if (PFftab[fd].format != PF_FORMAT_V1){
+		if ((error=PFmapWrite(fd))!= PFE_OK)
+			return(error);
+	}
+
+	/* the checksums on file match the pages again, unless the file is
+	still open for writing under another descriptor */
+	if (PFftab[fd].crcpages > 0 && !PFmapped(fd)){
+		pthread_mutex_lock(&PFftabmutex);
+		error = PFopenElsewhere(PFftab[fd].fname,fd) ? PFE_OK :
+			PFcrcInUse(fd,FALSE);
+		pthread_mutex_unlock(&PFftabmutex);
+		if (error != PFE_OK)
+			return(error);
+	}
+
+	if (PFftab[fd].hdrchanged){
+		/* write the header back to the file. A V2 or V3 file has
+		magic and version in front of it, which do not change. */
+		if((error=PFdevPwrite(PFftab[fd].dev, (char *)&PFftab[fd].hdr,
+				PF_HDR_SIZE,PFftab[fd].format != PF_FORMAT_V1 ?
+				(off_t)offsetof(PFhdr2_str,hdr) : (off_t)0))
+				!=PF_HDR_SIZE){
+			if (error <0)
+				PFerrno = PFE_UNIX;
+			else	PFerrno = PFE_HDRWRITE;
+			return(PFerrno);
+		}
+		PFftab[fd].hdrchanged = FALSE;
+	}
+
+
+		
+	/* close the file */
+	if ((error=PFdevClose(PFftab[fd].dev))== -1){
+		PFerrno = PFE_UNIX;
+		return(PFerrno);
+	}
+
+	/* free the file name space */
+	pthread_mutex_lock(&PFftabmutex);
+	PFclosedread += PFftab[fd].bytesread;
+	PFclosedwritten += PFftab[fd].byteswritten;
+	free((char *)PFftab[fd].fname);
+	PFftab[fd].fname = NULL;
+	pthread_mutex_unlock(&PFftabmutex);
+	PFmapFree(fd);
+	pthread_mutex_destroy(&PFftab[fd].lock);
+
+	return(PFE_OK);
+}
+
+
+int PF_Shutdown()
+/****************************************************************************
+SPECIFICATIONS:
+	Close every open file, as PF_CloseFile() does, before the
+	program exits or calls PF_Init() again: dirty pages are written,
+	and with warm restart on, the warm lists saved. No other thread
+	may be using the PF layer.
+
+RETURN VALUE:
+	PFE_OK	if all files were closed.
+	PF error code of the first that could not be; the others are
+		closed all the same.
+*****************************************************************************/
+{
+int error = PFE_OK;
+int fd;
+
+	for (fd = 0; fd < PF_FTAB_SIZE; fd++)
+		if (PFftab[fd].fname != NULL &&
+				PF_CloseFile(fd) != PFE_OK && error == PFE_OK)
+			error = PFerrno;
+	if (error != PFE_OK)
+		PFerrno = error;
+	return(error);
+}
+
+
+static void PFmappedAdvise(fd,pagenum,inorder)
+int fd;		/* file descriptor of a PF_OPEN_MAPPED file */
+int pagenum;	/* page about to be returned */
+int inorder;	/* TRUE if it follows the page returned last */
+/****************************************************************************
+SPECIFICATIONS:
+	Count the pages of file "fd" read in order, or out of order, in
+	a row, and once there are PF_MADV_STREAK of them, advise the
+	kernel to read the mapping ahead, or not to.
+
+RETURN VALUE: none. The advice is only a hint, so failing to give it
+	is not an error. Kept without a lock, like read-ahead.
+*****************************************************************************/
+{
+PFftab_ele *f = &PFftab[fd];
+int advice;
+
+	if (inorder)
+		f->streak = f->streak > 0 ? f->streak + 1 : 1;
+	else	f->streak = f->streak < 0 ? f->streak - 1 : -1;
+	f->ralast = pagenum;
+
+	if (f->streak >= PF_MADV_STREAK){
+		f->streak = PF_MADV_STREAK;
+		advice = MADV_SEQUENTIAL;
+	}
+	else if (f->streak <= -PF_MADV_STREAK){
+		f->streak = -PF_MADV_STREAK;
+		advice = MADV_RANDOM;
+	}
+	else	return;
+	if (advice != f->advice){
+		(void)madvise(f->mapaddr,f->maplen,advice);
+		f->advice = advice;
+	}
+}
+
+static int PFmappedPage(fd,pagenum,pagebuf)
+int fd;		/* file descriptor of a PF_OPEN_MAPPED file */
+int pagenum;	/* valid page number */
+char **pagebuf;	/* set to the page data */
+/****************************************************************************
+SPECIFICATIONS:
+	Set *pagebuf to the data of page "pagenum" in the mapping of
+	file "fd", if the page is used.
+
+RETURN VALUE:
+	PFE_OK	if the page is used
+	PFE_INVALIDPAGE	if it is free.
+*****************************************************************************/
+{
+char *p = PFftab[fd].mapaddr + PFpageOffset(fd,pagenum);
+
+	if (PFftab[fd].format == PF_FORMAT_V1){
+		/* "nextfree" is in front of the data */
+		if (*(int *)p != PF_PAGE_USED)
+			return(PFE_INVALIDPAGE);
+		p += sizeof(int);
+	}
+	else if (PFmapSaysFree(fd,pagenum))
+		return(PFE_INVALIDPAGE);
+	*pagebuf = p;
+	return(PFE_OK);
+}
+
+
+PF_GetFirstPage(fd,pagenum,pagebuf)
+int fd;	/* file descriptor */
+int *pagenum;	/* page number of first page */
+char **pagebuf;	/* pointer to the pointer to buffer */
+/****************************************************************************
+SPECIFICATIONS:
+	Read the first page into memory and set *pagebuf to point to it.
+	Set *pagenum to the page number of the page read.
+	The page read is fixed in the buffer until it is unixed with
+	PFunfix().
+
+AUTHOR: clc
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_EOF	if end of file reached.(meaning there is no first page. )
+	other PF error code if other error.
+
+*****************************************************************************/
+{
+
+	*pagenum = -1;
+	return(PF_GetNextPage(fd,pagenum,pagebuf));
+}
+
+
+static void PFreadAhead(fd,pagenum)
+int fd;		/* file descriptor */
+int pagenum;	/* page the scan of file "fd" is about to read */
+/****************************************************************************
+SPECIFICATIONS:
+	If "pagenum" is past the last read-ahead window of file "fd",
+	read the next window, starting at "pagenum", into the buffer,
+	and make the following window larger.
+
+RETURN VALUE: none. If reading ahead fails, PFbufGet() will read the
+	page itself and report the problem.
+	The window is kept per file, without a lock: threads scanning the
+	same file at once only make reading ahead less accurate.
+*****************************************************************************/
+{
+PFftab_ele *f = &PFftab[fd];
+int n;
+int ramax = PFbufSize() / 4;	/* largest window, the pool may be resized */
+
+	if (ramax > PF_RA_MAXPAGES)
+		ramax = PF_RA_MAXPAGES;
+	if (!PFreadaheadon || ramax < 2 || pagenum < f->raend)
+		return;
+
+	f->rawin = f->rawin == 0 ? PF_RA_MINPAGES : 2 * f->rawin;
+	if (f->rawin > ramax)
+		f->rawin = ramax;
+	n = f->hdr.numpages - pagenum < f->rawin ?
+			f->hdr.numpages - pagenum : f->rawin;
+	f->raend = pagenum + n;
+	if (n > 1)
+		(void)PFbufPrefetch(fd,pagenum,n,PFreadvfcn,PFwritefcn);
+}
+
+
+PF_GetNextPage(fd,pagenum,pagebuf)
+int fd;	/* file descriptor of the file */
+int *pagenum;	/* old page number on input, new page number on output */
+char **pagebuf;	/* pointer to pointer to buffer of page data */
+/****************************************************************************
+SPECIFICATIONS:
+	Read the next valid page after *pagenum, the current page number,
+	and set *pagebuf to point to the page data. Set *pagenum
+	to be the new page number. The new page is fixed in memory 
+	until PFunfix() is called.
+	Note that PF_GetNextPage() with *pagenum == -1 will return the 
+	first valid page. PFgetFirst() is just a short hand for this.
+
+AUTHOR: clc
+
+RETURN VALUE:
+	PFE_OK	if success
+	PFE_EOF	if end of file reached without encountering
+		any used page data. 
+	PFE_INVALIDPAGE  if page number is invalid.
+	other PF errors code for other error.
+
+*****************************************************************************/
+{
+int temppage;	/* page number to scan for next valid page */
+int error;	/* error code */
+PFfpage *fpage;	/* pointer to file page */
+int scanning;	/* TRUE if reading ahead */
+
+	if (PFinvalidFd(fd)){
+		PFerrno = PFE_FD;
+		return(PFerrno);
+	}
+
+
+	if (*pagenum < -1 || *pagenum >= PFftab[fd].hdr.numpages){
+		PFerrno = PFE_INVALIDPAGE;
+		return(PFerrno);
+	}
+
+	/* Going on from the page returned last means a scan. A call
+	with -1 may just want the first page (the root of an index, say),
+	so reading ahead waits for the scan's second call. */
+	scanning = *pagenum >= 0 && *pagenum == PFftab[fd].ralast;
+
+	if (PFmapped(fd)){
+		for (temppage= *pagenum+1;temppage<PFftab[fd].hdr.numpages;
+				temppage++)
+			if (PFmappedPage(fd,temppage,pagebuf) == PFE_OK){
+				PFmappedAdvise(fd,temppage,scanning);
+				*pagenum = temppage;
+				return(PFE_OK);
+			}
+		PFerrno = PFE_EOF;
+		return(PFerrno);
+	}
+	if (!scanning){
+		PFftab[fd].raend = 0;
+		PFftab[fd].rawin = 0;
+	}
+
+	/* scan the file until a valid used page is found */
+	for (temppage= *pagenum+1;temppage<PFftab[fd].hdr.numpages;temppage++){
+		if (PFmapSaysFree(fd,temppage))
+			/* the map says it is free: no need to read it */
+			continue;
+		if (scanning)
+			PFreadAhead(fd,temppage);
+		if ( (error=PFbufGet(fd,temppage,&fpage,PFreadfcn,
+					PFwritefcn))!= PFE_OK)
+			return(error);
+		else if (PFpageUsed(fd,temppage,fpage)){
+			/* found a used page */
+			*pagenum = temppage;
+			PFftab[fd].ralast = temppage;
+			*pagebuf = (char *)fpage->pagebuf;
+			return(PFE_OK);
+		}
+
+		/* page is free, unfix it */
+		if ((error=PFbufUnfix(fd,temppage,FALSE))!= PFE_OK)
+			return(error);
+	}
+
+	/* No valid used page found */
+	PFerrno = PFE_EOF;
+	return(PFerrno);
+
+}
+
+static int PFgetThisPage(fd,pagenum,pagebuf)
+int fd;		/* file descriptor */
+int pagenum;	/* page number to read */
+char **pagebuf;	/* pointer to pointer to page data */
+/****************************************************************************
+SPECIFICATIONS:
+	PF_GetThisPage(), without the timing.
+*****************************************************************************/
+{
+int error;
+PFfpage *fpage;
+
+	if (PFinvalidFd(fd)){
+		PFerrno = PFE_FD;
+		return(PFerrno);
+	}
+
+	if (PFinvalidPagenum(fd,pagenum) || PFmapSaysFree(fd,pagenum)){
+		PFerrno = PFE_INVALIDPAGE;
+		return(PFerrno);
+	}
+
+	if (PFmapped(fd)){
+		if ((PFerrno=PFmappedPage(fd,pagenum,pagebuf))!= PFE_OK)
+			return(PFerrno);
+		PFmappedAdvise(fd,pagenum,pagenum == PFftab[fd].ralast + 1);
+		return(PFE_OK);
+	}
+
+	if ( (error=PFbufGet(fd,pagenum,&fpage,PFreadfcn,PFwritefcn))!= PFE_OK)
+		return(error);
+
+	if (PFpageUsed(fd,pagenum,fpage)){
+		/* page is used*/
+		*pagebuf = (char *)fpage->pagebuf;
+		return(PFE_OK);
+	}
+	else {
+		/* invalid page */
+		if (PFbufUnfix(fd,pagenum,FALSE)!= PFE_OK){
+			printf("internal error:PFgetThis()\n");
+			exit(1);
+		}
+		PFerrno = PFE_INVALIDPAGE;
+		return(PFerrno);
+	}
+}
+
+PF_GetThisPage(fd,pagenum,pagebuf)
+int fd;		/* file descriptor */
+int pagenum;	/* page number to read */
+char **pagebuf;	/* pointer to pointer to page data */
+/****************************************************************************
+SPECIFICATIONS:
+	Read the page specifeid by "pagenum" and set *pagebuf to point
+	to the page data. The page number should be valid.
+	A page already fixed (by another scan, say) is fixed once more
+	and shared; every PF_GetThisPage() needs its own PF_UnfixPage().
+	Timed while PF_SetLatency() is on.
+
+AUTHOR: clc
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_INVALIDPAGE if invalid page number is specified.
+	other PF error codes if other error encountered.
+*****************************************************************************/
+{
+long long start = PFlatStart();
+int error;
+
+	error = PFgetThisPage(fd,pagenum,pagebuf);
+	PFlatEnd(PF_LAT_GETTHISPAGE,start);
+	return(error);
+}
+
+/* a call of PF_GetPagesAsync(), until its last page is passed on */
+typedef struct PFgetasync {
+	void (*callback)();	/* the caller's */
+	void *arg;		/* for "callback" */
+	int remaining;		/* # of pages not passed on, + 1 until
+				PF_GetPagesAsync() returns */
+} PFgetasync;
+
+static void PFgetasyncdone(get,fd,pagenum,fpage,error)
+PFgetasync *get;
+int fd;		/* file descriptor */
+int pagenum;	/* page got */
+PFfpage *fpage;	/* its buffer, fixed, or NULL if error */
+int error;	/* PFE_OK, or why it could not be got */
+/****************************************************************************
+SPECIFICATIONS:
+	Called by PFbufGetAsync() for each page: check that it is used,
+	as PF_GetThisPage() does, and pass it to the caller's callback.
+*****************************************************************************/
+{
+	if (error == PFE_OK && !PFpageUsed(fd,pagenum,fpage)){
+		/* invalid page */
+		if (PFbufUnfix(fd,pagenum,FALSE)!= PFE_OK){
+			printf("internal error:PFgetasyncdone()\n");
+			exit(1);
+		}
+		error = PFE_INVALIDPAGE;
+	}
+	(*get->callback)(fd,pagenum,
+		error == PFE_OK ? (char *)fpage->pagebuf : (char *)NULL,error,
+		get->arg);
+	if (__sync_sub_and_fetch(&get->remaining,1) == 0)
+		free((char *)get);
+}
+
+int PF_GetPagesAsync(fd,pages,n,callback,arg)
+int fd;		/* file descriptor */
+int *pages;	/* page numbers to read */
+int n;		/* # of pages in pages[] */
+void (*callback)();	/* called for each page, see below */
+void *arg;	/* passed to "callback" */
+/****************************************************************************
+SPECIFICATIONS:
+	Fix pages[0..n-1] of file "fd" in the buffer, as PF_GetThisPage()
+	would, without waiting for them to be read: the missing pages are
+	read in runs of pages adjacent in pages[], all handed to the
+	asynchronous I/O engine (see PF_SetAioEngine()) at once. As each
+	page is fixed, or cannot be,
+		callback(fd,pagenum,pagebuf,error,arg)
+		int fd;
+		int pagenum;
+		char *pagebuf;
+		int error;
+		void *arg;
+	is called with its data, or with a NULL "pagebuf" and the error
+	PF_GetThisPage() would have returned. Every page gets one call,
+	in no particular order: pages in the buffer, invalid pages and
+	pages of a PF_OPEN_MAPPED file before this returns, others from a
+	thread of the engine, possibly after it returns. Each page fixed
+	must be unfixed with PF_UnfixPage(), by the callback or later.
+	A page listed twice is fixed twice. The missing pages are read
+	in page number order, whatever their order in pages[].
+	The callback should be short. It must not get, allocate or
+	dispose pages, nor close files: those may wait for reads the
+	engine's thread would have to finish. It may use the page, unfix
+	it, and call PF_GetPagesAsync().
+
+RETURN VALUE:
+	PFE_OK	if the callback will be called for every page.
+	PFE_FD	if the file descriptor is invalid,
+	PFE_INVALIDARG	if "n" is negative or a pointer NULL,
+	PFE_NOMEM	if out of memory;
+		in those cases the callback is called for no page.
+*****************************************************************************/
+{
+PFgetasync *get;
+int *valid;	/* the valid pages of pages[], then the invalid ones
+		from the end */
+int nvalid = 0, ninvalid = 0;
+int error;
+char *pagebuf;
+int i;
+
+	if (PFinvalidFd(fd)){
+		PFerrno = PFE_FD;
+		return(PFerrno);
+	}
+	if (n < 0 || (n > 0 && pages == NULL) || callback == NULL){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	if (n == 0)
+		return(PFE_OK);
+
+	if (PFmapped(fd)){
+		/* the pages are in memory already */
+		for (i = 0; i < n; i++){
+			error = PFgetThisPage(fd,pages[i],&pagebuf);
+			(*callback)(fd,pages[i],error == PFE_OK ? pagebuf :
+				(char *)NULL,error,arg);
+		}
+		return(PFE_OK);
+	}
+
+	get = (PFgetasync *)malloc(sizeof(PFgetasync));
+	valid = (int *)malloc(n * sizeof(int));
+	if (get == NULL || valid == NULL){
+		free((char *)get);
+		free((char *)valid);
+		PFerrno = PFE_NOMEM;
+		return(PFerrno);
+	}
+	for (i = 0; i < n; i++)
+		if (PFinvalidPagenum(fd,pages[i]) || PFmapSaysFree(fd,pages[i]))
+			valid[n - ++ninvalid] = pages[i];
+		else	valid[nvalid++] = pages[i];
+	get->callback = callback;
+	get->arg = arg;
+	get->remaining = nvalid + 1;
+
+	if ((error=PFbufGetAsync(fd,valid,nvalid,FALSE,PFreadfcn,PFwritefcn,
+			PFstartfcn,PFgetasyncdone,get))!= PFE_OK){
+		free((char *)get);
+		free((char *)valid);
 		return(error);
+	}
+	for (i = n - ninvalid; i < n; i++)
+		(*callback)(fd,valid[i],(char *)NULL,PFE_INVALIDPAGE,arg);
+	free((char *)valid);
+	if (__sync_sub_and_fetch(&get->remaining,1) == 0)
+		free((char *)get);
+	return(PFE_OK);
+}
 
-	if (PFftab[fd].hdrchanged){
-		/* write the header back to the file */
-		/* First seek to the appropriate place */
-		if ((error=lseek(PFftab[fd].unixfd,(unsigned)0,L_SET)) == -1){
-			/* seek error */
-			PFerrno = PFE_UNIX;
-			return(PFerrno);
+static int PFbitmapAlloc(fd,pagenum,npages)
+int fd;		/* file descriptor of a V3 file */
+int pagenum;	/* first page, found by PFbitmapFind() */
+int npages;	/* # of pages */
+/****************************************************************************
+SPECIFICATIONS:
+	Mark pages "pagenum" to "pagenum"+npages-1 of file "fd" used,
+	making the file longer if they go past its end. Called with the
+	lock of file "fd" held.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PF error code if not OK.
+*****************************************************************************/
+{
+PFftab_ele *f = &PFftab[fd];
+int error;
+int p;
+
+	if (pagenum + npages > f->hdr.numpages){
+		if ((error=PFmapGrow(fd,pagenum+npages))!= PFE_OK ||
+				(error=PFfileGrow(fd,pagenum+npages,FALSE))!= PFE_OK)
+			return(error);
+		f->hdr.numpages = pagenum + npages;
+	}
+	for (p = pagenum; p < pagenum + npages; p++)
+		PFsetnextfree(fd,p,(PFfpage *)NULL,PF_PAGE_USED);
+
+	/* PFbitmapFind() found no free page below a run starting there */
+	if (pagenum == f->hdr.firstfree || npages == 1)
+		f->hdr.firstfree = pagenum + npages;
+	f->hdrchanged = TRUE;
+	return(PFE_OK);
+}
+
+static int PFallocPage(fd,pagenum,pagebuf)
+int fd;		/* file descriptor */
+int *pagenum;	/* page number */
+char **pagebuf;	/* pointer to pointer to page buffer*/
+/****************************************************************************
+SPECIFICATIONS:
+	PF_AllocPage(), called with the lock of file "fd" held.
+*****************************************************************************/
+{
+PFfpage *fpage;	/* pointer to file page */
+int error;
+
+	if (PFftab[fd].format == PF_FORMAT_V3){
+		/* Take the lowest free page from the bitmap. Its contents
+		do not matter, so it is not read: a buffer page is just
+		given to it, unless it is still in the buffer. */
+		*pagenum = PFbitmapFind(fd,1);
+		if ((error=PFbufAlloc(fd,*pagenum,&fpage,PFwritefcn))== PFE_PAGEINBUF)
+			error = PFbufGet(fd,*pagenum,&fpage,PFreadfcn,PFwritefcn);
+		if (error != PFE_OK)
+			return(error);
+		if ((error=PFbitmapAlloc(fd,*pagenum,1))!= PFE_OK){
+			(void)PFbufUnfix(fd,*pagenum,FALSE);
+			return(error);
 		}
 
-		/* write header*/
-		if((error=write(PFftab[fd].unixfd, (char *)&PFftab[fd].hdr,
-				PF_HDR_SIZE))!=PF_HDR_SIZE){
-			if (error <0)
-				PFerrno = PFE_UNIX;
-			else	PFerrno = PFE_HDRWRITE;
-			return(PFerrno);
+		/* mark this page dirty */
+		if ((error=PFbufUsed(fd,*pagenum))!= PFE_OK){
+			printf("internal error: PFalloc()\n");
+			exit(1);
 		}
-		PFftab[fd].hdrchanged = FALSE;
 	}
+	else if (PFftab[fd].hdr.firstfree != PF_PAGE_LIST_END){
+		/* get a page from the free list */
+		*pagenum = PFftab[fd].hdr.firstfree;
+		if ((error=PFbufGet(fd,*pagenum,&fpage,PFreadfcn,
+					PFwritefcn))!= PFE_OK)
+			/* can't get the page */
+			return(error);
+		PFftab[fd].hdr.firstfree = fpage->nextfree;
+		PFftab[fd].hdrchanged = TRUE;
+	}
+	else {
+		/* Free list empty, allocate one more page from the file */
+		*pagenum = PFftab[fd].hdr.numpages;
+		if (PFftab[fd].format == PF_FORMAT_V2 &&
+			(error=PFmapGrow(fd,*pagenum+1))!= PFE_OK)
+			return(error);
+		if ((error=PFfileGrow(fd,*pagenum+1,FALSE))!= PFE_OK)
+			return(error);
+		if ((error=PFbufAlloc(fd,*pagenum,&fpage,PFwritefcn))!= PFE_OK)
+			/* can't allocate a page */
+			return(error);
+	
+		/* increment # of pages for this file */
+		PFftab[fd].hdr.numpages++;
+		PFftab[fd].hdrchanged = TRUE;
 
+		/* mark this page dirty */
+		if ((error=PFbufUsed(fd,*pagenum))!= PFE_OK){
+			printf("internal error: PFalloc()\n");
+			exit(1);
+		}
 
-		
-	/* close the file */
-	if ((error=close(PFftab[fd].unixfd))== -1){
-		PFerrno = PFE_UNIX;
-		return(PFerrno);
 	}
 
-	/* free the file name space */
-	free((char *)PFftab[fd].fname);
-	PFftab[fd].fname = NULL;
+	/* zero out the page. Seems to be a nice thing to do,
+	at least for debugging. */
+	/*
+	bzero(fpage->pagebuf,PF_PAGE_SIZE);
+	*/
+
+	/* Mark the new page used */
+	PFsetnextfree(fd,*pagenum,fpage,PF_PAGE_USED);
 
+	/* set return value */
+	*pagebuf = fpage->pagebuf;
+	
 	return(PFE_OK);
 }
 
+/* a page of a PF_GetPages() call: pages[index] is "page" */
+typedef struct PFgetpage {
+	int page;
+	int index;
+} PFgetpage;
+
+/* a call of PF_GetPages(), waiting for its pages */
+typedef struct PFgetpages {
+	pthread_mutex_t lock;
+	pthread_cond_t over;	/* signalled when the last page is got */
+	PFgetpage *sorted;	/* its pages, by page then index */
+	int n;			/* # of them */
+	int *errors;		/* errors[index], 1 until passed on */
+	char **bufs;		/* the caller's */
+	int remaining;		/* # of pages not passed on */
+} PFgetpages;
+
+static int PFgetpagecmp(a,b)
+const void *a;
+const void *b;
+/****************************************************************************
+SPECIFICATIONS:
+	qsort() comparison of two PFgetpage's, by page then index.
+*****************************************************************************/
+{
+	if (((PFgetpage *)a)->page != ((PFgetpage *)b)->page)
+		return(((PFgetpage *)a)->page - ((PFgetpage *)b)->page);
+	return(((PFgetpage *)a)->index - ((PFgetpage *)b)->index);
+}
 
-PF_GetFirstPage(fd,pagenum,pagebuf)
-int fd;	/* file descriptor */
-int *pagenum;	/* page number of first page */
-char **pagebuf;	/* pointer to the pointer to buffer */
+static void PFgetpagesdone(fd,pagenum,pagebuf,error,get)
+int fd;		/* file descriptor */
+int pagenum;	/* page got */
+char *pagebuf;	/* its data, or NULL if error */
+int error;	/* PFE_OK, or why it could not be got */
+PFgetpages *get;
 /****************************************************************************
 SPECIFICATIONS:
-	Read the first page into memory and set *pagebuf to point to it.
-	Set *pagenum to the page number of the page read.
-	The page read is fixed in the buffer until it is unixed with
-	PFunfix().
+	Callback of PF_GetPagesAsync() for PF_GetPages(): store the page
+	in the first entry of bufs[] that asks for it and has not got it.
+*****************************************************************************/
+{
+int lo = 0, hi, mid;
+
+	pthread_mutex_lock(&get->lock);
+	for (hi = get->n; lo < hi; ){
+		mid = (lo + hi) / 2;
+		if (get->sorted[mid].page < pagenum)
+			lo = mid + 1;
+		else	hi = mid;
+	}
+	while (get->errors[get->sorted[lo].index] != 1)
+		lo++;
+	get->bufs[get->sorted[lo].index] = pagebuf;
+	get->errors[get->sorted[lo].index] = error;
+	if (--get->remaining == 0)
+		pthread_cond_signal(&get->over);
+	pthread_mutex_unlock(&get->lock);
+}
 
-AUTHOR: clc
+int PF_GetPages(fd,pages,n,bufs)
+int fd;		/* file descriptor */
+int *pages;	/* page numbers to read */
+int n;		/* # of pages in pages[] */
+char **bufs;	/* bufs[i] is set to the data of pages[i] */
+/****************************************************************************
+SPECIFICATIONS:
+	Fix pages[0..n-1] of file "fd" in the buffer, as that many calls
+	of PF_GetThisPage() would, and set bufs[i] to point to the data
+	of pages[i]. The pages are looked up all at once, and those
+	missing are read as one batch in page number order, adjacent pages
+	with one call, by the asynchronous I/O engine (see
+	PF_SetAioEngine()). Returns when all are fixed. A page listed
+	twice is fixed twice. Each page must be unfixed, with
+	PF_UnfixPage() or PF_UnfixPages().
 
 RETURN VALUE:
 	PFE_OK	if no error.
-	PFE_EOF	if end of file reached.(meaning there is no first page. )
-	other PF error code if other error.
-
+	PFE_INVALIDPAGE if an invalid page number is specified.
+	PFE_INVALIDARG	if "n" is negative or a pointer NULL.
+	other PF error codes if other error encountered: the error of
+		the first page in pages[] that could not be got. Then no
+		page is left fixed, and bufs[] is all NULL.
 *****************************************************************************/
 {
+PFgetpages get;
+int error = PFE_OK;
+int i;
 
-	*pagenum = -1;
-	return(PF_GetNextPage(fd,pagenum,pagebuf));
-}
+	if (PFinvalidFd(fd)){
+		PFerrno = PFE_FD;
+		return(PFerrno);
+	}
+	if (n < 0 || (n > 0 && (pages == NULL || bufs == NULL))){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	if (n == 0)
+		return(PFE_OK);
 
+	get.sorted = (PFgetpage *)malloc(n * sizeof(PFgetpage));
+	get.errors = (int *)malloc(n * sizeof(int));
+	if (get.sorted == NULL || get.errors == NULL){
+		free((char *)get.sorted);
+		free((char *)get.errors);
+		PFerrno = PFE_NOMEM;
+		return(PFerrno);
+	}
+	for (i = 0; i < n; i++){
+		get.sorted[i].page = pages[i];
+		get.sorted[i].index = i;
+		get.errors[i] = 1;
+	}
+	qsort((char *)get.sorted, n, sizeof(PFgetpage), PFgetpagecmp);
+	get.n = get.remaining = n;
+	get.bufs = bufs;
+	pthread_mutex_init(&get.lock,NULL);
+	pthread_cond_init(&get.over,NULL);
+
+	if ((error=PF_GetPagesAsync(fd,pages,n,PFgetpagesdone,&get))== PFE_OK){
+		pthread_mutex_lock(&get.lock);
+		while (get.remaining > 0)
+			pthread_cond_wait(&get.over,&get.lock);
+		pthread_mutex_unlock(&get.lock);
+		for (i = 0; i < n && error == PFE_OK; i++)
+			error = get.errors[i];
+	}
+	if (error != PFE_OK){
+		/* all or nothing */
+		for (i = 0; i < n; i++){
+			if (get.errors[i] == PFE_OK)
+				(void)PF_UnfixPage(fd,pages[i],FALSE);
+			bufs[i] = NULL;
+		}
+		PFerrno = error;
+	}
+	pthread_mutex_destroy(&get.lock);
+	pthread_cond_destroy(&get.over);
+	free((char *)get.sorted);
+	free((char *)get.errors);
+	return(error);
+}
 
-PF_GetNextPage(fd,pagenum,pagebuf)
-int fd;	/* file descriptor of the file */
-int *pagenum;	/* old page number on input, new page number on output */
-char **pagebuf;	/* pointer to pointer to buffer of page data */
+PF_AllocPage(fd,pagenum,pagebuf)
+int fd;		/* file descriptor */
+int *pagenum;	/* page number */
+char **pagebuf;	/* pointer to pointer to page buffer*/
 /****************************************************************************
 SPECIFICATIONS:
-	Read the next valid page after *pagenum, the current page number,
-	and set *pagebuf to point to the page data. Set *pagenum
-	to be the new page number. The new page is fixed in memory 
-	until PFunfix() is called.
-	Note that PF_GetNextPage() with *pagenum == -1 will return the 
-	first valid page. PFgetFirst() is just a short hand for this.
+	Allocate a new, empty page for file "fd".
+	set *pagenum to the new page number. 
+	Set *pagebuf to point to the buffer for that page.
+	The page allocated is fixed in the buffer.
+	Threads allocating or disposing pages of the same file take turns.
+	For a PF_FORMAT_V3 file the lowest free page is taken, and is not
+	read from the file. Timed while PF_SetLatency() is on.
 
 AUTHOR: clc
 
 RETURN VALUE:
-	PFE_OK	if success
-	PFE_EOF	if end of file reached without encountering
-		any used page data. 
-	PFE_INVALIDPAGE  if page number is invalid.
-	other PF errors code for other error.
+	PFE_OK	if ok
+	PF error codes if not ok.
 
 *****************************************************************************/
 {
-int temppage;	/* page number to scan for next valid page */
-int error;	/* error code */
-PFfpage *fpage;	/* pointer to file page */
+int error;
+long long start;
 
 	if (PFinvalidFd(fd)){
-		PFerrno = PFE_FD;
+		PFerrno= PFE_FD;
+		return(PFerrno);
+	}
+
+	if (PFmapped(fd)){
+		PFerrno = PFE_READONLY;
 		return(PFerrno);
 	}
 
+	start = PFlatStart();
+	pthread_mutex_lock(&PFftab[fd].lock);
+	error = PFallocPage(fd,pagenum,pagebuf);
+	pthread_mutex_unlock(&PFftab[fd].lock);
+	PFlatEnd(PF_LAT_ALLOCPAGE,start);
+	return(error);
+}
 
-	if (*pagenum < -1 || *pagenum >= PFftab[fd].hdr.numpages){
-		PFerrno = PFE_INVALIDPAGE;
+static int PFallocExtent(fd,npages,pagenum)
+int fd;		/* file descriptor of a V3 file */
+int npages;	/* # of pages */
+int *pagenum;	/* set to the first page */
+/****************************************************************************
+SPECIFICATIONS:
+	PF_AllocExtent(), called with the lock of file "fd" held.
+*****************************************************************************/
+{
+int error;
+
+	*pagenum = PFbitmapFind(fd,npages);
+
+	/* pages past the end of the file must be there to be read */
+	if (*pagenum + npages > PFftab[fd].hdr.numpages &&
+			(error=PFfileGrow(fd,*pagenum+npages,TRUE))!= PFE_OK)
+		return(error);
+	return(PFbitmapAlloc(fd,*pagenum,npages));
+}
+
+int PF_AllocExtent(fd,npages,pagenum)
+int fd;		/* file descriptor */
+int npages;	/* # of pages */
+int *pagenum;	/* set to the first page */
+/****************************************************************************
+SPECIFICATIONS:
+	Allocate "npages" pages of file "fd" with adjacent page numbers,
+	and set *pagenum to the first one. The pages are not fixed in the
+	buffer; their contents are undefined (zeros past the old end of the
+	file), until they are written with PF_GetThisPage() and
+	PF_UnfixPage(). They can be disposed one by one. The file must be
+	a PF_FORMAT_V3 file.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PFE_FORMAT	if the file is not a PF_FORMAT_V3 file.
+	PFE_INVALIDARG	if npages < 1.
+	PF error codes if not ok.
+*****************************************************************************/
+{
+int error;
+
+	if (PFinvalidFd(fd)){
+		PFerrno= PFE_FD;
+		return(PFerrno);
+	}
+	if (PFftab[fd].format != PF_FORMAT_V3){
+		PFerrno = PFE_FORMAT;
 		return(PFerrno);
 	}
 
-	/* scan the file until a valid used page is found */
-	for (temppage= *pagenum+1;temppage<PFftab[fd].hdr.numpages;temppage++){
-		if ( (error=PFbufGet(fd,temppage,&fpage,PFreadfcn,
-					PFwritefcn))!= PFE_OK)
-			return(error);
-		else if (fpage->nextfree == PF_PAGE_USED){
-			/* found a used page */
-			*pagenum = temppage;
-			*pagebuf = (char *)fpage->pagebuf;
-			return(PFE_OK);
+	if (PFmapped(fd)){
+		PFerrno = PFE_READONLY;
+		return(PFerrno);
+	}
+	if (npages < 1){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+
+	pthread_mutex_lock(&PFftab[fd].lock);
+	error = PFallocExtent(fd,npages,pagenum);
+	pthread_mutex_unlock(&PFftab[fd].lock);
+	return(error);
+}
+
+static int PFdisposePage(fd,pagenum)
+int fd;		/* file descriptor */
+int pagenum;	/* page number */
+/****************************************************************************
+SPECIFICATIONS:
+	PF_DisposePage(), called with the lock of file "fd" held.
+*****************************************************************************/
+{
+PFfpage *fpage;	/* pointer to file page */
+int error;
+
+	if (PFftab[fd].format == PF_FORMAT_V3){
+		/* only the bitmap changes: the page is not read, and a copy
+		left in the buffer is known to be free from the bitmap */
+		if (PFbufPinCount(fd,pagenum) > 0){
+			PFerrno = PFE_PAGEFIXED;
+			return(PFerrno);
 		}
+		if (PFmapSaysFree(fd,pagenum)){
+			PFerrno = PFE_PAGEFREE;
+			return(PFerrno);
+		}
+		PFsetnextfree(fd,pagenum,(PFfpage *)NULL,PF_PAGE_LIST_END);
+		if (pagenum < PFftab[fd].hdr.firstfree)
+			PFftab[fd].hdr.firstfree = pagenum;
+		PFftab[fd].hdrchanged = TRUE;
+		return(PFE_OK);
+	}
+
+	if ((error=PFbufGet(fd,pagenum,&fpage,PFreadfcn,PFwritefcn))!= PFE_OK)
+		/* can't get this page */
+		return(error);
 
-		/* page is free, unfix it */
-		if ((error=PFbufUnfix(fd,temppage,FALSE))!= PFE_OK)
-			return(error);
+	if (PFbufPinCount(fd,pagenum) > 1){
+		/* somebody else has it fixed */
+		if (PFbufUnfix(fd,pagenum,FALSE)!= PFE_OK){
+			printf("internal error: PFdispose()\n");
+			exit(1);
+		}
+		PFerrno = PFE_PAGEFIXED;
+		return(PFerrno);
+	}
+	
+	if (fpage->nextfree != PF_PAGE_USED){
+		/* this page already freed */
+		if (PFbufUnfix(fd,pagenum,FALSE)!= PFE_OK){
+			printf("internal error: PFdispose()\n");
+			exit(1);
+		}
+		PFerrno = PFE_PAGEFREE;
+		return(PFerrno);
 	}
 
-	/* No valid used page found */
-	PFerrno = PFE_EOF;
-	return(PFerrno);
+	/* put this page into the free list */
+	PFsetnextfree(fd,pagenum,fpage,PFftab[fd].hdr.firstfree);
+	PFftab[fd].hdr.firstfree = pagenum;
+	PFftab[fd].hdrchanged = TRUE;
 
+	/* unfix this page */
+	return(PFbufUnfix(fd,pagenum,TRUE));
 }
 
-PF_GetThisPage(fd,pagenum,pagebuf)
+PF_DisposePage(fd,pagenum)
 int fd;		/* file descriptor */
-int pagenum;	/* page number to read */
-char **pagebuf;	/* pointer to pointer to page data */
+int pagenum;	/* page number */
 /****************************************************************************
 SPECIFICATIONS:
-	Read the page specifeid by "pagenum" and set *pagebuf to point
-	to the page data. The page number should be valid.
+	Dispose the page numbered "pagenum" of the file "fd".
+	Only a page that is not fixed in the buffer can be disposed.
 
 AUTHOR: clc
 
 RETURN VALUE:
 	PFE_OK	if no error.
-	PFE_INVALIDPAGE if invalid page number is specified.
-	PFE_PAGEFIXED if page already fixed in memory. In this case,
-		*pagebuf  is still set to point to the buffer that contains
-		the page data.
-	other PF error codes if other error encountered.
+	PF error code if error.
+
 *****************************************************************************/
 {
 int error;
-PFfpage *fpage;
 
 	if (PFinvalidFd(fd)){
 		PFerrno = PFE_FD;
@@ -540,118 +2417,107 @@ PFfpage *fpage;
 		return(PFerrno);
 	}
 
-	if ( (error=PFbufGet(fd,pagenum,&fpage,PFreadfcn,PFwritefcn))!= PFE_OK){
-		if (error== PFE_PAGEFIXED)
-			*pagebuf = fpage->pagebuf;
-		return(error);
-	}
-
-	if (fpage->nextfree == PF_PAGE_USED){
-		/* page is used*/
-		*pagebuf = (char *)fpage->pagebuf;
-		return(PFE_OK);
-	}
-	else {
-		/* invalid page */
-		if (PFbufUnfix(fd,pagenum,FALSE)!= PFE_OK){
-			printf("internal error:PFgetThis()\n");
-			exit(1);
-		}
-		PFerrno = PFE_INVALIDPAGE;
+	if (PFmapped(fd)){
+		PFerrno = PFE_READONLY;
 		return(PFerrno);
 	}
+
+	pthread_mutex_lock(&PFftab[fd].lock);
+	error = PFdisposePage(fd,pagenum);
+	pthread_mutex_unlock(&PFftab[fd].lock);
+	return(error);
 }
 
-PF_AllocPage(fd,pagenum,pagebuf)
-int fd;		/* file descriptor */
-int *pagenum;	/* page number */
-char **pagebuf;	/* pointer to pointer to page buffer*/
+PF_UnfixPage(fd,pagenum,dirty)
+int fd;	/* file descriptor */
+int pagenum;	/* page number */
+int dirty;	/* true if file is dirty */
 /****************************************************************************
 SPECIFICATIONS:
-	Allocate a new, empty page for file "fd".
-	set *pagenum to the new page number. 
-	Set *pagebuf to point to the buffer for that page.
-	The page allocated is fixed in the buffer.
+	Tell the Paged File Interface that the page numbered "pagenum"
+	of the file "fd" is no longer needed in the buffer.
+	Set the variable "dirty" to TRUE if page has been modified.
 
 AUTHOR: clc
 
 RETURN VALUE:
-	PFE_OK	if ok
-	PF error codes if not ok.
+	PFE_OK	if no error
+	PF error code if error.
 
 *****************************************************************************/
 {
-PFfpage *fpage;	/* pointer to file page */
-int error;
 
 	if (PFinvalidFd(fd)){
-		PFerrno= PFE_FD;
+		PFerrno = PFE_FD;
 		return(PFerrno);
 	}
 
-	if (PFftab[fd].hdr.firstfree != PF_PAGE_LIST_END){
-		/* get a page from the free list */
-		*pagenum = PFftab[fd].hdr.firstfree;
-		if ((error=PFbufGet(fd,*pagenum,&fpage,PFreadfcn,
-					PFwritefcn))!= PFE_OK)
-			/* can't get the page */
-			return(error);
-		PFftab[fd].hdr.firstfree = fpage->nextfree;
-		PFftab[fd].hdrchanged = TRUE;
+	if (PFinvalidPagenum(fd,pagenum)){
+		PFerrno = PFE_INVALIDPAGE;
+		return(PFerrno);
 	}
-	else {
-		/* Free list empty, allocate one more page from the file */
-		*pagenum = PFftab[fd].hdr.numpages;
-		if ((error=PFbufAlloc(fd,*pagenum,&fpage,PFwritefcn))!= PFE_OK)
-			/* can't allocate a page */
-			return(error);
-	
-		/* increment # of pages for this file */
-		PFftab[fd].hdr.numpages++;
-		PFftab[fd].hdrchanged = TRUE;
 
-		/* mark this page dirty */
-		if ((error=PFbufUsed(fd,*pagenum))!= PFE_OK){
-			printf("internal error: PFalloc()\n");
-			exit(1);
+	if (PFmapped(fd)){
+		/* nothing was fixed */
+		if (dirty){
+			PFerrno = PFE_READONLY;
+			return(PFerrno);
 		}
-
+		return(PFE_OK);
 	}
 
-	/* zero out the page. Seems to be a nice thing to do,
-	at least for debugging. */
-	/*
-	bzero(fpage->pagebuf,PF_PAGE_SIZE);
-	*/
+	return(PFbufUnfix(fd,pagenum,dirty));
+}
 
-	/* Mark the new page used */
-	fpage->nextfree = PF_PAGE_USED;
+int PF_UnfixPages(fd,pages,n,dirty)
+int fd;		/* file descriptor */
+int *pages;	/* page numbers */
+int n;		/* # of pages in pages[] */
+int dirty;	/* TRUE if the pages have been modified */
+/****************************************************************************
+SPECIFICATIONS:
+	Unfix pages[0..n-1] of file "fd", as that many calls of
+	PF_UnfixPage() would: the counterpart of PF_GetPages().
 
-	/* set return value */
-	*pagebuf = fpage->pagebuf;
-	
-	return(PFE_OK);
+RETURN VALUE:
+	PFE_OK	if no error
+	PF error code if error: that of the first page that could not
+		be unfixed. The others are unfixed all the same.
+*****************************************************************************/
+{
+int error = PFE_OK;
+int i;
+
+	if (n < 0 || (n > 0 && pages == NULL)){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	for (i = 0; i < n; i++)
+		if (PF_UnfixPage(fd,pages[i],dirty) != PFE_OK && error == PFE_OK)
+			error = PFerrno;
+	if (error != PFE_OK)
+		PFerrno = error;
+	return(error);
 }
 
-PF_DisposePage(fd,pagenum)
+int PF_LatchPage(fd,pagenum,mode)
 int fd;		/* file descriptor */
-int pagenum;	/* page number */
+int pagenum;	/* page number, fixed by the caller */
+int mode;	/* PF_LATCH_SHARED or PF_LATCH_EXCLUSIVE */
 /****************************************************************************
 SPECIFICATIONS:
-	Dispose the page numbered "pagenum" of the file "fd".
-	Only a page that is not fixed in the buffer can be disposed.
-
-AUTHOR: clc
+	Latch the data of a page the caller has fixed, before reading it
+	(PF_LATCH_SHARED) or changing it (PF_LATCH_EXCLUSIVE) while other
+	threads may use it too. Waits until no other thread holds a
+	conflicting latch. Release it with PF_UnlatchPage() before
+	unfixing the page. Single threaded callers need no latches.
 
 RETURN VALUE:
-	PFE_OK	if no error.
+	PFE_OK	if no error
+	PFE_INVALIDARG	if mode is unknown
 	PF error code if error.
-
 *****************************************************************************/
 {
-PFfpage *fpage;	/* pointer to file page */
-int error;
-
 	if (PFinvalidFd(fd)){
 		PFerrno = PFE_FD;
 		return(PFerrno);
@@ -662,48 +2528,30 @@ int error;
 		return(PFerrno);
 	}
 
-	if ((error=PFbufGet(fd,pagenum,&fpage,PFreadfcn,PFwritefcn))!= PFE_OK)
-		/* can't get this page */
-		return(error);
-	
-	if (fpage->nextfree != PF_PAGE_USED){
-		/* this page already freed */
-		if (PFbufUnfix(fd,pagenum,FALSE)!= PFE_OK){
-			printf("internal error: PFdispose()\n");
-			exit(1);
-		}
-		PFerrno = PFE_PAGEFREE;
+	if (mode != PF_LATCH_SHARED && mode != PF_LATCH_EXCLUSIVE){
+		PFerrno = PFE_INVALIDARG;
 		return(PFerrno);
 	}
 
-	/* put this page into the free list */
-	fpage->nextfree = PFftab[fd].hdr.firstfree;
-	PFftab[fd].hdr.firstfree = pagenum;
-	PFftab[fd].hdrchanged = TRUE;
+	if (PFmapped(fd))
+		/* nobody changes the pages */
+		return(PFE_OK);
 
-	/* unfix this page */
-	return(PFbufUnfix(fd,pagenum,TRUE));
+	return(PFbufLatch(fd,pagenum,mode == PF_LATCH_EXCLUSIVE));
 }
 
-PF_UnfixPage(fd,pagenum,dirty)
-int fd;	/* file descriptor */
+int PF_UnlatchPage(fd,pagenum)
+int fd;		/* file descriptor */
 int pagenum;	/* page number */
-int dirty;	/* true if file is dirty */
 /****************************************************************************
 SPECIFICATIONS:
-	Tell the Paged File Interface that the page numbered "pagenum"
-	of the file "fd" is no longer needed in the buffer.
-	Set the variable "dirty" to TRUE if page has been modified.
-
-AUTHOR: clc
+	Release the latch taken by PF_LatchPage().
 
 RETURN VALUE:
 	PFE_OK	if no error
 	PF error code if error.
-
 *****************************************************************************/
 {
-
 	if (PFinvalidFd(fd)){
 		PFerrno = PFE_FD;
 		return(PFerrno);
@@ -714,7 +2562,10 @@ RETURN VALUE:
 		return(PFerrno);
 	}
 
-	return(PFbufUnfix(fd,pagenum,dirty));
+	if (PFmapped(fd))
+		return(PFE_OK);
+
+	return(PFbufUnlatch(fd,pagenum));
 }
 
 /* --- NEW: PF_PrintStats function --- */
@@ -729,11 +2580,210 @@ SPECIFICATIONS:
     /* Call the buffer manager's print stats function */
     /* This function must be declared extern at the top of pf.c */
     PFbufPrintStats();
+    printf("  I/O System Calls: %lld\n", PFiocalls);
+    if (PFwarmpages > 0)
+        printf("  Warm-up: %lld of %lld pages\n", PFwarmdone, PFwarmpages);
 
     printf("---------------------------\n");
 }
 /* --- END NEW --- */
 
+int PF_SetFlusher(lowpct,highpct)
+int lowpct;	/* flush down to this % of the pool being dirty */
+int highpct;	/* start flushing above this %; 0 turns the flusher off */
+/****************************************************************************
+SPECIFICATIONS:
+	Start, change or stop the background flusher, a thread that writes
+	dirty pages near the victim end of the buffer ahead of time, so
+	that PF_GetThisPage() and friends rarely have to write a dirty
+	victim themselves. It runs once more than "highpct" percent of
+	the buffer pages are dirty, or a caller had to write a victim, and
+	stops when "lowpct" percent are left dirty. PF_Init() turns it off.
+	Must not be called while another thread uses the PF layer.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PFE_INVALIDARG	unless 0 <= lowpct <= highpct <= 100
+	PFE_UNIX	if the thread cannot be started.
+*****************************************************************************/
+{
+	if (lowpct < 0 || lowpct > highpct || highpct > 100){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	return(PFbufSetFlusher(lowpct,highpct,PFwritefcn));
+}
+
+int PF_SetPoolBudget(maxbufs)
+int maxbufs;	/* most buffer pages, or 0 */
+/****************************************************************************
+SPECIFICATIONS:
+	Let the buffer pool grow and shrink between PF_Init()s, up to
+	"maxbufs" pages. From the next PF_Init() on, the pool starts at the
+	size given to PF_Init() and, every few thousand sampled gets, is
+	resized to the smallest size whose estimated hit rate (see
+	PF_GetStats()) is within 1% of the best "maxbufs" pages would get.
+	With 0, the default, the pool keeps the size given to PF_Init().
+	The memory is reserved at PF_Init(), but only used as the pool
+	grows.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PFE_INVALIDARG	if "maxbufs" is negative.
+*****************************************************************************/
+{
+	if (maxbufs < 0){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	PFbufSetBudget(maxbufs);
+	return(PFE_OK);
+}
+
+int PF_ResizePool(nbufs)
+int nbufs;	/* # of buffer pages wanted */
+/****************************************************************************
+SPECIFICATIONS:
+	Make the buffer pool "nbufs" pages large, at most the larger of the
+	size given to PF_Init() and the budget of PF_SetPoolBudget().
+	Pages that no longer fit are replaced, dirty ones written first;
+	fixed pages stay, so the pool may stay larger than asked for. Can
+	be called while other threads use the PF layer; they wait while
+	the pool is resized.
+
+RETURN VALUE:
+	The # of buffer pages the pool has now, or
+	PFE_INVALIDARG	if "nbufs" is out of range.
+	PF error code if a page cannot be written.
+*****************************************************************************/
+{
+	return(PFbufResize(nbufs,PFwritefcn));
+}
+
+int PF_SetExtentPages(npages)
+int npages;	/* PF_EXTENT_MIN to PF_EXTENT_MAX, or 0 */
+/****************************************************************************
+SPECIFICATIONS:
+	Make files grow by extents of "npages" pages: when a page is
+	allocated past the space of its file, that many pages are reserved
+	at once with fallocate(), and the pages allocated next are
+	written into them. The file's page count stays the number of
+	pages in use; the reserved pages after it are zeros, and are used
+	by later allocations, also after the file is opened again. With
+	0, the default, files grow a page at a time as pages are written.
+	Must not be called while another thread allocates pages.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PFE_INVALIDARG	unless "npages" is 0 or in range.
+*****************************************************************************/
+{
+	if (npages != 0 && (npages < PF_EXTENT_MIN || npages > PF_EXTENT_MAX)){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	PFextentpages = npages;
+	return(PFE_OK);
+}
+
+int PF_SetReadAhead(on)
+int on;		/* TRUE to turn reading ahead on, FALSE to turn it off */
+/****************************************************************************
+SPECIFICATIONS:
+	Turn reading ahead in PF_GetNextPage() scans on (the default) or
+	off. Reading ahead fetches a scan's next pages with one call,
+	but into frames other pages are using: with a small pool, pages
+	read ahead may push out pages that are asked for again before
+	the scan gets to them.
+
+RETURN VALUE:
+	PFE_OK	always.
+*****************************************************************************/
+{
+	PFreadaheadon = on ? TRUE : FALSE;
+	return(PFE_OK);
+}
+
+int PF_GetStats(stats)
+struct PF_Stats *stats;	/* filled with the counters */
+/****************************************************************************
+SPECIFICATIONS:
+	Fill "stats" with the 64 bit counters of the buffer manager: for
+	each open file since it was opened, and in all since PF_Init() or
+	PF_ResetStats(), and with the pool's size and ARC's target, which
+	are not counters. Files opened with PF_OPEN_MAPPED do not use the
+	buffer, so their counters stay 0. Can be called while other
+	threads use the PF layer; the counters are then only about
+	consistent with each other.
+
+RETURN VALUE:
+	PFE_OK	if ok
+	PFE_INVALIDARG	if "stats" is NULL.
+*****************************************************************************/
+{
+int fd;
+
+	if (stats == NULL){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+
+	PFbufGetStats(stats);
+	stats->total.bytes_read += PFclosedread;
+	stats->total.bytes_written += PFclosedwritten;
+	pthread_mutex_lock(&PFftabmutex);
+	for (fd = 0; fd < PF_FTAB_SIZE; fd++)
+		if (PFftab[fd].fname != NULL){
+			stats->file[fd].bytes_read = PFftab[fd].bytesread;
+			stats->file[fd].bytes_written = PFftab[fd].byteswritten;
+			stats->total.bytes_read += PFftab[fd].bytesread;
+			stats->total.bytes_written += PFftab[fd].byteswritten;
+		}
+	pthread_mutex_unlock(&PFftabmutex);
+	stats->iocalls = PFiocalls;
+	stats->arc_target = PFbufARCTarget();
+	stats->warm_pages = PFwarmpages;
+	stats->warm_done = PFwarmdone;
+	return(PFE_OK);
+}
+
+void PF_ResetStats()
+/****************************************************************************
+SPECIFICATIONS:
+	Set all the counters PF_GetStats() and PF_PrintStats() report to
+	0, leaving open files and the buffer as they are, unlike
+	PF_Init(). The warm-up counters are left alone: prefetching may
+	still be going on.
+
+RETURN VALUE: none
+*****************************************************************************/
+{
+int fd;
+
+	PFbufResetStats();
+	pthread_mutex_lock(&PFftabmutex);
+	for (fd = 0; fd < PF_FTAB_SIZE; fd++){
+		PFftab[fd].bytesread = 0;
+		PFftab[fd].byteswritten = 0;
+	}
+	PFclosedread = 0;
+	PFclosedwritten = 0;
+	pthread_mutex_unlock(&PFftabmutex);
+	PFiocalls = 0;
+}
+
+int PF_GetARCTarget()
+/****************************************************************************
+SPECIFICATIONS:
+    Return the number of buffer pages ARC currently aims to give to
+    recently-seen-once pages (its T1 target). It moves on every ghost
+    hit, so sampling it shows how ARC adapts to the workload. Returns 0
+    if the buffer does not use PF_ARC.
+*****************************************************************************/
+{
+    return(PFbufARCTarget());
+}
+
 /* error messages */
 static char *PFerrormsg[]={
 "No error",
@@ -755,7 +2805,12 @@ static char *PFerrormsg[]={
 "page already unfixed",
 "new page to be allocated already in buffer",
 "hash table entry not found",
-"page already in hash table"
+"page already in hash table",
+"not a paged file, or unknown format",
+"O_DIRECT needs a PF_FORMAT_V2 or V3 file",
+"invalid argument",
+"file is opened read-only",
+"page read does not match its checksum"
 };
 
 void PF_PrintError(s)
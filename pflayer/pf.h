@@ -1,4 +1,6 @@
 /* pf.h: externs and error codes for Paged File Interface*/
+#ifndef PF_H
+#define PF_H
 #ifndef TRUE
 #define TRUE 1
 #endif
@@ -30,26 +32,172 @@
 #define PFE_HASHNOTFOUND -18 /* hash table entry not found */
 #define PFE_HASHPAGEEXIST -19 /* page already exist in hash table */
 
+#define PFE_FORMAT -20 /* not a paged file, or unknown format */
+#define PFE_NODIRECT -21 /* O_DIRECT needs a PF_FORMAT_V2 or V3 file */
+#define PFE_INVALIDARG -22 /* invalid argument */
+#define PFE_READONLY -23 /* file is opened read-only (PF_OPEN_MAPPED) */
+#define PFE_CHECKSUM -24 /* page read does not match its checksum */
+
 /* page size */
 #define PF_PAGE_SIZE 4096
 
+/* buffer replacement strategies, passed to PF_Init() */
+#define PF_LRU 0 /* least recently used */
+#define PF_MRU 1 /* most recently used */
+#define PF_CLOCK 2 /* second chance: reference bit + sweeping hand */
+#define PF_2Q 3 /* scan resistant: pages must be re-referenced to stay */
+#define PF_ARC 4 /* adaptive replacement cache: tunes recency/frequency */
+
+/* file formats, for PF_CreateFileEx() */
+#define PF_FORMAT_V1 1 /* original: 8 byte header, 4100 byte pages */
+#define PF_FORMAT_V2 2 /* 4096 byte pages at 4096 aligned offsets */
+#define PF_FORMAT_V3 3 /* as V2, with a bitmap of free pages */
+#define PF_FORMAT_CHECKSUM 16 /* or'ed with V2 or V3: CRC32C of every page */
+
+/* flags for PF_OpenFileEx() */
+#define PF_OPEN_DIRECT 1 /* O_DIRECT: bypass the kernel page cache */
+#define PF_OPEN_MAPPED 2 /* read-only, pages read from an mmap()'d file */
+#define PF_OPEN_MEMORY 4 /* kept in memory, loaded at the first open */
+#define PF_OPEN_THROTTLED 8 /* as slow as the PF_SetDeviceModel() device */
+
+/* engines of asynchronous I/O, for PF_SetAioEngine() */
+#define PF_AIO_URING 0 /* io_uring, if the kernel has it */
+#define PF_AIO_THREADS 1 /* a pool of threads doing blocking I/O */
+
+/* ways of computing page checksums, for PF_SetCrcEngine() */
+#define PF_CRC_SSE42 0 /* the SSE4.2 crc32 instruction, if the CPU has it */
+#define PF_CRC_SLICE8 1 /* tables, 8 bytes at a time ("slicing-by-8") */
+
+/* sizes of the extents files grow by, for PF_SetExtentPages() */
+#define PF_EXTENT_MIN 64 /* pages */
+#define PF_EXTENT_MAX 1024 /* pages */
+
+/* # of files that can be open at once; file descriptors are below it */
+#define PF_MAX_FILES 20
+
+/* buffer counters of a file, or of all files, for PF_GetStats() */
+typedef struct PF_Counters {
+	long long hits;		/* gets of a page found in the buffer */
+	long long misses;	/* gets that had to read the page */
+	long long evictions;	/* pages replaced to make room for others */
+	long long dirty_evictions; /* of those, written out by the get
+				that replaced them */
+	long long pin_waits;	/* gets that waited for another thread:
+				to read or write the page, or to unfix a
+				frame when all were fixed or busy */
+	long long ra_pages;	/* pages read ahead */
+	long long ra_hits;	/* of those, asked for while still resident */
+	long long writes;	/* pages unfixed dirty */
+	long long pages_written;	/* pages written to the file */
+	long long flusher_writes;	/* of those, by the background flusher */
+	long long bytes_read;	/* bytes read from the file, pages only */
+	long long bytes_written;	/* bytes written to it, pages only */
+} PF_Counters;
+
+/* # of points of the miss ratio curve in struct PF_Stats: pools of 8
+pages to over 400000 */
+#define PF_MRC_NPOINTS 64
+
+/* all counters, filled by PF_GetStats() */
+struct PF_Stats {
+	PF_Counters total;	/* all files, also those closed since */
+	PF_Counters file[PF_MAX_FILES];	/* file descriptor i, since it
+				was opened; zero if it is not open */
+	long long iocalls;	/* page read/write system calls */
+	int nbufs;		/* # of pages the buffer pool uses now */
+	int arc_target;		/* pages ARC aims to give T1 now, see
+				PF_GetARCTarget(); 0 with other strategies */
+	long long warm_pages;	/* pages of warm lists to prefetch, see
+				PF_SetWarmRestart() */
+	long long warm_done;	/* of those, prefetched or found in the
+				buffer */
+
+	/* miss ratio curve, estimated from a sample of the gets since
+	PF_Init() or PF_ResetStats(): an LRU pool of mrc_nbufs[i] pages
+	would have had hit rate mrc_hitrate[i] over them. */
+	long long mrc_sampled;	/* # of gets sampled for it */
+	int mrc_nbufs[PF_MRC_NPOINTS];	/* pool sizes, growing by 2^(1/4) */
+	double mrc_hitrate[PF_MRC_NPOINTS];
+};
+
+/* calls timed by the latency histograms, for PF_GetLatency() */
+#define PF_LAT_GETTHISPAGE 0 /* PF_GetThisPage() */
+#define PF_LAT_ALLOCPAGE 1 /* PF_AllocPage() */
+#define PF_LAT_HFINSERT 2 /* HF_InsertRec() */
+#define PF_LAT_HFFINDNEXT 3 /* HF_FindNextRec() */
+#define PF_LAT_AMINSERT 4 /* AM_InsertEntry() */
+#define PF_LAT_AMFINDNEXT 5 /* AM_FindNextEntry() */
+#define PF_LAT_NOPS 6
+
+/* a record of the page access trace, see PF_StartTrace() */
+typedef struct PF_TraceRec {
+	int fd;		/* file descriptor, -1 for all files */
+	int page;	/* page number, -1 for a PF_TRACE_CLOSE */
+	int event;	/* PF_TRACE_* bits */
+} PF_TraceRec;
+
+#define PF_TRACE_PIN 1 /* page fixed; unfixed if not set */
+#define PF_TRACE_WRITE 2 /* with PF_TRACE_PIN: a new page was allocated,
+			else: the page was unfixed dirty */
+#define PF_TRACE_CLOSE 4 /* the buffer let go of every page of "fd" */
+
+/* latch modes, for PF_LatchPage() */
+#define PF_LATCH_SHARED 0 /* readers: any number at a time */
+#define PF_LATCH_EXCLUSIVE 1 /* a writer, alone */
+
 /* externs from the PF layer */
-extern int PFerrno; /* error number of last error */
+extern __thread int PFerrno; /* error number of last error, per thread */
 
 /* --- ALL PF Interface Functions --- */
 extern void PF_Init(int buf_size, int strategy);
 extern void PF_PrintError(char *s);
 extern void PF_PrintStats();
+extern int PF_GetARCTarget();
+extern int PF_GetStats(struct PF_Stats *stats);
+extern void PF_ResetStats();
+extern int PF_SetPoolBudget(int maxbufs);
+extern int PF_ResizePool(int nbufs);
+extern void PF_SetLatency(int on);
+extern void PF_ResetLatency();
+extern long long PF_GetLatency(int op, double pct);
+extern void PF_PrintLatency();
+extern int PF_StartTrace(char *fname);
+extern int PF_StopTrace();
+extern int PF_SetFlusher(int lowpct, int highpct);
+extern int PF_SetExtentPages(int npages);
+extern int PF_SetReadAhead(int on);
+extern int PF_SetDeviceModel(int read_us, int write_us, int mbps);
+extern int PF_SetAioEngine(int engine);
+extern int PF_SetWarmRestart(int on);
+extern int PF_SetCrcEngine(int engine);
+
+/* for the layers above: time a call of operation PF_LAT_*, see lat.c */
+extern long long PFlatStart();
+extern void PFlatEnd(int op, long long start);
 
 extern int PF_CreateFile(char *fname);
+extern int PF_CreateFileEx(char *fname, int format);
 extern int PF_DestroyFile(char *fname);
 extern int PF_OpenFile(char *fname);
+extern int PF_OpenFileEx(char *fname, int flags);
+extern int PF_OpenFileMapped(char *fname);
 extern int PF_CloseFile(int fd);
+extern int PF_Shutdown();
 
 extern int PF_GetFirstPage(int fd, int *pagenum, char **pagebuf);
 extern int PF_GetNextPage(int fd, int *pagenum, char **pagebuf);
 extern int PF_GetThisPage(int fd, int pagenum, char **pagebuf);
+extern int PF_GetPagesAsync(int fd, int *pages, int n,
+	void (*callback)(int fd, int pagenum, char *pagebuf, int error, void *arg),
+	void *arg);
+extern int PF_GetPages(int fd, int *pages, int n, char **bufs);
 
 extern int PF_AllocPage(int fd, int *pagenum, char **pagebuf);
+extern int PF_AllocExtent(int fd, int npages, int *pagenum);
 extern int PF_DisposePage(int fd, int pagenum);
-extern int PF_UnfixPage(int fd, int pagenum, int dirty);
\ No newline at end of file
+extern int PF_UnfixPage(int fd, int pagenum, int dirty);
+extern int PF_UnfixPages(int fd, int *pages, int n, int dirty);
+extern int PF_LatchPage(int fd, int pagenum, int mode);
+extern int PF_UnlatchPage(int fd, int pagenum);
+
+#endif /* PF_H */
@@ -0,0 +1,489 @@
+/* pfsim.c: replay a page access trace (see PF_StartTrace()) against the
+LRU, MRU and CLOCK strategies of the buffer manager, and against
+Belady's OPT, which replaces the page that is fixed again furthest in
+the future, for a sweep of pool sizes, and print the miss ratio of each.
+
+The pool is simulated the way buf.c runs one partition: a page is fixed
+by a get or an alloc and stays fixed until as many unfixes, fixed pages
+are never replaced, a page becomes most recently used at its last unfix,
+free frames are used before any page is replaced, and closing a file
+frees its frames. The miss ratio is the fraction of gets that had to
+read their page. An alloc takes a frame but reads nothing, so it is
+not counted. Read-ahead is not simulated. A pool smaller than the most
+pages ever fixed at once would run out of frames (PFE_NOBUF); its
+column says "nobuf".
+
+Usage: pfsim trace [nbufs ...]
+	Without sizes, pools of 8, 16, 32, ... pages are simulated, up to
+	one holding every page of the trace. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pf.h"
+
+#define NONE		(-1)
+#define NOREF		(1LL << 62)	/* next use of a page never fixed again */
+
+/* simulated strategies */
+#define SIM_LRU		0
+#define SIM_MRU		1
+#define SIM_CLOCK	2
+#define SIM_OPT		3
+#define SIM_NPOLICIES	4
+
+static char *simnames[SIM_NPOLICIES] = { "LRU", "MRU", "CLOCK", "OPT" };
+
+/* events, with pages numbered densely */
+#define EV_GET		0	/* page fixed by a get */
+#define EV_ALLOC	1	/* page fixed by an alloc */
+#define EV_UNFIX	2	/* page unfixed */
+#define EV_DROP		3	/* pages of file "id" let go of, all if NONE */
+
+typedef struct Event {
+	int id;		/* page, or file for EV_DROP */
+	int what;	/* EV_* */
+} Event;
+
+static Event *evs;		/* the trace */
+static long nevs;
+static long long *nextpin;	/* EV_GET, EV_ALLOC: event # of the next
+				fix of the same page, or NOREF */
+static int npages;		/* # of distinct pages */
+static int *pagefile;		/* file of each page */
+static long ngets, nallocs;
+
+/* simulation state, per page and per frame */
+static int *frame;		/* frame holding a page, or NONE */
+static int *pins;		/* # of times a page is fixed */
+static int *next, *prev;	/* used list, most recent first */
+static int head, tail;
+static int *frames;		/* page in each frame */
+static char *ref;		/* CLOCK reference bit of each frame */
+static int *freeframes;		/* stack of free frames */
+static int nfree;
+static int hand;
+static long long *nextuse;	/* OPT: next fix of each page */
+
+/* OPT: max heap of resident pages by next use. Entries are not removed
+when a page is fixed again or replaced, but skipped when popped. */
+typedef struct HeapEnt {
+	long long key;	/* nextuse[id] when pushed */
+	int id;
+} HeapEnt;
+static HeapEnt *heap;
+static long nheap;
+static HeapEnt *aside;		/* fixed pages popped, nbufs at most */
+static int uselist;		/* TRUE for LRU and MRU */
+
+static void *xalloc(n)
+size_t n;
+{
+void *p;
+
+	if ((p = calloc(n > 0 ? n : 1, 1)) == NULL){
+		fprintf(stderr, "pfsim: out of memory\n");
+		exit(1);
+	}
+	return(p);
+}
+
+/********************** mapping (file,page) to an id **********************/
+static long long *mapkey;	/* (file << 32 | page) + 1, 0 if empty */
+static int *mapid;
+static unsigned long mapcap;
+
+static unsigned long maphash(key)
+long long key;
+{
+	return((unsigned long)((unsigned long long)key * 0x9E3779B97F4A7C15ULL >> 20));
+}
+
+static int pageid(file,page)
+int file, page;
+{
+long long key = ((long long)file << 32 | (unsigned)page) + 1;
+unsigned long i, oldcap;
+long long *oldkey;
+int *oldid;
+
+	if (2 * (unsigned long)npages >= mapcap){
+		/* grow */
+		oldkey = mapkey;
+		oldid = mapid;
+		oldcap = mapcap;
+		mapcap = mapcap ? 2 * mapcap : 1024;
+		mapkey = xalloc(mapcap * sizeof(long long));
+		mapid = xalloc(mapcap * sizeof(int));
+		for (i = 0; i < oldcap; i++){
+			unsigned long j = maphash(oldkey[i]) & (mapcap - 1);
+
+			if (oldkey[i] == 0)
+				continue;
+			while (mapkey[j] != 0)
+				j = (j + 1) & (mapcap - 1);
+			mapkey[j] = oldkey[i];
+			mapid[j] = oldid[i];
+		}
+		free(oldkey);
+		free(oldid);
+		pagefile = realloc(pagefile, mapcap / 2 * sizeof(int));
+		if (pagefile == NULL){
+			fprintf(stderr, "pfsim: out of memory\n");
+			exit(1);
+		}
+	}
+	for (i = maphash(key) & (mapcap - 1); mapkey[i] != 0; i = (i + 1) & (mapcap - 1))
+		if (mapkey[i] == key)
+			return(mapid[i]);
+	mapkey[i] = key;
+	mapid[i] = npages;
+	pagefile[npages] = file;
+	return(npages++);
+}
+
+/* Read trace "fname" into evs[]. A file descriptor names a new file
+each time it is closed, so pages of different files never mix. */
+static void readtrace(fname)
+char *fname;
+{
+FILE *fp;
+PF_TraceRec rec;
+int gen[PF_MAX_FILES];
+int ngen, fd;
+long cap = 0;
+long long *lastpin;
+long i;
+
+	if ((fp = fopen(fname, "r")) == NULL){
+		perror(fname);
+		exit(1);
+	}
+	for (fd = 0; fd < PF_MAX_FILES; fd++)
+		gen[fd] = fd;
+	ngen = PF_MAX_FILES;
+	while (fread((char *)&rec, sizeof(rec), 1, fp) == 1){
+		if (rec.fd < -1 || rec.fd >= PF_MAX_FILES ||
+				(rec.fd == -1 && rec.event != PF_TRACE_CLOSE)){
+			fprintf(stderr, "%s: bad record %ld\n", fname, nevs);
+			exit(1);
+		}
+		if (nevs == cap){
+			cap = cap ? 2 * cap : 65536;
+			if ((evs = realloc(evs, cap * sizeof(Event))) == NULL){
+				fprintf(stderr, "pfsim: out of memory\n");
+				exit(1);
+			}
+		}
+		if (rec.event & PF_TRACE_CLOSE){
+			evs[nevs].what = EV_DROP;
+			evs[nevs].id = rec.fd < 0 ? NONE : gen[rec.fd];
+			for (fd = 0; fd < PF_MAX_FILES; fd++)
+				if (rec.fd < 0 || fd == rec.fd)
+					gen[fd] = ngen++;
+		}
+		else {
+			evs[nevs].id = pageid(gen[rec.fd], rec.page);
+			if (!(rec.event & PF_TRACE_PIN))
+				evs[nevs].what = EV_UNFIX;
+			else if (rec.event & PF_TRACE_WRITE){
+				evs[nevs].what = EV_ALLOC;
+				nallocs++;
+			}
+			else {
+				evs[nevs].what = EV_GET;
+				ngets++;
+			}
+		}
+		nevs++;
+	}
+	if (ferror(fp)){
+		perror(fname);
+		exit(1);
+	}
+	fclose(fp);
+
+	/* next fix of the same page, found walking backwards */
+	nextpin = xalloc((nevs > 0 ? nevs : 1) * sizeof(long long));
+	lastpin = xalloc((npages > 0 ? npages : 1) * sizeof(long long));
+	for (i = 0; i < npages; i++)
+		lastpin[i] = NOREF;
+	for (i = nevs - 1; i >= 0; i--)
+		if (evs[i].what == EV_GET || evs[i].what == EV_ALLOC){
+			nextpin[i] = lastpin[evs[i].id];
+			lastpin[evs[i].id] = i;
+		}
+	free(lastpin);
+}
+
+/******************************* used list ******************************/
+static void unlink_page(id)
+int id;
+{
+	if (prev[id] != NONE)
+		next[prev[id]] = next[id];
+	else
+		head = next[id];
+	if (next[id] != NONE)
+		prev[next[id]] = prev[id];
+	else
+		tail = prev[id];
+}
+
+static void link_head(id)
+int id;
+{
+	prev[id] = NONE;
+	next[id] = head;
+	if (head != NONE)
+		prev[head] = id;
+	else
+		tail = id;
+	head = id;
+}
+
+/****************************** OPT heap ********************************/
+static void heap_push(key,id)
+long long key;
+int id;
+{
+long i, p;
+
+	for (i = nheap++; i > 0 && heap[p = (i - 1) / 2].key < key; i = p)
+		heap[i] = heap[p];
+	heap[i].key = key;
+	heap[i].id = id;
+}
+
+static HeapEnt heap_pop()
+{
+HeapEnt top = heap[0], last = heap[--nheap];
+long i = 0, c;
+
+	while ((c = 2 * i + 1) < nheap){
+		if (c + 1 < nheap && heap[c + 1].key > heap[c].key)
+			c++;
+		if (heap[c].key <= last.key)
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = last;
+	return(top);
+}
+
+/****************************** simulation ******************************/
+
+/* the page to replace, NONE if all are fixed */
+static int victim(policy,nbufs)
+int policy, nbufs;
+{
+HeapEnt e;
+int id, n, naside;
+
+	switch (policy){
+	case SIM_LRU:
+		for (id = tail; id != NONE && pins[id] > 0; id = prev[id])
+			;
+		return(id);
+	case SIM_MRU:
+		for (id = head; id != NONE && pins[id] > 0; id = next[id])
+			;
+		return(id);
+	case SIM_CLOCK:
+		/* two full turns: the first may only clear reference bits */
+		for (n = 0; n < 2 * nbufs; n++){
+			id = frames[hand];
+			if (pins[id] > 0){
+				hand = (hand + 1) % nbufs;
+				continue;
+			}
+			if (ref[hand]){
+				ref[hand] = FALSE;
+				hand = (hand + 1) % nbufs;
+				continue;
+			}
+			hand = (hand + 1) % nbufs;
+			return(id);
+		}
+		return(NONE);
+	default:
+		/* skip stale entries, set fixed pages aside */
+		id = NONE;
+		naside = 0;
+		while (nheap > 0){
+			e = heap_pop();
+			if (frame[e.id] == NONE || nextuse[e.id] != e.key)
+				continue;
+			if (pins[e.id] == 0){
+				id = e.id;
+				break;
+			}
+			aside[naside++] = e;
+		}
+		while (naside > 0){
+			naside--;
+			heap_push(aside[naside].key, aside[naside].id);
+		}
+		return(id);
+	}
+}
+
+/* let go of page "id" */
+static void drop(id)
+int id;
+{
+	if (uselist)
+		unlink_page(id);
+	freeframes[nfree++] = frame[id];
+	frame[id] = NONE;
+	pins[id] = 0;
+}
+
+/* # of gets of the trace that miss with "policy" and "nbufs" frames,
+or -1 if the frames run out */
+static long simulate(policy,nbufs)
+int policy, nbufs;
+{
+long misses = 0;
+long i;
+int id, v, f;
+
+	for (id = 0; id < npages; id++){
+		frame[id] = NONE;
+		pins[id] = 0;
+		nextuse[id] = NOREF;
+	}
+	head = tail = NONE;
+	uselist = policy == SIM_LRU || policy == SIM_MRU;
+	for (f = 0; f < nbufs; f++){
+		freeframes[f] = nbufs - 1 - f;
+		ref[f] = FALSE;
+	}
+	nfree = nbufs;
+	hand = 0;
+	nheap = 0;
+
+	for (i = 0; i < nevs; i++){
+		id = evs[i].id;
+		switch (evs[i].what){
+		case EV_GET:
+		case EV_ALLOC:
+			if (policy == SIM_OPT){
+				nextuse[id] = nextpin[i];
+				if (frame[id] != NONE)
+					heap_push(nextuse[id], id);
+			}
+			if (frame[id] != NONE){
+				/* hit; only the first fix is a reference */
+				if (pins[id]++ == 0)
+					ref[frame[id]] = TRUE;
+				break;
+			}
+			if (evs[i].what == EV_GET)
+				misses++;
+			if (nfree == 0){
+				if ((v = victim(policy, nbufs)) == NONE)
+					return(-1);
+				drop(v);
+			}
+			f = freeframes[--nfree];
+			frame[id] = f;
+			frames[f] = id;
+			ref[f] = TRUE;
+			pins[id] = 1;
+			if (uselist)
+				link_head(id);
+			if (policy == SIM_OPT)
+				heap_push(nextuse[id], id);
+			break;
+		case EV_UNFIX:
+			if (frame[id] == NONE || pins[id] == 0)
+				/* fixed before the trace started */
+				break;
+			if (--pins[id] > 0)
+				break;
+			ref[frame[id]] = TRUE;
+			if (uselist){
+				unlink_page(id);
+				link_head(id);
+			}
+			break;
+		case EV_DROP:
+			for (f = 0; f < nbufs; f++){
+				v = frames[f];
+				if (v != NONE && frame[v] == f &&
+						(id == NONE || pagefile[v] == id))
+					drop(v);
+			}
+			break;
+		}
+	}
+	return(misses);
+}
+
+static void run(nbufs)
+int nbufs;
+{
+int policy;
+long misses;
+
+	frames = xalloc(nbufs * sizeof(int));
+	ref = xalloc(nbufs);
+	freeframes = xalloc(nbufs * sizeof(int));
+	aside = xalloc(nbufs * sizeof(HeapEnt));
+	printf("  %8d", nbufs);
+	for (policy = 0; policy < SIM_NPOLICIES; policy++){
+		memset((char *)frames, 0xff, nbufs * sizeof(int));
+		if ((misses = simulate(policy, nbufs)) < 0)
+			printf(" %10s", "nobuf");
+		else
+			printf(" %10.4f", ngets ? (double)misses / ngets : 0.0);
+	}
+	printf("\n");
+	free(frames);
+	free(ref);
+	free(freeframes);
+	free(aside);
+}
+
+int main(argc,argv)
+int argc;
+char **argv;
+{
+int nbufs, i, policy;
+
+	if (argc < 2){
+		fprintf(stderr, "Usage: %s trace [nbufs ...]\n", argv[0]);
+		exit(1);
+	}
+	readtrace(argv[1]);
+	frame = xalloc(npages * sizeof(int));
+	pins = xalloc(npages * sizeof(int));
+	next = xalloc(npages * sizeof(int));
+	prev = xalloc(npages * sizeof(int));
+	nextuse = xalloc(npages * sizeof(long long));
+	heap = xalloc((ngets + nallocs + 1) * sizeof(HeapEnt));
+
+	printf("%s: %ld events, %ld gets, %ld allocs, %d pages\n", argv[1],
+		nevs, ngets, nallocs, npages);
+	printf("miss ratio of gets:\n");
+	printf("  %8s", "nbufs");
+	for (policy = 0; policy < SIM_NPOLICIES; policy++)
+		printf(" %10s", simnames[policy]);
+	printf("\n");
+
+	if (argc > 2)
+		for (i = 2; i < argc; i++){
+			if ((nbufs = atoi(argv[i])) <= 0){
+				fprintf(stderr, "%s: bad pool size\n", argv[i]);
+				exit(1);
+			}
+			run(nbufs);
+		}
+	else {
+		for (nbufs = 8; nbufs < npages; nbufs *= 2)
+			run(nbufs);
+		run(npages > 0 ? npages : 1);
+	}
+	return(0);
+}
@@ -1,7 +1,9 @@
 /* pftypes.h: declarations for Paged File interface */
+#include <sys/types.h>
+#include <pthread.h>
 
 /**************************** File Page Decls *********************/
-/* Each file contains a header, which is a integer pointing
+/* A PF_FORMAT_V1 file contains a header, which is a integer pointing
 to the first free page, or -1 if no more free pages in the file.
 Followed by this header are the file pages as declared in struct PFfpage */
 typedef struct PFhdr_str {
@@ -12,69 +14,371 @@ typedef struct PFhdr_str {
 
 #define PF_HDR_SIZE sizeof(PFhdr_str)	/* size of file header */
 
-/* actual page struct to be written onto the file */
+/* A PF_FORMAT_V2 file is made of PF_PAGE_SIZE slots, so every page is
+at an aligned offset and can be read with O_DIRECT. Slot 0 is the header
+page, starting with a PFhdr2_str. Then come groups of one map page and
+PF_MAP_ENTRIES data pages; the map page holds the "nextfree" int of
+each page of its group, which a V1 file keeps in front of the page. */
+#define PF_MAGIC	0x32465050	/* "PPF2": first int of a V2 or V3 file */
+typedef struct PFhdr2_str {
+	int	magic;		/* PF_MAGIC */
+	int	version;	/* PF_FORMAT_V2 or PF_FORMAT_V3 */
+	PFhdr_str hdr;		/* same header as a V1 file */
+	int	checksums;	/* TRUE if created with PF_FORMAT_CHECKSUM;
+				0 in files made before there was a choice */
+	int	inuse;		/* with checksums: TRUE from opening the file
+				for writing to closing it, so still TRUE
+				after a crash, see PF_OpenFileEx() */
+} PFhdr2_str;
+
+#define PF_MAP_ENTRIES	(PF_PAGE_SIZE/sizeof(int))	/* pages per map page */
+
+/* A PF_FORMAT_V3 file is laid out the same way, but its map pages are
+bitmaps: bit i%8 of byte i/8 of the map is set if page i is used. One map
+page covers PF_BITMAP_ENTRIES data pages, and allocating or disposing a
+page only changes the map. The header's "firstfree" is not a list but a
+hint: no page below it is free. */
+#define PF_BITMAP_ENTRIES	(PF_PAGE_SIZE*8)	/* pages per bitmap page */
+
+/* A V2 or V3 file created with PF_FORMAT_CHECKSUM has, after each map
+page, the checksums of the pages of its group: an unsigned CRC32C (see
+crc.c) of each, PF_CRC_ENTRIES to a page, so 1 checksum page per V2
+group and 32 per V3 group. 0 is the checksum of a page never written.
+Like the map, the checksum pages are only written on close: after a
+crash they may be older than the pages, so they are dropped (see
+PFhdr2_str.inuse). */
+#define PF_CRC_ENTRIES	(PF_PAGE_SIZE/sizeof(unsigned))	/* per page */
+
+/* file offset of data page "pagenum" and of map page "group", with
+"n" data pages and "m" map and checksum pages per group */
+#define PFgroupPageOffset(pagenum,n,m) ((off_t)PF_PAGE_SIZE * (1 + (m) + \
+	(pagenum)/(n)*((n)+(m)) + (pagenum)%(n)))
+#define PFgroupMapOffset(group,n,m) ((off_t)PF_PAGE_SIZE * (1 + \
+	(group)*((n)+(m))))
+#define PFv2PageOffset(pagenum) PFgroupPageOffset(pagenum,PF_MAP_ENTRIES,1)
+#define PFv2MapOffset(group) PFgroupMapOffset(group,PF_MAP_ENTRIES,1)
+#define PFv3PageOffset(pagenum) PFgroupPageOffset(pagenum,PF_BITMAP_ENTRIES,1)
+#define PFv3MapOffset(group) PFgroupMapOffset(group,PF_BITMAP_ENTRIES,1)
+
+/* A page is written onto the file as its "nextfree" int followed by
+PF_PAGE_SIZE bytes of data (PF_FPAGE_SIZE bytes in all). In memory the
+two parts are kept apart, so that page data can live in the page
+aligned buffer pool: a PFfpage holds "nextfree" and points to the data. */
 #define PF_PAGE_LIST_END	-1	/* end of list of free pages */
 #define PF_PAGE_USED		-2	/* page is being used */
 typedef struct PFfpage {
 	int nextfree;	/* page number of next free page in the linked
 			list of free pages, or PF_PAGE_LIST_END if
 			end of list, or PF_PAGE_USED if this page is not free */
-	char pagebuf[PF_PAGE_SIZE];	/* actual page data */
+	char *pagebuf;	/* actual page data, PF_PAGE_SIZE bytes */
 } PFfpage;
 
+#define PF_FPAGE_SIZE	(sizeof(int) + PF_PAGE_SIZE)	/* page on file */
+
+#define PF_IO_MAXPAGES	64	/* most pages moved by one vectored call */
+
+/************************** Storage Device Decls ********************/
+/* The bytes of an open file are kept by a storage device (see dev.c),
+chosen when the file is opened. A device is a struct starting with a
+PFdev; its calls return what the Unix calls they stand for return, -1
+with errno set if they fail. */
+struct iovec;
+typedef struct PFdev {
+	struct PFdevops *ops;
+} PFdev;
+
+typedef struct PFdevops {
+	ssize_t (*readv)(PFdev *dev, struct iovec *iov, int niov, off_t offset);
+	ssize_t (*writev)(PFdev *dev, struct iovec *iov, int niov, off_t offset);
+	off_t (*size)(PFdev *dev);	/* # of bytes of the file */
+	int (*truncate)(PFdev *dev, off_t len);
+	int (*allocate)(PFdev *dev, off_t offset, off_t len);	/* as
+				fallocate() with mode 0 */
+	int (*direct)(PFdev *dev, int on);	/* O_DIRECT on or off */
+	int (*close)(PFdev *dev);	/* also frees "dev" */
+} PFdevops;
+
+#define PFdevReadv(dev,iov,niov,offset) ((dev)->ops->readv(dev,iov,niov,offset))
+#define PFdevWritev(dev,iov,niov,offset) ((dev)->ops->writev(dev,iov,niov,offset))
+#define PFdevSize(dev) ((dev)->ops->size(dev))
+#define PFdevTruncate(dev,len) ((dev)->ops->truncate(dev,len))
+#define PFdevAllocate(dev,offset,len) ((dev)->ops->allocate(dev,offset,len))
+#define PFdevDirect(dev,on) ((dev)->ops->direct(dev,on))
+#define PFdevClose(dev) ((dev)->ops->close(dev))
+
+/*********************** Asynchronous I/O Decls *********************/
+/* a read or write handed to the engine of aio.c */
+typedef struct PFaioreq {
+	PFdev *dev;		/* device of the file */
+	int write;		/* TRUE to write, FALSE to read */
+	struct iovec *iov;	/* what to move */
+	int niov;		/* # of entries of iov[] */
+	off_t offset;		/* where in the file */
+	ssize_t result;		/* set to the # of bytes moved, or -1 */
+	int err;		/* and then to the errno */
+	void (*done)(struct PFaioreq *req);	/* called when it is over */
+	void *arg;		/* for "done" */
+	struct PFaioreq *next;	/* used by the engine */
+} PFaioreq;
+
 /*************************** Opened File Table **********************/
-#define PF_FTAB_SIZE	20	/* size of open file table */
+#define PF_FTAB_SIZE	PF_MAX_FILES	/* size of open file table */
+#define PF_MAP_NOLD	32	/* a map doubles when it grows, so it can
+				be replaced at most this many times */
+
+/* the checksums of the pages of a map group, as on its checksum pages.
+Pages are written without the file's lock, each setting its own entry,
+so these never move once allocated. */
+typedef struct PFcrcgroup {
+	char dirty;		/* TRUE if changed since open */
+	unsigned crc[1];	/* one per page of the group, allocated to
+				PFmapEntries() of them */
+} PFcrcgroup;
 
 /* open file table entry */
 typedef struct PFftab_ele {
 	char *fname;	/* file name, or NULL if entry not used */
-	int unixfd;	/* unix file descriptor*/
+	PFdev *dev;	/* storage device holding the file */
 	PFhdr_str hdr;	/* file header */
 	short hdrchanged; /* TRUE if file header has changed */
+	short format;	/* PF_FORMAT_V1, V2 or V3 */
+	int flags;	/* PF_OPEN_* flags the file was opened with */
+	off_t allocend;	/* the file is known to be this long; it may
+			be past the last page (hdr.numpages) when an extent
+			was reserved, see PF_SetExtentPages() */
+	short nofalloc;	/* TRUE if the file system cannot fallocate() */
+	int *pagemap;	/* V2: "nextfree" of every page, V3: the bitmap;
+			the contents of the map pages. Kept up to date by
+			PF_AllocPage() and PF_DisposePage(). */
+	int mapgroups;	/* V2, V3: # of map pages pagemap[] has room for */
+	char *mapdirty;	/* V2, V3: TRUE for map pages changed since open */
+	int mapcap;	/* V2, V3: # of map pages allocated at pagemap */
+	int *mapold[PF_MAP_NOLD];	/* V2, V3: maps replaced by a larger
+			one. Another thread may still be reading one, so
+			they are only freed on close. */
+	int nmapold;	/* # of entries in mapold[] */
+	short crcpages;	/* # of checksum pages per map page, 0 if none */
+	PFcrcgroup **crcs;	/* the checksums of map group g at crcs[g],
+			mapgroups of them; room for mapcap */
+	PFcrcgroup **crcold[PF_MAP_NOLD];	/* crcs replaced along with
+			mapold[]; the groups themselves never move */
+	pthread_mutex_t lock;	/* held while the header or map change */
+	int ralast;	/* page last returned by PF_GetNextPage(), or by any
+			get of a PF_OPEN_MAPPED file */
+	int raend;	/* first page past the last read-ahead window */
+	int rawin;	/* size of that window, 0 if not scanning */
+	char *mapaddr;	/* PF_OPEN_MAPPED: the whole file, mmap()'d */
+	size_t maplen;	/* # of bytes at mapaddr */
+	int advice;	/* MADV_* last given for the mapping */
+	int streak;	/* > 0: # of pages in a row read in order,
+			< 0: # of pages in a row read out of order */
+	long long bytesread;	/* page bytes read since open, see */
+	long long byteswritten;	/* PF_GetStats() */
 } PFftab_ele;
 
+/* Read-ahead: while PF_GetNextPage() is called with the page it returned
+last, the file is being scanned. Each time the scan gets past what was
+read ahead, the next window of pages is read with one vectored call; the
+window starts at PF_RA_MINPAGES and doubles up to PF_RA_MAXPAGES, or a
+quarter of the buffer pool if that is smaller. */
+#define PF_RA_MINPAGES	4
+#define PF_RA_MAXPAGES	PF_IO_MAXPAGES
+
+/* A file opened with PF_OPEN_MAPPED is read straight from the mapping.
+The kernel is told to read ahead (MADV_SEQUENTIAL) once this many pages
+in a row were read in order, and not to (MADV_RANDOM) once this many
+were not; switching needs a system call, so a lone jump does not. */
+#define PF_MADV_STREAK	8
+
 /************************** Buffer Page Decls *********************/
 
 
-/* buffer page decl */
+/* used lists a buffer page can be on (PFbpage.queue) */
+#define PF_QMAIN	0	/* the only list for LRU/MRU/CLOCK; 2Q's Am,
+				ARC's T2 */
+#define PF_QNEW		1	/* 2Q's A1in, ARC's T1: pages referenced
+				only once */
+#define PF_NQUEUES	2
+
+/* buffer page decl. The data of the page is not in here: fpage.pagebuf
+points into the buffer pool's data region (see buf.c). */
 typedef struct PFbpage {
 	struct PFbpage *nextpage;	/* next in the linked list of
 					buffer page */
 	struct PFbpage *prevpage;	/* previous in the linked list
 					of buffer pages */
+	struct PFbpage *nextfile;	/* next resident page of the same
+					file, in no particular order */
+	struct PFbpage *prevfile;	/* previous one */
+	unsigned version;		/* odd while the frame changes hands
+					or is being read or written, see
+					buf.c; readers without the lock
+					check it did not change */
+	short	pincount;		/* # of times the page is fixed in
+					the buffer; 0 if it can be replaced,
+					-1 while the frame changes hands */
+	char	refbit;			/* CLOCK reference bit: TRUE if page
+					was used since the hand last passed.
+					Not a bit field: it is set without
+					the partition lock. */
 	short	dirty:1,		/* TRUE if page is dirty */
-		fixed:1;		/* TRUE if page is fixed in buffer*/
+		prefetched:1,		/* TRUE if read ahead and not yet
+					asked for */
+		iobusy:1,		/* TRUE while the page is read or
+					written without its partition locked */
+		reref:1;		/* 2Q: TRUE if referenced again, not
+					correlated, while on A1in */
+	short	queue;			/* used list holding this page,
+					PF_QMAIN or PF_QNEW */
 	int	page;			/* page number of this page */
 	int	fd;			/* file desciptor of this page */
 	PFfpage fpage; /* page data from the file */
+	pthread_rwlock_t latch;		/* shared/exclusive latch on the
+					data, see PF_LatchPage() */
 } PFbpage;
 
 
 
 /******************** Hash Table Decls ****************************/
-#define PF_HASH_TBL_SIZE	20	/* size of PF hash table */
+#define PF_HASH_MIN_SLOTS	32	/* smallest PF hash table */
 
-/* Hash table bucket entries*/
+/* Hash table slots (open addressing) */
 typedef struct PFhash_entry {
-	struct PFhash_entry *nextentry; /* next hash table element, or NULL */
-	struct PFhash_entry *preventry;/*previous hash table element,or NULL*/
 	int fd;		/* file descriptor */
 	int page;	/* page number */
-	struct PFbpage *bpage; /* pointer to buffer holding this page */
+	struct PFbpage *bpage; /* pointer to buffer holding this page,
+				or NULL if the slot is empty */
 } PFhash_entry;
 
-/* Hash function for hash table */
-#define PFhash(fd,page) (((fd)+(page)) % PF_HASH_TBL_SIZE)
+/* a hash table; each buffer partition has its own */
+typedef struct PFhashtab {
+	PFhash_entry *tbl;	/* slots, or NULL */
+	unsigned mask;		/* # of slots - 1, # of slots is a power of 2 */
+	int count;		/* # of slots in use */
+} PFhashtab;
+
+/* Hash function for hash table: Fibonacci hashing of the 64 bit key
+(fd,page), keeping the high half of the product, whose low bits depend
+on every bit of the key. Mask the result to the table size. */
+#define PFhash(fd,page) ((unsigned)(((unsigned long long)(unsigned)(fd) << 32 \
+		| (unsigned)(page)) * 0x9E3779B97F4A7C15ULL >> 32))
+
+/******************** Ghost Directory Decls ***********************/
+#define PF_GHOST_NLISTS	2	/* # of lists in the ghost directory */
+
+/* a ghost directory (see ghost.c); each buffer partition has its own */
+typedef struct PFghostdir {
+	struct PFghost_entry *tbl;	/* pool of entries */
+	int *bucket;		/* hash buckets, indices into tbl[] */
+	int cap;		/* # of entries in the pool */
+	int mask;		/* # of buckets - 1 */
+	int free;		/* free entries, chained by next */
+	int head[PF_GHOST_NLISTS];	/* most recent entry of a list */
+	int tail[PF_GHOST_NLISTS];	/* least recent entry of a list */
+	int len[PF_GHOST_NLISTS];	/* # of entries in a list */
+} PFghostdir;
+
+/******************** Miss Ratio Curve Decls **********************/
+#define PF_MRC_MAXPAGES	2048	/* most pages a tracker keeps */
+#define PF_MRC_SHIFT0	3	/* a tracker starts sampling 1 page in 2^this */
+
+/* a reuse distance tracker (see mrc.c); each buffer partition has its own */
+typedef struct PFmrc {
+	struct PFmrc_entry *tbl;	/* sampled pages, open addressing */
+	int mask;		/* # of slots - 1 */
+	int count;		/* # of sampled pages kept */
+	int shift;		/* 1 page in 2^shift is sampled */
+	int scale;		/* # of partitions, each seeing 1/scale of
+				the pages */
+	int *tree;		/* Fenwick tree over times: 1 at the time of
+				the last get of each page kept */
+	int clock;		/* time of the next sampled get */
+	long long hist[PF_MRC_NPOINTS + 1];	/* gets, scaled, by the
+				first curve point they hit at; the last one
+				counts gets that miss at every point */
+	long long win[PF_MRC_NPOINTS + 1];	/* the same, since the last
+				auto-sizing of the pool */
+	long long nsampled;	/* # of gets counted in hist[], unscaled */
+} PFmrc;
+
+/* hash of (fd,page) deciding whether it is sampled: independent of
+PFhash(), which places pages in partitions and hash slots */
+#define PFmrcHash(fd,page) ((unsigned)(((unsigned long long)(unsigned)(fd) << 32 \
+		| (unsigned)(page)) * 0xD6E8FEB86659FD93ULL >> 32))
+#define PFmrcSampled(m,fd,page) \
+	((PFmrcHash(fd,page) & ((1U << (m)->shift) - 1)) == 0)
 
 /******************* Interface functions from Hash Table ****************/
-extern void PFhashInit();
+extern void PFhashInit(PFhashtab *tab, int nentries);
 extern PFbpage *PFhashFind();
-extern PFhashInsert();
-extern PFhashDelete();
-extern PFhashPrint();
+extern PFbpage *PFhashPeek();
+extern int PFhashInsert();
+extern int PFhashDelete();
+extern void PFhashPrint();
+
+/******************* Interface functions from Ghost Directory ***********/
+extern void PFghostInit(PFghostdir *g, int nentries);
+extern int PFghostFind(PFghostdir *g, int fd, int page);
+extern void PFghostInsert(PFghostdir *g, int list, int fd, int page);
+extern void PFghostDelete(PFghostdir *g, int fd, int page);
+extern void PFghostForget(PFghostdir *g, int fd);
+extern void PFghostDeleteLRU(PFghostdir *g, int list);
+extern int PFghostLen(PFghostdir *g, int list);
+
+/******************* Interface functions from mrc.c *********************/
+extern void PFmrcInit(PFmrc *m, int scale);
+extern int PFmrcRef(PFmrc *m, int fd, int page, int counted);
+extern void PFmrcForget(PFmrc *m, int fd);
+extern int PFmrcSize(int point);
 
 /****************** Interface functions from Buffer Manager *************/
-extern PFbufGet();
-extern PFbufUnfix();
-extern PFbufalloc();
-extern PFbufReleaseFile();
+extern int PFbufGet();
+extern int PFbufUnfix();
+extern int PFbufalloc();
+extern int PFbufReleaseFile();
+extern int PFbufPrefetch();
+extern int PFbufGetAsync();
+extern int PFbufResident();
+extern int PFbufSetFlusher();
+extern int PFbufPinCount();
+extern int PFbufLatch();
+extern int PFbufUnlatch();
+extern void PFbufSetOptimistic(int on);
+extern void PFbufGetStats(struct PF_Stats *stats);
+extern void PFbufResetStats();
+extern int PFbufResize();
+extern void PFbufSetBudget(int maxbufs);
+extern int PFbufSize();
+
+/********************** Interface functions from dev.c ******************/
+extern int PFdevOpen(char *fname, int flags, PFdev **devp);
+extern int PFdevUnixFd(PFdev *dev);
+extern ssize_t PFdevPread(PFdev *dev, char *buf, size_t len, off_t offset);
+extern ssize_t PFdevPwrite(PFdev *dev, char *buf, size_t len, off_t offset);
+extern int PFdevForget(char *fname);
+
+/********************** Interface functions from aio.c ******************/
+extern void PFaioSubmit(PFaioreq **reqs, int n, int more);
+
+/********************** Interface functions from crc.c ******************/
+extern unsigned PFcrc32c(unsigned crc, char *buf, int len);
+extern unsigned PFcrcPage(int pagenum, char *pagebuf);
+
+/********************** Interface functions from warm.c *****************/
+extern int PFwarmon;
+extern long long PFwarmpages, PFwarmdone;
+extern void PFwarmSave(char *fname, int *pages, int n);
+extern int PFwarmLoad(char *fname, int **pages);
+extern void PFwarmForget(char *fname);
+extern void PFwarmed();
+
+/********************** Interface functions from trace.c ****************/
+extern int PFtraceon;
+extern void PFtrace(int fd, int page, int event);
+
+/********************** Interface functions from pf.c *******************/
+extern long long PFiocalls;
+extern int PFreadfcn(int fd, int pagenum, PFfpage *buf);
+extern int PFwritefcn(int fd, int pagenum, PFfpage *buf);
+extern int PFreadvfcn(int fd, int pagenum, PFfpage **bufs, int n);
+extern int PFwritevfcn(int fd, int pagenum, PFfpage **bufs, int n);
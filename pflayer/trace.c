@@ -0,0 +1,115 @@
+/* trace.c: the page access trace. While it is on, the buffer manager
+calls PFtrace() for every page it fixes or unfixes and every file it
+lets go of, and a PF_TraceRec is appended to the trace file. pfsim
+replays such a file against other replacement strategies and pool
+sizes. While the trace is off (the default) that costs a test of
+PFtraceon. Records are written by the thread making the call, through
+a stdio buffer, under PFtracelock. */
+#include <stdio.h>
+#include <pthread.h>
+#include "pf.h"
+
+#define PF_TRACE_BUFSIZE (64*1024)	/* stdio buffer of the trace file */
+
+int PFtraceon = FALSE;	/* TRUE while the trace is on */
+static FILE *PFtracefp = NULL;	/* the trace file, or NULL */
+static int PFtraceerr = FALSE;	/* TRUE if a record could not be written */
+static pthread_mutex_t PFtracelock = PTHREAD_MUTEX_INITIALIZER;
+
+
+void PFtrace(fd,page,event)
+int fd;		/* file descriptor, -1 for all files */
+int page;	/* page number, -1 for a PF_TRACE_CLOSE */
+int event;	/* PF_TRACE_* bits */
+/****************************************************************************
+SPECIFICATIONS:
+	Append an event to the trace, if it is on. Events of one page
+	are in the order they happened; events of different pages fixed
+	by different threads at the same time may be in either order.
+
+RETURN VALUE: none. A failed write is reported by PF_StopTrace().
+*****************************************************************************/
+{
+PF_TraceRec rec;
+
+	rec.fd = fd;
+	rec.page = page;
+	rec.event = event;
+	pthread_mutex_lock(&PFtracelock);
+	if (PFtracefp != NULL && fwrite((char *)&rec, sizeof(rec), 1, PFtracefp) != 1)
+		PFtraceerr = TRUE;
+	pthread_mutex_unlock(&PFtracelock);
+}
+
+
+int PF_StartTrace(fname)
+char *fname;	/* name of the trace file */
+/****************************************************************************
+SPECIFICATIONS:
+	Start writing the page access trace to file "fname", replacing
+	its contents. A trace already being written is stopped first.
+	The trace is kept across PF_Init(), which is recorded as a
+	PF_TRACE_CLOSE of all files.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_INVALIDARG	if "fname" is NULL.
+	PFE_UNIX	if the file cannot be created, or the previous
+			trace could not be written.
+*****************************************************************************/
+{
+FILE *fp;
+int error;
+
+	if (fname == NULL){
+		PFerrno = PFE_INVALIDARG;
+		return(PFerrno);
+	}
+	if ((error=PF_StopTrace()) != PFE_OK)
+		return(error);
+	if ((fp = fopen(fname, "w")) == NULL){
+		PFerrno = PFE_UNIX;
+		return(PFerrno);
+	}
+	setvbuf(fp, NULL, _IOFBF, PF_TRACE_BUFSIZE);
+
+	pthread_mutex_lock(&PFtracelock);
+	PFtracefp = fp;
+	PFtraceerr = FALSE;
+	PFtraceon = TRUE;
+	pthread_mutex_unlock(&PFtracelock);
+	return(PFE_OK);
+}
+
+
+int PF_StopTrace()
+/****************************************************************************
+SPECIFICATIONS:
+	Stop the page access trace and close its file. Nothing is done
+	if no trace is being written. Other threads may go on using the
+	PF layer meanwhile; their events may or may not be recorded.
+
+RETURN VALUE:
+	PFE_OK	if no error.
+	PFE_UNIX	if some records could not be written.
+*****************************************************************************/
+{
+FILE *fp;
+int failed;
+
+	pthread_mutex_lock(&PFtracelock);
+	fp = PFtracefp;
+	failed = PFtraceerr;
+	PFtracefp = NULL;
+	PFtraceerr = FALSE;
+	PFtraceon = FALSE;
+	pthread_mutex_unlock(&PFtracelock);
+
+	if (fp != NULL && fclose(fp) != 0)
+		failed = TRUE;
+	if (failed){
+		PFerrno = PFE_UNIX;
+		return(PFerrno);
+	}
+	return(PFE_OK);
+}
@@ -0,0 +1,189 @@
+/* warm.c: warm restart. While it is on (PF_SetWarmRestart()), closing a
+file saves the list of its pages in the buffer to the file's warm list,
+"<fname>.warm", and opening the file again prefetches the pages listed
+with the asynchronous I/O engine, in page number order: the buffer is
+as it was, instead of filling one miss at a time. The list is kept
+coldest page first, and the pages go on the replacement lists in that
+order, so that the hottest are the last to be replaced. PF_GetStats()
+counts the pages to prefetch and those done, so the warm-up can be
+followed. This file reads and writes the lists; pf.c saves and loads
+them. A warm list is only advice: one that cannot be written or read is
+ignored, and pages listed that are no longer in the file are left out. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pf.h"
+#include "pftypes.h"
+
+#define PF_WARM_SUFFIX	".warm"	/* warm list of file f: f.warm */
+#define PF_WARM_MAGIC	"PFWARM1"
+
+/* a warm list is this header, then the page numbers, coldest first */
+typedef struct PFwarmhdr {
+	char magic[8];		/* PF_WARM_MAGIC */
+	int npages;		/* # of pages that follow */
+} PFwarmhdr;
+
+int PFwarmon = FALSE;		/* TRUE while warm restart is on */
+long long PFwarmpages = 0;	/* pages of warm lists to prefetch */
+long long PFwarmdone = 0;	/* of those, prefetched or found in the buffer */
+
+
+static char *PFwarmName(fname,suffix)
+char *fname;	/* name of a paged file */
+char *suffix;	/* appended after PF_WARM_SUFFIX */
+/****************************************************************************
+SPECIFICATIONS:
+	Name the warm list of file "fname".
+
+RETURN VALUE:
+	The name, malloc()'ed, or NULL if no memory.
+*****************************************************************************/
+{
+char *name;
+
+	if ((name = malloc(strlen(fname) + strlen(PF_WARM_SUFFIX) +
+			strlen(suffix) + 1)) != NULL)
+		sprintf(name,"%s%s%s",fname,PF_WARM_SUFFIX,suffix);
+	return(name);
+}
+
+
+void PFwarmSave(fname,pages,n)
+char *fname;	/* name of a paged file */
+int *pages;	/* pages of it in the buffer, coldest first */
+int n;		/* # of pages in pages[] */
+/****************************************************************************
+SPECIFICATIONS:
+	Replace the warm list of file "fname" by pages[0..n-1], or remove
+	it if "n" is 0. The list is written beside it and renamed, so a
+	crash leaves the old list or the new one.
+
+RETURN VALUE: none.
+*****************************************************************************/
+{
+PFwarmhdr hdr;
+char *name, *tmp;
+FILE *fp;
+int ok;
+
+	if ((name = PFwarmName(fname,"")) == NULL)
+		return;
+	if (n == 0){
+		(void)unlink(name);
+		free(name);
+		return;
+	}
+	if ((tmp = PFwarmName(fname,".tmp")) == NULL){
+		free(name);
+		return;
+	}
+	memset((char *)&hdr,0,sizeof(hdr));
+	strcpy(hdr.magic,PF_WARM_MAGIC);
+	hdr.npages = n;
+	if ((fp = fopen(tmp,"w")) != NULL){
+		ok = fwrite((char *)&hdr,sizeof(hdr),1,fp) == 1 &&
+			fwrite((char *)pages,sizeof(int),n,fp) == n;
+		if (fclose(fp) == 0 && ok)
+			(void)rename(tmp,name);
+		else	(void)unlink(tmp);
+	}
+	free(tmp);
+	free(name);
+}
+
+
+int PFwarmLoad(fname,pages)
+char *fname;	/* name of a paged file */
+int **pages;	/* set to its warm list, malloc()'ed */
+/****************************************************************************
+SPECIFICATIONS:
+	Read the warm list of file "fname". *pages is NULL if it has
+	none, or none that can be read; else the caller frees it.
+
+RETURN VALUE:
+	The # of pages in *pages.
+*****************************************************************************/
+{
+PFwarmhdr hdr;
+char *name;
+FILE *fp;
+int n = 0;
+
+	*pages = NULL;
+	if ((name = PFwarmName(fname,"")) == NULL)
+		return(0);
+	fp = fopen(name,"r");
+	free(name);
+	if (fp == NULL)
+		return(0);
+	if (fread((char *)&hdr,sizeof(hdr),1,fp) == 1 &&
+			strcmp(hdr.magic,PF_WARM_MAGIC) == 0 && hdr.npages > 0 &&
+			(*pages = (int *)malloc(hdr.npages * sizeof(int))) != NULL){
+		if ((n = fread((char *)*pages,sizeof(int),hdr.npages,fp)) == 0){
+			free((char *)*pages);
+			*pages = NULL;
+		}
+	}
+	fclose(fp);
+	return(n);
+}
+
+
+void PFwarmForget(fname)
+char *fname;	/* name of a paged file, destroyed */
+/****************************************************************************
+SPECIFICATIONS:
+	Remove the warm list of file "fname", if it has one.
+
+RETURN VALUE: none.
+*****************************************************************************/
+{
+char *name;
+
+	if ((name = PFwarmName(fname,"")) != NULL){
+		(void)unlink(name);
+		free(name);
+	}
+}
+
+
+void PFwarmed(arg,fd,pagenum,fpage,error)
+void *arg;	/* not used */
+int fd;		/* file descriptor */
+int pagenum;	/* page of a warm list */
+PFfpage *fpage;	/* NULL: prefetched pages are not fixed */
+int error;	/* PFE_OK, or why it could not be prefetched */
+/****************************************************************************
+SPECIFICATIONS:
+	Called by PFbufGetAsync() as each page of a warm list is
+	prefetched, or found in the buffer, or cannot be.
+*****************************************************************************/
+{
+	__sync_fetch_and_add(&PFwarmdone,1);
+}
+
+
+/************************** Interface Routines **************************/
+
+int PF_SetWarmRestart(on)
+int on;		/* TRUE to turn warm restart on, FALSE to turn it off */
+/****************************************************************************
+SPECIFICATIONS:
+	Turn warm restart on or off (the default). While it is on,
+	PF_CloseFile() and PF_Shutdown() save the list of the file's
+	pages in the buffer to "<fname>.warm", and PF_OpenFile() starts
+	prefetching the pages of that list, as many as the pool holds,
+	in large batches in page number order, and returns without
+	waiting for them. PF_GetStats() tells how far the prefetching
+	is (warm_pages, warm_done). Files opened with PF_OPEN_MAPPED
+	neither save nor load a list. PF_DestroyFile() removes the list.
+
+RETURN VALUE:
+	PFE_OK	always.
+*****************************************************************************/
+{
+	PFwarmon = on ? TRUE : FALSE;
+	return(PFE_OK);
+}
@@ -5,6 +5,11 @@
  * the student data file using three different methods and
  * comparing their performance (Time and Page I/O).
  *
+ * Usage: test_am [lru|mru|clock|2q|arc] [flush] [noreadahead] [trace=FILE]
+ *   buffer strategy (default lru); "flush" runs the background flusher;
+ *   "noreadahead" turns off reading ahead in scans;
+ *   "trace=FILE" writes the page access trace to FILE, for pflayer/pfsim
+ *
  * (CORRECTED VERSION 3: Robust header skipping)
  */
 
@@ -28,6 +33,13 @@
 #define ATTR_TYPE 'i'    // 'i' for integer
 #define ATTR_LENGTH 4    // 4 bytes for an integer
 
+// --- Buffer Configuration ---
+#define BUFFER_SIZE 20   // # of buffer pages for every method
+#define FLUSH_LOW   10   // flusher watermarks, % of the pool dirty
+#define FLUSH_HIGH  25
+
+static int use_flusher = 0;
+
 /*
  * Helper function to check errors from all layers
  */
@@ -66,10 +78,22 @@ int get_roll_no(char *record) {
 }
 
 
+/*
+ * (Re)initialize the PF layer, which also resets its stats and
+ * latency histograms
+ */
+void init_pf(int strategy) {
+    PF_Init(BUFFER_SIZE, strategy);
+    PF_ResetLatency();
+    if (use_flusher)
+        check_error(PF_SetFlusher(FLUSH_LOW, FLUSH_HIGH), "Start flusher");
+}
+
+
 /*
  * Main test function
  */
-int main() {
+int main(int argc, char **argv) {
     int hfFd;  // Heap File descriptor
     int amFd;  // Index File descriptor
     int scanFd;
@@ -79,7 +103,28 @@ int main() {
     int roll_no;
     clock_t start, end;
     double cpu_time_used;
+    int strategy = PF_LRU;
+    char *trace_file = NULL;
+    int i;
     
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "lru") == 0) strategy = PF_LRU;
+        else if (strcmp(argv[i], "mru") == 0) strategy = PF_MRU;
+        else if (strcmp(argv[i], "clock") == 0) strategy = PF_CLOCK;
+        else if (strcmp(argv[i], "2q") == 0) strategy = PF_2Q;
+        else if (strcmp(argv[i], "arc") == 0) strategy = PF_ARC;
+        else if (strcmp(argv[i], "flush") == 0) use_flusher = 1;
+        else if (strcmp(argv[i], "noreadahead") == 0) PF_SetReadAhead(FALSE);
+        else if (strncmp(argv[i], "trace=", 6) == 0) trace_file = argv[i] + 6;
+        else {
+            printf("Usage: %s [lru|mru|clock|2q|arc] [flush] [noreadahead] [trace=FILE]\n", argv[0]);
+            exit(1);
+        }
+    }
+    if (trace_file != NULL)
+        check_error(PF_StartTrace(trace_file), "Start trace");
+
+    PF_SetLatency(TRUE); // time every PF/HF/AM call
     printf("--- AM Layer Indexing Performance Test ---\n");
     printf("WARNING: This test may take a few minutes.\n");
 
@@ -89,7 +134,7 @@ int main() {
 
     // 1. Setup: Create the heap file
     printf("  1. Creating heap file from %s...\n", STUDENT_DATA_FILE);
-    PF_Init(20, 0); // Init PF layer (20 buf, LRU)
+    init_pf(strategy); // Init PF layer
     check_error(HF_CreateFile(HEAP_FILE_NAME), "Create heap file");
     hfFd = PF_OpenFile(HEAP_FILE_NAME); // Use PF_OpenFile
     dataFile = fopen(STUDENT_DATA_FILE, "r");
@@ -116,7 +161,7 @@ int main() {
 
     // 2. Test: Build the index on the existing file
     printf("  2. Building index...\n");
-    PF_Init(20, 0); // Reset stats
+    init_pf(strategy); // Reset stats
     hfFd = PF_OpenFile(HEAP_FILE_NAME); // Use PF_OpenFile
     
     check_error(AM_CreateIndex(HEAP_FILE_NAME, INDEX_NO, ATTR_TYPE, ATTR_LENGTH), "Create index");
@@ -142,6 +187,7 @@ int main() {
     printf("     Time Taken: %.4f seconds\n", cpu_time_used);
     printf("     PF Layer Statistics (for Index Build only):\n");
     PF_PrintStats(); // Print the stats!
+    PF_PrintLatency();
 
     // Cleanup for Method 1
     PF_CloseFile(amFd); // Use PF_CloseFile
@@ -155,7 +201,7 @@ int main() {
     // =================================================================
 
     printf("  1. Building heap file and index incrementally...\n");
-    PF_Init(20, 0); // Reset stats
+    init_pf(strategy); // Reset stats
     
     check_error(HF_CreateFile(HEAP_FILE_NAME), "Create heap file");
     check_error(AM_CreateIndex(HEAP_FILE_NAME, INDEX_NO, ATTR_TYPE, ATTR_LENGTH), "Create index");
@@ -197,6 +243,7 @@ int main() {
     printf("     Time Taken: %.4f seconds\n", cpu_time_used);
     printf("     PF Layer Statistics (for entire process):\n");
     PF_PrintStats(); // Print the stats!
+    PF_PrintLatency();
 
     // Cleanup for Method 2
     fclose(dataFile);
@@ -211,7 +258,7 @@ int main() {
     // =================================================================
 
     printf("  1. Building heap file and index from %s...\n", STUDENT_SORTED_FILE);
-    PF_Init(20, 0); // Reset stats
+    init_pf(strategy); // Reset stats
     
     check_error(HF_CreateFile(HEAP_FILE_NAME), "Create heap file");
     check_error(AM_CreateIndex(HEAP_FILE_NAME, INDEX_NO, ATTR_TYPE, ATTR_LENGTH), "Create index");
@@ -258,6 +305,7 @@ int main() {
     printf("     Time Taken: %.4f seconds\n", cpu_time_used);
     printf("     PF Layer Statistics (for entire process):\n");
     PF_PrintStats(); // Print the stats!
+    PF_PrintLatency();
 
     // Cleanup for Method 3
     fclose(dataFile);
@@ -265,8 +313,9 @@ int main() {
     HF_CloseFile(hfFd);
     check_error(PF_DestroyFile(HEAP_FILE_NAME), "Destroy heap file");
     check_error(PF_DestroyFile(INDEX_FILE_NAME), "Destroy index file");
-    
-    
+    if (trace_file != NULL)
+        check_error(PF_StopTrace(), "Stop trace");
+
     printf("\n--- Test Complete ---\n");
     return 0;
 }
\ No newline at end of file
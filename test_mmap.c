@@ -0,0 +1,204 @@
+/*
+ * test_mmap.c
+ *
+ * This program compares reading files through the buffer pool
+ * (PF_OpenFile) with reading them straight from an mmap()'d file
+ * (PF_OpenFileMapped). It builds the student heap file and its
+ * index, then times, both ways:
+ *   - full scans of the heap file with HF_FindNextRec()
+ *   - point lookups of random roll numbers in the index
+ *     (AM_OpenIndexScan with EQUAL + AM_FindNextEntry)
+ *
+ * Usage: test_mmap   (run from a directory next to ../data, like test_am)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "pf.h"   // PF layer
+#include "hf.h"   // HF layer
+#include "am.h"   // AM layer
+
+// --- File Definitions ---
+#define HEAP_FILE_NAME      "student.hf"
+#define INDEX_FILE_NAME     "student.hf.1"
+#define STUDENT_DATA_FILE   "../data/student.txt"
+#define MAX_LINE_LENGTH     255
+#define MAX_STUDENTS        100000
+
+// --- Index Configuration ---
+#define INDEX_NO 1
+#define ATTR_TYPE 'i'
+#define ATTR_LENGTH 4
+#define EQ_OP 1          // EQUAL in amlayer/am_internal.h
+
+// --- Benchmark Configuration ---
+#define BUFFER_SIZE 20   // # of buffer pages, as in test_am
+#define NSCANS      20   // full scans of the heap file
+#define NLOOKUPS    100000 // index point lookups
+
+static int rolls[MAX_STUDENTS];
+static int nrolls = 0;
+static int nkeys = 0;    // rolls[0..nkeys-1]: roll numbers found only once
+
+void check_error(int error_code, const char *message) {
+    if (error_code < 0) {
+        printf("Error: %s (code: %d)\n", message, error_code);
+        exit(1);
+    }
+}
+
+/* roll-no of a record: its second ';' separated field, or -1 */
+int get_roll_no(char *record) {
+    char *first_sep = strchr(record, ';');
+    if (first_sep == NULL) return -1;
+    char *second_sep = strchr(first_sep + 1, ';');
+    if (second_sep == NULL) return -1;
+    int len = second_sep - (first_sep + 1);
+    char roll_str[32];
+    if (len <= 0) return -1;
+    if (len > 31) len = 31;
+    strncpy(roll_str, first_sep + 1, len);
+    roll_str[len] = '\0';
+    return atoi(roll_str);
+}
+
+int compare_int(const void *a, const void *b) {
+    return *(const int *)a < *(const int *)b ? -1 : *(const int *)a > *(const int *)b;
+}
+
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Build the heap file and its index, and remember the roll numbers */
+void build() {
+    char lineBuffer[MAX_LINE_LENGTH];
+    FILE *dataFile;
+    RecId recId;
+    int hfFd, amFd, roll_no;
+
+    PF_Init(BUFFER_SIZE, PF_LRU);
+    check_error(HF_CreateFile(HEAP_FILE_NAME), "Create heap file");
+    check_error(AM_CreateIndex(HEAP_FILE_NAME, INDEX_NO, ATTR_TYPE, ATTR_LENGTH), "Create index");
+    hfFd = PF_OpenFile(HEAP_FILE_NAME);
+    amFd = PF_OpenFile(INDEX_FILE_NAME);
+    check_error(hfFd, "Open heap file");
+    check_error(amFd, "Open index file");
+    if ((dataFile = fopen(STUDENT_DATA_FILE, "r")) == NULL) {
+        fprintf(stderr, "Error: Could not open '%s'.\n", STUDENT_DATA_FILE);
+        exit(1);
+    }
+    while (fgets(lineBuffer, sizeof(lineBuffer), dataFile) != NULL) {
+        int length = strlen(lineBuffer);
+        if (lineBuffer[length - 1] == '\n') {
+            lineBuffer[length - 1] = '\0';
+            length--;
+        }
+        if ((roll_no = get_roll_no(lineBuffer)) == -1)
+            continue; // header or blank line
+        check_error(HF_InsertRec(hfFd, lineBuffer, length, &recId), "Insert record");
+        check_error(AM_InsertEntry(amFd, ATTR_TYPE, ATTR_LENGTH, (char *)&roll_no, recId), "Insert index entry");
+        if (nrolls < MAX_STUDENTS)
+            rolls[nrolls++] = roll_no;
+    }
+    fclose(dataFile);
+    check_error(PF_CloseFile(amFd), "Close index file");
+    check_error(PF_CloseFile(hfFd), "Close heap file");
+
+    // Rolls like "00D01001" all parse to the same number; look up
+    // only the keys of one record
+    int i, j;
+    qsort(rolls, nrolls, sizeof(int), compare_int);
+    for (i = 0; i < nrolls; i = j) {
+        for (j = i + 1; j < nrolls && rolls[j] == rolls[i]; j++)
+            ;
+        if (j == i + 1)
+            rolls[nkeys++] = rolls[i];
+    }
+}
+
+/* Open "fname" through the buffer pool, or mapped */
+int open_file(char *fname, int mapped) {
+    int fd = mapped ? PF_OpenFileMapped(fname) : PF_OpenFile(fname);
+    check_error(fd, "Open file");
+    return fd;
+}
+
+/* NSCANS full scans of the heap file; returns seconds, sets *nrecs */
+double scan(int mapped, long *nrecs) {
+    char record[MAX_LINE_LENGTH];
+    RecId recId;
+    int hfFd, scanFd, i;
+    double t0;
+
+    PF_Init(BUFFER_SIZE, PF_LRU);
+    hfFd = open_file(HEAP_FILE_NAME, mapped);
+    *nrecs = 0;
+    t0 = now();
+    for (i = 0; i < NSCANS; i++) {
+        check_error(scanFd = HF_OpenScan(hfFd), "Open scan");
+        while (HF_FindNextRec(scanFd, record, &recId) == HFE_OK)
+            (*nrecs)++;
+        HF_CloseScan(scanFd);
+    }
+    t0 = now() - t0;
+    check_error(PF_CloseFile(hfFd), "Close heap file");
+    return t0;
+}
+
+/* NLOOKUPS lookups of random roll numbers; returns seconds */
+double lookup(int mapped) {
+    int amFd, scanDesc, i, roll_no;
+    double t0;
+
+    PF_Init(BUFFER_SIZE, PF_LRU);
+    amFd = open_file(INDEX_FILE_NAME, mapped);
+    srand(1); // same keys both ways
+    t0 = now();
+    for (i = 0; i < NLOOKUPS; i++) {
+        roll_no = rolls[rand() % nkeys];
+        check_error(scanDesc = AM_OpenIndexScan(amFd, ATTR_TYPE, ATTR_LENGTH, EQ_OP, (char *)&roll_no), "Open index scan");
+        if (AM_FindNextEntry(scanDesc) < 0) {
+            printf("Error: roll no %d not found\n", roll_no);
+            exit(1);
+        }
+        AM_CloseIndexScan(scanDesc);
+    }
+    t0 = now() - t0;
+    check_error(PF_CloseFile(amFd), "Close index file");
+    return t0;
+}
+
+int main() {
+    long nrecs[2];
+    double scantime[2], looktime[2];
+    int mapped;
+
+    printf("--- Buffered vs mmap()'d Read Test ---\n");
+    build();
+    printf("  %d records, %d unique keys, %d buffer pages\n", nrolls, nkeys, BUFFER_SIZE);
+
+    for (mapped = 0; mapped <= 1; mapped++) {
+        scantime[mapped] = scan(mapped, &nrecs[mapped]);
+        looktime[mapped] = lookup(mapped);
+    }
+    if (nrecs[0] != nrecs[1] || nrecs[0] != (long)nrolls * NSCANS) {
+        printf("Error: scans returned %ld and %ld records\n", nrecs[0], nrecs[1]);
+        exit(1);
+    }
+
+    printf("  %-28s %12s %12s\n", "", "buffered", "mapped");
+    printf("  %-28s %12.4f %12.4f\n", "HF full scans (s)", scantime[0], scantime[1]);
+    printf("  %-28s %12.0f %12.0f\n", "  records/s", nrecs[0] / scantime[0], nrecs[1] / scantime[1]);
+    printf("  %-28s %12.4f %12.4f\n", "AM point lookups (s)", looktime[0], looktime[1]);
+    printf("  %-28s %12.0f %12.0f\n", "  lookups/s", NLOOKUPS / looktime[0], NLOOKUPS / looktime[1]);
+
+    check_error(PF_DestroyFile(HEAP_FILE_NAME), "Destroy heap file");
+    check_error(PF_DestroyFile(INDEX_FILE_NAME), "Destroy index file");
+    printf("\n--- Test Complete ---\n");
+    return 0;
+}
@@ -3,22 +3,37 @@
  *
  * This program tests the configurable buffer manager and statistics collection.
  * It runs a specific workload and prints the resulting I/O statistics.
+ *
+ * Usage: test_pf_stats [lru|mru|clock|2q|arc|all] [num_requests]
+ * With "all" (the default) the same workload is run once per strategy,
+ * so hit rate and ns per PF_GetThisPage can be compared side by side.
  */
 
 #include <stdio.h>
 #include <stdlib.h> // For exit()
+#include <string.h>
+#include <time.h>   // For clock_gettime()
+#include <pthread.h>
+#include <unistd.h>   // For fork()
+#include <sys/wait.h>
 #include "pf.h"     // Your PF layer header
 
 // --- Configuration ---
 #define TEST_FILE_NAME  "pf_test_workload.db"
 #define BUFFER_SIZE     20  // The number of pages in the buffer pool
 #define NUM_PAGES       50  // The number of pages in our test file
-#define NUM_REQUESTS    1000 // Total number of page requests to simulate
+#define NUM_REQUESTS    1000 // Default number of page requests to simulate
 
-// --- Strategies (must match what you used in buf.c) ---
-#define LRU 0
-#define MRU 1
-// ---
+static const char *strategy_name(int strategy) {
+    switch (strategy) {
+    case PF_LRU:   return "LRU";
+    case PF_MRU:   return "MRU";
+    case PF_CLOCK: return "CLOCK";
+    case PF_2Q:    return "2Q";
+    case PF_ARC:   return "ARC";
+    }
+    return "?";
+}
 
 /*
  * Helper function to check PF errors and exit if something bad happens.
@@ -32,21 +47,195 @@ void check_error(int error_code, const char *message) {
 }
 
 /*
- * Main test function
+ * Callback of PF_GetPagesAsync(): count the calls of each page, and
+ * unfix the pages got.
  */
-int main(int argc, char **argv) {
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_over = PTHREAD_COND_INITIALIZER;
+static int async_calls[NUM_PAGES + 1];  // the last for invalid pages
+static int async_done, async_bad;
+
+static void async_got(int fd, int pagenum, char *pagebuf, int error, void *arg) {
+    int bad;
+
+    if (pagenum >= 0 && pagenum < NUM_PAGES)
+        bad = error != PFE_OK || pagebuf == NULL ||
+            PF_UnfixPage(fd, pagenum, FALSE) != PFE_OK;
+    else
+        bad = error != PFE_INVALIDPAGE || pagebuf != NULL;
+    pthread_mutex_lock(&async_lock);
+    async_calls[pagenum >= 0 && pagenum < NUM_PAGES ? pagenum : NUM_PAGES]++;
+    async_bad += bad;
+    if (++async_done == *(int *)arg)
+        pthread_cond_signal(&async_over);
+    pthread_mutex_unlock(&async_lock);
+}
+
+/*
+ * Gets every page twice, and two invalid pages, with one
+ * PF_GetPagesAsync(): more pages than the pool has frames.
+ */
+static void check_async(int fd) {
+    int pages[2 * NUM_PAGES + 2];
+    int n = 0, i;
+
+    for (i = 0; i < NUM_PAGES; i++) {
+        pages[n++] = i;
+        pages[n++] = NUM_PAGES - 1 - i;
+    }
+    pages[n++] = NUM_PAGES + 5;
+    pages[n++] = -1;
+    memset(async_calls, 0, sizeof(async_calls));
+    async_done = async_bad = 0;
+    check_error(PF_GetPagesAsync(fd, pages, n, async_got, &n), "Getting pages async");
+    pthread_mutex_lock(&async_lock);
+    while (async_done < n)
+        pthread_cond_wait(&async_over, &async_lock);
+    pthread_mutex_unlock(&async_lock);
+    for (i = 0; i < NUM_PAGES; i++)
+        if (async_calls[i] != 2)
+            async_bad++;
+    if (async_bad > 0 || async_calls[NUM_PAGES] != 2) {
+        printf("Error: PF_GetPagesAsync() got %d pages wrong\n", async_bad);
+        exit(1);
+    }
+}
+
+/*
+ * Pins half a pool of pages, backwards and one twice, with one
+ * PF_GetPages(); then a batch with an invalid page, which must pin none.
+ */
+static void check_getpages(int fd) {
+    int pages[BUFFER_SIZE / 2 + 1];
+    char *bufs[BUFFER_SIZE / 2 + 1];
+    char *buf;
+    int n = 0, i;
+
+    for (i = BUFFER_SIZE / 2 - 1; i >= 0; i--)
+        pages[n++] = 3 * i;
+    pages[n++] = 3;
+    check_error(PF_GetPages(fd, pages, n, bufs), "Getting pages");
+    for (i = 0; i < n; i++) {
+        check_error(PF_GetThisPage(fd, pages[i], &buf), "Getting page");
+        if (bufs[i] != buf) {
+            printf("Error: PF_GetPages() gave page %d the wrong buffer\n", pages[i]);
+            exit(1);
+        }
+        check_error(PF_UnfixPage(fd, pages[i], FALSE), "Unfixing page");
+    }
+    check_error(PF_UnfixPages(fd, pages, n, FALSE), "Unfixing pages");
+
+    pages[n / 2] = NUM_PAGES + 5;
+    if (PF_GetPages(fd, pages, n, bufs) != PFE_INVALIDPAGE || bufs[0] != NULL) {
+        printf("Error: PF_GetPages() accepted an invalid page\n");
+        exit(1);
+    }
+}
+
+/*
+ * Writes "text" and the page number into every page of file "fd", each
+ * unfixed dirty: with more pages than buffers, most are evicted.
+ */
+static void rewrite_pages(int fd, const char *text) {
+    char *buf;
+    int i;
+
+    for (i = 0; i < NUM_PAGES; i++) {
+        check_error(PF_GetThisPage(fd, i, &buf), "Getting page");
+        sprintf(buf, "%s %d", text, i);
+        check_error(PF_UnfixPage(fd, i, TRUE), "Unfixing dirty page");
+    }
+}
+
+/*
+ * Writes a file with checksums. A child process rewrites its pages and
+ * dies without closing it, so pages evicted on the way are newer than
+ * the checksums on file: they must still be got. Then a byte of the
+ * last page is changed behind the PF layer's back: getting that page
+ * must fail with PFE_CHECKSUM, and getting the others must not.
+ */
+static void check_checksums(void) {
+    int fd, pagenum, i, c, status;
+    char *buf;
+    FILE *fp;
+    pid_t pid;
+
+    PF_Init(BUFFER_SIZE, PF_LRU);
+    check_error(PF_CreateFileEx(TEST_FILE_NAME, PF_FORMAT_V3 | PF_FORMAT_CHECKSUM),
+        "Creating file with checksums");
+    if ((fd = PF_OpenFile(TEST_FILE_NAME)) < 0)
+        check_error(fd, "Opening file");
+    for (i = 0; i < NUM_PAGES; i++) {
+        check_error(PF_AllocPage(fd, &pagenum, &buf), "Allocating page");
+        sprintf(buf, "page %d", pagenum);
+        check_error(PF_UnfixPage(fd, pagenum, TRUE), "Unfixing dirty page");
+    }
+    check_error(PF_CloseFile(fd), "Closing file");
+
+    fflush(stdout);
+    if ((pid = fork()) == 0) {
+        PF_Init(BUFFER_SIZE, PF_LRU);
+        if ((fd = PF_OpenFile(TEST_FILE_NAME)) < 0)
+            check_error(fd, "Opening file");
+        rewrite_pages(fd, "crashed");
+        _exit(0);
+    }
+    if (pid < 0 || waitpid(pid, &status, 0) != pid || status != 0) {
+        printf("Error: the crashing child failed\n");
+        exit(1);
+    }
+    PF_Init(BUFFER_SIZE, PF_LRU);
+    if ((fd = PF_OpenFile(TEST_FILE_NAME)) < 0)
+        check_error(fd, "Re-opening file after a crash");
+    for (i = 0; i < NUM_PAGES; i++) {
+        check_error(PF_GetThisPage(fd, i, &buf), "Getting page after a crash");
+        check_error(PF_UnfixPage(fd, i, FALSE), "Unfixing page");
+    }
+    rewrite_pages(fd, "page");
+    check_error(PF_CloseFile(fd), "Closing file");
+
+    if ((fp = fopen(TEST_FILE_NAME, "r+b")) == NULL ||
+            fseek(fp, -1L, SEEK_END) != 0 || (c = getc(fp)) == EOF ||
+            fseek(fp, -1L, SEEK_END) != 0 || putc(c ^ 1, fp) == EOF ||
+            fclose(fp) != 0) {
+        printf("Error: cannot change the file\n");
+        exit(1);
+    }
+
+    PF_Init(BUFFER_SIZE, PF_LRU);
+    if ((fd = PF_OpenFile(TEST_FILE_NAME)) < 0)
+        check_error(fd, "Re-opening file");
+    if (PF_GetThisPage(fd, NUM_PAGES - 1, &buf) != PFE_CHECKSUM) {
+        printf("Error: a changed page was got\n");
+        exit(1);
+    }
+    for (i = 0; i < NUM_PAGES - 1; i++) {
+        check_error(PF_GetThisPage(fd, i, &buf), "Getting page");
+        check_error(PF_UnfixPage(fd, i, FALSE), "Unfixing page");
+    }
+    check_error(PF_CloseFile(fd), "Closing file");
+    check_error(PF_DestroyFile(TEST_FILE_NAME), "Destroying file");
+    printf("Checksums: a changed page fails with PFE_CHECKSUM.\n");
+}
+
+/*
+ * Runs the workload once with the given strategy and prints its stats.
+ */
+void run_workload(int strategy, int num_requests) {
     int fd;
     int pagenum;
     char *pagebuf;
     int error;
     int i;
+    struct timespec t0, t1;
+    double get_ns = 0;
+    struct PF_Stats stats;
+    PF_Counters *fs;
 
-    // --- Select Strategy ---
-    int strategy = LRU;
-    printf("Testing with Strategy: %s\n", (strategy == LRU) ? "LRU" : "MRU");
+    printf("Testing with Strategy: %s\n", strategy_name(strategy));
     printf("Buffer Size: %d pages\n", BUFFER_SIZE);
     printf("File Size: %d pages\n", NUM_PAGES);
-    printf("Total Requests: %d\n", NUM_REQUESTS);
+    printf("Total Requests: %d\n", num_requests);
     printf("---------------------------\n");
 
 
@@ -74,29 +263,31 @@ int main(int argc, char **argv) {
         check_error(PF_UnfixPage(fd, pagenum, TRUE), "Unfixing dirty page");
     }
     printf("File initialization complete.\n");
-/* --- ADD THIS LINE --- */
+    // Closing flushes the initial pages, so the workload starts cold
     check_error(PF_CloseFile(fd), "Closing file after init");
     // 4. Run the Workload
     // This simulates the 90% read / 10% write workload
-    printf("Running %d-request workload (90%% Read / 10%% Write)...\n", NUM_REQUESTS);
+    printf("Running %d-request workload (90%% Read / 10%% Write)...\n", num_requests);
     
     // We reset stats *after* file creation to only measure the workload
-    PF_Init(BUFFER_SIZE, strategy); // This resets all counters
+    PF_ResetStats(); // Unlike PF_Init(), keeps the buffer and file table
     
-    // We must re-open the file since PF_Init() cleared the file table
     fd = PF_OpenFile(TEST_FILE_NAME); 
     if (fd < 0) {
         check_error(fd, "Re-opening file");
     }
 
     srand(0); // Use a fixed seed for reproducible tests
-    for (i = 0; i < NUM_REQUESTS; i++) {
+    for (i = 0; i < num_requests; i++) {
         // Pick a random page to access
         int page_to_access = rand() % NUM_PAGES;
         
-        // Get the page
+        // Get the page, timing only the buffer manager call
+        clock_gettime(CLOCK_MONOTONIC, &t0);
         error = PF_GetThisPage(fd, page_to_access, &pagebuf);
+        clock_gettime(CLOCK_MONOTONIC, &t1);
         check_error(error, "Getting page for workload");
+        get_ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
 
         // Decide if this is a read or a write (90% read)
         if (i % 10 == 0) {
@@ -113,6 +304,33 @@ int main(int argc, char **argv) {
     }
     printf("Workload complete.\n");
 
+    // Counters of this file, read without parsing PF_PrintStats()
+    check_error(PF_GetStats(&stats), "Getting stats");
+    fs = &stats.file[fd];
+    printf("File counters: %lld hits, %lld misses, %lld evictions (%lld dirty), %lld bytes read\n",
+        fs->hits, fs->misses, fs->evictions, fs->dirty_evictions, fs->bytes_read);
+    if (fs->hits + fs->misses != num_requests ||
+            fs->hits != stats.total.hits || fs->bytes_read != stats.total.bytes_read ||
+            stats.arc_target != PF_GetARCTarget() ||
+            (strategy != PF_ARC && stats.arc_target != 0)) {
+        printf("Error: counters do not add up\n");
+        exit(1);
+    }
+
+    // Estimated LRU hit rate of other pool sizes; it cannot fall as
+    // the pool grows
+    printf("Estimated hit rate (%lld gets sampled):", stats.mrc_sampled);
+    for (i = 0; i < PF_MRC_NPOINTS && stats.mrc_nbufs[i] <= 2 * NUM_PAGES; i += 2)
+        printf(" %d:%.2f", stats.mrc_nbufs[i], stats.mrc_hitrate[i]);
+    printf("\n");
+    for (i = 1; i < PF_MRC_NPOINTS; i++) {
+        if (stats.mrc_hitrate[i] < stats.mrc_hitrate[i - 1] ||
+                stats.mrc_hitrate[i] > 1.0) {
+            printf("Error: bad miss ratio curve\n");
+            exit(1);
+        }
+    }
+
 
     // 5. Close the file (this flushes all dirty pages)
     check_error(PF_CloseFile(fd), "Closing file");
@@ -121,9 +339,67 @@ int main(int argc, char **argv) {
     // 6. Print the Statistics!
     // This calls your new PF_PrintStats() function.
     PF_PrintStats();
+    printf("  ns per PF_GetThisPage: %.1f\n\n", get_ns / num_requests);
 
-    // 7. Clean up
+    // 7. Check the other ways of getting pages, after the measured part
+    fd = PF_OpenFile(TEST_FILE_NAME);
+    if (fd < 0) {
+        check_error(fd, "Reopening file");
+    }
+    // The same pages, without waiting for each read, with both engines
+    PF_SetAioEngine(PF_AIO_URING);
+    check_async(fd);
+    PF_SetAioEngine(PF_AIO_THREADS);
+    check_async(fd);
+    PF_SetAioEngine(PF_AIO_URING);
+    printf("PF_GetPagesAsync: every page got once per request.\n\n");
+    check_getpages(fd);
+    rewrite_pages(fd, "Resized");
+    // Shrink the pool under dirty pages and grow it back
+    if (PF_ResizePool(BUFFER_SIZE / 2) != BUFFER_SIZE / 2 ||
+            PF_ResizePool(BUFFER_SIZE) != BUFFER_SIZE) {
+        printf("Error: cannot resize the pool\n");
+        exit(1);
+    }
+    check_error(PF_CloseFile(fd), "Closing file");
+
+    // 8. Clean up
     check_error(PF_DestroyFile(TEST_FILE_NAME), "Destroying file");
+}
+
+/*
+ * Main test function
+ */
+int main(int argc, char **argv) {
+    const char *which = (argc > 1) ? argv[1] : "all";
+    int num_requests = (argc > 2) ? atoi(argv[2]) : NUM_REQUESTS;
+
+    if (num_requests <= 0) {
+        printf("Error: number of requests must be positive\n");
+        exit(1);
+    }
+
+    if (strcmp(which, "lru") == 0) {
+        run_workload(PF_LRU, num_requests);
+    } else if (strcmp(which, "mru") == 0) {
+        run_workload(PF_MRU, num_requests);
+    } else if (strcmp(which, "clock") == 0) {
+        run_workload(PF_CLOCK, num_requests);
+    } else if (strcmp(which, "2q") == 0) {
+        run_workload(PF_2Q, num_requests);
+    } else if (strcmp(which, "arc") == 0) {
+        run_workload(PF_ARC, num_requests);
+    } else if (strcmp(which, "all") == 0) {
+        run_workload(PF_LRU, num_requests);
+        run_workload(PF_MRU, num_requests);
+        run_workload(PF_CLOCK, num_requests);
+        run_workload(PF_2Q, num_requests);
+        run_workload(PF_ARC, num_requests);
+    } else {
+        printf("Usage: %s [lru|mru|clock|2q|arc|all] [num_requests]\n", argv[0]);
+        exit(1);
+    }
+    check_checksums();
 
     return 0;
 }
\ No newline at end of file